@@ -0,0 +1,153 @@
+#ifndef HAZUKI_BTREE_H_INCLUDED
+#define HAZUKI_BTREE_H_INCLUDED
+
+#include "hazuki/vector.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * An ordered map from keys to values, implemented as a B+ tree.
+ *
+ * Unlike hz_map, the keys are kept in sorted order, so the tree can find
+ * the first key that is >= some key and iterate over a range of keys in
+ * order. All operations take O(log n) time. Each node holds enough keys
+ * to fill several cache lines, so a lookup touches a handful of nodes
+ * and a range scan reads entries sequentially:
+ *
+ * int key_cmp(const void *a, const void *b) { ... }
+ * hz_btree *tree = hz_btree_new(sizeof(TKey), sizeof(TValue), key_cmp);
+ * hz_btree_put(tree, &key, &value, NULL);
+ * hz_btree_get(tree, &key, &value);
+ * ...
+ * hz_btree_free(tree);
+ *
+ * To visit every key in [lo, hi), start a cursor at lo and stop once a
+ * key reaches hi:
+ *
+ * hz_btree_cursor cursor;
+ * hz_btree_lower_bound(tree, &lo, &cursor);
+ * const void *key;
+ * const void *value;
+ * while (hz_btree_cursor_next(&cursor, &key, &value)) {
+ *     if (key_cmp(key, &hi) >= 0) {
+ *         break;
+ *     }
+ *     ...
+ * }
+ */
+typedef struct hz_btree hz_btree;
+
+/**
+ * Comparator function for hz_btree. Must return a negative number if
+ * a < b, a positive number if a > b, and zero if a == b, and must
+ * define a consistent total order over the keys.
+ */
+typedef int (*hz_btree_cmp_func)(const void *a, const void *b);
+
+/**
+ * Allocation-free iterator for hz_btree, which visits entries in key
+ * order. Position a cursor with hz_btree_cursor_init() or
+ * hz_btree_lower_bound(), then advance it with hz_btree_cursor_next().
+ * The fields are private; do not access them directly. A cursor does
+ * not need to be freed.
+ */
+typedef struct hz_btree_cursor
+{
+    const struct hz_btree *tree;
+    const struct hz_btree_node *node;
+    size_t index;
+    unsigned int mod_count;
+} hz_btree_cursor;
+
+/**
+ * Creates a new empty tree with the given key and value sizes and
+ * key comparator function. You must free the returned tree using
+ * hz_btree_free().
+ */
+hz_btree *
+hz_btree_new(size_t key_size, size_t value_size, hz_btree_cmp_func cmp_func);
+
+/**
+ * Frees a tree created by hz_btree_new(). Using the tree after deletion
+ * results in undefined behavior.
+ */
+void
+hz_btree_free(hz_btree *tree);
+
+/**
+ * Gets the number of entries in the tree.
+ */
+size_t
+hz_btree_size(const hz_btree *tree);
+
+/**
+ * Removes all elements from the tree.
+ */
+void
+hz_btree_clear(hz_btree *tree);
+
+/**
+ * Fills an empty tree from a vector of keys in strictly increasing order
+ * and a vector of the same number of values. This builds the tree bottom
+ * up in O(n) time, which is much faster than inserting the entries one
+ * at a time. The elements of the vectors must have the tree's key and
+ * value sizes. If the tree is not empty, the vectors have different
+ * sizes, or the keys are not in strictly increasing order, the program
+ * is aborted.
+ */
+void
+hz_btree_load_sorted(hz_btree *tree, const hz_vector *keys, const hz_vector *values);
+
+/**
+ * Gets the value associated with the given key. Returns true if the entry
+ * exists in the tree, and false otherwise. If the entry exists and
+ * out_value is not NULL, the value is written to out_value.
+ */
+bool
+hz_btree_get(const hz_btree *tree, const void *key, void *out_value);
+
+/**
+ * Sets the value associated with the given key. Returns true if this
+ * replaces an existing value, and false otherwise. If a value was replaced
+ * and out_value is not NULL, the previous value is written to out_value.
+ */
+bool
+hz_btree_put(hz_btree *tree, const void *key, const void *value, void *out_value);
+
+/**
+ * Removes the entry associated with the given key. Returns true if
+ * the entry exists in the tree, and false otherwise. If the entry exists
+ * and out_value is not NULL, the removed value is written to out_value.
+ */
+bool
+hz_btree_remove(hz_btree *tree, const void *key, void *out_value);
+
+/**
+ * Initializes a cursor positioned before the smallest key in the tree.
+ * The cursor is invalidated after any modifications to the tree;
+ * continuing to use it results in an error.
+ */
+void
+hz_btree_cursor_init(hz_btree_cursor *cursor, const hz_btree *tree);
+
+/**
+ * Initializes a cursor positioned before the smallest key in the tree
+ * that is >= the given key, so that the next call to
+ * hz_btree_cursor_next() returns that key (if there is one). Otherwise
+ * the same as hz_btree_cursor_init().
+ */
+void
+hz_btree_lower_bound(const hz_btree *tree, const void *key, hz_btree_cursor *cursor);
+
+/**
+ * Moves the cursor to the next element in key order. If there are no
+ * more elements in the tree, returns false and the key and value
+ * parameters are unchanged. Otherwise, returns true and the key and value
+ * parameters are set to point to the stored key and value, which remain
+ * valid until the tree is modified. You may pass NULL for the key or
+ * value parameters to ignore their value.
+ */
+bool
+hz_btree_cursor_next(hz_btree_cursor *cursor, const void **key, const void **value);
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef HAZUKI_CACHE_H_INCLUDED
+#define HAZUKI_CACHE_H_INCLUDED
+
+#include "hazuki/map.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A bounded key-value cache that evicts the least recently used entry
+ * when it is full.
+ *
+ * Entries are stored in an ordinary hz_map, and the recency list is
+ * threaded through the map's own entries, so a hit costs a single lookup
+ * and relinking a few pointers, and insertion and eviction are O(1)
+ * with no allocations beyond the map entry itself. The cache can be
+ * bounded by number of entries, by total bytes (as reported by a size
+ * function), or both:
+ *
+ * hz_cache_options options;
+ * hz_cache_options_init(&options);
+ * options.max_entries = 10000;
+ * hz_cache *cache = hz_cache_new(
+ *     sizeof(TKey), sizeof(TValue), key_hash, key_cmp, &options);
+ * if (!hz_cache_get(cache, &key, &value)) {
+ *     value = compute(key);
+ *     hz_cache_put(cache, &key, &value, NULL);
+ * }
+ * ...
+ * hz_cache_free(cache);
+ */
+typedef struct hz_cache hz_cache;
+
+/**
+ * Function that returns the number of bytes that an entry counts
+ * towards the cache's max_bytes limit, e.g. the size of a buffer that
+ * the value points to. Called once when the entry is put into the cache.
+ */
+typedef size_t (*hz_cache_size_func)(const void *key, const void *value, void *ctx);
+
+/**
+ * Function that is called when an entry is evicted to make room for
+ * another. Receives the entry's key and value just before they are
+ * freed, and the context pointer from the options. Must not call back
+ * into the cache.
+ */
+typedef void (*hz_cache_evict_func)(const void *key, void *value, void *ctx);
+
+/**
+ * Settings for hz_cache_new(). Initialize the struct with
+ * hz_cache_options_init(), then set at least one of the limits.
+ */
+typedef struct hz_cache_options
+{
+    /**
+     * Maximum number of entries in the cache, or 0 for no limit.
+     * Defaults to 0.
+     */
+    size_t max_entries;
+
+    /**
+     * Maximum total size of the entries in the cache, in bytes, or 0 for
+     * no limit. Defaults to 0.
+     */
+    size_t max_bytes;
+
+    /**
+     * Function that computes the size of each entry. If NULL, each entry
+     * counts as key_size + value_size bytes. Defaults to NULL.
+     */
+    hz_cache_size_func size_func;
+
+    /**
+     * Function that is called for each evicted entry, e.g. to release
+     * resources that the value owns. Not called for entries that are
+     * removed, replaced, or cleared explicitly. Defaults to NULL.
+     */
+    hz_cache_evict_func evict_func;
+
+    /**
+     * Context pointer passed to size_func and evict_func. Defaults to NULL.
+     */
+    void *ctx;
+
+    /**
+     * Options for the hz_map backing the cache. These are the hz_map
+     * defaults, except that use_pool defaults to true: a full cache frees
+     * an entry for every one it inserts, so recycling them saves a
+     * malloc() and free() per miss.
+     */
+    hz_map_options map_options;
+} hz_cache_options;
+
+/**
+ * Hit, miss, and eviction counters for a cache. Only hz_cache_get() and
+ * hz_cache_get_ref() count as hits or misses.
+ */
+typedef struct hz_cache_stats
+{
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} hz_cache_stats;
+
+/**
+ * Initializes the options struct with the default settings.
+ */
+void
+hz_cache_options_init(hz_cache_options *options);
+
+/**
+ * Creates a new empty cache with the given key and value sizes, key hash
+ * and comparator functions, and options. If options sets neither
+ * max_entries nor max_bytes, the program is aborted. You must free the
+ * returned cache using hz_cache_free().
+ */
+hz_cache *
+hz_cache_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_cache_options *options);
+
+/**
+ * Frees a cache created by hz_cache_new(). Using the cache after deletion
+ * results in undefined behavior.
+ */
+void
+hz_cache_free(hz_cache *cache);
+
+/**
+ * Gets the number of entries in the cache.
+ */
+size_t
+hz_cache_size(const hz_cache *cache);
+
+/**
+ * Gets the total size of the entries in the cache, in bytes.
+ */
+size_t
+hz_cache_bytes(const hz_cache *cache);
+
+/**
+ * Gets the hit, miss, and eviction counts since the cache was created.
+ */
+void
+hz_cache_get_stats(const hz_cache *cache, hz_cache_stats *out_stats);
+
+/**
+ * Removes all elements from the cache. This does not count as evicting
+ * them, and does not reset the stats.
+ */
+void
+hz_cache_clear(hz_cache *cache);
+
+/**
+ * Gets the value associated with the given key, and marks the entry as
+ * the most recently used. Returns true if the entry exists in the cache,
+ * and false otherwise. If the entry exists and out_value is not NULL,
+ * the value is written to out_value.
+ */
+bool
+hz_cache_get(hz_cache *cache, const void *key, void *out_value);
+
+/**
+ * Same as hz_cache_get(), but returns a pointer to the value, or NULL if
+ * the key is not in the cache. The pointer remains valid until the entry
+ * is removed, which may happen on the next hz_cache_put() if the entry
+ * is evicted.
+ */
+void *
+hz_cache_get_ref(hz_cache *cache, const void *key);
+
+/**
+ * Same as hz_cache_get(), but does not mark the entry as recently used
+ * or count towards the stats.
+ */
+bool
+hz_cache_peek(const hz_cache *cache, const void *key, void *out_value);
+
+/**
+ * Sets the value associated with the given key and marks the entry as
+ * the most recently used, then evicts least recently used entries until
+ * the cache is within its limits. The new entry itself is never evicted,
+ * even if it alone exceeds max_bytes. Returns true if this replaces an
+ * existing value, and false otherwise. If a value was replaced and
+ * out_value is not NULL, the previous value is written to out_value.
+ */
+bool
+hz_cache_put(hz_cache *cache, const void *key, const void *value, void *out_value);
+
+/**
+ * Removes the entry associated with the given key. Returns true if
+ * the entry exists in the cache, and false otherwise. If the entry exists
+ * and out_value is not NULL, the removed value is written to out_value.
+ */
+bool
+hz_cache_remove(hz_cache *cache, const void *key, void *out_value);
+
+#endif
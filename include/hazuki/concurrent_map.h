@@ -0,0 +1,189 @@
+#ifndef HAZUKI_CONCURRENT_MAP_H_INCLUDED
+#define HAZUKI_CONCURRENT_MAP_H_INCLUDED
+
+#include "hazuki/map.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A thread-safe hashmap that can be read and written by many threads
+ * at once.
+ *
+ * Keys are partitioned into independently locked shards by the high bits
+ * of their hash, and each shard is an ordinary hz_map. Operations on keys
+ * in different shards never contend with each other, so throughput scales
+ * with the number of threads as long as there are enough shards.
+ *
+ * Since this library has no platform-specific code, the caller supplies
+ * the lock implementation through hz_lock_ops, e.g. using pthread_rwlock_t:
+ *
+ * hz_concurrent_map_options options;
+ * hz_concurrent_map_options_init(&options);
+ * options.lock_ops = &rwlock_ops;
+ * hz_concurrent_map *map = hz_concurrent_map_new(
+ *     sizeof(TKey), sizeof(TValue), key_hash, key_cmp, &options);
+ * ...
+ * hz_concurrent_map_free(map);
+ *
+ * Creating and freeing the map are not thread-safe; all other operations
+ * may be called concurrently.
+ */
+typedef struct hz_concurrent_map hz_concurrent_map;
+
+/**
+ * Lock implementation used by hz_concurrent_map. Each shard has its own
+ * lock, stored in lock_size bytes of memory owned by the map. The storage
+ * is aligned for any type and sits on its own cache line.
+ */
+typedef struct hz_lock_ops
+{
+    /**
+     * Size of a single lock, in bytes. Must be > 0.
+     */
+    size_t lock_size;
+
+    /**
+     * Initializes and destroys a lock.
+     */
+    void (*init)(void *lock);
+    void (*destroy)(void *lock);
+
+    /**
+     * Acquires and releases the lock exclusively. Used for operations
+     * that modify the map.
+     */
+    void (*lock)(void *lock);
+    void (*unlock)(void *lock);
+
+    /**
+     * Acquires and releases the lock for reading. Any number of readers
+     * may hold the lock at once. If either is NULL, the exclusive
+     * functions are used instead (e.g. for spinlocks).
+     */
+    void (*lock_shared)(void *lock);
+    void (*unlock_shared)(void *lock);
+} hz_lock_ops;
+
+/**
+ * Optional settings for hz_concurrent_map_new(). Initialize the struct
+ * with hz_concurrent_map_options_init(), then override the settings you
+ * want to change.
+ */
+typedef struct hz_concurrent_map_options
+{
+    /**
+     * Lock implementation for the shards. Must be set before creating
+     * the map; there is no default. The struct must outlive the map.
+     */
+    const hz_lock_ops *lock_ops;
+
+    /**
+     * Number of shards. Rounded up to a power of 2, and capped at 65536.
+     * More shards reduce contention at the cost of memory. A few times
+     * the number of threads is usually a good choice. Defaults to 64.
+     */
+    size_t shard_count;
+
+    /**
+     * Options for the hz_map backing each shard. The seed also determines
+     * which shard each key belongs to.
+     */
+    hz_map_options map_options;
+} hz_concurrent_map_options;
+
+/**
+ * Function that updates a value in place for hz_concurrent_map_emplace().
+ * Receives a pointer to the stored value, whether the entry was just
+ * inserted (in which case the value is zero-filled), and the context
+ * pointer passed to hz_concurrent_map_emplace().
+ */
+typedef void (*hz_concurrent_map_update_func)(void *value, bool inserted, void *ctx);
+
+/**
+ * Initializes the options struct with the default settings.
+ */
+void
+hz_concurrent_map_options_init(hz_concurrent_map_options *options);
+
+/**
+ * Creates a new empty concurrent hashmap with the given key and value
+ * sizes, key hash and comparator functions, and options. options and
+ * options->lock_ops must not be NULL. The hash and comparator functions
+ * may be called from several threads at once. You must free the returned
+ * hashmap using hz_concurrent_map_free().
+ */
+hz_concurrent_map *
+hz_concurrent_map_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_concurrent_map_options *options);
+
+/**
+ * Frees a hashmap created by hz_concurrent_map_new(). No other thread may
+ * be using the hashmap. Using the hashmap after deletion results in
+ * undefined behavior.
+ */
+void
+hz_concurrent_map_free(hz_concurrent_map *map);
+
+/**
+ * Gets the number of shards in the hashmap.
+ */
+size_t
+hz_concurrent_map_shard_count(const hz_concurrent_map *map);
+
+/**
+ * Gets the number of entries in the hashmap. The shards are counted one
+ * at a time, so if other threads are modifying the hashmap, the result
+ * may not match the size at any single point in time.
+ */
+size_t
+hz_concurrent_map_size(hz_concurrent_map *map);
+
+/**
+ * Removes all elements from the hashmap. The shards are cleared one at a
+ * time, so entries inserted concurrently may survive.
+ */
+void
+hz_concurrent_map_clear(hz_concurrent_map *map);
+
+/**
+ * Same as hz_map_get(), but takes the shard's lock for reading.
+ */
+bool
+hz_concurrent_map_get(hz_concurrent_map *map, const void *key, void *out_value);
+
+/**
+ * Same as hz_map_put(), but takes the shard's lock exclusively.
+ */
+bool
+hz_concurrent_map_put(
+    hz_concurrent_map *map,
+    const void *key,
+    const void *value,
+    void *out_value);
+
+/**
+ * Same as hz_map_remove(), but takes the shard's lock exclusively.
+ */
+bool
+hz_concurrent_map_remove(hz_concurrent_map *map, const void *key, void *out_value);
+
+/**
+ * Finds the entry for the given key, inserting a zero-filled one if it
+ * does not exist, and calls update_func on its value while holding the
+ * shard's lock. Since the value may be moved or freed as soon as the lock
+ * is released, this is the only way to modify a value in place; the
+ * pointer must not be used after update_func returns. update_func must not
+ * call back into the hashmap. Returns true if a new entry was inserted.
+ */
+bool
+hz_concurrent_map_emplace(
+    hz_concurrent_map *map,
+    const void *key,
+    hz_concurrent_map_update_func update_func,
+    void *ctx);
+
+#endif
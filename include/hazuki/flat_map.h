@@ -0,0 +1,137 @@
+#ifndef HAZUKI_FLAT_MAP_H_INCLUDED
+#define HAZUKI_FLAT_MAP_H_INCLUDED
+
+#include "hazuki/map.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * An open-addressing hashmap that maps each key to a value.
+ *
+ * hz_flat_map has the same interface and semantics as hz_map, but stores
+ * its keys and values directly in flat arrays instead of in separately
+ * allocated chain entries. Each slot has a one-byte control tag holding
+ * 7 bits of the key's hash; lookups compare 16 tags at a time (using SSE2
+ * where available) and only call the comparator on tag matches. This makes
+ * it considerably faster than hz_map for lookup-heavy workloads, at the
+ * cost of moving entries around when the map is resized.
+ *
+ * size_t key_hash(const void *key) { ... }
+ * int key_cmp(const void *a, const void *b) { ... }
+ * hz_flat_map *map = hz_flat_map_new(sizeof(TKey), sizeof(TValue), key_hash, key_cmp);
+ * ...
+ * hz_flat_map_free(map);
+ *
+ * Since all bits of the hash are used to place keys, the hash function
+ * should be well distributed. Low-quality hashes are scrambled internally,
+ * but a hash function that maps many keys to the same value will still
+ * result in long probe sequences.
+ */
+typedef struct hz_flat_map hz_flat_map;
+
+/**
+ * Iterator for hz_flat_map. Create using hz_flat_map_iterator_new(),
+ * destroy with hz_flat_map_iterator_free(). Usage is identical to
+ * hz_map_iterator.
+ */
+typedef struct hz_flat_map_iterator hz_flat_map_iterator;
+
+/**
+ * Creates a new empty hashmap with the given key and value sizes and
+ * key hash and comparator functions. You must free the returned hashmap
+ * using hz_flat_map_free().
+ */
+hz_flat_map *
+hz_flat_map_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func);
+
+/**
+ * Creates a new hashmap by copying an existing one.
+ * You must free the returned hashmap using hz_flat_map_free().
+ */
+hz_flat_map *
+hz_flat_map_copy(const hz_flat_map *map);
+
+/**
+ * Frees a hashmap created by hz_flat_map_new() or hz_flat_map_copy(). Using
+ * the hashmap after deletion results in undefined behavior.
+ */
+void
+hz_flat_map_free(hz_flat_map *map);
+
+/**
+ * Gets the number of entries in the hashmap.
+ */
+size_t
+hz_flat_map_size(const hz_flat_map *map);
+
+/**
+ * Removes all elements from the hashmap.
+ */
+void
+hz_flat_map_clear(hz_flat_map *map);
+
+/**
+ * Gets the value associated with the given key. Returns true if the entry
+ * exists in the map, and false otherwise. If the entry exists and out_value
+ * is not NULL, the value is written to out_value.
+ */
+bool
+hz_flat_map_get(const hz_flat_map *map, const void *key, void *out_value);
+
+/**
+ * Sets the value associated with the given key. Returns true if this replaces
+ * an existing value, and false otherwise. If a value was replaced and
+ * out_value is not NULL, the previous value is written to out_value.
+ */
+bool
+hz_flat_map_put(
+    hz_flat_map *map,
+    const void *key,
+    const void *value,
+    void *out_value);
+
+/**
+ * Removes the entry associated with the given key. Returns true if
+ * the entry exists in the map, and false otherwise. If the entry exists
+ * and out_value is not NULL, the removed value is written to out_value.
+ */
+bool
+hz_flat_map_remove(hz_flat_map *map, const void *key, void *out_value);
+
+/**
+ * Compares the two hashmaps. Semantics are identical to hz_map_equals().
+ */
+bool
+hz_flat_map_equals(
+    const hz_flat_map *a,
+    const hz_flat_map *b,
+    hz_map_cmp_func cmp_func);
+
+/**
+ * Creates an iterator that can be used to iterate over the elements in
+ * the hashmap. The iterator is invalidated after any modifications to
+ * the hashmap; continuing to use it results in an error. You must free
+ * the returned iterator using hz_flat_map_iterator_free().
+ */
+hz_flat_map_iterator *
+hz_flat_map_iterator_new(const hz_flat_map *map);
+
+/**
+ * Frees an iterator allocated by hz_flat_map_iterator_new().
+ * Using the iterator after deletion results in undefined behavior.
+ */
+void
+hz_flat_map_iterator_free(hz_flat_map_iterator *it);
+
+/**
+ * Moves the iterator to the next element in the hashmap. Semantics are
+ * identical to hz_map_iterator_next().
+ */
+bool
+hz_flat_map_iterator_next(hz_flat_map_iterator *it, void *key, void *value);
+
+#endif
@@ -44,6 +44,67 @@ typedef struct hz_map hz_map;
  */
 typedef struct hz_map_iterator hz_map_iterator;
 
+/**
+ * A read-only hashmap backed by an image created with hz_map_serialize().
+ *
+ * The image is a single flat, position-independent block of memory, so
+ * it can be written to a file and later mapped back into memory (e.g.
+ * using mmap()). Opening a view only checks the image header, and lookups
+ * read the entries directly from the image. Loading a large map from disk
+ * therefore costs a few page faults per lookup, rather than re-inserting
+ * every entry:
+ *
+ * size_t size = hz_map_serialized_size(map);
+ * void *buf = malloc(size);
+ * hz_map_serialize(map, buf, size);
+ * fwrite(buf, 1, size, file);
+ * ...
+ * void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+ * hz_map_view *view = hz_map_view_open(
+ *     data, size, sizeof(TKey), sizeof(TValue), key_hash, key_cmp);
+ * hz_map_view_get(view, &key, &value);
+ * ...
+ * hz_map_view_free(view);
+ * munmap(data, size);
+ *
+ * Keys and values are copied into the image byte for byte, so they must
+ * not contain pointers. Images can only be read on the same platform
+ * (size_t width, byte order, and type layout) that wrote them, and lookups
+ * must use the same hash function as the original map. Images read from
+ * a source that could be corrupt or untrusted should be checked once with
+ * hz_map_view_validate() after opening.
+ */
+typedef struct hz_map_view hz_map_view;
+
+/**
+ * Allocation-free iterator for hz_map. Unlike hz_map_iterator, a cursor
+ * can live on the stack, and yields pointers to the stored keys and
+ * values instead of copying them out:
+ *
+ * hz_map_cursor cursor;
+ * hz_map_cursor_init(&cursor, map);
+ * const void *key;
+ * const void *value;
+ * while (hz_map_cursor_next(&cursor, &key, &value)) {
+ *     const TKey *k = key;
+ *     const TValue *v = value;
+ *     ...
+ * }
+ *
+ * The fields are private; do not access them directly. A cursor does not
+ * need to be freed.
+ */
+typedef struct hz_map_cursor
+{
+    const struct hz_map *map;
+    const struct hz_map_entry *entry;
+    size_t chain_index;
+    size_t chain_end;
+    size_t chain_pos;
+    unsigned int mod_count;
+    unsigned int unshare_count;
+} hz_map_cursor;
+
 /**
  * Key hash function for hz_map. This function must satisfy the
  * condition that if cmp(a, b) == 0, then hash(a) == hash(b). This
@@ -57,10 +118,201 @@ typedef size_t (*hz_map_hash_func)(const void *key);
  */
 typedef int (*hz_map_cmp_func)(const void *a, const void *b);
 
+/**
+ * Visitor function for hz_map_for_each(). Receives pointers to the
+ * stored key and value, and the context pointer passed to
+ * hz_map_for_each(). Returns true to continue iterating, or false
+ * to stop.
+ */
+typedef bool (*hz_map_visit_func)(const void *key, const void *value, void *ctx);
+
+/**
+ * Combiner function for hz_map_merge(), called for each key that is in
+ * both maps. Receives a pointer to the stored key, the destination value
+ * (to be updated in place, e.g. by adding the source value to it), the
+ * source value, and the context pointer passed to hz_map_merge().
+ */
+typedef void (*hz_map_combine_func)(const void *key, void *dst_value, const void *src_value, void *ctx);
+
+/**
+ * Number of entries in the chain length histogram of hz_map_stats.
+ */
+#define HZ_MAP_CHAIN_HISTOGRAM_SIZE 8
+
+/**
+ * Snapshot of a hashmap's internal state, filled in by hz_map_get_stats().
+ * This is meant for diagnosing slow or oversized maps, e.g. by exporting
+ * it to a metrics system: long chains point to a poor hash function, and
+ * a low load factor points to a map that was presized for far more
+ * entries than it holds.
+ *
+ * The operation counters are only maintained if the library is compiled
+ * with HZ_MAP_STATS defined (e.g. by adding -DHZ_MAP_STATS to CFLAGS),
+ * and are zero otherwise. With HZ_MAP_STATS, lookups count themselves
+ * with relaxed atomic increments, so a map may still be read by multiple
+ * threads at once (e.g. through the shared locks of hz_concurrent_map).
+ */
+typedef struct
+{
+    /**
+     * Number of entries in the map.
+     */
+    size_t size;
+
+    /**
+     * Number of buckets. During an incremental resize, this is the
+     * number of buckets in the new bucket array.
+     */
+    size_t bucket_count;
+
+    /**
+     * Number of entries per bucket, or 0 if the map has no buckets.
+     */
+    double load_factor;
+
+    /**
+     * chain_lengths[i] is the number of buckets with exactly i entries,
+     * except for the last element, which counts all buckets with at least
+     * HZ_MAP_CHAIN_HISTOGRAM_SIZE - 1 entries. During an incremental
+     * resize, this includes the buckets of the old bucket array that
+     * haven't been moved yet.
+     */
+    size_t chain_lengths[HZ_MAP_CHAIN_HISTOGRAM_SIZE];
+
+    /**
+     * Number of entries in the longest chain.
+     */
+    size_t max_chain_length;
+
+    /**
+     * Number of buckets that have so many entries that they are indexed
+     * by a tree (see hz_map_options.order_func).
+     */
+    size_t tree_buckets;
+
+    /**
+     * Number of times the map has grown or shrunk its bucket array,
+     * including the initial allocation.
+     */
+    size_t resizes;
+
+    /**
+     * Total number of bytes allocated by the map: the map itself, its
+     * bucket array, entries, trees, key arena, and Bloom filter. Memory
+     * that is shared with snapshots is counted by each of them, and free
+     * entries held by the entry pool are not counted.
+     */
+    size_t memory_usage;
+
+    /**
+     * Number of keys looked up by hz_map_get(), hz_map_get_many(),
+     * hz_map_get_ref(), and hz_map_find(). Only counted with HZ_MAP_STATS.
+     */
+    size_t gets;
+
+    /**
+     * Number of keys written by hz_map_put(), hz_map_put_many(),
+     * hz_map_emplace(), and the merge functions. Only counted with
+     * HZ_MAP_STATS.
+     */
+    size_t puts;
+
+    /**
+     * Number of calls to hz_map_remove() and hz_map_remove_ref(). Only
+     * counted with HZ_MAP_STATS.
+     */
+    size_t removes;
+} hz_map_stats;
+
+/**
+ * Optional settings for hz_map_new_with_options(). Always initialize
+ * an options struct with hz_map_options_init() before changing any
+ * fields, so that any other fields keep their default values:
+ *
+ * hz_map_options options;
+ * hz_map_options_init(&options);
+ * options.use_pool = true;
+ * hz_map *map = hz_map_new_with_options(..., &options);
+ */
+typedef struct
+{
+    /**
+     * If true, the map allocates its entries from a private pool
+     * instead of calling malloc() for each entry. Removed entries
+     * are recycled by later insertions, and clearing or freeing the
+     * map releases all entries at once. Memory held by the pool is
+     * only returned to the system when the map is cleared or freed.
+     * Defaults to false.
+     */
+    bool use_pool;
+
+    /**
+     * If true, the map grows incrementally: when the load factor is
+     * reached, a new bucket array is allocated, but entries are moved
+     * over a few at a time by each subsequent hz_map_put() and
+     * hz_map_remove() call instead of all at once. If the load factor is
+     * reached again before that finishes, the map goes over it rather
+     * than starting a new resize. This puts a hard bound on the work
+     * done by any single insertion, at the cost of slightly slower
+     * operations while a resize is in progress. Lookups
+     * never move entries, so a resize only makes progress while the map
+     * is being modified. Defaults to false.
+     */
+    bool incremental_resize;
+
+    /**
+     * If true, hz_map_remove() shrinks the bucket array once the map
+     * falls below a quarter of its maximum load factor. Shrinking leaves
+     * the map half full, so a map that hovers around one size does not
+     * keep resizing back and forth. Shrinks are incremental if
+     * incremental_resize is set. Otherwise, the bucket array only shrinks
+     * when hz_map_trim() or hz_map_clear() is called. Defaults to false.
+     */
+    bool auto_shrink;
+
+    /**
+     * If true, the map keeps a Bloom filter of its keys (about one byte
+     * per bucket) and checks it before searching the bucket array. The
+     * filter reads a single cache line per lookup, and rejects all but
+     * a few percent of the keys that are not in the map without touching
+     * the buckets or calling the comparator. This makes insertions
+     * slightly slower, so it only pays off for maps where most lookups
+     * miss. Defaults to false.
+     */
+    bool bloom_filter;
+
+    /**
+     * Optional function that orders keys, returning a negative, zero, or
+     * positive value like strcmp(). It must return zero for exactly the
+     * keys that cmp_func considers equal. If set, a bucket that collects
+     * more than a few keys (because the hash function is poor, or because
+     * the keys were chosen to collide) is indexed by a balanced tree, so
+     * operations on the map take O(log n) time even if every key has the
+     * same hash. String-keyed maps always do this, and ignore this field.
+     * Defaults to NULL.
+     */
+    hz_map_cmp_func order_func;
+
+    /**
+     * Seed that is mixed into every key hash before it is used. Maps with
+     * different seeds place keys in unrelated buckets, so setting this to
+     * a random value (e.g. read from the OS entropy source) protects maps
+     * with untrusted keys against hash flooding attacks. Defaults to 0.
+     */
+    size_t seed;
+} hz_map_options;
+
+/**
+ * Initializes the options struct with the default settings.
+ */
+void
+hz_map_options_init(hz_map_options *options);
+
 /**
  * Creates a new empty hashmap with the given key and value sizes and
- * key hash and comparator functions. You must free the returned hashmap
- * using hz_map_free().
+ * key hash and comparator functions. The value size may be 0, in which
+ * case entries only hold a key (see hz_set for a set built on this).
+ * You must free the returned hashmap using hz_map_free().
  */
 hz_map *
 hz_map_new(
@@ -70,15 +322,100 @@ hz_map_new(
     hz_map_cmp_func cmp_func);
 
 /**
- * Creates a new hashmap by copying an existing one.
- * You must free the returned hashmap using hz_map_free().
+ * Same as hz_map_new(), but with additional options. If options is
+ * NULL, this is equivalent to hz_map_new().
+ */
+hz_map *
+hz_map_new_with_options(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_map_options *options);
+
+/**
+ * Creates a new empty hashmap whose keys are NUL-terminated strings. The
+ * options may be NULL. You must free the returned hashmap using
+ * hz_map_free().
+ *
+ * Keys are passed to every function as the string itself (not a pointer
+ * to it), and are copied into an arena owned by the map, so the caller
+ * does not need to keep them alive:
+ *
+ * hz_map *map = hz_map_new_string(sizeof(int), NULL);
+ * int value = 1;
+ * hz_map_put(map, "hello", &value, NULL);
+ * hz_map_get(map, "hello", &value);
+ *
+ * Each entry caches the length and hash of its key, and lookups compare
+ * those before comparing any bytes, so a lookup only reads a key's bytes
+ * if it is very likely to match.
+ *
+ * Functions that take an array of keys (hz_map_get_many() and
+ * hz_map_put_many()) expect an array of const char * for these maps.
+ * Iterators write each key out as a const char * pointing into the map,
+ * and cursors and hz_map_for_each() yield the stored string directly;
+ * either way, the key string remains valid until the map is modified.
+ * The memory of removed keys is reclaimed when the map is cleared, or
+ * once it makes up most of the arena.
+ */
+hz_map *
+hz_map_new_string(size_t value_size, const hz_map_options *options);
+
+/**
+ * Same as hz_map_new(), but preallocates space for the given number of
+ * entries (see hz_map_reserve()).
+ */
+hz_map *
+hz_map_new_with_capacity(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    size_t capacity);
+
+/**
+ * Creates a new hashmap by copying an existing one. The copy has the same
+ * options as the original. You must free the returned hashmap using
+ * hz_map_free().
  */
 hz_map *
 hz_map_copy(const hz_map *map);
 
 /**
- * Frees a hashmap created by hz_map_new() or hz_map_copy(). Using the hashmap
- * after deletion results in undefined behavior.
+ * Creates a snapshot of the hashmap. The snapshot behaves like a copy
+ * made with hz_map_copy(), but shares memory with the original: the
+ * bucket array is split into pages of 64 buckets, and a page (along with
+ * the entries in it) is only copied when either map first modifies it.
+ * This makes snapshots cheap to take even for very large maps, as long as
+ * only a small part of the map changes while the snapshot is alive. You
+ * must free the returned hashmap using hz_map_free(); the snapshot and
+ * the original may be freed in any order.
+ *
+ * Until its first snapshot, a map keeps its buckets in one flat array,
+ * which saves a pointer lookup on every access. The first snapshot splits
+ * that array into pages, which takes time linear in the number of
+ * buckets; later snapshots take O(1) time.
+ *
+ * Taking a snapshot invalidates every pointer previously returned by
+ * hz_map_get_ref() or hz_map_emplace() on the original, since the entries
+ * they point into are now shared with the snapshot. To keep updating a
+ * value in place, fetch a new pointer to it after the snapshot; doing so
+ * gives the original its own copy of the entry first.
+ *
+ * Since the two maps share state, they are not independent for
+ * thread-safety purposes: any number of threads may read the snapshot
+ * (e.g. with hz_map_get() or a cursor) while another thread modifies the
+ * original, but the snapshot must not be modified or freed concurrently
+ * with any operation on the original, and vice versa.
+ */
+hz_map *
+hz_map_snapshot(hz_map *map);
+
+/**
+ * Frees a hashmap created by hz_map_new(), hz_map_new_with_options(), or
+ * hz_map_copy(). Using the hashmap after deletion results in undefined
+ * behavior.
  */
 void
 hz_map_free(hz_map *map);
@@ -90,11 +427,69 @@ size_t
 hz_map_size(const hz_map *map);
 
 /**
- * Removes all elements from the hashmap.
+ * Gets the key size that the hashmap was created with. String-keyed
+ * hashmaps have no fixed key size; use hz_map_is_string() to tell them
+ * apart.
+ */
+size_t
+hz_map_key_size(const hz_map *map);
+
+/**
+ * Gets the value size that the hashmap was created with.
+ */
+size_t
+hz_map_value_size(const hz_map *map);
+
+/**
+ * Returns true if the hashmap was created with hz_map_new_string() (or
+ * is a copy or snapshot of one), and false otherwise.
+ */
+bool
+hz_map_is_string(const hz_map *map);
+
+/**
+ * Grows the hashmap so that it can hold at least the given number of
+ * entries without resizing. If the hashmap is already large enough, this
+ * function does nothing. This does *NOT* add or remove any entries from the
+ * hashmap, it is only useful for performance optimization. The resize is
+ * always performed immediately, even if the map uses incremental resizing.
+ */
+void
+hz_map_reserve(hz_map *map, size_t capacity);
+
+/**
+ * Shrinks the bucket array to the smallest size that holds the current
+ * entries without exceeding the maximum load factor, finishing any resize
+ * in progress, and frees the key memory of removed entries in a string
+ * map. An empty map frees its bucket array entirely.
+ */
+void
+hz_map_trim(hz_map *map);
+
+/**
+ * Removes all elements from the hashmap and frees the bucket array.
  */
 void
 hz_map_clear(hz_map *map);
 
+/**
+ * Removes all elements from the hashmap, but keeps the bucket array at
+ * its current size. If the map uses an entry pool, the removed entries
+ * are returned to it. This makes refilling the map to about the same
+ * size cheaper than after hz_map_clear(), since it does not have to grow
+ * again or allocate new entries.
+ */
+void
+hz_map_clear_keep_capacity(hz_map *map);
+
+/**
+ * Gets statistics about the hashmap's internal state. This visits every
+ * bucket, so it takes O(n) time. The operation counters, resize count,
+ * and memory usage of a copy or snapshot start out at zero.
+ */
+void
+hz_map_get_stats(const hz_map *map, hz_map_stats *out_stats);
+
 /**
  * Gets the value associated with the given key. Returns true if the entry
  * exists in the map, and false otherwise. If the entry exists and out_value
@@ -103,6 +498,26 @@ hz_map_clear(hz_map *map);
 bool
 hz_map_get(const hz_map *map, const void *key, void *out_value);
 
+/**
+ * Looks up a batch of keys at once. keys must point to an array of n keys.
+ * For each key that exists in the map, the corresponding element of
+ * out_values is set to its value; elements for missing keys are left
+ * unchanged. If out_found is not NULL, out_found[i] is set to whether
+ * keys[i] exists in the map. Either output array may be NULL. Returns
+ * the number of keys that were found.
+ *
+ * This is equivalent to calling hz_map_get() for each key, but is faster
+ * for large maps since the memory accesses for several keys are
+ * overlapped instead of being performed one after another.
+ */
+size_t
+hz_map_get_many(
+    const hz_map *map,
+    const void *keys,
+    size_t n,
+    void *out_values,
+    bool *out_found);
+
 /**
  * Sets the value associated with the given key. Returns true if this replaces
  * an existing value, and false otherwise. If a value was replaced and
@@ -111,6 +526,103 @@ hz_map_get(const hz_map *map, const void *key, void *out_value);
 bool
 hz_map_put(hz_map *map, const void *key, const void *value, void *out_value);
 
+/**
+ * Inserts a batch of entries at once. keys and values must point to arrays
+ * of n keys and n values respectively. This is equivalent to calling
+ * hz_map_put() for each key-value pair in order (so if a key appears more
+ * than once, the last value wins), but only resizes the hashmap once.
+ * Returns the number of keys that were not already in the hashmap.
+ */
+size_t
+hz_map_put_many(hz_map *map, const void *keys, const void *values, size_t n);
+
+/**
+ * Inserts every entry of src into dst. Keys that are only in src are
+ * copied over. For keys in both maps, combine_func is called to merge
+ * the source value into the destination value, or if combine_func is
+ * NULL, the source value replaces the destination value. The maps must
+ * have the same key and value types, and must not be the same map. If
+ * they also have the same hash function and seed, keys are not hashed
+ * again. dst is grown up front to hold as many keys as the larger of the
+ * two maps, and only resizes again if many keys are only in src. Returns
+ * the number of keys that were not already in dst.
+ */
+size_t
+hz_map_merge(hz_map *dst, const hz_map *src, hz_map_combine_func combine_func, void *ctx);
+
+/**
+ * Gets the shard that a key belongs to in hz_map_merge_shard(), out of
+ * shard_count shards. Maps with the same hash function and seed always
+ * put a key in the same shard.
+ */
+size_t
+hz_map_shard_of(const hz_map *map, const void *key, size_t shard_count);
+
+/**
+ * Same as calling hz_map_merge() for each of the src_count maps in srcs,
+ * but only for the keys in the given shard, as defined by
+ * hz_map_shard_of(). The source maps must all have the same hash function
+ * and seed. Since every key belongs to exactly one shard, a multi-way
+ * merge can be split across threads without locking, each thread merging
+ * one shard into its own destination map:
+ *
+ * // On thread i of n:
+ * hz_map_merge_shard(dsts[i], srcs, src_count, i, n, combine_func, ctx);
+ *
+ * The results are disjoint, and a key can be looked up in
+ * dsts[hz_map_shard_of(srcs[0], key, n)]. The source maps may be read by
+ * any number of threads at once, but must not be modified until every
+ * thread is done, and the destination maps must not be snapshots of
+ * each other or of the sources. If shard >= shard_count, the program is
+ * aborted.
+ */
+size_t
+hz_map_merge_shard(
+    hz_map *dst,
+    const hz_map *const *srcs,
+    size_t src_count,
+    size_t shard,
+    size_t shard_count,
+    hz_map_combine_func combine_func,
+    void *ctx);
+
+/**
+ * Gets a pointer to the value associated with the given key, or NULL if
+ * the key is not in the hashmap. The value may be read and modified in
+ * place through the returned pointer, which is suitably aligned for the
+ * value type. Since entries are never moved, the pointer remains valid
+ * until the entry is removed, the hashmap is cleared or freed, or a
+ * snapshot of the hashmap is taken with hz_map_snapshot(). Writes
+ * through the pointer never show up in snapshots of the hashmap: if the
+ * entry is shared with a snapshot, this function first gives the hashmap
+ * its own copy of it. Doing so is not a modification, so it does not
+ * invalidate cursors.
+ */
+void *
+hz_map_get_ref(hz_map *map, const void *key);
+
+/**
+ * Same as hz_map_get_ref(), but for reading only: the hashmap is not
+ * changed, and the value must not be modified through the returned
+ * pointer. The pointer remains valid until the next call that takes a
+ * non-const pointer to the hashmap.
+ */
+const void *
+hz_map_find(const hz_map *map, const void *key);
+
+/**
+ * Finds the entry for the given key, inserting it if it does not exist,
+ * and returns a pointer to its value. Newly inserted values are zero-filled.
+ * If out_inserted is not NULL, it is set to whether a new entry was
+ * inserted. The returned pointer has the same guarantees as the one
+ * returned by hz_map_get_ref(). For example, to count occurrences:
+ *
+ * size_t *count = hz_map_emplace(map, &key, NULL);
+ * (*count)++;
+ */
+void *
+hz_map_emplace(hz_map *map, const void *key, bool *out_inserted);
+
 /**
  * Removes the entry associated with the given key. Returns true if
  * the entry exists in the map, and false otherwise. If the entry exists
@@ -119,6 +631,56 @@ hz_map_put(hz_map *map, const void *key, const void *value, void *out_value);
 bool
 hz_map_remove(hz_map *map, const void *key, void *out_value);
 
+/**
+ * Gets the hash that the hashmap uses for the given key: the result of
+ * the hash function, mixed with the map's seed. Maps with the same hash
+ * function and seed return the same hash for the same key. A caller that
+ * already needs the hash (e.g. to pick one of several maps to look in)
+ * can pass it to the *_hashed() functions below, so that the key is only
+ * hashed once.
+ */
+size_t
+hz_map_hash(const hz_map *map, const void *key);
+
+/**
+ * Same as hz_map_get(), hz_map_put(), hz_map_emplace(), and
+ * hz_map_remove(), but use the given hash instead of hashing the key.
+ * The hash must be the one returned by hz_map_hash() for the same key,
+ * on this map or one with the same hash function and seed; otherwise,
+ * the behavior is undefined.
+ */
+bool
+hz_map_get_hashed(const hz_map *map, size_t hash, const void *key, void *out_value);
+
+bool
+hz_map_put_hashed(hz_map *map, size_t hash, const void *key, const void *value, void *out_value);
+
+void *
+hz_map_emplace_hashed(hz_map *map, size_t hash, const void *key, bool *out_inserted);
+
+bool
+hz_map_remove_hashed(hz_map *map, size_t hash, const void *key, void *out_value);
+
+/**
+ * Gets the key of the entry whose value is at the given pointer, which
+ * must have been returned by hz_map_get_ref() or hz_map_emplace() and
+ * still be valid. The key remains valid for as long as the value does,
+ * but must not be modified. This lets data structures that link values
+ * together (e.g. hz_cache) find the entry a value belongs to.
+ */
+const void *
+hz_map_ref_key(const hz_map *map, const void *value);
+
+/**
+ * Removes the entry whose value is at the given pointer, which must
+ * have been returned by hz_map_get_ref() or hz_map_emplace() and still
+ * be valid. This is the same as calling hz_map_remove() with the entry's
+ * key, but skips hashing the key. If out_value is not NULL, the removed
+ * value is written to out_value.
+ */
+void
+hz_map_remove_ref(hz_map *map, void *value, void *out_value);
+
 /**
  * Compares the two hashmaps. Returns true if for all keys in a and b
  * a[key] == b[key], and false otherwise. If either hashmap is NULL,
@@ -156,4 +718,163 @@ hz_map_iterator_free(hz_map_iterator *it);
 bool
 hz_map_iterator_next(hz_map_iterator *it, void *key, void *value);
 
+/**
+ * Initializes a cursor positioned before the first element in the
+ * hashmap. Like hz_map_iterator, the cursor is invalidated after any
+ * modifications to the hashmap; continuing to use it results in an error.
+ * Calling hz_map_get_ref() does not count as a modification.
+ */
+void
+hz_map_cursor_init(hz_map_cursor *cursor, const hz_map *map);
+
+/**
+ * Moves the cursor to the next element in the hashmap. If there are no
+ * more elements in the hashmap, returns false and the key and value
+ * parameters are unchanged. Otherwise, returns true and the key and value
+ * parameters are set to point to the stored key and value, which remain
+ * valid until the hashmap is modified. You may pass NULL for the key or
+ * value parameters to ignore their value.
+ */
+bool
+hz_map_cursor_next(hz_map_cursor *cursor, const void **key, const void **value);
+
+/**
+ * Initializes a cursor over one of count disjoint partitions of the
+ * hashmap, numbered from 0 to count - 1. Together, the partitions visit
+ * every element exactly once, and each one covers about the same number
+ * of buckets. Since cursors only read the map, each partition can be
+ * scanned by a different thread, as long as no thread modifies the map
+ * in the meantime:
+ *
+ * // On thread i of n:
+ * hz_map_cursor cursor;
+ * hz_map_cursor_init_partition(&cursor, map, i, n);
+ * while (hz_map_cursor_next(&cursor, &key, &value)) {
+ *     ...
+ * }
+ *
+ * Using more partitions than threads and handing them out as threads
+ * become free evens out the work when entries are unevenly spread.
+ * If index >= count, the program is aborted.
+ */
+void
+hz_map_cursor_init_partition(hz_map_cursor *cursor, const hz_map *map, size_t index, size_t count);
+
+/**
+ * Calls visit_func with pointers to the key and value of each element
+ * in the hashmap, stopping early if visit_func returns false. Returns
+ * true if every element was visited, and false otherwise. visit_func
+ * must not modify the hashmap.
+ */
+bool
+hz_map_for_each(const hz_map *map, hz_map_visit_func visit_func, void *ctx);
+
+/**
+ * Same as hz_map_for_each(), but only visits the elements in the given
+ * partition of the hashmap, as defined by hz_map_cursor_init_partition().
+ */
+bool
+hz_map_for_each_partition(
+    const hz_map *map,
+    size_t index,
+    size_t count,
+    hz_map_visit_func visit_func,
+    void *ctx);
+
+/**
+ * Gets the number of bytes needed to hold the image of the hashmap
+ * written by hz_map_serialize().
+ */
+size_t
+hz_map_serialized_size(const hz_map *map);
+
+/**
+ * Writes an image of the hashmap to buf, which can be read back using
+ * hz_map_view_open() (or hz_map_view_open_string() for string-keyed
+ * hashmaps). buf must be aligned for any type (as memory returned by
+ * malloc() is) and at least hz_map_serialized_size() bytes long;
+ * otherwise, the program is aborted. The image contains no pointers and
+ * no uninitialized bytes, so serializing the same hashmap twice produces
+ * identical images.
+ */
+void
+hz_map_serialize(const hz_map *map, void *buf, size_t buf_size);
+
+/**
+ * Opens a read-only view of the hashmap image in data, which must hold
+ * size bytes and stay valid and unmodified until the view is freed. data
+ * must be aligned for any type (as memory returned by malloc() or mmap()
+ * is); otherwise, the program is aborted. The hash and comparator
+ * functions must behave the same as those of the serialized hashmap.
+ * Returns NULL if the image is truncated, was written on an incompatible
+ * platform, has different key or value sizes, or has an invalid header.
+ * Only the image header is checked, which keeps opening a view O(1); to
+ * use an image that may be corrupt, also call hz_map_view_validate()
+ * before any lookups. You must free the returned view using
+ * hz_map_view_free().
+ */
+hz_map_view *
+hz_map_view_open(
+    const void *data,
+    size_t size,
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func);
+
+/**
+ * Same as hz_map_view_open(), but for the image of a hashmap created by
+ * hz_map_new_string(). Keys passed to and returned from the view are
+ * NUL-terminated strings.
+ */
+hz_map_view *
+hz_map_view_open_string(const void *data, size_t size, size_t value_size);
+
+/**
+ * Checks the parts of the image that hz_map_view_open() does not: that
+ * every bucket's entries lie within the image, and that every string key
+ * fits in the image and is NUL-terminated. This reads the whole image,
+ * so it takes time linear in its size. Returns true if lookups and
+ * hz_map_view_for_each() only read memory within the image. If this
+ * returns false, using the view results in undefined behavior, and it
+ * should only be freed.
+ */
+bool
+hz_map_view_validate(const hz_map_view *view);
+
+/**
+ * Frees a view created by hz_map_view_open(). This does not free the
+ * image itself. Using the view after deletion results in undefined
+ * behavior.
+ */
+void
+hz_map_view_free(hz_map_view *view);
+
+/**
+ * Gets the number of entries in the view.
+ */
+size_t
+hz_map_view_size(const hz_map_view *view);
+
+/**
+ * Same as hz_map_get(), but for a view.
+ */
+bool
+hz_map_view_get(const hz_map_view *view, const void *key, void *out_value);
+
+/**
+ * Gets a pointer to the value associated with the given key within the
+ * image, or NULL if the key is not in the view. The value is suitably
+ * aligned for the value type, and must not be modified.
+ */
+const void *
+hz_map_view_get_ref(const hz_map_view *view, const void *key);
+
+/**
+ * Same as hz_map_for_each(), but for a view. Entries are visited in an
+ * unspecified order.
+ */
+bool
+hz_map_view_for_each(const hz_map_view *view, hz_map_visit_func visit_func, void *ctx);
+
 #endif
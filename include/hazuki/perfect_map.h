@@ -0,0 +1,103 @@
+#ifndef HAZUKI_PERFECT_MAP_H_INCLUDED
+#define HAZUKI_PERFECT_MAP_H_INCLUDED
+
+#include "hazuki/map.h"
+#include "hazuki/vector.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A read-only map from keys to values, built once from a fixed set of
+ * keys using a minimal perfect hash function.
+ *
+ * The entries are stored in an array with exactly one slot per key, and
+ * each key hashes straight to its own slot, so there are no empty slots,
+ * no chains, and no probing. A lookup reads one small displacement value
+ * (about one byte per key in total, so it usually stays in cache) and
+ * then the single slot the key can be in, making this the smallest and
+ * fastest option for maps that are built once and then only read:
+ *
+ * hz_perfect_map *map = hz_perfect_map_new(
+ *     sizeof(TKey), sizeof(TValue), key_hash, key_cmp, keys, values);
+ * hz_perfect_map_get(map, &key, &value);
+ * ...
+ * hz_perfect_map_free(map);
+ *
+ * Looking up a key that is not in the map is allowed, and returns false.
+ * Since keys are told apart by their hashes while building the map, the
+ * hash function must not return the same value for two distinct keys, or
+ * building fails. This holds for integer keys hashed with the identity
+ * function, and is vanishingly unlikely for a good 64-bit hash.
+ */
+typedef struct hz_perfect_map hz_perfect_map;
+
+/**
+ * Builds a perfect map from a vector of distinct keys and a vector of
+ * the same number of values, such that looking up keys[i] returns
+ * values[i]. The elements of the vectors must have the given key and
+ * value sizes. If the vectors have different sizes or a key appears more
+ * than once, the program is aborted. If two distinct keys have the same
+ * hash, returns NULL. Building takes O(n) expected time. You must free
+ * the returned map using hz_perfect_map_free().
+ */
+hz_perfect_map *
+hz_perfect_map_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_vector *keys,
+    const hz_vector *values);
+
+/**
+ * Same as hz_perfect_map_new(), but builds the map from the entries of
+ * an existing hz_map. The program is aborted if the hz_map is
+ * string-keyed or does not have the given key and value sizes. The hash
+ * and comparator functions do not have to be the same as the hz_map's.
+ */
+hz_perfect_map *
+hz_perfect_map_new_from_map(
+    const hz_map *map,
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func);
+
+/**
+ * Frees a map created by hz_perfect_map_new(). Using the map after
+ * deletion results in undefined behavior.
+ */
+void
+hz_perfect_map_free(hz_perfect_map *map);
+
+/**
+ * Gets the number of entries in the map.
+ */
+size_t
+hz_perfect_map_size(const hz_perfect_map *map);
+
+/**
+ * Gets the total number of bytes allocated by the map, including the
+ * map itself.
+ */
+size_t
+hz_perfect_map_memory_usage(const hz_perfect_map *map);
+
+/**
+ * Gets the value associated with the given key. Returns true if the entry
+ * exists in the map, and false otherwise. If the entry exists and
+ * out_value is not NULL, the value is written to out_value.
+ */
+bool
+hz_perfect_map_get(const hz_perfect_map *map, const void *key, void *out_value);
+
+/**
+ * Gets a pointer to the value associated with the given key, or NULL if
+ * the key is not in the map. The value is suitably aligned for the value
+ * type, and may be modified in place; it remains valid until the map is
+ * freed.
+ */
+void *
+hz_perfect_map_get_ref(const hz_perfect_map *map, const void *key);
+
+#endif
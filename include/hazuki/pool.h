@@ -0,0 +1,68 @@
+#ifndef HAZUKI_POOL_H_INCLUDED
+#define HAZUKI_POOL_H_INCLUDED
+
+#include <stddef.h>
+
+/**
+ * A pool allocator for objects of a single fixed size.
+ *
+ * Objects are carved out of large slabs, and released objects are kept
+ * on a free list for reuse by later allocations. All objects can be
+ * released at once (without visiting each one) by clearing or freeing
+ * the pool:
+ *
+ * hz_pool *pool = hz_pool_new(sizeof(T));
+ * T *a = hz_pool_alloc(pool);
+ * T *b = hz_pool_alloc(pool);
+ * hz_pool_release(pool, a);
+ * ...
+ * hz_pool_free(pool);
+ *
+ * Every object returned by hz_pool_alloc() is suitably aligned for any
+ * type. The contents of a newly allocated object are undefined.
+ */
+typedef struct hz_pool hz_pool;
+
+/**
+ * Creates a new empty pool for objects of the given size. The object size
+ * must not be 0. You must free the returned pool using hz_pool_free().
+ */
+hz_pool *
+hz_pool_new(size_t object_size);
+
+/**
+ * Frees a pool created by hz_pool_new(), along with every object allocated
+ * from it. Using the pool or any of its objects after deletion results in
+ * undefined behavior.
+ */
+void
+hz_pool_free(hz_pool *pool);
+
+/**
+ * Gets the size of the objects allocated by the pool.
+ */
+size_t
+hz_pool_object_size(const hz_pool *pool);
+
+/**
+ * Allocates an object from the pool. The object remains valid until it is
+ * released or the pool is cleared or freed.
+ */
+void *
+hz_pool_alloc(hz_pool *pool);
+
+/**
+ * Returns an object allocated by hz_pool_alloc() to the pool. Calling
+ * hz_pool_release on a NULL pointer is a no-op. Releasing an object that
+ * was not allocated from this pool results in undefined behavior.
+ */
+void
+hz_pool_release(hz_pool *pool, void *ptr);
+
+/**
+ * Releases every object allocated from the pool and frees its slabs.
+ */
+void
+hz_pool_clear(hz_pool *pool);
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef HAZUKI_RCU_MAP_H_INCLUDED
+#define HAZUKI_RCU_MAP_H_INCLUDED
+
+#include "hazuki/map.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A read-mostly concurrent hashmap whose lookups take no locks and never
+ * write to memory shared with other threads.
+ *
+ * Entries are never modified once they are visible to readers: writers
+ * build a replacement entry (or a whole new bucket array when resizing)
+ * and publish it with a single atomic pointer store. Unlinked entries
+ * are reclaimed using epochs: each reader thread announces the epoch it
+ * started reading in using its own hz_rcu_reader, and an entry is only
+ * freed once every reader that could still see it has finished.
+ *
+ * hz_rcu_map *map = hz_rcu_map_new(sizeof(TKey), sizeof(TValue), key_hash, key_cmp);
+ *
+ * // On each reader thread
+ * hz_rcu_reader *reader = hz_rcu_reader_new(map);
+ * hz_rcu_map_get(reader, &key, &value);
+ * hz_rcu_reader_free(reader);
+ *
+ * // On the writer thread
+ * hz_rcu_map_put(map, &key, &value, NULL);
+ *
+ * Any number of threads may read at once, each with its own reader.
+ * Writes (put, remove, clear, and collect) must not run concurrently
+ * with each other; if there is more than one writer thread, serialize
+ * them with a lock. Writes are relatively expensive, since every update
+ * allocates an entry and resizing copies the whole map.
+ *
+ * This module requires compiler support for atomic operations
+ * (GCC and Clang are supported).
+ */
+typedef struct hz_rcu_map hz_rcu_map;
+
+/**
+ * Per-thread read handle for hz_rcu_map. Create using hz_rcu_reader_new(),
+ * destroy with hz_rcu_reader_free(). A reader must only be used by one
+ * thread at a time.
+ */
+typedef struct hz_rcu_reader hz_rcu_reader;
+
+/**
+ * Optional settings for hz_rcu_map_new_with_options(). Always initialize
+ * an options struct with hz_rcu_map_options_init() before changing any
+ * fields, so that any other fields keep their default values.
+ */
+typedef struct hz_rcu_map_options
+{
+    /**
+     * Seed that is mixed into every key hash before it is used. Same as
+     * the seed in hz_map_options. Defaults to 0.
+     */
+    size_t seed;
+} hz_rcu_map_options;
+
+/**
+ * Initializes the options struct with the default settings.
+ */
+void
+hz_rcu_map_options_init(hz_rcu_map_options *options);
+
+/**
+ * Creates a new empty hashmap with the given key and value sizes and key
+ * hash and comparator functions. The hash and comparator functions may be
+ * called from several threads at once. You must free the returned hashmap
+ * using hz_rcu_map_free().
+ */
+hz_rcu_map *
+hz_rcu_map_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func);
+
+/**
+ * Same as hz_rcu_map_new(), but with the given options. options may be
+ * NULL to use the defaults.
+ */
+hz_rcu_map *
+hz_rcu_map_new_with_options(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_rcu_map_options *options);
+
+/**
+ * Frees a hashmap created by hz_rcu_map_new() or
+ * hz_rcu_map_new_with_options(), along with any readers that have not
+ * been freed. No other thread may be using the hashmap. Using the
+ * hashmap after deletion results in undefined behavior.
+ */
+void
+hz_rcu_map_free(hz_rcu_map *map);
+
+/**
+ * Gets the number of entries in the hashmap. May be called from any
+ * thread, but the result may be stale if a write is in progress.
+ */
+size_t
+hz_rcu_map_size(const hz_rcu_map *map);
+
+/**
+ * Creates a reader for the given hashmap. Readers freed with
+ * hz_rcu_reader_free() are recycled, so this only allocates memory
+ * when more threads are reading at once than ever before.
+ */
+hz_rcu_reader *
+hz_rcu_reader_new(hz_rcu_map *map);
+
+/**
+ * Releases a reader created by hz_rcu_reader_new(). Using the reader
+ * after it is released results in undefined behavior.
+ */
+void
+hz_rcu_reader_free(hz_rcu_reader *reader);
+
+/**
+ * Gets the value associated with the given key, using the reader's
+ * hashmap. Semantics are identical to hz_map_get(). Never blocks, even
+ * while a write is in progress; the result reflects either the state
+ * before or after any concurrent write.
+ */
+bool
+hz_rcu_map_get(hz_rcu_reader *reader, const void *key, void *out_value);
+
+/**
+ * Same as hz_map_put(). Must not be called concurrently with other writes.
+ */
+bool
+hz_rcu_map_put(hz_rcu_map *map, const void *key, const void *value, void *out_value);
+
+/**
+ * Same as hz_map_remove(). Must not be called concurrently with other
+ * writes.
+ */
+bool
+hz_rcu_map_remove(hz_rcu_map *map, const void *key, void *out_value);
+
+/**
+ * Removes all elements from the hashmap. Must not be called concurrently
+ * with other writes.
+ */
+void
+hz_rcu_map_clear(hz_rcu_map *map);
+
+/**
+ * Frees memory from previous writes that is no longer visible to any
+ * reader. This is done automatically after each write; call it to
+ * reclaim memory after the last write in a batch, once the readers
+ * that were active at the time have finished. Must not be called
+ * concurrently with other writes.
+ */
+void
+hz_rcu_map_collect(hz_rcu_map *map);
+
+#endif
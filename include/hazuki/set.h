@@ -0,0 +1,175 @@
+#ifndef HAZUKI_SET_H_INCLUDED
+#define HAZUKI_SET_H_INCLUDED
+
+#include "hazuki/map.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * An unordered set of keys, backed by an hz_map with no value storage.
+ * Each element costs only its key and the map's entry header, and adding
+ * a key copies nothing but the key itself:
+ *
+ * hz_set *set = hz_set_new(sizeof(TKey), key_hash, key_cmp);
+ * hz_set_add(set, &key);
+ * if (hz_set_contains(set, &key)) {
+ *     ...
+ * }
+ * hz_set_free(set);
+ *
+ * The key hash and comparator functions follow the same rules as for
+ * hz_map.
+ */
+typedef struct hz_set hz_set;
+
+/**
+ * Allocation-free iterator for hz_set, which yields pointers to the
+ * stored keys:
+ *
+ * hz_set_cursor cursor;
+ * hz_set_cursor_init(&cursor, set);
+ * const void *key;
+ * while (hz_set_cursor_next(&cursor, &key)) {
+ *     const TKey *k = key;
+ *     ...
+ * }
+ *
+ * The fields are private; do not access them directly. A cursor does not
+ * need to be freed.
+ */
+typedef struct hz_set_cursor
+{
+    hz_map_cursor map_cursor;
+} hz_set_cursor;
+
+/**
+ * Creates a new empty set with the given key size and key hash and
+ * comparator functions. You must free the returned set using
+ * hz_set_free().
+ */
+hz_set *
+hz_set_new(size_t key_size, hz_map_hash_func hash_func, hz_map_cmp_func cmp_func);
+
+/**
+ * Same as hz_set_new(), but with the given hz_map options for the
+ * underlying map. options may be NULL to use the defaults.
+ */
+hz_set *
+hz_set_new_with_options(
+    size_t key_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_map_options *options);
+
+/**
+ * Frees a set created by any of the functions in this header. Using the
+ * set after deletion results in undefined behavior.
+ */
+void
+hz_set_free(hz_set *set);
+
+/**
+ * Creates a copy of the given set. You must free the returned set using
+ * hz_set_free().
+ */
+hz_set *
+hz_set_copy(const hz_set *set);
+
+/**
+ * Gets the number of keys in the set.
+ */
+size_t
+hz_set_size(const hz_set *set);
+
+/**
+ * Ensures that the set can hold at least capacity keys without
+ * resizing.
+ */
+void
+hz_set_reserve(hz_set *set, size_t capacity);
+
+/**
+ * Removes all keys from the set.
+ */
+void
+hz_set_clear(hz_set *set);
+
+/**
+ * Returns true if the key is in the set, and false otherwise.
+ */
+bool
+hz_set_contains(const hz_set *set, const void *key);
+
+/**
+ * Adds a key to the set. Returns true if the key was not already in the
+ * set, and false otherwise.
+ */
+bool
+hz_set_add(hz_set *set, const void *key);
+
+/**
+ * Removes a key from the set. Returns true if the key was in the set,
+ * and false otherwise.
+ */
+bool
+hz_set_remove(hz_set *set, const void *key);
+
+/**
+ * Returns true if the two sets contain the same keys, and false
+ * otherwise. The sets must have the same key size, hash function, and
+ * comparator.
+ */
+bool
+hz_set_equals(const hz_set *a, const hz_set *b);
+
+/**
+ * Initializes a cursor positioned before the first key in the set. The
+ * cursor is invalidated after any modifications to the set; continuing
+ * to use it results in an error.
+ */
+void
+hz_set_cursor_init(hz_set_cursor *cursor, const hz_set *set);
+
+/**
+ * Moves the cursor to the next key in the set. If there are no more keys,
+ * returns false and key is unchanged. Otherwise, returns true and key is
+ * set to point to the stored key, which remains valid until the set is
+ * modified. You may pass NULL for key to ignore its value.
+ */
+bool
+hz_set_cursor_next(hz_set_cursor *cursor, const void **key);
+
+/**
+ * Creates a new set containing the keys that are in a, b, or both. The
+ * larger set is copied in bulk and each key of the smaller set is added
+ * to the copy, so this takes time proportional to the size of the smaller
+ * set, plus the cost of copying the larger one. The result has the
+ * options of the larger set (or of a, if the sets are the same size).
+ * The sets must have the same key size, hash function, and comparator.
+ * You must free the returned set using hz_set_free().
+ */
+hz_set *
+hz_set_union(const hz_set *a, const hz_set *b);
+
+/**
+ * Creates a new set containing the keys that are in both a and b. Each
+ * key of the smaller set is looked up in the larger one, so this takes
+ * time proportional to the size of the smaller set. The result has the
+ * options of a. The sets must have the same key size, hash function, and
+ * comparator. You must free the returned set using hz_set_free().
+ */
+hz_set *
+hz_set_intersection(const hz_set *a, const hz_set *b);
+
+/**
+ * Creates a new set containing the keys that are in a but not in b. If a
+ * is the smaller set, each of its keys is looked up in b; otherwise, a is
+ * copied in bulk and each key of b is removed from the copy. The result
+ * has the options of a. The sets must have the same key size, hash
+ * function, and comparator. You must free the returned set using
+ * hz_set_free().
+ */
+hz_set *
+hz_set_difference(const hz_set *a, const hz_set *b);
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef HAZUKI_TYPED_MAP_H_INCLUDED
+#define HAZUKI_TYPED_MAP_H_INCLUDED
+
+#include "hazuki/utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * Generates a hashmap specialized for a single key and value type.
+ *
+ * hz_map handles every key and value type with the same code, so each
+ * operation calls the hash and comparator functions through pointers and
+ * copies keys and values with memcpy() using their runtime sizes. A map
+ * generated by HZ_MAP_DEFINE stores K and V directly in its entries and
+ * calls its hash and equality functions directly, so the compiler can
+ * inline both and turn copies into plain assignments:
+ *
+ * static inline size_t u64_hash(const uint64_t *key) { return *key; }
+ * static inline bool u64_eq(const uint64_t *a, const uint64_t *b) { return *a == *b; }
+ * HZ_MAP_DEFINE(u64_map, uint64_t, point, u64_hash, u64_eq)
+ *
+ * u64_map *map = u64_map_new();
+ * u64_map_put(map, &key, &value, NULL);
+ * u64_map_get(map, &key, &value);
+ * u64_map_free(map);
+ *
+ * This defines the types name, name_entry, and name_cursor, and the
+ * functions listed below, all prefixed with name_. Each function has the
+ * same semantics as the hz_map function with the same suffix, with keys
+ * and values passed as const K * and V * instead of void pointers:
+ *
+ * new, new_with_capacity, free, size, reserve, clear, get, put,
+ * get_ref, emplace, remove, cursor_init, cursor_next
+ *
+ * hash_func must have the signature size_t hash(const K *key), and eq_func
+ * must have the signature bool eq(const K *a, const K *b), returning true
+ * if the keys are equal. Either may also be a function-like macro. As
+ * with hz_map, the hash is scrambled before use, so the identity function
+ * is a fine hash for integers.
+ *
+ * The generated map behaves like an hz_map created with the default
+ * options (the bucket array grows all at once, and entries are allocated
+ * with malloc()), and does not support snapshots. Since every function is
+ * static inline, expand the macro in a header to share a map type between
+ * several source files. Functions and fields whose names end with an
+ * underscore are private.
+ */
+#define HZ_MAP_DEFINE(name, K, V, hash_func, eq_func)                               \
+                                                                                    \
+typedef struct name##_entry                                                         \
+{                                                                                   \
+    struct name##_entry *next;                                                      \
+    size_t hash;                                                                    \
+    K key;                                                                          \
+    V value;                                                                        \
+} name##_entry;                                                                     \
+                                                                                    \
+typedef struct name                                                                 \
+{                                                                                   \
+    name##_entry **buckets_;                                                        \
+    size_t bucket_count_;                                                           \
+    size_t size_;                                                                   \
+    unsigned int mod_count_;                                                        \
+} name;                                                                             \
+                                                                                    \
+typedef struct name##_cursor                                                        \
+{                                                                                   \
+    const name *map_;                                                               \
+    const name##_entry *entry_;                                                     \
+    size_t chain_index_;                                                            \
+    unsigned int mod_count_;                                                        \
+} name##_cursor;                                                                    \
+                                                                                    \
+static inline size_t                                                                \
+name##_hash_key_(const K *key)                                                      \
+{                                                                                   \
+    return hz_hash_mix(hash_func(key), 0);                                          \
+}                                                                                   \
+                                                                                    \
+static inline name##_entry **                                                       \
+name##_find_link_(const name *map, size_t hash_value, const K *key)                 \
+{                                                                                   \
+    if (map->bucket_count_ == 0) {                                                  \
+        return NULL;                                                                \
+    }                                                                               \
+    size_t index = hash_value & (map->bucket_count_ - 1);                           \
+    name##_entry **link = &map->buckets_[index];                                    \
+    while (*link != NULL) {                                                         \
+        if ((*link)->hash == hash_value && eq_func(key, &(*link)->key)) {           \
+            return link;                                                            \
+        }                                                                           \
+        link = &(*link)->next;                                                      \
+    }                                                                               \
+    return NULL;                                                                    \
+}                                                                                   \
+                                                                                    \
+static inline void                                                                  \
+name##_resize_to_(name *map, size_t new_count)                                      \
+{                                                                                   \
+    name##_entry **new_buckets = hz_calloc(new_count, sizeof(name##_entry *));      \
+    for (size_t i = 0; i < map->bucket_count_; ++i) {                               \
+        name##_entry *entry = map->buckets_[i];                                     \
+        while (entry != NULL) {                                                     \
+            name##_entry *next = entry->next;                                       \
+            size_t index = entry->hash & (new_count - 1);                           \
+            entry->next = new_buckets[index];                                       \
+            new_buckets[index] = entry;                                             \
+            entry = next;                                                           \
+        }                                                                           \
+    }                                                                               \
+    hz_free(map->buckets_);                                                         \
+    map->buckets_ = new_buckets;                                                    \
+    map->bucket_count_ = new_count;                                                 \
+}                                                                                   \
+                                                                                    \
+static inline size_t                                                                \
+name##_bucket_count_for_(size_t num_entries)                                        \
+{                                                                                   \
+    /* Same growth policy as hz_map: start at 8 buckets, double, and */             \
+    /* keep the load factor below 3/4 */                                            \
+    size_t count = 8;                                                               \
+    while (count - count / 4 <= num_entries) {                                      \
+        if (count > SIZE_MAX / 2) {                                                 \
+            hz_abort("Too many entries: %zu", num_entries);                         \
+        }                                                                           \
+        count *= 2;                                                                 \
+    }                                                                               \
+    return count;                                                                   \
+}                                                                                   \
+                                                                                    \
+static inline name##_entry *                                                        \
+name##_add_entry_(name *map, size_t hash_value, const K *key)                       \
+{                                                                                   \
+    if (map->size_ >= map->bucket_count_ - map->bucket_count_ / 4) {                \
+        name##_resize_to_(map, name##_bucket_count_for_(map->size_ + 1));           \
+    }                                                                               \
+    size_t index = hash_value & (map->bucket_count_ - 1);                           \
+    name##_entry *entry = hz_malloc(1, sizeof(name##_entry));                       \
+    entry->next = map->buckets_[index];                                             \
+    entry->hash = hash_value;                                                       \
+    entry->key = *key;                                                              \
+    map->buckets_[index] = entry;                                                   \
+    map->size_++;                                                                   \
+    return entry;                                                                   \
+}                                                                                   \
+                                                                                    \
+static inline void                                                                  \
+name##_free_entries_(name *map)                                                     \
+{                                                                                   \
+    for (size_t i = 0; i < map->bucket_count_; ++i) {                               \
+        name##_entry *entry = map->buckets_[i];                                     \
+        while (entry != NULL) {                                                     \
+            name##_entry *next = entry->next;                                       \
+            hz_free(entry);                                                         \
+            entry = next;                                                           \
+        }                                                                           \
+    }                                                                               \
+    hz_free(map->buckets_);                                                         \
+    map->buckets_ = NULL;                                                           \
+    map->bucket_count_ = 0;                                                         \
+    map->size_ = 0;                                                                 \
+}                                                                                   \
+                                                                                    \
+static inline name *                                                                \
+name##_new(void)                                                                    \
+{                                                                                   \
+    name *map = hz_malloc(1, sizeof(name));                                         \
+    map->buckets_ = NULL;                                                           \
+    map->bucket_count_ = 0;                                                         \
+    map->size_ = 0;                                                                 \
+    map->mod_count_ = 0;                                                            \
+    return map;                                                                     \
+}                                                                                   \
+                                                                                    \
+static inline void                                                                  \
+name##_reserve(name *map, size_t capacity)                                          \
+{                                                                                   \
+    hz_check_null(map);                                                             \
+    if (capacity == 0) {                                                            \
+        return;                                                                     \
+    }                                                                               \
+    size_t new_count = name##_bucket_count_for_(capacity);                          \
+    if (new_count > map->bucket_count_) {                                           \
+        map->mod_count_++;                                                          \
+        name##_resize_to_(map, new_count);                                          \
+    }                                                                               \
+}                                                                                   \
+                                                                                    \
+static inline name *                                                                \
+name##_new_with_capacity(size_t capacity)                                           \
+{                                                                                   \
+    name *map = name##_new();                                                       \
+    name##_reserve(map, capacity);                                                  \
+    return map;                                                                     \
+}                                                                                   \
+                                                                                    \
+static inline void                                                                  \
+name##_free(name *map)                                                              \
+{                                                                                   \
+    if (map != NULL) {                                                              \
+        name##_free_entries_(map);                                                  \
+        hz_free(map);                                                               \
+    }                                                                               \
+}                                                                                   \
+                                                                                    \
+static inline size_t                                                                \
+name##_size(const name *map)                                                        \
+{                                                                                   \
+    hz_check_null(map);                                                             \
+    return map->size_;                                                              \
+}                                                                                   \
+                                                                                    \
+static inline void                                                                  \
+name##_clear(name *map)                                                             \
+{                                                                                   \
+    hz_check_null(map);                                                             \
+    map->mod_count_++;                                                              \
+    name##_free_entries_(map);                                                      \
+}                                                                                   \
+                                                                                    \
+static inline bool                                                                  \
+name##_get(const name *map, const K *key, V *out_value)                             \
+{                                                                                   \
+    hz_check_null(map);                                                             \
+    hz_check_null(key);                                                             \
+    name##_entry **link = name##_find_link_(map, name##_hash_key_(key), key);       \
+    if (link == NULL) {                                                             \
+        return false;                                                               \
+    }                                                                               \
+    if (out_value != NULL) {                                                        \
+        *out_value = (*link)->value;                                                \
+    }                                                                               \
+    return true;                                                                    \
+}                                                                                   \
+                                                                                    \
+static inline bool                                                                  \
+name##_put(name *map, const K *key, const V *value, V *out_value)                   \
+{                                                                                   \
+    hz_check_null(map);                                                             \
+    hz_check_null(key);                                                             \
+    hz_check_null(value);                                                           \
+    map->mod_count_++;                                                              \
+    size_t hash_value = name##_hash_key_(key);                                      \
+    name##_entry **link = name##_find_link_(map, hash_value, key);                  \
+    if (link != NULL) {                                                             \
+        if (out_value != NULL) {                                                    \
+            *out_value = (*link)->value;                                            \
+        }                                                                           \
+        (*link)->value = *value;                                                    \
+        return true;                                                                \
+    }                                                                               \
+    name##_add_entry_(map, hash_value, key)->value = *value;                        \
+    return false;                                                                   \
+}                                                                                   \
+                                                                                    \
+static inline V *                                                                   \
+name##_get_ref(name *map, const K *key)                                             \
+{                                                                                   \
+    hz_check_null(map);                                                             \
+    hz_check_null(key);                                                             \
+    name##_entry **link = name##_find_link_(map, name##_hash_key_(key), key);       \
+    return link != NULL ? &(*link)->value : NULL;                                   \
+}                                                                                   \
+                                                                                    \
+static inline V *                                                                   \
+name##_emplace(name *map, const K *key, bool *out_inserted)                         \
+{                                                                                   \
+    hz_check_null(map);                                                             \
+    hz_check_null(key);                                                             \
+    map->mod_count_++;                                                              \
+    size_t hash_value = name##_hash_key_(key);                                      \
+    name##_entry **link = name##_find_link_(map, hash_value, key);                  \
+    name##_entry *entry;                                                            \
+    bool inserted = (link == NULL);                                                 \
+    if (inserted) {                                                                 \
+        entry = name##_add_entry_(map, hash_value, key);                            \
+        memset(&entry->value, 0, sizeof(V));                                        \
+    } else {                                                                        \
+        entry = *link;                                                              \
+    }                                                                               \
+    if (out_inserted != NULL) {                                                     \
+        *out_inserted = inserted;                                                   \
+    }                                                                               \
+    return &entry->value;                                                           \
+}                                                                                   \
+                                                                                    \
+static inline bool                                                                  \
+name##_remove(name *map, const K *key, V *out_value)                                \
+{                                                                                   \
+    hz_check_null(map);                                                             \
+    hz_check_null(key);                                                             \
+    name##_entry **link = name##_find_link_(map, name##_hash_key_(key), key);       \
+    if (link == NULL) {                                                             \
+        return false;                                                               \
+    }                                                                               \
+    name##_entry *entry = *link;                                                    \
+    if (out_value != NULL) {                                                        \
+        *out_value = entry->value;                                                  \
+    }                                                                               \
+    *link = entry->next;                                                            \
+    hz_free(entry);                                                                 \
+    map->size_--;                                                                   \
+    map->mod_count_++;                                                              \
+    return true;                                                                    \
+}                                                                                   \
+                                                                                    \
+static inline void                                                                  \
+name##_cursor_init(name##_cursor *cursor, const name *map)                          \
+{                                                                                   \
+    hz_check_null(cursor);                                                          \
+    hz_check_null(map);                                                             \
+    cursor->map_ = map;                                                             \
+    cursor->entry_ = NULL;                                                          \
+    cursor->chain_index_ = 0;                                                       \
+    cursor->mod_count_ = map->mod_count_;                                           \
+}                                                                                   \
+                                                                                    \
+static inline bool                                                                  \
+name##_cursor_next(name##_cursor *cursor, const K **key, const V **value)           \
+{                                                                                   \
+    hz_check_null(cursor);                                                          \
+    const name *map = cursor->map_;                                                 \
+    if (cursor->mod_count_ != map->mod_count_) {                                    \
+        hz_abort("Map contents modified during iteration");                         \
+    }                                                                               \
+    while (cursor->entry_ == NULL) {                                                \
+        if (cursor->chain_index_ == map->bucket_count_) {                           \
+            return false;                                                           \
+        }                                                                           \
+        cursor->entry_ = map->buckets_[cursor->chain_index_++];                     \
+    }                                                                               \
+    if (key != NULL) {                                                              \
+        *key = &cursor->entry_->key;                                                \
+    }                                                                               \
+    if (value != NULL) {                                                            \
+        *value = &cursor->entry_->value;                                            \
+    }                                                                               \
+    cursor->entry_ = cursor->entry_->next;                                          \
+    return true;                                                                    \
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define HAZUKI_UTILS_H_INCLUDED
 
 #include <stddef.h>
+#include <stdint.h>
 
 /**
  * Prints a formatted message to stderr and aborts the program.
@@ -39,6 +40,94 @@ do {                                                  \
  */
 #define hz_max(x, y) (((x) > (y)) ? (x) : (y))
 
+/**
+ * Union of the types with the strictest alignment requirements. Memory
+ * aligned to HZ_MAX_ALIGN is suitably aligned for any object type, as
+ * with the result of malloc().
+ */
+typedef union
+{
+    long double ld;
+    long long ll;
+    double d;
+    void *p;
+    void (*fp)(void);
+} hz_max_align;
+
+struct hz_max_align_probe
+{
+    char c;
+    hz_max_align m;
+};
+
+/**
+ * Strictest alignment required by any type, in bytes.
+ */
+#define HZ_MAX_ALIGN (offsetof(struct hz_max_align_probe, m))
+
+/**
+ * Assumed size of a cache line, in bytes. Data written by different
+ * threads is padded to a multiple of this, so that the threads don't
+ * bounce the same cache line between cores.
+ */
+#define HZ_CACHE_LINE_SIZE 64
+
+/**
+ * Rounds offset up to the next multiple of align, which must be a power
+ * of 2. If the result does not fit in a size_t, the program is aborted.
+ */
+static inline size_t
+hz_align_up(size_t offset, size_t align)
+{
+    if (offset > SIZE_MAX - (align - 1)) {
+        hz_abort("Size is too large: %zu", offset);
+    }
+    return (offset + align - 1) & ~(align - 1);
+}
+
+/**
+ * Gets an alignment that is safe for any type of the given size. The
+ * alignment of a type always divides its size, so this is the largest
+ * power of 2 that divides the size, capped at HZ_MAX_ALIGN. Returns 1
+ * for a size of 0.
+ */
+static inline size_t
+hz_align_of(size_t size)
+{
+    if (size == 0) {
+        return 1;
+    }
+    return hz_min(size & (~size + 1), HZ_MAX_ALIGN);
+}
+
+/**
+ * The 64-bit finalizer from MurmurHash3. It is a bijection in which
+ * every bit of the input affects every bit of the output.
+ */
+static inline uint64_t
+hz_fmix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * Scrambles a hash value with hz_fmix64(). This turns weak hash
+ * functions (such as the identity function on integers) into ones whose
+ * low bits are usable as a table index. Different seeds produce
+ * unrelated outputs for the same input. This is defined in the header
+ * so that it can be inlined into hot lookup paths.
+ */
+static inline size_t
+hz_hash_mix(size_t hash, size_t seed)
+{
+    return (size_t)hz_fmix64((uint64_t)hash + (uint64_t)seed * UINT64_C(0x9e3779b97f4a7c15));
+}
+
 /**
  * Allocates a block of memory, with overflow and failure checking.
  * If num == 0, NULL is returned. The unit size must not be 0.
@@ -0,0 +1,51 @@
+#ifndef HAZUKI_BENCH_H_INCLUDED
+#define HAZUKI_BENCH_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Returns the current monotonic wall clock time in seconds.
+ */
+double
+bench_now(void);
+
+/**
+ * Returns the next value from a fast deterministic pseudorandom
+ * sequence (splitmix64). The state may be initialized to any value.
+ */
+uint64_t
+bench_rand(uint64_t *state);
+
+/**
+ * Prints a single benchmark result, in nanoseconds per operation.
+ */
+void
+bench_report(const char *name, size_t n, double seconds, size_t ops);
+
+/**
+ * Identity hash function for uint64_t keys.
+ */
+size_t
+u64_hash(const void *key);
+
+/**
+ * Equality comparator for uint64_t keys, for hash-based containers.
+ */
+int
+u64_cmp(const void *a, const void *b);
+
+/**
+ * Ordering comparator for uint64_t keys, for sorting and ordered
+ * containers.
+ */
+int
+u64_order(const void *a, const void *b);
+
+/**
+ * Sink for benchmark results, to prevent the compiler from optimizing
+ * away the operations being measured.
+ */
+extern volatile size_t bench_sink;
+
+#endif
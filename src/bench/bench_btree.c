@@ -0,0 +1,183 @@
+#include "bench.h"
+#include "hazuki/btree.h"
+#include "hazuki/map.h"
+#include "hazuki/vector.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Number of lookups and range scans performed for each measurement.
+ */
+#define BTREE_LOOKUP_OPS 1000000
+#define BTREE_SCAN_OPS 100000
+
+/**
+ * Number of consecutive keys visited by each range scan.
+ */
+#define BTREE_SCAN_LENGTH 100
+
+/**
+ * Largest size for which the sorted vector is built by insertion,
+ * since each insertion moves half the vector on average.
+ */
+#define VECTOR_INSERT_MAX 100000
+
+typedef struct
+{
+    uint64_t key;
+    uint64_t value;
+} bench_pair;
+
+/**
+ * Gets the index of the first pair in the sorted vector whose key is
+ * >= the given key. Keys are compared through a function pointer, as
+ * hz_vector_bsearch() and hz_btree do, so that the comparison is fair.
+ */
+static size_t
+bench_vector_lower_bound(const hz_vector *vec, uint64_t key)
+{
+    int (*volatile cmp_func)(const void *, const void *) = u64_order;
+    int (*cmp)(const void *, const void *) = cmp_func;
+    const bench_pair *pairs = hz_vector_data(vec);
+    size_t lo = 0;
+    size_t hi = hz_vector_size(vec);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cmp(&pairs[mid].key, &key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void
+bench_btree_size(size_t n)
+{
+    // Random keys, plus a sorted copy for the bulk load and the
+    // vector, which is built by insertion only when that's feasible
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    uint64_t state = 1;
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = bench_rand(&state);
+    }
+    hz_vector *sorted_keys = hz_vector_new(sizeof(uint64_t));
+    hz_vector_resize(sorted_keys, n, NULL);
+    uint64_t *sorted = hz_vector_data(sorted_keys);
+    for (size_t i = 0; i < n; ++i) {
+        sorted[i] = keys[i];
+    }
+    hz_vector_sort(sorted_keys, u64_order);
+
+    hz_vector *vec = hz_vector_new(sizeof(bench_pair));
+    double start;
+    if (n <= VECTOR_INSERT_MAX) {
+        start = bench_now();
+        for (size_t i = 0; i < n; ++i) {
+            bench_pair pair = { keys[i], i };
+            hz_vector_insert(vec, bench_vector_lower_bound(vec, keys[i]), &pair);
+        }
+        bench_report("sorted hz_vector insert", n, bench_now() - start, n);
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            bench_pair pair = { sorted[i], i };
+            hz_vector_append(vec, &pair);
+        }
+    }
+
+    hz_btree *tree = hz_btree_new(sizeof(uint64_t), sizeof(uint64_t), u64_order);
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_btree_put(tree, &keys[i], &i, NULL);
+    }
+    bench_report("hz_btree put", n, bench_now() - start, n);
+
+    hz_btree *loaded = hz_btree_new(sizeof(uint64_t), sizeof(uint64_t), u64_order);
+    start = bench_now();
+    hz_btree_load_sorted(loaded, sorted_keys, sorted_keys);
+    bench_report("hz_btree load_sorted", n, bench_now() - start, n);
+    hz_btree_free(loaded);
+
+    hz_map *map = hz_map_new(sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp);
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_put(map, &keys[i], &i, NULL);
+    }
+    bench_report("hz_map put", n, bench_now() - start, n);
+
+    // Point lookups of random existing keys
+    size_t sum = 0;
+    state = 2;
+    start = bench_now();
+    for (size_t i = 0; i < BTREE_LOOKUP_OPS; ++i) {
+        uint64_t key = keys[bench_rand(&state) % n];
+        const bench_pair *pairs = hz_vector_data(vec);
+        sum += pairs[bench_vector_lower_bound(vec, key)].value;
+    }
+    bench_report("sorted hz_vector get", n, bench_now() - start, BTREE_LOOKUP_OPS);
+
+    state = 2;
+    start = bench_now();
+    for (size_t i = 0; i < BTREE_LOOKUP_OPS; ++i) {
+        uint64_t key = keys[bench_rand(&state) % n];
+        uint64_t value = 0;
+        hz_btree_get(tree, &key, &value);
+        sum += value;
+    }
+    bench_report("hz_btree get", n, bench_now() - start, BTREE_LOOKUP_OPS);
+
+    state = 2;
+    start = bench_now();
+    for (size_t i = 0; i < BTREE_LOOKUP_OPS; ++i) {
+        uint64_t key = keys[bench_rand(&state) % n];
+        uint64_t value = 0;
+        hz_map_get(map, &key, &value);
+        sum += value;
+    }
+    bench_report("hz_map get", n, bench_now() - start, BTREE_LOOKUP_OPS);
+
+    // Range scans starting at a random key (hz_map can't do these)
+    state = 3;
+    start = bench_now();
+    for (size_t i = 0; i < BTREE_SCAN_OPS; ++i) {
+        uint64_t key = bench_rand(&state);
+        const bench_pair *pairs = hz_vector_data(vec);
+        size_t end = hz_vector_size(vec);
+        for (size_t j = bench_vector_lower_bound(vec, key), k = 0; j < end && k < BTREE_SCAN_LENGTH; ++j, ++k) {
+            sum += pairs[j].value;
+        }
+    }
+    bench_report("sorted hz_vector scan (per scan)", n, bench_now() - start, BTREE_SCAN_OPS);
+
+    state = 3;
+    start = bench_now();
+    for (size_t i = 0; i < BTREE_SCAN_OPS; ++i) {
+        uint64_t key = bench_rand(&state);
+        hz_btree_cursor cursor;
+        hz_btree_lower_bound(tree, &key, &cursor);
+        const void *value;
+        for (size_t k = 0; k < BTREE_SCAN_LENGTH && hz_btree_cursor_next(&cursor, NULL, &value); ++k) {
+            sum += *(const uint64_t *)value;
+        }
+    }
+    bench_report("hz_btree scan (per scan)", n, bench_now() - start, BTREE_SCAN_OPS);
+
+    bench_sink += sum;
+    hz_map_free(map);
+    hz_btree_free(tree);
+    hz_vector_free(vec);
+    hz_vector_free(sorted_keys);
+    free(keys);
+}
+
+void
+bench_btree(size_t max_entries)
+{
+    printf("== btree: sorted hz_vector vs. hz_btree vs. hz_map ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_btree_size(n);
+    }
+}
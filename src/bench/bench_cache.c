@@ -0,0 +1,164 @@
+#include "bench.h"
+#include "hazuki/cache.h"
+#include "hazuki/map.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Number of cache lookups performed for each measurement.
+ */
+#define CACHE_OPS 2000000
+
+typedef struct
+{
+    uint64_t a;
+    uint64_t b;
+} bench_value;
+
+/**
+ * List node for the hand-rolled LRU cache: an hz_map from each key to its
+ * node, plus a separately allocated doubly linked list in recency order.
+ */
+typedef struct bench_lru_node
+{
+    struct bench_lru_node *prev;
+    struct bench_lru_node *next;
+    uint64_t key;
+    bench_value value;
+} bench_lru_node;
+
+typedef struct
+{
+    hz_map *map;
+    bench_lru_node head;
+    size_t capacity;
+} bench_lru;
+
+static void
+bench_lru_unlink(bench_lru_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+static void
+bench_lru_link_front(bench_lru *lru, bench_lru_node *node)
+{
+    node->prev = &lru->head;
+    node->next = lru->head.next;
+    lru->head.next->prev = node;
+    lru->head.next = node;
+}
+
+static bool
+bench_lru_get(bench_lru *lru, uint64_t key, bench_value *out_value)
+{
+    bench_lru_node *node;
+    if (!hz_map_get(lru->map, &key, &node)) {
+        return false;
+    }
+    bench_lru_unlink(node);
+    bench_lru_link_front(lru, node);
+    *out_value = node->value;
+    return true;
+}
+
+static void
+bench_lru_put(bench_lru *lru, uint64_t key, const bench_value *value)
+{
+    bench_lru_node *node = malloc(sizeof(bench_lru_node));
+    node->key = key;
+    node->value = *value;
+    hz_map_put(lru->map, &key, &node, NULL);
+    bench_lru_link_front(lru, node);
+    if (hz_map_size(lru->map) > lru->capacity) {
+        bench_lru_node *victim = lru->head.prev;
+        bench_lru_unlink(victim);
+        hz_map_remove(lru->map, &victim->key, NULL);
+        free(victim);
+    }
+}
+
+/**
+ * Generates a skewed key sequence: three quarters of the lookups go to
+ * a hot set half the size of the cache, and the rest are spread over a
+ * key space four times the size of the cache.
+ */
+static uint64_t *
+bench_cache_keys(size_t capacity)
+{
+    uint64_t *keys = malloc(CACHE_OPS * sizeof(uint64_t));
+    uint64_t state = 1;
+    for (size_t i = 0; i < CACHE_OPS; ++i) {
+        uint64_t r = bench_rand(&state);
+        if (r % 4 != 0) {
+            keys[i] = (r >> 2) % (capacity / 2 + 1);
+        } else {
+            keys[i] = (r >> 2) % (capacity * 4);
+        }
+    }
+    return keys;
+}
+
+static void
+bench_cache_size(size_t capacity)
+{
+    uint64_t *keys = bench_cache_keys(capacity);
+    bench_value value = { 1, 2 };
+    size_t hits = 0;
+
+    bench_lru lru;
+    lru.map = hz_map_new(sizeof(uint64_t), sizeof(bench_lru_node *), u64_hash, u64_cmp);
+    lru.head.prev = &lru.head;
+    lru.head.next = &lru.head;
+    lru.capacity = capacity;
+    double start = bench_now();
+    for (size_t i = 0; i < CACHE_OPS; ++i) {
+        if (bench_lru_get(&lru, keys[i], &value)) {
+            hits++;
+        } else {
+            bench_lru_put(&lru, keys[i], &value);
+        }
+    }
+    bench_report("hz_map + linked list get/put", capacity, bench_now() - start, CACHE_OPS);
+    while (lru.head.next != &lru.head) {
+        bench_lru_node *node = lru.head.next;
+        bench_lru_unlink(node);
+        free(node);
+    }
+    hz_map_free(lru.map);
+
+    hz_cache_options options;
+    hz_cache_options_init(&options);
+    options.max_entries = capacity;
+    hz_cache *cache = hz_cache_new(
+        sizeof(uint64_t), sizeof(bench_value), u64_hash, u64_cmp, &options);
+    start = bench_now();
+    for (size_t i = 0; i < CACHE_OPS; ++i) {
+        if (hz_cache_get(cache, &keys[i], &value)) {
+            hits++;
+        } else {
+            hz_cache_put(cache, &keys[i], &value, NULL);
+        }
+    }
+    bench_report("hz_cache get/put", capacity, bench_now() - start, CACHE_OPS);
+
+    hz_cache_stats stats;
+    hz_cache_get_stats(cache, &stats);
+    printf("    hit rate %.1f%%, %zu evictions\n",
+        100.0 * (double)stats.hits / CACHE_OPS, stats.evictions);
+    bench_sink += hits + value.a;
+    hz_cache_free(cache);
+    free(keys);
+}
+
+void
+bench_cache(size_t max_entries)
+{
+    printf("== cache: hz_map + linked list vs. hz_cache ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_cache_size(n);
+    }
+}
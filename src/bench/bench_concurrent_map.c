@@ -0,0 +1,187 @@
+#define _POSIX_C_SOURCE 200112L
+#include "bench.h"
+#include "hazuki/concurrent_map.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Total number of operations performed for each measurement,
+ * split evenly between the threads.
+ */
+#define CONCURRENT_OPS 4000000
+
+/**
+ * Percentage of operations that are writes; the rest are reads.
+ */
+#define WRITE_PERCENT 10
+
+static void
+bench_rwlock_init(void *lock)
+{
+    pthread_rwlock_init(lock, NULL);
+}
+
+static void
+bench_rwlock_destroy(void *lock)
+{
+    pthread_rwlock_destroy(lock);
+}
+
+static void
+bench_rwlock_lock(void *lock)
+{
+    pthread_rwlock_wrlock(lock);
+}
+
+static void
+bench_rwlock_lock_shared(void *lock)
+{
+    pthread_rwlock_rdlock(lock);
+}
+
+static void
+bench_rwlock_unlock(void *lock)
+{
+    pthread_rwlock_unlock(lock);
+}
+
+static void
+bench_mutex_init(void *lock)
+{
+    pthread_mutex_init(lock, NULL);
+}
+
+static void
+bench_mutex_destroy(void *lock)
+{
+    pthread_mutex_destroy(lock);
+}
+
+static void
+bench_mutex_lock(void *lock)
+{
+    pthread_mutex_lock(lock);
+}
+
+static void
+bench_mutex_unlock(void *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+
+static const hz_lock_ops bench_rwlock_ops = {
+    sizeof(pthread_rwlock_t),
+    bench_rwlock_init,
+    bench_rwlock_destroy,
+    bench_rwlock_lock,
+    bench_rwlock_unlock,
+    bench_rwlock_lock_shared,
+    bench_rwlock_unlock,
+};
+
+static const hz_lock_ops bench_mutex_ops = {
+    sizeof(pthread_mutex_t),
+    bench_mutex_init,
+    bench_mutex_destroy,
+    bench_mutex_lock,
+    bench_mutex_unlock,
+    NULL,
+    NULL,
+};
+
+typedef struct
+{
+    hz_concurrent_map *map;
+    size_t n;
+    size_t ops;
+    uint64_t seed;
+    size_t found;
+} bench_worker;
+
+static void *
+bench_worker_run(void *arg)
+{
+    bench_worker *worker = arg;
+    uint64_t state = worker->seed;
+    size_t found = 0;
+    for (size_t i = 0; i < worker->ops; ++i) {
+        uint64_t r = bench_rand(&state);
+        uint64_t key = r % worker->n;
+        if ((r >> 32) % 100 < WRITE_PERCENT) {
+            hz_concurrent_map_put(worker->map, &key, &r, NULL);
+        } else {
+            found += hz_concurrent_map_get(worker->map, &key, NULL);
+        }
+    }
+    worker->found = found;
+    return NULL;
+}
+
+static void
+bench_concurrent_map_run(
+    const char *lock_name,
+    const hz_lock_ops *lock_ops,
+    size_t shard_count,
+    size_t n,
+    size_t threads)
+{
+    hz_concurrent_map_options options;
+    hz_concurrent_map_options_init(&options);
+    options.lock_ops = lock_ops;
+    options.shard_count = shard_count;
+    hz_concurrent_map *map = hz_concurrent_map_new(
+        sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp, &options);
+    for (uint64_t i = 0; i < n; ++i) {
+        hz_concurrent_map_put(map, &i, &i, NULL);
+    }
+
+    bench_worker *workers = calloc(threads, sizeof(bench_worker));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    for (size_t i = 0; i < threads; ++i) {
+        workers[i].map = map;
+        workers[i].n = n;
+        workers[i].ops = CONCURRENT_OPS / threads;
+        workers[i].seed = i + 1;
+    }
+
+    double start = bench_now();
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_create(&tids[i], NULL, bench_worker_run, &workers[i]);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+        bench_sink += workers[i].found;
+    }
+    double elapsed = bench_now() - start;
+
+    char name[64];
+    snprintf(name, sizeof(name), "%zu %s shard(s), %zu thread(s)", shard_count, lock_name, threads);
+    bench_report(name, n, elapsed, workers[0].ops * threads);
+
+    free(tids);
+    free(workers);
+    hz_concurrent_map_free(map);
+}
+
+void
+bench_concurrent_map(size_t max_entries)
+{
+    printf("== concurrent_map: global lock vs. sharded, %d%% writes ==\n", WRITE_PERCENT);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = cores > 0 ? (size_t)cores : 1;
+    for (size_t threads = 1; ; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+        bench_concurrent_map_run("mutex", &bench_mutex_ops, 1, max_entries, threads);
+        bench_concurrent_map_run("mutex", &bench_mutex_ops, 64, max_entries, threads);
+        bench_concurrent_map_run("rwlock", &bench_rwlock_ops, 64, max_entries, threads);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
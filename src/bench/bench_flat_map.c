@@ -0,0 +1,74 @@
+#include "bench.h"
+#include "hazuki/flat_map.h"
+#include "hazuki/map.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Number of lookups performed for each measurement.
+ */
+#define LOOKUP_OPS 1000000
+
+/**
+ * Returns the i-th key inserted into the maps. Keys i >= n are
+ * never inserted, so they can be used to measure misses.
+ */
+static uint64_t
+bench_key(size_t i)
+{
+    uint64_t state = i;
+    return bench_rand(&state);
+}
+
+static void
+bench_flat_map_size(size_t n)
+{
+    hz_map *map = hz_map_new(sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp);
+    hz_flat_map *flat = hz_flat_map_new(sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = bench_key(i);
+        uint64_t value = i;
+        hz_map_put(map, &key, &value, NULL);
+        hz_flat_map_put(flat, &key, &value, NULL);
+    }
+
+    for (int miss = 0; miss <= 1; ++miss) {
+        size_t found;
+        uint64_t state;
+        double start;
+
+        found = 0;
+        state = 1;
+        start = bench_now();
+        for (size_t i = 0; i < LOOKUP_OPS; ++i) {
+            uint64_t key = bench_key(bench_rand(&state) % n + (miss ? n : 0));
+            found += hz_map_get(map, &key, NULL);
+        }
+        bench_report(miss ? "hz_map get (miss)" : "hz_map get (hit)",
+            n, bench_now() - start, LOOKUP_OPS);
+        bench_sink += found;
+
+        found = 0;
+        state = 1;
+        start = bench_now();
+        for (size_t i = 0; i < LOOKUP_OPS; ++i) {
+            uint64_t key = bench_key(bench_rand(&state) % n + (miss ? n : 0));
+            found += hz_flat_map_get(flat, &key, NULL);
+        }
+        bench_report(miss ? "hz_flat_map get (miss)" : "hz_flat_map get (hit)",
+            n, bench_now() - start, LOOKUP_OPS);
+        bench_sink += found;
+    }
+
+    hz_map_free(map);
+    hz_flat_map_free(flat);
+}
+
+void
+bench_flat_map(size_t max_entries)
+{
+    printf("== flat_map: chained vs. open-addressing lookups ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_flat_map_size(n);
+    }
+}
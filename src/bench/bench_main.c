@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 199309L
+#include "bench.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern void bench_flat_map(size_t max_entries);
+extern void bench_map_resize(size_t max_entries);
+extern void bench_map_hash(size_t max_entries);
+extern void bench_map_get_many(size_t max_entries);
+extern void bench_map_bulk_load(size_t max_entries);
+extern void bench_map_emplace(size_t max_entries);
+extern void bench_map_iterate(size_t max_entries);
+extern void bench_map_snapshot(size_t max_entries);
+extern void bench_map_string(size_t max_entries);
+extern void bench_map_image(size_t max_entries);
+extern void bench_map_bloom(size_t max_entries);
+extern void bench_map_collision(size_t max_entries);
+extern void bench_map_clear(size_t max_entries);
+extern void bench_map_partition(size_t max_entries);
+extern void bench_map_merge(size_t max_entries);
+extern void bench_concurrent_map(size_t max_entries);
+extern void bench_rcu_map(size_t max_entries);
+extern void bench_typed_map(size_t max_entries);
+extern void bench_btree(size_t max_entries);
+extern void bench_cache(size_t max_entries);
+extern void bench_perfect_map(size_t max_entries);
+extern void bench_set(size_t max_entries);
+
+typedef struct
+{
+    const char *name;
+    void (*func)(size_t max_entries);
+} bench_entry;
+
+static const bench_entry benchmarks[] = {
+    { "flat_map", bench_flat_map },
+    { "map_resize", bench_map_resize },
+    { "map_hash", bench_map_hash },
+    { "map_get_many", bench_map_get_many },
+    { "map_bulk_load", bench_map_bulk_load },
+    { "map_emplace", bench_map_emplace },
+    { "map_iterate", bench_map_iterate },
+    { "map_snapshot", bench_map_snapshot },
+    { "map_string", bench_map_string },
+    { "map_image", bench_map_image },
+    { "map_bloom", bench_map_bloom },
+    { "map_collision", bench_map_collision },
+    { "map_clear", bench_map_clear },
+    { "map_partition", bench_map_partition },
+    { "map_merge", bench_map_merge },
+    { "concurrent_map", bench_concurrent_map },
+    { "rcu_map", bench_rcu_map },
+    { "typed_map", bench_typed_map },
+    { "btree", bench_btree },
+    { "cache", bench_cache },
+    { "perfect_map", bench_perfect_map },
+    { "set", bench_set },
+};
+
+volatile size_t bench_sink;
+
+double
+bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+uint64_t
+bench_rand(uint64_t *state)
+{
+    uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+size_t
+u64_hash(const void *key)
+{
+    return (size_t)*(const uint64_t *)key;
+}
+
+int
+u64_cmp(const void *a, const void *b)
+{
+    return *(const uint64_t *)a != *(const uint64_t *)b;
+}
+
+int
+u64_order(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void
+bench_report(const char *name, size_t n, double seconds, size_t ops)
+{
+    printf("%-40s n=%-10zu %8.1f ns/op\n", name, n, seconds * 1e9 / ops);
+    fflush(stdout);
+}
+
+/**
+ * Usage: bench [name|all] [max_entries]
+ */
+int
+main(int argc, char **argv)
+{
+    const char *name = argc > 1 ? argv[1] : "all";
+    size_t max_entries = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : 1000000;
+    size_t count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    int found = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (strcmp(name, "all") == 0 || strcmp(name, benchmarks[i].name) == 0) {
+            benchmarks[i].func(max_entries);
+            found = 1;
+        }
+    }
+    if (!found) {
+        fprintf(stderr, "Unknown benchmark: %s\n", name);
+        return 1;
+    }
+    return 0;
+}
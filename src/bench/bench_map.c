@@ -0,0 +1,897 @@
+#define _POSIX_C_SOURCE 200112L
+#include "bench.h"
+#include "hazuki/map.h"
+#include "hazuki/utils.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static hz_map *
+bench_map_new(const hz_map_options *options)
+{
+    return hz_map_new_with_options(sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp, options);
+}
+
+static void
+bench_map_resize_latency(size_t n, bool incremental)
+{
+    // Entries are pooled so that the worst case isn't dominated by
+    // malloc() consolidating the entries freed by the previous run
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.use_pool = true;
+    options.incremental_resize = incremental;
+    hz_map *map = bench_map_new(&options);
+
+    // Track the slowest single insertion as well as the average
+    double worst = 0;
+    uint64_t state = 1;
+    double start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = bench_rand(&state);
+        double op_start = bench_now();
+        hz_map_put(map, &key, &i, NULL);
+        double op_time = bench_now() - op_start;
+        if (op_time > worst) {
+            worst = op_time;
+        }
+    }
+    double total = bench_now() - start;
+
+    const char *name = incremental ? "hz_map put (incremental)" : "hz_map put (one-shot)";
+    bench_report(name, n, total, n);
+    printf("%-40s n=%-10zu %8.1f us worst\n", name, n, worst * 1e6);
+    hz_map_free(map);
+}
+
+void
+bench_map_resize(size_t max_entries)
+{
+    printf("== map_resize: one-shot vs. incremental resize latency ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_resize_latency(n, false);
+        bench_map_resize_latency(n, true);
+    }
+}
+
+/**
+ * Number of lookups performed for each hashing measurement.
+ */
+#define HASH_LOOKUP_OPS 1000000
+
+static void
+bench_map_hash_keys(size_t n, uint64_t stride)
+{
+    hz_map *map = bench_map_new(NULL);
+    double start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = i * stride;
+        hz_map_put(map, &key, &i, NULL);
+    }
+    bench_report(stride == 1 ? "hz_map put (sequential)" : "hz_map put (stride 1024)",
+        n, bench_now() - start, n);
+
+    // Look up keys in a random order, so that we measure
+    // the bucket distribution rather than prefetching
+    uint64_t state = 1;
+    size_t found = 0;
+    start = bench_now();
+    for (size_t i = 0; i < HASH_LOOKUP_OPS; ++i) {
+        uint64_t key = bench_rand(&state) % n * stride;
+        found += hz_map_get(map, &key, NULL);
+    }
+    bench_report(stride == 1 ? "hz_map get (sequential)" : "hz_map get (stride 1024)",
+        n, bench_now() - start, HASH_LOOKUP_OPS);
+    bench_sink += found;
+    hz_map_free(map);
+}
+
+static void
+bench_map_bulk_load_size(size_t n)
+{
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    uint64_t *values = malloc(n * sizeof(uint64_t));
+    uint64_t state = 1;
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = bench_rand(&state);
+        values[i] = i;
+    }
+
+    hz_map *map = bench_map_new(NULL);
+    double start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_put(map, &keys[i], &values[i], NULL);
+    }
+    bench_report("hz_map put (loop)", n, bench_now() - start, n);
+    hz_map_free(map);
+
+    map = bench_map_new(NULL);
+    start = bench_now();
+    hz_map_put_many(map, keys, values, n);
+    bench_report("hz_map put_many", n, bench_now() - start, n);
+    hz_map_free(map);
+
+    free(keys);
+    free(values);
+}
+
+void
+bench_map_bulk_load(size_t max_entries)
+{
+    printf("== map_bulk_load: put loop vs. presized put_many ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_bulk_load_size(n);
+    }
+}
+
+/**
+ * Number of increments performed for each emplace measurement.
+ */
+#define COUNT_OPS 1000000
+
+static void
+bench_map_emplace_size(size_t n)
+{
+    uint64_t state;
+    double start;
+
+    hz_map *map = bench_map_new(NULL);
+    state = 1;
+    start = bench_now();
+    for (size_t i = 0; i < COUNT_OPS; ++i) {
+        uint64_t key = bench_rand(&state) % n;
+        uint64_t count = 0;
+        hz_map_get(map, &key, &count);
+        count++;
+        hz_map_put(map, &key, &count, NULL);
+    }
+    bench_report("hz_map get + put", n, bench_now() - start, COUNT_OPS);
+    bench_sink += hz_map_size(map);
+    hz_map_free(map);
+
+    map = bench_map_new(NULL);
+    state = 1;
+    start = bench_now();
+    for (size_t i = 0; i < COUNT_OPS; ++i) {
+        uint64_t key = bench_rand(&state) % n;
+        uint64_t *count = hz_map_emplace(map, &key, NULL);
+        (*count)++;
+    }
+    bench_report("hz_map emplace", n, bench_now() - start, COUNT_OPS);
+    bench_sink += hz_map_size(map);
+    hz_map_free(map);
+}
+
+void
+bench_map_emplace(size_t max_entries)
+{
+    printf("== map_emplace: counting with get + put vs. emplace ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_emplace_size(n);
+    }
+}
+
+/**
+ * Number of puts performed on the original map after each snapshot.
+ */
+#define SNAPSHOT_WRITES 1000
+
+static void
+bench_map_snapshot_size(size_t n)
+{
+    hz_map *map = bench_map_new(NULL);
+    for (uint64_t i = 0; i < n; ++i) {
+        hz_map_put(map, &i, &i, NULL);
+    }
+
+    double start = bench_now();
+    hz_map *snapshot = hz_map_snapshot(map);
+    bench_report("hz_map snapshot", n, bench_now() - start, 1);
+
+    // The first write after a snapshot copies the top-level directory,
+    // and each write pays for copying the chunk and page it touches
+    // (if nobody else has yet). Writing the same keys again is free.
+    uint64_t key = 0;
+    start = bench_now();
+    hz_map_put(map, &key, &key, NULL);
+    bench_report("hz_map first put after snapshot", n, bench_now() - start, 1);
+
+    uint64_t state = 1;
+    start = bench_now();
+    for (size_t i = 0; i < SNAPSHOT_WRITES; ++i) {
+        key = bench_rand(&state) % n;
+        hz_map_put(map, &key, &i, NULL);
+    }
+    bench_report("hz_map put after snapshot", n, bench_now() - start, SNAPSHOT_WRITES);
+
+    state = 1;
+    start = bench_now();
+    for (size_t i = 0; i < SNAPSHOT_WRITES; ++i) {
+        key = bench_rand(&state) % n;
+        hz_map_put(map, &key, &i, NULL);
+    }
+    bench_report("hz_map put (already copied)", n, bench_now() - start, SNAPSHOT_WRITES);
+
+    start = bench_now();
+    hz_map_free(snapshot);
+    bench_report("hz_map free snapshot", n, bench_now() - start, 1);
+
+    // Done last, since freeing the copy leaves malloc() with a lot of
+    // consolidation work that would be charged to whatever runs next
+    start = bench_now();
+    hz_map *copy = hz_map_copy(map);
+    bench_report("hz_map copy", n, bench_now() - start, 1);
+    hz_map_free(copy);
+    hz_map_free(map);
+}
+
+void
+bench_map_snapshot(size_t max_entries)
+{
+    printf("== map_snapshot: deep copy vs. copy-on-write snapshot ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_snapshot_size(n);
+    }
+}
+
+/**
+ * Large value type used by the iteration benchmark, so that the cost
+ * of copying values out of the map is visible.
+ */
+typedef struct
+{
+    uint64_t id;
+    char payload[248];
+} bench_big_value;
+
+static bool
+bench_sum_ids_visit(const void *key, const void *value, void *ctx)
+{
+    (void)key;
+    *(uint64_t *)ctx += ((const bench_big_value *)value)->id;
+    return true;
+}
+
+static void
+bench_map_iterate_size(size_t n)
+{
+    hz_map *map = hz_map_new(sizeof(uint64_t), sizeof(bench_big_value), u64_hash, u64_cmp);
+    bench_big_value value = {0};
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = i;
+        value.id = i;
+        hz_map_put(map, &key, &value, NULL);
+    }
+
+    uint64_t sum = 0;
+    double start = bench_now();
+    hz_map_iterator *it = hz_map_iterator_new(map);
+    while (hz_map_iterator_next(it, NULL, &value)) {
+        sum += value.id;
+    }
+    hz_map_iterator_free(it);
+    bench_report("hz_map iterator", n, bench_now() - start, n);
+
+    start = bench_now();
+    hz_map_cursor cursor;
+    hz_map_cursor_init(&cursor, map);
+    const void *ref;
+    while (hz_map_cursor_next(&cursor, NULL, &ref)) {
+        sum += ((const bench_big_value *)ref)->id;
+    }
+    bench_report("hz_map cursor", n, bench_now() - start, n);
+
+    start = bench_now();
+    hz_map_for_each(map, bench_sum_ids_visit, &sum);
+    bench_report("hz_map for_each", n, bench_now() - start, n);
+
+    bench_sink += sum;
+    hz_map_free(map);
+}
+
+void
+bench_map_iterate(size_t max_entries)
+{
+    printf("== map_iterate: copying iterator vs. cursor vs. for_each ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_iterate_size(n);
+    }
+}
+
+/**
+ * Number of keys looked up per hz_map_get_many() call.
+ */
+#define GET_MANY_BATCH 1024
+
+static void
+bench_map_get_many_size(size_t n)
+{
+    hz_map *map = bench_map_new(NULL);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = i;
+        hz_map_put(map, &key, &i, NULL);
+    }
+
+    // Generate the keys up front so that we only measure the lookups
+    uint64_t keys[GET_MANY_BATCH];
+    uint64_t values[GET_MANY_BATCH];
+    uint64_t state = 1;
+    size_t rounds = HASH_LOOKUP_OPS / GET_MANY_BATCH;
+    size_t found = 0;
+    double single = 0;
+    double batched = 0;
+    for (size_t r = 0; r < rounds; ++r) {
+        // Use fresh keys for each run, so that the second run doesn't
+        // benefit from entries cached by the first one
+        for (size_t i = 0; i < GET_MANY_BATCH; ++i) {
+            keys[i] = bench_rand(&state) % n;
+        }
+        double start = bench_now();
+        for (size_t i = 0; i < GET_MANY_BATCH; ++i) {
+            found += hz_map_get(map, &keys[i], &values[i]);
+        }
+        single += bench_now() - start;
+
+        for (size_t i = 0; i < GET_MANY_BATCH; ++i) {
+            keys[i] = bench_rand(&state) % n;
+        }
+        start = bench_now();
+        found += hz_map_get_many(map, keys, GET_MANY_BATCH, values, NULL);
+        batched += bench_now() - start;
+    }
+    bench_report("hz_map get (loop)", n, single, rounds * GET_MANY_BATCH);
+    bench_report("hz_map get_many", n, batched, rounds * GET_MANY_BATCH);
+    bench_sink += found;
+    hz_map_free(map);
+}
+
+void
+bench_map_get_many(size_t max_entries)
+{
+    printf("== map_get_many: single-key loop vs. batched lookups ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_get_many_size(n);
+    }
+}
+
+void
+bench_map_hash(size_t max_entries)
+{
+    printf("== map_hash: integer keys with an identity hash function ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_hash_keys(n, 1);
+        bench_map_hash_keys(n, 1024);
+    }
+}
+
+/**
+ * Length of the keys used by the string benchmark, including the
+ * NUL terminator.
+ */
+#define STRING_KEY_SIZE 32
+
+static size_t
+bench_str_hash(const void *key)
+{
+    // FNV-1a, a typical choice for hashing C strings
+    const unsigned char *str = *(const unsigned char *const *)key;
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+    while (*str != '\0') {
+        h = (h ^ *str++) * UINT64_C(0x100000001b3);
+    }
+    return (size_t)h;
+}
+
+static int
+bench_str_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void
+bench_map_string_size(size_t n)
+{
+    // Keys share a long prefix, like most real-world string keys. The
+    // lookup keys are separate copies, so that the char * map can't
+    // get lucky by comparing a string with itself.
+    char *keys = malloc(n * STRING_KEY_SIZE);
+    char *lookups = malloc(n * STRING_KEY_SIZE);
+    char **key_ptrs = malloc(n * sizeof(char *));
+    uint64_t state = 1;
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(&keys[i * STRING_KEY_SIZE], STRING_KEY_SIZE, "session/%016llx",
+            (unsigned long long)bench_rand(&state));
+        key_ptrs[i] = &keys[i * STRING_KEY_SIZE];
+    }
+    for (size_t i = 0; i < n; ++i) {
+        memcpy(&lookups[i * STRING_KEY_SIZE], key_ptrs[bench_rand(&state) % n], STRING_KEY_SIZE);
+    }
+
+    hz_map *map = hz_map_new(sizeof(char *), sizeof(uint64_t), bench_str_hash, bench_str_cmp);
+    double start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_put(map, &key_ptrs[i], &i, NULL);
+    }
+    bench_report("hz_map put (char * keys)", n, bench_now() - start, n);
+    size_t found = 0;
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        const char *key = &lookups[i * STRING_KEY_SIZE];
+        found += hz_map_get(map, &key, NULL);
+    }
+    bench_report("hz_map get (char * keys)", n, bench_now() - start, n);
+    hz_map_free(map);
+
+    map = hz_map_new_string(sizeof(uint64_t), NULL);
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_put(map, key_ptrs[i], &i, NULL);
+    }
+    bench_report("hz_map put (string keys)", n, bench_now() - start, n);
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        found += hz_map_get(map, &lookups[i * STRING_KEY_SIZE], NULL);
+    }
+    bench_report("hz_map get (string keys)", n, bench_now() - start, n);
+    hz_map_free(map);
+
+    bench_sink += found;
+    free(key_ptrs);
+    free(lookups);
+    free(keys);
+}
+
+void
+bench_map_string(size_t max_entries)
+{
+    printf("== map_string: char * keys with strcmp vs. string-keyed map ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_string_size(n);
+    }
+}
+
+static void
+bench_map_image_size(size_t n)
+{
+    // Same keys as the string benchmark, loaded the slow way (one put
+    // per key, as when parsing a file) and then served from an image
+    char *keys = malloc(n * STRING_KEY_SIZE);
+    uint64_t state = 1;
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(&keys[i * STRING_KEY_SIZE], STRING_KEY_SIZE, "session/%016llx",
+            (unsigned long long)bench_rand(&state));
+    }
+
+    hz_map *map = hz_map_new_string(sizeof(uint64_t), NULL);
+    double start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_put(map, &keys[i * STRING_KEY_SIZE], &i, NULL);
+    }
+    bench_report("hz_map load by put", n, bench_now() - start, 1);
+
+    size_t size = hz_map_serialized_size(map);
+    void *image = malloc(size);
+    start = bench_now();
+    hz_map_serialize(map, image, size);
+    bench_report("hz_map serialize", n, bench_now() - start, 1);
+
+    start = bench_now();
+    hz_map_view *view = hz_map_view_open_string(image, size, sizeof(uint64_t));
+    bench_report("hz_map_view open", n, bench_now() - start, 1);
+
+    size_t found = 0;
+    state = 2;
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        found += hz_map_get(map, &keys[(bench_rand(&state) % n) * STRING_KEY_SIZE], NULL);
+    }
+    bench_report("hz_map get", n, bench_now() - start, n);
+
+    state = 2;
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        found += hz_map_view_get(view, &keys[(bench_rand(&state) % n) * STRING_KEY_SIZE], NULL);
+    }
+    bench_report("hz_map_view get", n, bench_now() - start, n);
+
+    bench_sink += found;
+    hz_map_view_free(view);
+    free(image);
+    hz_map_free(map);
+    free(keys);
+}
+
+void
+bench_map_image(size_t max_entries)
+{
+    printf("== map_image: rebuilding a string-keyed map vs. opening its image ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_image_size(n);
+    }
+}
+
+/**
+ * Number of lookups per measurement in the Bloom filter benchmark, and
+ * how many of them (out of 10) are for keys that are not in the map.
+ */
+#define BLOOM_LOOKUP_OPS 2000000
+#define BLOOM_MISSES_PER_10 9
+
+static void
+bench_map_bloom_size(size_t n)
+{
+    // Keys in the map are even, and the keys that miss are odd
+    uint64_t *lookups = malloc(BLOOM_LOOKUP_OPS * sizeof(uint64_t));
+    uint64_t state = 1;
+    for (size_t i = 0; i < BLOOM_LOOKUP_OPS; ++i) {
+        uint64_t r = bench_rand(&state);
+        lookups[i] = (r % n) * 2 + (r % 10 < BLOOM_MISSES_PER_10);
+    }
+
+    for (int bloom = 0; bloom <= 1; ++bloom) {
+        hz_map_options options;
+        hz_map_options_init(&options);
+        options.bloom_filter = bloom;
+        hz_map *map = bench_map_new(&options);
+        double start = bench_now();
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t key = i * 2;
+            hz_map_put(map, &key, &i, NULL);
+        }
+        bench_report(bloom ? "hz_map put (bloom filter)" : "hz_map put", n, bench_now() - start, n);
+
+        size_t found = 0;
+        start = bench_now();
+        for (size_t i = 0; i < BLOOM_LOOKUP_OPS; ++i) {
+            found += hz_map_get(map, &lookups[i], NULL);
+        }
+        bench_report(
+            bloom ? "hz_map get, 90% misses (bloom filter)" : "hz_map get, 90% misses",
+            n,
+            bench_now() - start,
+            BLOOM_LOOKUP_OPS);
+        bench_sink += found;
+        hz_map_free(map);
+    }
+    free(lookups);
+}
+
+void
+bench_map_bloom(size_t max_entries)
+{
+    printf("== map_bloom: mostly-missing lookups without vs. with a Bloom filter ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_bloom_size(n);
+    }
+}
+
+/**
+ * Largest map size that the collision benchmark runs without bucket
+ * trees, since every operation on it walks the whole map.
+ */
+#define COLLISION_MAX_CHAINED 10000
+
+static size_t
+bench_constant_hash(const void *key)
+{
+    (void)key;
+    return 0;
+}
+
+static void
+bench_map_collision_run(const char *name, size_t n, hz_map_hash_func hash_func, hz_map_cmp_func order_func)
+{
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.order_func = order_func;
+    hz_map *map = hz_map_new_with_options(
+        sizeof(uint64_t), sizeof(uint64_t), hash_func, u64_cmp, &options);
+    char label[64];
+    double start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = i;
+        hz_map_put(map, &key, &i, NULL);
+    }
+    snprintf(label, sizeof(label), "hz_map put (%s)", name);
+    bench_report(label, n, bench_now() - start, n);
+
+    uint64_t state = 1;
+    size_t found = 0;
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = bench_rand(&state) % n;
+        found += hz_map_get(map, &key, NULL);
+    }
+    snprintf(label, sizeof(label), "hz_map get (%s)", name);
+    bench_report(label, n, bench_now() - start, n);
+    bench_sink += found;
+    hz_map_free(map);
+}
+
+void
+bench_map_collision(size_t max_entries)
+{
+    printf("== map_collision: every key with the same hash, chains vs. bucket trees ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_collision_run("good hash", n, u64_hash, NULL);
+        if (n <= COLLISION_MAX_CHAINED) {
+            bench_map_collision_run("same hash, chain", n, bench_constant_hash, NULL);
+        }
+        bench_map_collision_run("same hash, tree", n, bench_constant_hash, u64_order);
+    }
+}
+
+/**
+ * Number of times the clear benchmark refills the map.
+ */
+#define CLEAR_ROUNDS 10
+
+static void
+bench_map_clear_run(size_t n, bool use_pool, bool keep_capacity)
+{
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.use_pool = use_pool;
+    hz_map *map = bench_map_new(&options);
+    char label[64];
+    double start = bench_now();
+    for (size_t round = 0; round < CLEAR_ROUNDS; ++round) {
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t key = round * n + i;
+            hz_map_put(map, &key, &i, NULL);
+        }
+        if (keep_capacity) {
+            hz_map_clear_keep_capacity(map);
+        } else {
+            hz_map_clear(map);
+        }
+    }
+    snprintf(
+        label,
+        sizeof(label),
+        "hz_map fill + %s%s",
+        keep_capacity ? "clear_keep_capacity" : "clear",
+        use_pool ? " (pool)" : "");
+    bench_report(label, n, bench_now() - start, n * CLEAR_ROUNDS);
+    hz_map_free(map);
+}
+
+void
+bench_map_clear(size_t max_entries)
+{
+    printf("== map_clear: refilling a map after hz_map_clear() vs. hz_map_clear_keep_capacity() ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_map_clear_run(n, false, false);
+        bench_map_clear_run(n, false, true);
+        bench_map_clear_run(n, true, false);
+        bench_map_clear_run(n, true, true);
+    }
+}
+
+/**
+ * Number of partitions handed out to each thread by the parallel scan
+ * benchmark, so that a thread that finishes early can take over work.
+ */
+#define PARTITIONS_PER_THREAD 8
+
+typedef struct
+{
+    const hz_map *map;
+    pthread_mutex_t *lock;
+    size_t *next_partition;
+    size_t partition_count;
+    uint64_t sum;
+
+    // Keep each worker's result off its neighbors' cache lines
+    char padding[HZ_CACHE_LINE_SIZE];
+} bench_scan_worker;
+
+static void *
+bench_scan_worker_run(void *arg)
+{
+    bench_scan_worker *worker = arg;
+    uint64_t sum = 0;
+    for (;;) {
+        pthread_mutex_lock(worker->lock);
+        size_t index = (*worker->next_partition)++;
+        pthread_mutex_unlock(worker->lock);
+        if (index >= worker->partition_count) {
+            break;
+        }
+        hz_map_cursor cursor;
+        hz_map_cursor_init_partition(&cursor, worker->map, index, worker->partition_count);
+        const void *value;
+        while (hz_map_cursor_next(&cursor, NULL, &value)) {
+            sum += *(const uint64_t *)value;
+        }
+    }
+    worker->sum = sum;
+    return NULL;
+}
+
+static void
+bench_map_partition_run(const hz_map *map, size_t n, size_t threads)
+{
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    bench_scan_worker *workers = malloc(threads * sizeof(bench_scan_worker));
+    pthread_mutex_t lock;
+    pthread_mutex_init(&lock, NULL);
+    size_t next_partition = 0;
+    for (size_t i = 0; i < threads; ++i) {
+        workers[i].map = map;
+        workers[i].lock = &lock;
+        workers[i].next_partition = &next_partition;
+        workers[i].partition_count = threads * PARTITIONS_PER_THREAD;
+        workers[i].sum = 0;
+    }
+
+    double start = bench_now();
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_create(&tids[i], NULL, bench_scan_worker_run, &workers[i]);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+        bench_sink += workers[i].sum;
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "hz_map partitioned scan, %zu thread(s)", threads);
+    bench_report(label, n, bench_now() - start, n);
+
+    pthread_mutex_destroy(&lock);
+    free(tids);
+    free(workers);
+}
+
+void
+bench_map_partition(size_t max_entries)
+{
+    printf("== map_partition: full scans split into partitions across threads ==\n");
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = cores > 0 ? (size_t)cores : 1;
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        hz_map *map = bench_map_new(NULL);
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t key = i;
+            hz_map_put(map, &key, &i, NULL);
+        }
+        for (size_t threads = 1; ; threads *= 2) {
+            if (threads > max_threads) {
+                threads = max_threads;
+            }
+            bench_map_partition_run(map, n, threads);
+            if (threads == max_threads) {
+                break;
+            }
+        }
+        hz_map_free(map);
+    }
+}
+
+/**
+ * Number of source maps in the merge benchmark. Each one holds n keys,
+ * half of which are shared with the next source.
+ */
+#define MERGE_SOURCES 8
+
+static void
+bench_add_u64_combine(const void *key, void *dst_value, const void *src_value, void *ctx)
+{
+    (void)key;
+    (void)ctx;
+    *(uint64_t *)dst_value += *(const uint64_t *)src_value;
+}
+
+typedef struct
+{
+    hz_map *dst;
+    const hz_map *const *srcs;
+    size_t shard;
+    size_t shard_count;
+} bench_merge_worker;
+
+static void *
+bench_merge_worker_run(void *arg)
+{
+    bench_merge_worker *worker = arg;
+    hz_map_merge_shard(
+        worker->dst,
+        worker->srcs,
+        MERGE_SOURCES,
+        worker->shard,
+        worker->shard_count,
+        bench_add_u64_combine,
+        NULL);
+    return NULL;
+}
+
+static void
+bench_map_merge_sharded(const hz_map *const *srcs, size_t n, size_t total, size_t threads)
+{
+    pthread_t *tids = malloc(threads * sizeof(pthread_t));
+    bench_merge_worker *workers = malloc(threads * sizeof(bench_merge_worker));
+    for (size_t i = 0; i < threads; ++i) {
+        workers[i].dst = bench_map_new(NULL);
+        workers[i].srcs = srcs;
+        workers[i].shard = i;
+        workers[i].shard_count = threads;
+    }
+
+    double start = bench_now();
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_create(&tids[i], NULL, bench_merge_worker_run, &workers[i]);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "hz_map_merge_shard, %zu thread(s)", threads);
+    bench_report(label, n, bench_now() - start, total);
+
+    for (size_t i = 0; i < threads; ++i) {
+        bench_sink += hz_map_size(workers[i].dst);
+        hz_map_free(workers[i].dst);
+    }
+    free(tids);
+    free(workers);
+}
+
+void
+bench_map_merge(size_t max_entries)
+{
+    printf("== map_merge: combining %d maps with overlapping keys ==\n", MERGE_SOURCES);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = cores > 0 ? (size_t)cores : 1;
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        hz_map *srcs[MERGE_SOURCES];
+        for (size_t i = 0; i < MERGE_SOURCES; ++i) {
+            srcs[i] = bench_map_new(NULL);
+            for (size_t j = 0; j < n; ++j) {
+                uint64_t key = i * (n / 2) + j;
+                hz_map_put(srcs[i], &key, &j, NULL);
+            }
+        }
+        size_t total = n * MERGE_SOURCES;
+
+        hz_map *dst = bench_map_new(NULL);
+        double start = bench_now();
+        for (size_t i = 0; i < MERGE_SOURCES; ++i) {
+            hz_map_cursor cursor;
+            hz_map_cursor_init(&cursor, srcs[i]);
+            const void *key;
+            const void *value;
+            while (hz_map_cursor_next(&cursor, &key, &value)) {
+                bool inserted;
+                uint64_t *stored = hz_map_emplace(dst, key, &inserted);
+                *stored = (inserted ? 0 : *stored) + *(const uint64_t *)value;
+            }
+        }
+        bench_report("cursor + hz_map_emplace", n, bench_now() - start, total);
+        hz_map_free(dst);
+
+        dst = bench_map_new(NULL);
+        start = bench_now();
+        for (size_t i = 0; i < MERGE_SOURCES; ++i) {
+            hz_map_merge(dst, srcs[i], bench_add_u64_combine, NULL);
+        }
+        bench_report("hz_map_merge", n, bench_now() - start, total);
+        bench_sink += hz_map_size(dst);
+        hz_map_free(dst);
+
+        for (size_t threads = 1; ; threads *= 2) {
+            if (threads > max_threads) {
+                threads = max_threads;
+            }
+            bench_map_merge_sharded((const hz_map *const *)srcs, n, total, threads);
+            if (threads == max_threads) {
+                break;
+            }
+        }
+        for (size_t i = 0; i < MERGE_SOURCES; ++i) {
+            hz_map_free(srcs[i]);
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#include "bench.h"
+#include "hazuki/map.h"
+#include "hazuki/perfect_map.h"
+#include "hazuki/vector.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Number of lookups performed for each measurement.
+ */
+#define LOOKUP_OPS 2000000
+
+/**
+ * Estimates the memory used by an hz_map with n entries of u64 keys and
+ * values: a 32-byte entry plus malloc()'s 16 bytes of overhead, and an
+ * 8-byte bucket pointer for every bucket (with 1 to 2 buckets for every
+ * 0.75 entries).
+ */
+static double
+bench_map_bytes_per_entry(size_t n)
+{
+    size_t buckets = 8;
+    while (n > buckets - buckets / 4) {
+        buckets *= 2;
+    }
+    return 48.0 + 8.0 * (double)buckets / (double)n;
+}
+
+static void
+bench_perfect_map_size(size_t n)
+{
+    hz_vector *keys = hz_vector_new(sizeof(uint64_t));
+    hz_vector *values = hz_vector_new(sizeof(uint64_t));
+    uint64_t state = 1;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = bench_rand(&state);
+        hz_vector_append(keys, &key);
+        hz_vector_append(values, &i);
+    }
+    const uint64_t *key_data = hz_vector_data(keys);
+
+    double start = bench_now();
+    hz_map *map = hz_map_new(sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp);
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_put(map, &key_data[i], &i, NULL);
+    }
+    bench_report("hz_map build", n, bench_now() - start, n);
+
+    start = bench_now();
+    hz_perfect_map *perfect = hz_perfect_map_new(
+        sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp, keys, values);
+    bench_report("hz_perfect_map build", n, bench_now() - start, n);
+
+    size_t sum = 0;
+    state = 2;
+    start = bench_now();
+    for (size_t i = 0; i < LOOKUP_OPS; ++i) {
+        uint64_t value = 0;
+        hz_map_get(map, &key_data[bench_rand(&state) % n], &value);
+        sum += value;
+    }
+    bench_report("hz_map get (hit)", n, bench_now() - start, LOOKUP_OPS);
+
+    state = 2;
+    start = bench_now();
+    for (size_t i = 0; i < LOOKUP_OPS; ++i) {
+        uint64_t value = 0;
+        hz_perfect_map_get(perfect, &key_data[bench_rand(&state) % n], &value);
+        sum += value;
+    }
+    bench_report("hz_perfect_map get (hit)", n, bench_now() - start, LOOKUP_OPS);
+
+    state = 3;
+    start = bench_now();
+    for (size_t i = 0; i < LOOKUP_OPS; ++i) {
+        uint64_t key = bench_rand(&state);
+        sum += hz_map_get(map, &key, NULL);
+    }
+    bench_report("hz_map get (miss)", n, bench_now() - start, LOOKUP_OPS);
+
+    state = 3;
+    start = bench_now();
+    for (size_t i = 0; i < LOOKUP_OPS; ++i) {
+        uint64_t key = bench_rand(&state);
+        sum += hz_perfect_map_get(perfect, &key, NULL);
+    }
+    bench_report("hz_perfect_map get (miss)", n, bench_now() - start, LOOKUP_OPS);
+
+    printf("    bytes per entry: hz_map ~%.1f (estimated), hz_perfect_map %.1f\n",
+        bench_map_bytes_per_entry(n),
+        (double)hz_perfect_map_memory_usage(perfect) / (double)n);
+
+    bench_sink += sum;
+    hz_perfect_map_free(perfect);
+    hz_map_free(map);
+    hz_vector_free(values);
+    hz_vector_free(keys);
+}
+
+void
+bench_perfect_map(size_t max_entries)
+{
+    printf("== perfect_map: hz_map vs. hz_perfect_map ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_perfect_map_size(n);
+    }
+}
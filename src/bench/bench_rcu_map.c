@@ -0,0 +1,148 @@
+#define _POSIX_C_SOURCE 200112L
+#include "bench.h"
+#include "hazuki/map.h"
+#include "hazuki/rcu_map.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Total number of lookups performed for each measurement,
+ * split evenly between the reader threads.
+ */
+#define READ_OPS 4000000
+
+/**
+ * The two maps being compared: an hz_map behind a single rwlock (what a
+ * read-mostly table looks like without this library's help), and an
+ * hz_rcu_map.
+ */
+typedef struct
+{
+    bool rcu;
+    hz_map *map;
+    pthread_rwlock_t lock;
+    hz_rcu_map *rcu_map;
+    size_t n;
+    int stop;
+} bench_table;
+
+typedef struct
+{
+    bench_table *table;
+    size_t ops;
+    uint64_t seed;
+    size_t found;
+} bench_reader;
+
+static void *
+bench_reader_run(void *arg)
+{
+    bench_reader *reader = arg;
+    bench_table *table = reader->table;
+    hz_rcu_reader *rcu_reader = table->rcu ? hz_rcu_reader_new(table->rcu_map) : NULL;
+    uint64_t state = reader->seed;
+    size_t found = 0;
+    for (size_t i = 0; i < reader->ops; ++i) {
+        uint64_t key = bench_rand(&state) % table->n;
+        if (table->rcu) {
+            found += hz_rcu_map_get(rcu_reader, &key, NULL);
+        } else {
+            pthread_rwlock_rdlock(&table->lock);
+            found += hz_map_get(table->map, &key, NULL);
+            pthread_rwlock_unlock(&table->lock);
+        }
+    }
+    hz_rcu_reader_free(rcu_reader);
+    reader->found = found;
+    return NULL;
+}
+
+static void *
+bench_writer_run(void *arg)
+{
+    // Keep updating random entries until the readers are done
+    bench_table *table = arg;
+    uint64_t state = 0;
+    while (!__atomic_load_n(&table->stop, __ATOMIC_RELAXED)) {
+        uint64_t r = bench_rand(&state);
+        uint64_t key = r % table->n;
+        if (table->rcu) {
+            hz_rcu_map_put(table->rcu_map, &key, &r, NULL);
+        } else {
+            pthread_rwlock_wrlock(&table->lock);
+            hz_map_put(table->map, &key, &r, NULL);
+            pthread_rwlock_unlock(&table->lock);
+        }
+    }
+    return NULL;
+}
+
+static void
+bench_rcu_map_run(bool rcu, size_t n, size_t threads)
+{
+    bench_table table;
+    table.rcu = rcu;
+    table.map = hz_map_new(sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp);
+    pthread_rwlock_init(&table.lock, NULL);
+    table.rcu_map = hz_rcu_map_new(sizeof(uint64_t), sizeof(uint64_t), u64_hash, u64_cmp);
+    table.n = n;
+    table.stop = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        hz_map_put(table.map, &i, &i, NULL);
+        hz_rcu_map_put(table.rcu_map, &i, &i, NULL);
+    }
+
+    bench_reader *readers = calloc(threads, sizeof(bench_reader));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    pthread_t writer;
+    for (size_t i = 0; i < threads; ++i) {
+        readers[i].table = &table;
+        readers[i].ops = READ_OPS / threads;
+        readers[i].seed = i + 1;
+    }
+
+    pthread_create(&writer, NULL, bench_writer_run, &table);
+    double start = bench_now();
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_create(&tids[i], NULL, bench_reader_run, &readers[i]);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_join(tids[i], NULL);
+        bench_sink += readers[i].found;
+    }
+    double elapsed = bench_now() - start;
+    __atomic_store_n(&table.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(writer, NULL);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s get, %zu reader(s)", rcu ? "hz_rcu_map" : "rwlock hz_map", threads);
+    bench_report(name, n, elapsed, readers[0].ops * threads);
+
+    free(tids);
+    free(readers);
+    hz_map_free(table.map);
+    pthread_rwlock_destroy(&table.lock);
+    hz_rcu_map_free(table.rcu_map);
+}
+
+void
+bench_rcu_map(size_t max_entries)
+{
+    printf("== rcu_map: rwlock vs. lock-free reads, with a concurrent writer ==\n");
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = cores > 0 ? (size_t)cores : 1;
+    for (size_t threads = 1; ; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+        bench_rcu_map_run(false, max_entries, threads);
+        bench_rcu_map_run(true, max_entries, threads);
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
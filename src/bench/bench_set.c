@@ -0,0 +1,101 @@
+#include "bench.h"
+#include "hazuki/map.h"
+#include "hazuki/set.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Ratio between the sizes of the large and small set in the set
+ * operation benchmarks.
+ */
+#define SET_SIZE_RATIO 100
+
+static void
+bench_set_vs_map(size_t n)
+{
+    // The old workaround: a map with a dummy 1-byte value
+    char dummy = 0;
+    hz_map *map = hz_map_new(sizeof(uint64_t), sizeof(char), u64_hash, u64_cmp);
+    double start = bench_now();
+    for (uint64_t i = 0; i < n; ++i) {
+        hz_map_put(map, &i, &dummy, NULL);
+    }
+    bench_report("hz_map put (1-byte value)", n, bench_now() - start, n);
+
+    hz_set *set = hz_set_new(sizeof(uint64_t), u64_hash, u64_cmp);
+    start = bench_now();
+    for (uint64_t i = 0; i < n; ++i) {
+        hz_set_add(set, &i);
+    }
+    bench_report("hz_set add", n, bench_now() - start, n);
+
+    size_t found = 0;
+    start = bench_now();
+    for (uint64_t i = 0; i < n; ++i) {
+        found += hz_map_get(map, &i, NULL);
+    }
+    bench_report("hz_map get (1-byte value)", n, bench_now() - start, n);
+
+    start = bench_now();
+    for (uint64_t i = 0; i < n; ++i) {
+        found += hz_set_contains(set, &i);
+    }
+    bench_report("hz_set contains", n, bench_now() - start, n);
+    bench_sink += found;
+    hz_map_free(map);
+    hz_set_free(set);
+}
+
+static void
+bench_set_operations(size_t n)
+{
+    // Half of the small set's keys are in the large set
+    hz_set *large = hz_set_new(sizeof(uint64_t), u64_hash, u64_cmp);
+    hz_set *small = hz_set_new(sizeof(uint64_t), u64_hash, u64_cmp);
+    for (uint64_t i = 0; i < n; ++i) {
+        hz_set_add(large, &i);
+    }
+    for (uint64_t i = 0; i < n / SET_SIZE_RATIO; ++i) {
+        uint64_t key = i * 2 * SET_SIZE_RATIO;
+        hz_set_add(small, &key);
+    }
+
+    double start = bench_now();
+    hz_set *result = hz_set_union(large, small);
+    bench_report("hz_set_union (large, small)", n, bench_now() - start, n);
+    bench_sink += hz_set_size(result);
+    hz_set_free(result);
+
+    start = bench_now();
+    result = hz_set_intersection(large, small);
+    bench_report("hz_set_intersection (large, small)", n, bench_now() - start, n);
+    bench_sink += hz_set_size(result);
+    hz_set_free(result);
+
+    start = bench_now();
+    result = hz_set_difference(small, large);
+    bench_report("hz_set_difference (small, large)", n, bench_now() - start, n);
+    bench_sink += hz_set_size(result);
+    hz_set_free(result);
+
+    start = bench_now();
+    result = hz_set_difference(large, small);
+    bench_report("hz_set_difference (large, small)", n, bench_now() - start, n);
+    bench_sink += hz_set_size(result);
+    hz_set_free(result);
+
+    hz_set_free(large);
+    hz_set_free(small);
+}
+
+void
+bench_set(size_t max_entries)
+{
+    printf("== set: hz_set vs. hz_map with a dummy value, and set operations ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        bench_set_vs_map(n);
+        bench_set_operations(n);
+    }
+}
@@ -0,0 +1,120 @@
+#include "bench.h"
+#include "hazuki/map.h"
+#include "hazuki/typed_map.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Value type for both maps, large enough that copying it with
+ * memcpy() and a runtime size is not free.
+ */
+typedef struct
+{
+    uint64_t a;
+    uint64_t b;
+    uint64_t c;
+} bench_value;
+
+static inline size_t
+u64_hash_typed(const uint64_t *key)
+{
+    return (size_t)*key;
+}
+
+static inline bool
+u64_eq_typed(const uint64_t *a, const uint64_t *b)
+{
+    return *a == *b;
+}
+
+HZ_MAP_DEFINE(bench_u64_map, uint64_t, bench_value, u64_hash_typed, u64_eq_typed)
+
+static void
+bench_typed_map_generic(const uint64_t *keys, size_t n)
+{
+    hz_map *map = hz_map_new(sizeof(uint64_t), sizeof(bench_value), u64_hash, u64_cmp);
+    bench_value value = { 1, 2, 3 };
+    double start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_put(map, &keys[i], &value, NULL);
+    }
+    bench_report("hz_map put", n, bench_now() - start, n);
+
+    size_t sum = 0;
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_get(map, &keys[i], &value);
+        sum += value.a;
+    }
+    bench_report("hz_map get (hit)", n, bench_now() - start, n);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = ~keys[i];
+        sum += hz_map_get(map, &key, NULL);
+    }
+    bench_report("hz_map get (miss)", n, bench_now() - start, n);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_remove(map, &keys[i], NULL);
+    }
+    bench_report("hz_map remove", n, bench_now() - start, n);
+    bench_sink += sum;
+    hz_map_free(map);
+}
+
+static void
+bench_typed_map_typed(const uint64_t *keys, size_t n)
+{
+    bench_u64_map *map = bench_u64_map_new();
+    bench_value value = { 1, 2, 3 };
+    double start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        bench_u64_map_put(map, &keys[i], &value, NULL);
+    }
+    bench_report("HZ_MAP_DEFINE put", n, bench_now() - start, n);
+
+    size_t sum = 0;
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        bench_u64_map_get(map, &keys[i], &value);
+        sum += value.a;
+    }
+    bench_report("HZ_MAP_DEFINE get (hit)", n, bench_now() - start, n);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = ~keys[i];
+        sum += bench_u64_map_get(map, &key, NULL);
+    }
+    bench_report("HZ_MAP_DEFINE get (miss)", n, bench_now() - start, n);
+
+    start = bench_now();
+    for (size_t i = 0; i < n; ++i) {
+        bench_u64_map_remove(map, &keys[i], NULL);
+    }
+    bench_report("HZ_MAP_DEFINE remove", n, bench_now() - start, n);
+    bench_sink += sum;
+    bench_u64_map_free(map);
+}
+
+void
+bench_typed_map(size_t max_entries)
+{
+    printf("== typed_map: generic hz_map vs. HZ_MAP_DEFINE ==\n");
+    for (size_t n = 1000; n <= max_entries; n *= 10) {
+        // Keys are random so that lookups in both maps miss the
+        // cache the same way; misses look up the complemented keys
+        uint64_t *keys = malloc(n * sizeof(uint64_t));
+        uint64_t state = 1;
+        for (size_t i = 0; i < n; ++i) {
+            keys[i] = bench_rand(&state) >> 1;
+        }
+        bench_typed_map_generic(keys, n);
+        bench_typed_map_typed(keys, n);
+        free(keys);
+    }
+}
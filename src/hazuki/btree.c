@@ -0,0 +1,746 @@
+#include "hazuki/btree.h"
+#include "hazuki/utils.h"
+#include "hazuki/vector.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Target size of the key array in each node, in bytes. Searching a node
+ * is a binary search over its keys, so this is a few cache lines: wide
+ * enough to keep the tree shallow, but small enough that shifting keys
+ * around on insertion is cheap.
+ */
+#define NODE_KEY_BYTES 256
+
+/**
+ * Minimum number of keys per node, for trees with very large keys.
+ * Must be >= 4, so that a node that is at least half full always has
+ * a key to spare when it isn't.
+ */
+#define MIN_NODE_KEYS 4
+
+/**
+ * Hints to the processor that the given address will be read soon.
+ * This has no effect on program behavior.
+ */
+#if defined(__GNUC__)
+#define hz_btree_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define hz_btree_prefetch(addr) ((void)(addr))
+#endif
+
+/**
+ * Node header. Every node holds up to capacity keys in sorted order, plus
+ * room for one more so that an insertion can overflow the node before it
+ * is split. Leaves store a value for each key, and are linked together in
+ * key order for iteration. Inner nodes store count + 1 children; child i
+ * holds the keys that are >= key i - 1 and < key i.
+ */
+typedef struct hz_btree_node
+{
+    size_t count;
+    bool leaf;
+    struct hz_btree_node *next;
+} hz_btree_node;
+
+struct hz_btree
+{
+    size_t key_size;
+    size_t value_size;
+    hz_btree_cmp_func cmp_func;
+    size_t capacity;
+    size_t min_count;
+    size_t keys_offset;
+    size_t values_offset;
+    size_t children_offset;
+    size_t leaf_size;
+    size_t inner_size;
+    hz_btree_node *root;
+    hz_btree_node *first;
+    size_t size;
+    void *separator;
+    unsigned int mod_count;
+};
+
+static void
+hz_btree_touch(hz_btree *tree)
+{
+    tree->mod_count++;
+}
+
+static void
+hz_btree_init_layout(hz_btree *tree)
+{
+    // Nodes are laid out as [header][keys][values or children]. Each
+    // array has one extra slot (and inner nodes one extra child) for
+    // the entry that overflows a full node just before it is split.
+    tree->capacity = hz_max(NODE_KEY_BYTES / tree->key_size, MIN_NODE_KEYS);
+    tree->min_count = tree->capacity / 2;
+    size_t slots = tree->capacity + 1;
+    if (tree->key_size > SIZE_MAX / 4 / slots || tree->value_size > SIZE_MAX / 4 / slots) {
+        hz_abort("Entry size is too large");
+    }
+    tree->keys_offset = hz_align_up(sizeof(hz_btree_node), HZ_MAX_ALIGN);
+    tree->values_offset = hz_align_up(tree->keys_offset + slots * tree->key_size, HZ_MAX_ALIGN);
+    tree->children_offset = tree->values_offset;
+    tree->leaf_size = tree->values_offset + slots * tree->value_size;
+    tree->inner_size = tree->children_offset + (slots + 1) * sizeof(hz_btree_node *);
+}
+
+static void *
+hz_btree_key_at(const hz_btree *tree, const hz_btree_node *node, size_t index)
+{
+    return (char *)node + tree->keys_offset + index * tree->key_size;
+}
+
+static void *
+hz_btree_value_at(const hz_btree *tree, const hz_btree_node *node, size_t index)
+{
+    return (char *)node + tree->values_offset + index * tree->value_size;
+}
+
+static hz_btree_node **
+hz_btree_children(const hz_btree *tree, const hz_btree_node *node)
+{
+    return (hz_btree_node **)((char *)node + tree->children_offset);
+}
+
+static hz_btree_node *
+hz_btree_node_new(hz_btree *tree, bool leaf)
+{
+    hz_btree_node *node = hz_malloc(1, leaf ? tree->leaf_size : tree->inner_size);
+    node->count = 0;
+    node->leaf = leaf;
+    node->next = NULL;
+    return node;
+}
+
+static void
+hz_btree_node_free(hz_btree *tree, hz_btree_node *node)
+{
+    if (!node->leaf) {
+        hz_btree_node **children = hz_btree_children(tree, node);
+        for (size_t i = 0; i <= node->count; ++i) {
+            hz_btree_node_free(tree, children[i]);
+        }
+    }
+    hz_free(node);
+}
+
+/**
+ * Prefetches every cache line of the node's keys. A binary search over
+ * the keys touches several lines, one after another; prefetching them
+ * all up front overlaps the cache misses instead.
+ */
+static void
+hz_btree_prefetch_keys(const hz_btree *tree, const hz_btree_node *node)
+{
+    const char *keys = (const char *)node + tree->keys_offset;
+    size_t size = node->count * tree->key_size;
+    for (size_t offset = 0; offset < size; offset += HZ_CACHE_LINE_SIZE) {
+        hz_btree_prefetch(keys + offset);
+    }
+}
+
+/**
+ * Gets the index of the first key in the node that is >= the given key,
+ * or the node's count if there is no such key.
+ */
+static size_t
+hz_btree_lower_index(const hz_btree *tree, const hz_btree_node *node, const void *key)
+{
+    size_t lo = 0;
+    size_t hi = node->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tree->cmp_func(hz_btree_key_at(tree, node, mid), key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Gets the index of the first key in the node that is > the given key,
+ * which for inner nodes is the index of the child to descend into.
+ */
+static size_t
+hz_btree_upper_index(const hz_btree *tree, const hz_btree_node *node, const void *key)
+{
+    size_t lo = 0;
+    size_t hi = node->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tree->cmp_func(hz_btree_key_at(tree, node, mid), key) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Finds the leaf that would hold the given key.
+ */
+static hz_btree_node *
+hz_btree_find_leaf(const hz_btree *tree, const void *key)
+{
+    hz_btree_node *node = tree->root;
+    hz_btree_prefetch_keys(tree, node);
+    while (!node->leaf) {
+        node = hz_btree_children(tree, node)[hz_btree_upper_index(tree, node, key)];
+        hz_btree_prefetch_keys(tree, node);
+    }
+    return node;
+}
+
+/**
+ * Moves the entries [from, count) of a leaf to start at index to.
+ */
+static void
+hz_btree_leaf_shift(hz_btree *tree, hz_btree_node *node, size_t from, size_t to)
+{
+    size_t n = node->count - from;
+    memmove(
+        hz_btree_key_at(tree, node, to),
+        hz_btree_key_at(tree, node, from),
+        n * tree->key_size);
+    memmove(
+        hz_btree_value_at(tree, node, to),
+        hz_btree_value_at(tree, node, from),
+        n * tree->value_size);
+}
+
+/**
+ * Moves the keys [from, count) of an inner node to start at index to,
+ * along with the children to the right of each key.
+ */
+static void
+hz_btree_inner_shift(hz_btree *tree, hz_btree_node *node, size_t from, size_t to)
+{
+    size_t n = node->count - from;
+    hz_btree_node **children = hz_btree_children(tree, node);
+    memmove(
+        hz_btree_key_at(tree, node, to),
+        hz_btree_key_at(tree, node, from),
+        n * tree->key_size);
+    memmove(&children[to + 1], &children[from + 1], n * sizeof(hz_btree_node *));
+}
+
+/**
+ * Copies n entries from one leaf to another.
+ */
+static void
+hz_btree_leaf_copy(
+    hz_btree *tree,
+    hz_btree_node *dest,
+    size_t dest_index,
+    const hz_btree_node *src,
+    size_t src_index,
+    size_t n)
+{
+    memcpy(
+        hz_btree_key_at(tree, dest, dest_index),
+        hz_btree_key_at(tree, src, src_index),
+        n * tree->key_size);
+    memcpy(
+        hz_btree_value_at(tree, dest, dest_index),
+        hz_btree_value_at(tree, src, src_index),
+        n * tree->value_size);
+}
+
+/**
+ * Splits an overflowing leaf in half, and returns the new right half.
+ * The smallest key in the right half is written to tree->separator.
+ */
+static hz_btree_node *
+hz_btree_split_leaf(hz_btree *tree, hz_btree_node *node)
+{
+    hz_btree_node *right = hz_btree_node_new(tree, true);
+    size_t left_count = node->count / 2;
+    right->count = node->count - left_count;
+    hz_btree_leaf_copy(tree, right, 0, node, left_count, right->count);
+    node->count = left_count;
+    right->next = node->next;
+    node->next = right;
+    memcpy(tree->separator, hz_btree_key_at(tree, right, 0), tree->key_size);
+    return right;
+}
+
+/**
+ * Splits an overflowing inner node around its middle key, and returns
+ * the new right half. The middle key moves up to the parent, so it is
+ * written to tree->separator.
+ */
+static hz_btree_node *
+hz_btree_split_inner(hz_btree *tree, hz_btree_node *node)
+{
+    hz_btree_node *right = hz_btree_node_new(tree, false);
+    size_t mid = node->count / 2;
+    right->count = node->count - mid - 1;
+    memcpy(
+        hz_btree_key_at(tree, right, 0),
+        hz_btree_key_at(tree, node, mid + 1),
+        right->count * tree->key_size);
+    memcpy(
+        hz_btree_children(tree, right),
+        &hz_btree_children(tree, node)[mid + 1],
+        (right->count + 1) * sizeof(hz_btree_node *));
+    memcpy(tree->separator, hz_btree_key_at(tree, node, mid), tree->key_size);
+    node->count = mid;
+    return right;
+}
+
+/**
+ * Inserts or replaces an entry in the subtree rooted at the given node.
+ * If the node had to be split, returns its new right sibling and writes
+ * the key that separates them to tree->separator; otherwise returns NULL.
+ */
+static hz_btree_node *
+hz_btree_insert(
+    hz_btree *tree,
+    hz_btree_node *node,
+    const void *key,
+    const void *value,
+    void *out_value,
+    bool *replaced)
+{
+    if (node->leaf) {
+        size_t index = hz_btree_lower_index(tree, node, key);
+        if (index < node->count && tree->cmp_func(hz_btree_key_at(tree, node, index), key) == 0) {
+            void *entry_value = hz_btree_value_at(tree, node, index);
+            if (out_value != NULL) {
+                hz_memcpy(out_value, entry_value, 1, tree->value_size);
+            }
+            hz_memcpy(entry_value, value, 1, tree->value_size);
+            *replaced = true;
+            return NULL;
+        }
+        hz_btree_leaf_shift(tree, node, index, index + 1);
+        hz_memcpy(hz_btree_key_at(tree, node, index), key, 1, tree->key_size);
+        hz_memcpy(hz_btree_value_at(tree, node, index), value, 1, tree->value_size);
+        node->count++;
+        return node->count > tree->capacity ? hz_btree_split_leaf(tree, node) : NULL;
+    }
+
+    // If the child splits, its new sibling goes to the right of it,
+    // with the separator between them
+    size_t index = hz_btree_upper_index(tree, node, key);
+    hz_btree_node **children = hz_btree_children(tree, node);
+    hz_btree_node *right = hz_btree_insert(tree, children[index], key, value, out_value, replaced);
+    if (right == NULL) {
+        return NULL;
+    }
+    hz_btree_inner_shift(tree, node, index, index + 1);
+    memcpy(hz_btree_key_at(tree, node, index), tree->separator, tree->key_size);
+    children[index + 1] = right;
+    node->count++;
+    return node->count > tree->capacity ? hz_btree_split_inner(tree, node) : NULL;
+}
+
+/**
+ * Moves the last entry of child index - 1 to the front of child index.
+ */
+static void
+hz_btree_borrow_left(hz_btree *tree, hz_btree_node *parent, size_t index)
+{
+    hz_btree_node **children = hz_btree_children(tree, parent);
+    hz_btree_node *left = children[index - 1];
+    hz_btree_node *child = children[index];
+    void *separator = hz_btree_key_at(tree, parent, index - 1);
+    if (child->leaf) {
+        hz_btree_leaf_shift(tree, child, 0, 1);
+        hz_btree_leaf_copy(tree, child, 0, left, left->count - 1, 1);
+        memcpy(separator, hz_btree_key_at(tree, child, 0), tree->key_size);
+    } else {
+        // The separator moves down into the child, and the left
+        // sibling's last key moves up to replace it
+        hz_btree_node **child_children = hz_btree_children(tree, child);
+        hz_btree_inner_shift(tree, child, 0, 1);
+        child_children[1] = child_children[0];
+        memcpy(hz_btree_key_at(tree, child, 0), separator, tree->key_size);
+        child_children[0] = hz_btree_children(tree, left)[left->count];
+        memcpy(separator, hz_btree_key_at(tree, left, left->count - 1), tree->key_size);
+    }
+    left->count--;
+    child->count++;
+}
+
+/**
+ * Moves the first entry of child index + 1 to the end of child index.
+ */
+static void
+hz_btree_borrow_right(hz_btree *tree, hz_btree_node *parent, size_t index)
+{
+    hz_btree_node **children = hz_btree_children(tree, parent);
+    hz_btree_node *child = children[index];
+    hz_btree_node *right = children[index + 1];
+    void *separator = hz_btree_key_at(tree, parent, index);
+    if (child->leaf) {
+        hz_btree_leaf_copy(tree, child, child->count, right, 0, 1);
+        hz_btree_leaf_shift(tree, right, 1, 0);
+        right->count--;
+        memcpy(separator, hz_btree_key_at(tree, right, 0), tree->key_size);
+    } else {
+        hz_btree_node **right_children = hz_btree_children(tree, right);
+        memcpy(hz_btree_key_at(tree, child, child->count), separator, tree->key_size);
+        hz_btree_children(tree, child)[child->count + 1] = right_children[0];
+        memcpy(separator, hz_btree_key_at(tree, right, 0), tree->key_size);
+        right_children[0] = right_children[1];
+        hz_btree_inner_shift(tree, right, 1, 0);
+        right->count--;
+    }
+    child->count++;
+}
+
+/**
+ * Merges child index + 1 into child index, and removes the separator
+ * between them from the parent.
+ */
+static void
+hz_btree_merge(hz_btree *tree, hz_btree_node *parent, size_t index)
+{
+    hz_btree_node **children = hz_btree_children(tree, parent);
+    hz_btree_node *left = children[index];
+    hz_btree_node *right = children[index + 1];
+    if (left->leaf) {
+        hz_btree_leaf_copy(tree, left, left->count, right, 0, right->count);
+        left->count += right->count;
+        left->next = right->next;
+    } else {
+        // The separator moves down between the two halves
+        memcpy(
+            hz_btree_key_at(tree, left, left->count),
+            hz_btree_key_at(tree, parent, index),
+            tree->key_size);
+        memcpy(
+            hz_btree_key_at(tree, left, left->count + 1),
+            hz_btree_key_at(tree, right, 0),
+            right->count * tree->key_size);
+        memcpy(
+            &hz_btree_children(tree, left)[left->count + 1],
+            hz_btree_children(tree, right),
+            (right->count + 1) * sizeof(hz_btree_node *));
+        left->count += right->count + 1;
+    }
+    hz_free(right);
+    hz_btree_inner_shift(tree, parent, index + 1, index);
+    parent->count--;
+}
+
+/**
+ * Removes an entry from the subtree rooted at the given node, and
+ * rebalances any child that falls below the minimum size as a result.
+ * Returns true if the entry was found.
+ */
+static bool
+hz_btree_delete(hz_btree *tree, hz_btree_node *node, const void *key, void *out_value)
+{
+    if (node->leaf) {
+        size_t index = hz_btree_lower_index(tree, node, key);
+        if (index == node->count || tree->cmp_func(hz_btree_key_at(tree, node, index), key) != 0) {
+            return false;
+        }
+        if (out_value != NULL) {
+            hz_memcpy(out_value, hz_btree_value_at(tree, node, index), 1, tree->value_size);
+        }
+        hz_btree_leaf_shift(tree, node, index + 1, index);
+        node->count--;
+        return true;
+    }
+
+    size_t index = hz_btree_upper_index(tree, node, key);
+    hz_btree_node **children = hz_btree_children(tree, node);
+    if (!hz_btree_delete(tree, children[index], key, out_value)) {
+        return false;
+    }
+
+    // Refill the child from a sibling if one has entries to spare,
+    // otherwise merge it with one. Separators in this node may now be
+    // smaller than the keys they separate, which is fine; they only
+    // need to be > every key to their left and <= every key to their
+    // right.
+    if (children[index]->count < tree->min_count) {
+        if (index > 0 && children[index - 1]->count > tree->min_count) {
+            hz_btree_borrow_left(tree, node, index);
+        } else if (index < node->count && children[index + 1]->count > tree->min_count) {
+            hz_btree_borrow_right(tree, node, index);
+        } else if (index > 0) {
+            hz_btree_merge(tree, node, index - 1);
+        } else {
+            hz_btree_merge(tree, node, index);
+        }
+    }
+    return true;
+}
+
+hz_btree *
+hz_btree_new(size_t key_size, size_t value_size, hz_btree_cmp_func cmp_func)
+{
+    hz_check_null(cmp_func);
+    if (key_size == 0) {
+        hz_abort("Key size is zero");
+    }
+
+    hz_btree *tree = hz_malloc(1, sizeof(hz_btree));
+    tree->key_size = key_size;
+    tree->value_size = value_size;
+    tree->cmp_func = cmp_func;
+    hz_btree_init_layout(tree);
+    tree->root = NULL;
+    tree->first = NULL;
+    tree->size = 0;
+    tree->separator = hz_malloc(1, key_size);
+    tree->mod_count = 0;
+    return tree;
+}
+
+void
+hz_btree_free(hz_btree *tree)
+{
+    if (tree != NULL) {
+        hz_btree_clear(tree);
+        hz_free(tree->separator);
+        hz_free(tree);
+    }
+}
+
+size_t
+hz_btree_size(const hz_btree *tree)
+{
+    hz_check_null(tree);
+    return tree->size;
+}
+
+void
+hz_btree_clear(hz_btree *tree)
+{
+    hz_check_null(tree);
+    hz_btree_touch(tree);
+    if (tree->root != NULL) {
+        hz_btree_node_free(tree, tree->root);
+    }
+    tree->root = NULL;
+    tree->first = NULL;
+    tree->size = 0;
+}
+
+void
+hz_btree_load_sorted(hz_btree *tree, const hz_vector *keys, const hz_vector *values)
+{
+    hz_check_null(tree);
+    hz_check_null(keys);
+    hz_check_null(values);
+    if (tree->size != 0) {
+        hz_abort("Tree is not empty");
+    }
+    size_t n = hz_vector_size(keys);
+    if (hz_vector_size(values) != n) {
+        hz_abort("Have %zu keys but %zu values", n, hz_vector_size(values));
+    }
+    if (n == 0) {
+        return;
+    }
+    const char *key_bytes = hz_vector_data(keys);
+    const char *value_bytes = hz_vector_data(values);
+    for (size_t i = 1; i < n; ++i) {
+        const char *prev = &key_bytes[(i - 1) * tree->key_size];
+        if (tree->cmp_func(prev, prev + tree->key_size) >= 0) {
+            hz_abort("Keys are not in strictly increasing order at index %zu", i);
+        }
+    }
+    hz_btree_touch(tree);
+
+    // Fill the leaves, spreading the entries evenly so that none of
+    // them are less than half full. For each node in the current level,
+    // also track the smallest key in its subtree, which becomes its
+    // separator in the level above.
+    size_t count = (n + tree->capacity - 1) / tree->capacity;
+    hz_btree_node **level = hz_malloc(count, sizeof(hz_btree_node *));
+    const void **lows = hz_malloc(count, sizeof(const void *));
+    size_t start = 0;
+    for (size_t i = 0; i < count; ++i) {
+        hz_btree_node *leaf = hz_btree_node_new(tree, true);
+        leaf->count = n / count + (i < n % count);
+        memcpy(
+            hz_btree_key_at(tree, leaf, 0),
+            &key_bytes[start * tree->key_size],
+            leaf->count * tree->key_size);
+        memcpy(
+            hz_btree_value_at(tree, leaf, 0),
+            &value_bytes[start * tree->value_size],
+            leaf->count * tree->value_size);
+        if (i > 0) {
+            level[i - 1]->next = leaf;
+        }
+        level[i] = leaf;
+        lows[i] = hz_btree_key_at(tree, leaf, 0);
+        start += leaf->count;
+    }
+    tree->first = level[0];
+
+    // Build each level of inner nodes from the one below it, until
+    // there is only one node left
+    while (count > 1) {
+        size_t parent_count = (count + tree->capacity) / (tree->capacity + 1);
+        hz_btree_node **parents = hz_malloc(parent_count, sizeof(hz_btree_node *));
+        const void **parent_lows = hz_malloc(parent_count, sizeof(const void *));
+        start = 0;
+        for (size_t i = 0; i < parent_count; ++i) {
+            size_t child_count = count / parent_count + (i < count % parent_count);
+            hz_btree_node *parent = hz_btree_node_new(tree, false);
+            parent->count = child_count - 1;
+            memcpy(hz_btree_children(tree, parent), &level[start], child_count * sizeof(hz_btree_node *));
+            for (size_t j = 1; j < child_count; ++j) {
+                memcpy(hz_btree_key_at(tree, parent, j - 1), lows[start + j], tree->key_size);
+            }
+            parents[i] = parent;
+            parent_lows[i] = lows[start];
+            start += child_count;
+        }
+        hz_free(level);
+        hz_free(lows);
+        level = parents;
+        lows = parent_lows;
+        count = parent_count;
+    }
+    tree->root = level[0];
+    tree->size = n;
+    hz_free(level);
+    hz_free(lows);
+}
+
+bool
+hz_btree_get(const hz_btree *tree, const void *key, void *out_value)
+{
+    hz_check_null(tree);
+    hz_check_null(key);
+    if (tree->root == NULL) {
+        return false;
+    }
+
+    hz_btree_node *leaf = hz_btree_find_leaf(tree, key);
+    size_t index = hz_btree_lower_index(tree, leaf, key);
+    if (index == leaf->count || tree->cmp_func(hz_btree_key_at(tree, leaf, index), key) != 0) {
+        return false;
+    }
+    if (out_value != NULL) {
+        hz_memcpy(out_value, hz_btree_value_at(tree, leaf, index), 1, tree->value_size);
+    }
+    return true;
+}
+
+bool
+hz_btree_put(hz_btree *tree, const void *key, const void *value, void *out_value)
+{
+    hz_check_null(tree);
+    hz_check_null(key);
+    hz_check_null(value);
+
+    hz_btree_touch(tree);
+    if (tree->root == NULL) {
+        tree->root = hz_btree_node_new(tree, true);
+        tree->first = tree->root;
+    }
+
+    // If the root splits, the tree grows a level
+    bool replaced = false;
+    hz_btree_node *right = hz_btree_insert(tree, tree->root, key, value, out_value, &replaced);
+    if (right != NULL) {
+        hz_btree_node *root = hz_btree_node_new(tree, false);
+        root->count = 1;
+        memcpy(hz_btree_key_at(tree, root, 0), tree->separator, tree->key_size);
+        hz_btree_children(tree, root)[0] = tree->root;
+        hz_btree_children(tree, root)[1] = right;
+        tree->root = root;
+    }
+    if (!replaced) {
+        tree->size++;
+    }
+    return replaced;
+}
+
+bool
+hz_btree_remove(hz_btree *tree, const void *key, void *out_value)
+{
+    hz_check_null(tree);
+    hz_check_null(key);
+    if (tree->root == NULL || !hz_btree_delete(tree, tree->root, key, out_value)) {
+        return false;
+    }
+    hz_btree_touch(tree);
+    tree->size--;
+
+    // The root is allowed to fall below the minimum size. Once it runs
+    // out of keys, the tree shrinks by a level (or becomes empty).
+    hz_btree_node *root = tree->root;
+    if (root->count == 0) {
+        if (root->leaf) {
+            tree->root = NULL;
+            tree->first = NULL;
+        } else {
+            tree->root = hz_btree_children(tree, root)[0];
+        }
+        hz_free(root);
+    }
+    return true;
+}
+
+void
+hz_btree_cursor_init(hz_btree_cursor *cursor, const hz_btree *tree)
+{
+    hz_check_null(cursor);
+    hz_check_null(tree);
+    cursor->tree = tree;
+    cursor->node = tree->first;
+    cursor->index = 0;
+    cursor->mod_count = tree->mod_count;
+}
+
+void
+hz_btree_lower_bound(const hz_btree *tree, const void *key, hz_btree_cursor *cursor)
+{
+    hz_check_null(key);
+    hz_btree_cursor_init(cursor, tree);
+    if (tree->root != NULL) {
+        // If every key in the leaf is smaller, the cursor starts past
+        // its end and moves on to the next leaf
+        cursor->node = hz_btree_find_leaf(tree, key);
+        cursor->index = hz_btree_lower_index(tree, cursor->node, key);
+    }
+}
+
+bool
+hz_btree_cursor_next(hz_btree_cursor *cursor, const void **key, const void **value)
+{
+    hz_check_null(cursor);
+
+    // Make sure we haven't modified the tree between iterations,
+    // since the node may no longer exist
+    const hz_btree *tree = cursor->tree;
+    if (cursor->mod_count != tree->mod_count) {
+        hz_abort("Tree contents modified during iteration");
+    }
+
+    while (cursor->node != NULL && cursor->index == cursor->node->count) {
+        cursor->node = cursor->node->next;
+        cursor->index = 0;
+    }
+    if (cursor->node == NULL) {
+        return false;
+    }
+
+    if (key != NULL) {
+        *key = hz_btree_key_at(tree, cursor->node, cursor->index);
+    }
+    if (value != NULL) {
+        *value = hz_btree_value_at(tree, cursor->node, cursor->index);
+    }
+    cursor->index++;
+    return true;
+}
@@ -0,0 +1,279 @@
+#include "hazuki/cache.h"
+#include "hazuki/map.h"
+#include "hazuki/utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Recency links, stored at the start of each map value. The user's value
+ * follows at value_offset. The list is circular, with the cache's head
+ * node as the sentinel: head.next is the most recently used entry, and
+ * head.prev is the least recently used one.
+ */
+typedef struct hz_cache_node
+{
+    struct hz_cache_node *prev;
+    struct hz_cache_node *next;
+    size_t bytes;
+} hz_cache_node;
+
+struct hz_cache
+{
+    hz_map *map;
+    size_t key_size;
+    size_t value_size;
+    size_t value_offset;
+    size_t max_entries;
+    size_t max_bytes;
+    hz_cache_size_func size_func;
+    hz_cache_evict_func evict_func;
+    void *ctx;
+    hz_cache_node head;
+    size_t bytes;
+    hz_cache_stats stats;
+};
+
+static void *
+hz_cache_node_value(const hz_cache *cache, const hz_cache_node *node)
+{
+    return (char *)node + cache->value_offset;
+}
+
+static void
+hz_cache_unlink(hz_cache_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+static void
+hz_cache_link_front(hz_cache *cache, hz_cache_node *node)
+{
+    node->prev = &cache->head;
+    node->next = cache->head.next;
+    cache->head.next->prev = node;
+    cache->head.next = node;
+}
+
+static void
+hz_cache_reset_list(hz_cache *cache)
+{
+    cache->head.prev = &cache->head;
+    cache->head.next = &cache->head;
+    cache->bytes = 0;
+}
+
+static bool
+hz_cache_over_limit(const hz_cache *cache)
+{
+    return (cache->max_entries != 0 && hz_map_size(cache->map) > cache->max_entries) ||
+        (cache->max_bytes != 0 && cache->bytes > cache->max_bytes);
+}
+
+/**
+ * Unlinks the node and removes its entry from the map.
+ */
+static void
+hz_cache_remove_node(hz_cache *cache, hz_cache_node *node)
+{
+    hz_cache_unlink(node);
+    cache->bytes -= node->bytes;
+    hz_map_remove_ref(cache->map, node, NULL);
+}
+
+void
+hz_cache_options_init(hz_cache_options *options)
+{
+    hz_check_null(options);
+    options->max_entries = 0;
+    options->max_bytes = 0;
+    options->size_func = NULL;
+    options->evict_func = NULL;
+    options->ctx = NULL;
+    hz_map_options_init(&options->map_options);
+    options->map_options.use_pool = true;
+}
+
+hz_cache *
+hz_cache_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_cache_options *options)
+{
+    hz_check_null(hash_func);
+    hz_check_null(cmp_func);
+    hz_check_null(options);
+    if (options->max_entries == 0 && options->max_bytes == 0) {
+        hz_abort("Cache must have a size limit");
+    }
+
+    // Each map value is [links][value], padded to the maximum alignment
+    // so that the map aligns the links (and therefore the value) for
+    // any type
+    hz_cache *cache = hz_malloc(1, sizeof(hz_cache));
+    cache->key_size = key_size;
+    cache->value_size = value_size;
+    cache->value_offset = hz_align_up(sizeof(hz_cache_node), HZ_MAX_ALIGN);
+    if (value_size > SIZE_MAX - cache->value_offset) {
+        hz_abort("Entry size is too large");
+    }
+    size_t slot_size = hz_align_up(cache->value_offset + value_size, HZ_MAX_ALIGN);
+    cache->map = hz_map_new_with_options(
+        key_size, slot_size, hash_func, cmp_func, &options->map_options);
+    cache->max_entries = options->max_entries;
+    cache->max_bytes = options->max_bytes;
+    cache->size_func = options->size_func;
+    cache->evict_func = options->evict_func;
+    cache->ctx = options->ctx;
+    cache->stats.hits = 0;
+    cache->stats.misses = 0;
+    cache->stats.evictions = 0;
+    hz_cache_reset_list(cache);
+    return cache;
+}
+
+void
+hz_cache_free(hz_cache *cache)
+{
+    if (cache != NULL) {
+        hz_map_free(cache->map);
+        hz_free(cache);
+    }
+}
+
+size_t
+hz_cache_size(const hz_cache *cache)
+{
+    hz_check_null(cache);
+    return hz_map_size(cache->map);
+}
+
+size_t
+hz_cache_bytes(const hz_cache *cache)
+{
+    hz_check_null(cache);
+    return cache->bytes;
+}
+
+void
+hz_cache_get_stats(const hz_cache *cache, hz_cache_stats *out_stats)
+{
+    hz_check_null(cache);
+    hz_check_null(out_stats);
+    *out_stats = cache->stats;
+}
+
+void
+hz_cache_clear(hz_cache *cache)
+{
+    hz_check_null(cache);
+    hz_map_clear(cache->map);
+    hz_cache_reset_list(cache);
+}
+
+void *
+hz_cache_get_ref(hz_cache *cache, const void *key)
+{
+    hz_check_null(cache);
+    hz_check_null(key);
+    hz_cache_node *node = hz_map_get_ref(cache->map, key);
+    if (node == NULL) {
+        cache->stats.misses++;
+        return NULL;
+    }
+    cache->stats.hits++;
+    if (cache->head.next != node) {
+        hz_cache_unlink(node);
+        hz_cache_link_front(cache, node);
+    }
+    return hz_cache_node_value(cache, node);
+}
+
+bool
+hz_cache_get(hz_cache *cache, const void *key, void *out_value)
+{
+    void *value = hz_cache_get_ref(cache, key);
+    if (value == NULL) {
+        return false;
+    }
+    if (out_value != NULL) {
+        hz_memcpy(out_value, value, 1, cache->value_size);
+    }
+    return true;
+}
+
+bool
+hz_cache_peek(const hz_cache *cache, const void *key, void *out_value)
+{
+    hz_check_null(cache);
+    hz_check_null(key);
+    const hz_cache_node *node = hz_map_find(cache->map, key);
+    if (node == NULL) {
+        return false;
+    }
+    if (out_value != NULL) {
+        hz_memcpy(out_value, hz_cache_node_value(cache, node), 1, cache->value_size);
+    }
+    return true;
+}
+
+bool
+hz_cache_put(hz_cache *cache, const void *key, const void *value, void *out_value)
+{
+    hz_check_null(cache);
+    hz_check_null(key);
+    hz_check_null(value);
+
+    // Insert or update the entry in place, then move it to the front
+    bool inserted;
+    hz_cache_node *node = hz_map_emplace(cache->map, key, &inserted);
+    void *stored = hz_cache_node_value(cache, node);
+    if (!inserted) {
+        if (out_value != NULL) {
+            hz_memcpy(out_value, stored, 1, cache->value_size);
+        }
+        hz_cache_unlink(node);
+        cache->bytes -= node->bytes;
+    }
+    hz_memcpy(stored, value, 1, cache->value_size);
+    if (cache->size_func != NULL) {
+        node->bytes = cache->size_func(key, value, cache->ctx);
+    } else {
+        node->bytes = cache->key_size + cache->value_size;
+    }
+    cache->bytes += node->bytes;
+    hz_cache_link_front(cache, node);
+
+    // Evict from the back of the list, stopping short of the new entry
+    while (hz_cache_over_limit(cache) && cache->head.prev != node) {
+        hz_cache_node *victim = cache->head.prev;
+        if (cache->evict_func != NULL) {
+            cache->evict_func(
+                hz_map_ref_key(cache->map, victim),
+                hz_cache_node_value(cache, victim),
+                cache->ctx);
+        }
+        hz_cache_remove_node(cache, victim);
+        cache->stats.evictions++;
+    }
+    return !inserted;
+}
+
+bool
+hz_cache_remove(hz_cache *cache, const void *key, void *out_value)
+{
+    hz_check_null(cache);
+    hz_check_null(key);
+    hz_cache_node *node = hz_map_get_ref(cache->map, key);
+    if (node == NULL) {
+        return false;
+    }
+    if (out_value != NULL) {
+        hz_memcpy(out_value, hz_cache_node_value(cache, node), 1, cache->value_size);
+    }
+    hz_cache_remove_node(cache, node);
+    return true;
+}
@@ -0,0 +1,293 @@
+#include "hazuki/concurrent_map.h"
+#include "hazuki/map.h"
+#include "hazuki/utils.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Default number of shards. Must be a power of 2.
+ */
+#define DEFAULT_SHARD_COUNT 64
+
+/**
+ * Maximum number of shards. Shards are chosen by the top
+ * MAX_SHARD_BITS bits of the hash.
+ */
+#define MAX_SHARD_BITS 16
+#define MAX_SHARD_COUNT ((size_t)1 << MAX_SHARD_BITS)
+
+/**
+ * Shard header. The lock storage follows at lock_offset bytes from the
+ * start of the shard.
+ */
+typedef struct
+{
+    hz_map *map;
+} hz_concurrent_map_shard;
+
+struct hz_concurrent_map
+{
+    hz_map_hash_func hash_func;
+    hz_lock_ops lock_ops;
+    size_t seed;
+    size_t shard_count;
+    size_t lock_offset;
+    size_t shard_stride;
+    char *shard_storage;
+    char *shards;
+};
+
+static hz_concurrent_map_shard *
+hz_concurrent_map_shard_at(const hz_concurrent_map *map, size_t index)
+{
+    return (hz_concurrent_map_shard *)(map->shards + index * map->shard_stride);
+}
+
+static void *
+hz_concurrent_map_shard_lock(const hz_concurrent_map *map, hz_concurrent_map_shard *shard)
+{
+    return (char *)shard + map->lock_offset;
+}
+
+/**
+ * Gets the shard for the key with the given hash. The hash is the same
+ * one the shard maps use (they share the hash function and seed), so
+ * it is computed once and passed through to the *_hashed() map calls.
+ */
+static hz_concurrent_map_shard *
+hz_concurrent_map_shard_for(const hz_concurrent_map *map, size_t hash)
+{
+    // The shard maps pick buckets using the low bits of the hash, so
+    // use the high bits here to keep the two independent
+    size_t top = hash >> (sizeof(size_t) * CHAR_BIT - MAX_SHARD_BITS);
+    return hz_concurrent_map_shard_at(map, top & (map->shard_count - 1));
+}
+
+static void
+hz_concurrent_map_lock_shared(const hz_concurrent_map *map, hz_concurrent_map_shard *shard)
+{
+    void *lock = hz_concurrent_map_shard_lock(map, shard);
+    if (map->lock_ops.lock_shared != NULL && map->lock_ops.unlock_shared != NULL) {
+        map->lock_ops.lock_shared(lock);
+    } else {
+        map->lock_ops.lock(lock);
+    }
+}
+
+static void
+hz_concurrent_map_unlock_shared(const hz_concurrent_map *map, hz_concurrent_map_shard *shard)
+{
+    void *lock = hz_concurrent_map_shard_lock(map, shard);
+    if (map->lock_ops.lock_shared != NULL && map->lock_ops.unlock_shared != NULL) {
+        map->lock_ops.unlock_shared(lock);
+    } else {
+        map->lock_ops.unlock(lock);
+    }
+}
+
+static void
+hz_concurrent_map_lock(const hz_concurrent_map *map, hz_concurrent_map_shard *shard)
+{
+    map->lock_ops.lock(hz_concurrent_map_shard_lock(map, shard));
+}
+
+static void
+hz_concurrent_map_unlock(const hz_concurrent_map *map, hz_concurrent_map_shard *shard)
+{
+    map->lock_ops.unlock(hz_concurrent_map_shard_lock(map, shard));
+}
+
+static size_t
+hz_concurrent_map_shard_count_for(size_t requested)
+{
+    size_t count = 1;
+    while (count < requested && count < MAX_SHARD_COUNT) {
+        count *= 2;
+    }
+    return count;
+}
+
+void
+hz_concurrent_map_options_init(hz_concurrent_map_options *options)
+{
+    hz_check_null(options);
+    options->lock_ops = NULL;
+    options->shard_count = DEFAULT_SHARD_COUNT;
+    hz_map_options_init(&options->map_options);
+}
+
+hz_concurrent_map *
+hz_concurrent_map_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_concurrent_map_options *options)
+{
+    hz_check_null(hash_func);
+    hz_check_null(options);
+    const hz_lock_ops *lock_ops = options->lock_ops;
+    if (lock_ops == NULL) {
+        hz_abort("No lock operations provided");
+    }
+    hz_check_null(lock_ops->init);
+    hz_check_null(lock_ops->destroy);
+    hz_check_null(lock_ops->lock);
+    hz_check_null(lock_ops->unlock);
+    if (lock_ops->lock_size == 0) {
+        hz_abort("Lock size is zero");
+    }
+
+    hz_concurrent_map *map = hz_malloc(1, sizeof(hz_concurrent_map));
+    map->hash_func = hash_func;
+    map->lock_ops = *lock_ops;
+    map->seed = options->map_options.seed;
+    map->shard_count = hz_concurrent_map_shard_count_for(options->shard_count);
+
+    // Each shard is the shard header followed by the lock, padded
+    // out to a whole number of cache lines
+    map->lock_offset = hz_align_up(sizeof(hz_concurrent_map_shard), HZ_MAX_ALIGN);
+    if (lock_ops->lock_size > SIZE_MAX - map->lock_offset - HZ_CACHE_LINE_SIZE) {
+        hz_abort("Lock size is too large: %zu", lock_ops->lock_size);
+    }
+    map->shard_stride = hz_align_up(map->lock_offset + lock_ops->lock_size, HZ_CACHE_LINE_SIZE);
+    if (map->shard_stride > (SIZE_MAX - HZ_CACHE_LINE_SIZE) / map->shard_count) {
+        hz_abort("Lock size is too large: %zu", lock_ops->lock_size);
+    }
+
+    // malloc() only guarantees alignment for the fundamental types,
+    // so over-allocate and align the shards to a cache line ourselves
+    map->shard_storage = hz_malloc(1, map->shard_count * map->shard_stride + HZ_CACHE_LINE_SIZE);
+    uintptr_t base = (uintptr_t)map->shard_storage;
+    size_t padding = (HZ_CACHE_LINE_SIZE - base % HZ_CACHE_LINE_SIZE) % HZ_CACHE_LINE_SIZE;
+    map->shards = map->shard_storage + padding;
+
+    for (size_t i = 0; i < map->shard_count; ++i) {
+        hz_concurrent_map_shard *shard = hz_concurrent_map_shard_at(map, i);
+        shard->map = hz_map_new_with_options(
+            key_size,
+            value_size,
+            hash_func,
+            cmp_func,
+            &options->map_options);
+        map->lock_ops.init(hz_concurrent_map_shard_lock(map, shard));
+    }
+    return map;
+}
+
+void
+hz_concurrent_map_free(hz_concurrent_map *map)
+{
+    if (map != NULL) {
+        for (size_t i = 0; i < map->shard_count; ++i) {
+            hz_concurrent_map_shard *shard = hz_concurrent_map_shard_at(map, i);
+            map->lock_ops.destroy(hz_concurrent_map_shard_lock(map, shard));
+            hz_map_free(shard->map);
+        }
+        hz_free(map->shard_storage);
+        hz_free(map);
+    }
+}
+
+size_t
+hz_concurrent_map_shard_count(const hz_concurrent_map *map)
+{
+    hz_check_null(map);
+    return map->shard_count;
+}
+
+size_t
+hz_concurrent_map_size(hz_concurrent_map *map)
+{
+    hz_check_null(map);
+    size_t size = 0;
+    for (size_t i = 0; i < map->shard_count; ++i) {
+        hz_concurrent_map_shard *shard = hz_concurrent_map_shard_at(map, i);
+        hz_concurrent_map_lock_shared(map, shard);
+        size += hz_map_size(shard->map);
+        hz_concurrent_map_unlock_shared(map, shard);
+    }
+    return size;
+}
+
+void
+hz_concurrent_map_clear(hz_concurrent_map *map)
+{
+    hz_check_null(map);
+    for (size_t i = 0; i < map->shard_count; ++i) {
+        hz_concurrent_map_shard *shard = hz_concurrent_map_shard_at(map, i);
+        hz_concurrent_map_lock(map, shard);
+        hz_map_clear(shard->map);
+        hz_concurrent_map_unlock(map, shard);
+    }
+}
+
+bool
+hz_concurrent_map_get(hz_concurrent_map *map, const void *key, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+
+    size_t hash = hz_hash_mix(map->hash_func(key), map->seed);
+    hz_concurrent_map_shard *shard = hz_concurrent_map_shard_for(map, hash);
+    hz_concurrent_map_lock_shared(map, shard);
+    bool found = hz_map_get_hashed(shard->map, hash, key, out_value);
+    hz_concurrent_map_unlock_shared(map, shard);
+    return found;
+}
+
+bool
+hz_concurrent_map_put(
+    hz_concurrent_map *map,
+    const void *key,
+    const void *value,
+    void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_check_null(value);
+
+    size_t hash = hz_hash_mix(map->hash_func(key), map->seed);
+    hz_concurrent_map_shard *shard = hz_concurrent_map_shard_for(map, hash);
+    hz_concurrent_map_lock(map, shard);
+    bool replaced = hz_map_put_hashed(shard->map, hash, key, value, out_value);
+    hz_concurrent_map_unlock(map, shard);
+    return replaced;
+}
+
+bool
+hz_concurrent_map_remove(hz_concurrent_map *map, const void *key, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+
+    size_t hash = hz_hash_mix(map->hash_func(key), map->seed);
+    hz_concurrent_map_shard *shard = hz_concurrent_map_shard_for(map, hash);
+    hz_concurrent_map_lock(map, shard);
+    bool removed = hz_map_remove_hashed(shard->map, hash, key, out_value);
+    hz_concurrent_map_unlock(map, shard);
+    return removed;
+}
+
+bool
+hz_concurrent_map_emplace(
+    hz_concurrent_map *map,
+    const void *key,
+    hz_concurrent_map_update_func update_func,
+    void *ctx)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_check_null(update_func);
+
+    size_t hash = hz_hash_mix(map->hash_func(key), map->seed);
+    hz_concurrent_map_shard *shard = hz_concurrent_map_shard_for(map, hash);
+    hz_concurrent_map_lock(map, shard);
+    bool inserted;
+    void *value = hz_map_emplace_hashed(shard->map, hash, key, &inserted);
+    update_func(value, inserted, ctx);
+    hz_concurrent_map_unlock(map, shard);
+    return inserted;
+}
@@ -0,0 +1,596 @@
+#include "hazuki/flat_map.h"
+#include "hazuki/utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) && !defined(HZ_NO_SIMD)
+#include <emmintrin.h>
+#define HZ_FLAT_MAP_SSE2 1
+#endif
+
+/**
+ * Number of slots whose control bytes are probed together. Slots are
+ * grouped into aligned blocks of this many entries, and the probe
+ * sequence visits one block at a time. Must be 16 (the SSE2 register
+ * width, and the number of bits in a group match mask).
+ */
+#define GROUP_WIDTH 16
+
+/**
+ * Initial capacity for the hashmap, in slots. Must be a power of 2
+ * that is >= GROUP_WIDTH.
+ */
+#define INITIAL_CAPACITY 16
+
+/**
+ * The hashmap is resized once this fraction of the slots are in use
+ * (including deleted slots). Expressed as a fraction to avoid floating
+ * point math in the insert path. Must be < 1.
+ */
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 8
+
+/**
+ * Control byte values. Full slots hold the low 7 bits of the key hash,
+ * so they always have the high bit clear; empty and deleted slots both
+ * have the high bit set.
+ */
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+struct hz_flat_map
+{
+    size_t key_size;
+    size_t value_size;
+    hz_map_hash_func hash_func;
+    hz_map_cmp_func cmp_func;
+    size_t size;
+    size_t capacity;
+    size_t growth_left;
+    unsigned char *ctrl;
+    char *keys;
+    char *values;
+    unsigned int mod_count;
+};
+
+struct hz_flat_map_iterator
+{
+    const hz_flat_map *map;
+    size_t slot_index;
+    unsigned int mod_count;
+};
+
+static void
+hz_flat_map_touch(hz_flat_map *map)
+{
+    map->mod_count++;
+}
+
+static size_t
+hz_flat_map_hash_key(const hz_flat_map *map, const void *key)
+{
+    // Since we take the tag from the low bits and the probe start from
+    // the high bits, the user hash needs to be well mixed.
+    return hz_hash_mix(map->hash_func(key), 0);
+}
+
+static unsigned char
+hz_flat_map_h2(size_t hash)
+{
+    return (unsigned char)(hash & 0x7F);
+}
+
+static size_t
+hz_flat_map_h1(size_t hash)
+{
+    return hash >> 7;
+}
+
+static void *
+hz_flat_map_key_at(const hz_flat_map *map, size_t index)
+{
+    return &map->keys[index * map->key_size];
+}
+
+static void *
+hz_flat_map_value_at(const hz_flat_map *map, size_t index)
+{
+    return &map->values[index * map->value_size];
+}
+
+static size_t
+hz_flat_map_max_load(size_t capacity)
+{
+    return capacity / MAX_LOAD_DEN * MAX_LOAD_NUM;
+}
+
+/**
+ * Returns the index of the lowest set bit in a non-zero mask.
+ */
+static unsigned int
+hz_flat_map_lowest_bit(unsigned int mask)
+{
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_ctz(mask);
+#else
+    unsigned int index = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+/**
+ * Returns a bitmask with bit i set if ctrl[i] == h2.
+ */
+static unsigned int
+hz_flat_map_group_match(const unsigned char *ctrl, unsigned char h2)
+{
+#if defined(HZ_FLAT_MAP_SSE2)
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    __m128i match = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)h2));
+    return (unsigned int)_mm_movemask_epi8(match);
+#else
+    unsigned int mask = 0;
+    for (unsigned int i = 0; i < GROUP_WIDTH; ++i) {
+        mask |= (unsigned int)(ctrl[i] == h2) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Returns a bitmask with bit i set if ctrl[i] is CTRL_EMPTY.
+ */
+static unsigned int
+hz_flat_map_group_match_empty(const unsigned char *ctrl)
+{
+    return hz_flat_map_group_match(ctrl, CTRL_EMPTY);
+}
+
+/**
+ * Returns a bitmask with bit i set if ctrl[i] is CTRL_EMPTY or
+ * CTRL_DELETED (i.e. the slot is available for insertion).
+ */
+static unsigned int
+hz_flat_map_group_match_available(const unsigned char *ctrl)
+{
+#if defined(HZ_FLAT_MAP_SSE2)
+    // Both special values have the high bit set, so movemask
+    // extracts exactly the mask we want.
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (unsigned int)_mm_movemask_epi8(group);
+#else
+    unsigned int mask = 0;
+    for (unsigned int i = 0; i < GROUP_WIDTH; ++i) {
+        mask |= (unsigned int)((ctrl[i] & 0x80) != 0) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Finds the slot containing the given key. Returns true and writes
+ * the slot index to out_index if found, and false otherwise.
+ */
+static bool
+hz_flat_map_find_slot(
+    const hz_flat_map *map,
+    size_t hash,
+    const void *key,
+    size_t *out_index)
+{
+    if (map->capacity == 0) {
+        return false;
+    }
+
+    // Probe groups using triangular numbers, which visits every
+    // group exactly once when the group count is a power of 2.
+    size_t group_mask = map->capacity / GROUP_WIDTH - 1;
+    size_t group = hz_flat_map_h1(hash) & group_mask;
+    unsigned char h2 = hz_flat_map_h2(hash);
+    for (size_t step = 1; step <= group_mask + 1; ++step) {
+        const unsigned char *ctrl = &map->ctrl[group * GROUP_WIDTH];
+        unsigned int match = hz_flat_map_group_match(ctrl, h2);
+        while (match != 0) {
+            size_t index = group * GROUP_WIDTH + hz_flat_map_lowest_bit(match);
+            if (map->cmp_func(key, hz_flat_map_key_at(map, index)) == 0) {
+                *out_index = index;
+                return true;
+            }
+            match &= match - 1;
+        }
+
+        // If the group has any empty slots, the key would have been
+        // inserted there, so it can't be in any later group.
+        if (hz_flat_map_group_match_empty(ctrl) != 0) {
+            return false;
+        }
+        group = (group + step) & group_mask;
+    }
+    return false;
+}
+
+/**
+ * Finds the first empty or deleted slot in the probe sequence for the
+ * given hash. The map must have at least one available slot.
+ */
+static size_t
+hz_flat_map_find_available_slot(const hz_flat_map *map, size_t hash)
+{
+    size_t group_mask = map->capacity / GROUP_WIDTH - 1;
+    size_t group = hz_flat_map_h1(hash) & group_mask;
+    for (size_t step = 1; ; ++step) {
+        const unsigned char *ctrl = &map->ctrl[group * GROUP_WIDTH];
+        unsigned int available = hz_flat_map_group_match_available(ctrl);
+        if (available != 0) {
+            return group * GROUP_WIDTH + hz_flat_map_lowest_bit(available);
+        }
+        group = (group + step) & group_mask;
+    }
+}
+
+static void
+hz_flat_map_alloc_slots(hz_flat_map *map, size_t capacity)
+{
+    map->capacity = capacity;
+    map->growth_left = hz_flat_map_max_load(capacity);
+    map->ctrl = hz_malloc(capacity, sizeof(unsigned char));
+    memset(map->ctrl, CTRL_EMPTY, capacity);
+    map->keys = hz_malloc(capacity, map->key_size);
+    map->values = hz_malloc(capacity, map->value_size);
+}
+
+static void
+hz_flat_map_free_slots(hz_flat_map *map)
+{
+    hz_free(map->ctrl);
+    hz_free(map->keys);
+    hz_free(map->values);
+}
+
+static size_t
+hz_flat_map_next_capacity(const hz_flat_map *map)
+{
+    if (map->capacity == 0) {
+        return INITIAL_CAPACITY;
+    }
+
+    // If most of the used slots are tombstones, rehashing at the
+    // same capacity is enough to free up space.
+    if (map->size < hz_flat_map_max_load(map->capacity) / 2) {
+        return map->capacity;
+    }
+    if (map->capacity > SIZE_MAX / 2 / hz_max(map->key_size, map->value_size)) {
+        hz_abort("Cannot resize map larger than %zu slots", map->capacity);
+    }
+    return map->capacity * 2;
+}
+
+static void
+hz_flat_map_resize(hz_flat_map *map)
+{
+    size_t old_capacity = map->capacity;
+    unsigned char *old_ctrl = map->ctrl;
+    char *old_keys = map->keys;
+    char *old_values = map->values;
+
+    // Allocate new slot arrays and move every full slot over
+    hz_flat_map_alloc_slots(map, hz_flat_map_next_capacity(map));
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if ((old_ctrl[i] & 0x80) != 0) {
+            continue;
+        }
+        void *key = &old_keys[i * map->key_size];
+        void *value = &old_values[i * map->value_size];
+        size_t hash = hz_flat_map_hash_key(map, key);
+        size_t index = hz_flat_map_find_available_slot(map, hash);
+        map->ctrl[index] = hz_flat_map_h2(hash);
+        hz_memcpy(hz_flat_map_key_at(map, index), key, 1, map->key_size);
+        hz_memcpy(hz_flat_map_value_at(map, index), value, 1, map->value_size);
+    }
+    map->growth_left -= map->size;
+
+    hz_free(old_ctrl);
+    hz_free(old_keys);
+    hz_free(old_values);
+}
+
+static void
+hz_flat_map_add_entry(
+    hz_flat_map *map,
+    size_t hash,
+    const void *key,
+    const void *value)
+{
+    size_t index = 0;
+    if (map->capacity != 0) {
+        index = hz_flat_map_find_available_slot(map, hash);
+    }
+
+    // Reusing a deleted slot doesn't reduce the number of slots
+    // available for new insertions, so only resize if we need to
+    // consume an empty slot and we're out of room.
+    if (map->capacity == 0 ||
+        (map->ctrl[index] == CTRL_EMPTY && map->growth_left == 0))
+    {
+        hz_flat_map_resize(map);
+        index = hz_flat_map_find_available_slot(map, hash);
+    }
+
+    if (map->ctrl[index] == CTRL_EMPTY) {
+        map->growth_left--;
+    }
+    map->ctrl[index] = hz_flat_map_h2(hash);
+    hz_memcpy(hz_flat_map_key_at(map, index), key, 1, map->key_size);
+    hz_memcpy(hz_flat_map_value_at(map, index), value, 1, map->value_size);
+    map->size++;
+}
+
+static void
+hz_flat_map_erase_slot(hz_flat_map *map, size_t index)
+{
+    // If the group still has an empty slot, no probe sequence can
+    // have passed through it, so the slot can become empty again.
+    // Otherwise we must leave a tombstone so that lookups for keys
+    // in later groups keep probing.
+    const unsigned char *ctrl = &map->ctrl[index / GROUP_WIDTH * GROUP_WIDTH];
+    if (hz_flat_map_group_match_empty(ctrl) != 0) {
+        map->ctrl[index] = CTRL_EMPTY;
+        map->growth_left++;
+    } else {
+        map->ctrl[index] = CTRL_DELETED;
+    }
+    map->size--;
+}
+
+hz_flat_map *
+hz_flat_map_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func)
+{
+    hz_check_null(hash_func);
+    hz_check_null(cmp_func);
+    hz_flat_map *map = hz_malloc(1, sizeof(hz_flat_map));
+    map->key_size = key_size;
+    map->value_size = value_size;
+    map->hash_func = hash_func;
+    map->cmp_func = cmp_func;
+    map->size = 0;
+    map->capacity = 0;
+    map->growth_left = 0;
+    map->ctrl = NULL;
+    map->keys = NULL;
+    map->values = NULL;
+    map->mod_count = 0;
+    return map;
+}
+
+hz_flat_map *
+hz_flat_map_copy(const hz_flat_map *map)
+{
+    hz_check_null(map);
+    hz_flat_map *new_map = hz_malloc(1, sizeof(hz_flat_map));
+    *new_map = *map;
+    new_map->ctrl = hz_malloc(map->capacity, sizeof(unsigned char));
+    new_map->keys = hz_malloc(map->capacity, map->key_size);
+    new_map->values = hz_malloc(map->capacity, map->value_size);
+    hz_memcpy(new_map->ctrl, map->ctrl, map->capacity, sizeof(unsigned char));
+    hz_memcpy(new_map->keys, map->keys, map->capacity, map->key_size);
+    hz_memcpy(new_map->values, map->values, map->capacity, map->value_size);
+    return new_map;
+}
+
+void
+hz_flat_map_free(hz_flat_map *map)
+{
+    if (map != NULL) {
+        hz_flat_map_free_slots(map);
+        hz_free(map);
+    }
+}
+
+size_t
+hz_flat_map_size(const hz_flat_map *map)
+{
+    hz_check_null(map);
+    return map->size;
+}
+
+void
+hz_flat_map_clear(hz_flat_map *map)
+{
+    hz_check_null(map);
+    hz_flat_map_touch(map);
+    hz_flat_map_free_slots(map);
+    map->size = 0;
+    map->capacity = 0;
+    map->growth_left = 0;
+    map->ctrl = NULL;
+    map->keys = NULL;
+    map->values = NULL;
+}
+
+bool
+hz_flat_map_get(const hz_flat_map *map, const void *key, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+
+    size_t hash = hz_flat_map_hash_key(map, key);
+    size_t index;
+    if (hz_flat_map_find_slot(map, hash, key, &index)) {
+        if (out_value != NULL) {
+            void *value = hz_flat_map_value_at(map, index);
+            hz_memcpy(out_value, value, 1, map->value_size);
+        }
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool
+hz_flat_map_put(
+    hz_flat_map *map,
+    const void *key,
+    const void *value,
+    void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_check_null(value);
+
+    hz_flat_map_touch(map);
+    size_t hash = hz_flat_map_hash_key(map, key);
+    size_t index;
+    if (hz_flat_map_find_slot(map, hash, key, &index)) {
+        // If we already had a matching entry for the given key,
+        // just replace the slot's value
+        void *slot_value = hz_flat_map_value_at(map, index);
+        if (out_value != NULL) {
+            hz_memcpy(out_value, slot_value, 1, map->value_size);
+        }
+        hz_memcpy(slot_value, value, 1, map->value_size);
+        return true;
+    } else {
+        // No matching entry for the given key, insert a new one
+        hz_flat_map_add_entry(map, hash, key, value);
+        return false;
+    }
+}
+
+bool
+hz_flat_map_remove(hz_flat_map *map, const void *key, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+
+    // No slots to check, fail fast
+    if (map->size == 0) {
+        return false;
+    }
+
+    size_t hash = hz_flat_map_hash_key(map, key);
+    size_t index;
+    if (!hz_flat_map_find_slot(map, hash, key, &index)) {
+        return false;
+    }
+    if (out_value != NULL) {
+        void *value = hz_flat_map_value_at(map, index);
+        hz_memcpy(out_value, value, 1, map->value_size);
+    }
+    hz_flat_map_erase_slot(map, index);
+    hz_flat_map_touch(map);
+    return true;
+}
+
+bool
+hz_flat_map_equals(
+    const hz_flat_map *a,
+    const hz_flat_map *b,
+    hz_map_cmp_func cmp_func)
+{
+    if (a == b) {
+        return true;
+    }
+    if (a == NULL || b == NULL) {
+        return false;
+    }
+    if (a->key_size != b->key_size) {
+        hz_abort("Maps have different key types");
+    }
+    if (a->value_size != b->value_size) {
+        hz_abort("Maps have different value types");
+    }
+    if (a->size != b->size) {
+        return false;
+    }
+
+    // Since the maps have the same size, they are equal if and only if
+    // each key in A also exists in B and maps to the same value.
+    for (size_t i = 0; i < a->capacity; ++i) {
+        if ((a->ctrl[i] & 0x80) != 0) {
+            continue;
+        }
+
+        // Find corresponding slot in B
+        void *a_key = hz_flat_map_key_at(a, i);
+        size_t b_hash = hz_flat_map_hash_key(b, a_key);
+        size_t b_index;
+        if (!hz_flat_map_find_slot(b, b_hash, a_key, &b_index)) {
+            return false;
+        }
+
+        // If a custom comparator function was provided, use
+        // that to determine value equality. Otherwise, use memcmp().
+        void *a_value = hz_flat_map_value_at(a, i);
+        void *b_value = hz_flat_map_value_at(b, b_index);
+        int cmp;
+        if (cmp_func == NULL) {
+            cmp = hz_memcmp(a_value, b_value, 1, a->value_size);
+        } else {
+            cmp = cmp_func(a_value, b_value);
+        }
+        if (cmp != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+hz_flat_map_iterator *
+hz_flat_map_iterator_new(const hz_flat_map *map)
+{
+    hz_check_null(map);
+    hz_flat_map_iterator *it = hz_malloc(1, sizeof(hz_flat_map_iterator));
+    it->map = map;
+    it->mod_count = map->mod_count;
+    it->slot_index = 0;
+    return it;
+}
+
+void
+hz_flat_map_iterator_free(hz_flat_map_iterator *it)
+{
+    hz_free(it);
+}
+
+bool
+hz_flat_map_iterator_next(hz_flat_map_iterator *it, void *key, void *value)
+{
+    hz_check_null(it);
+
+    // Make sure we haven't modified the map between iterations,
+    // since the slot index may no longer be valid
+    const hz_flat_map *map = it->map;
+    if (it->mod_count != map->mod_count) {
+        hz_abort("Map contents modified during iteration");
+    }
+
+    // Skip over empty and deleted slots
+    while (it->slot_index < map->capacity &&
+           (map->ctrl[it->slot_index] & 0x80) != 0)
+    {
+        it->slot_index++;
+    }
+    if (it->slot_index == map->capacity) {
+        return false;
+    }
+
+    // Write key and value as necessary
+    size_t index = it->slot_index++;
+    if (key != NULL) {
+        hz_memcpy(key, hz_flat_map_key_at(map, index), 1, map->key_size);
+    }
+    if (value != NULL) {
+        hz_memcpy(value, hz_flat_map_value_at(map, index), 1, map->value_size);
+    }
+    return true;
+}
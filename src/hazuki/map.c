@@ -1,52 +1,425 @@
 #include "hazuki/map.h"
+#include "hazuki/pool.h"
 #include "hazuki/utils.h"
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 /**
- * Initial capacity for the hashmap. Must be an integer > 0.
+ * Initial capacity for the hashmap. Must be a power of 2.
  */
 #define INITIAL_CAPACITY 8
 
 /**
  * Factor by which to scale the hashmap's bucket array when the load
- * factor is reached. Must be > 1.
+ * factor is reached. Must be a power of 2 > 1.
  */
 #define SCALING_FACTOR 2
 
+/**
+ * Largest possible bucket count (the largest power of 2 that fits
+ * in a size_t).
+ */
+#define MAX_BUCKET_COUNT ((SIZE_MAX >> 1) + 1)
+
 /**
  * When the number of entries divided by the number of buckets reaches
  * this value, the hashmap is resized. Must be > 0.
  */
 #define LOAD_FACTOR 0.75
 
+/**
+ * If automatic shrinking is enabled, the hashmap is shrunk when the
+ * number of entries divided by the number of buckets falls below this
+ * value. Shrinking brings the load factor back up to at least half of
+ * LOAD_FACTOR, so the map has to lose or gain a lot of entries again
+ * before it resizes in either direction. Must be < LOAD_FACTOR / 2.
+ */
+#define SHRINK_LOAD_FACTOR (LOAD_FACTOR / 4)
+
+/**
+ * Seed for remixing a key's hash to pick its shard in a sharded merge.
+ * The shard must not depend on the low bits of the hash, which pick the
+ * bucket, or else each destination map would only use some of its
+ * buckets.
+ */
+#define SHARD_SEED 0x5bd1e995
+
+/**
+ * Number of buckets per page. The bucket array is split into pages so
+ * that snapshots can share it with the original map, and only the pages
+ * that are written to need to be copied. Must be a power of 2.
+ */
+#define PAGE_BUCKETS 64
+
+/**
+ * Number of pages per chunk. Pages are grouped into chunks so that the
+ * first write after a snapshot only has to copy the top-level directory
+ * and one chunk, rather than a directory of every page in the map.
+ * Must be a power of 2.
+ */
+#define CHUNK_PAGES 512
+
+/**
+ * Number of buckets covered by a single chunk.
+ */
+#define CHUNK_BUCKETS ((size_t)CHUNK_PAGES * PAGE_BUCKETS)
+
+/**
+ * Maximum number of entries moved to the new bucket array by each
+ * modifying operation while an incremental resize is in progress.
+ * Must be an integer > 0.
+ */
+#define MIGRATION_ENTRIES 16
+
+/**
+ * Maximum number of old buckets (including empty ones) visited by each
+ * modifying operation while an incremental resize is in progress.
+ * Must be an integer > 0.
+ */
+#define MIGRATION_BUCKETS 64
+
+/**
+ * Number of entries at which a bucket's chain is indexed by a tree, if
+ * the map has an order function. The tree is freed again once the chain
+ * is shorter than this, so a chain is indexed exactly when it has at
+ * least this many entries. Must be an integer > 1.
+ */
+#define TREEIFY_THRESHOLD 8
+
+/**
+ * Number of keys that hz_map_get_many() processes in lockstep. Each
+ * key in a batch has its bucket and entry prefetched before any of
+ * them are resolved, so this controls how many cache misses can be
+ * in flight at once. Must be an integer > 0.
+ */
+#define GET_BATCH_SIZE 16
+
+/**
+ * Size of the first block of a string-keyed map's key arena. Later
+ * blocks double in size, up to ARENA_MAX_BLOCK_SIZE bytes (unless a
+ * single key needs more).
+ */
+#define ARENA_MIN_BLOCK_SIZE 4096
+
+/**
+ * Largest size that a key arena block grows to.
+ */
+#define ARENA_MAX_BLOCK_SIZE (1024 * 1024)
+
+/**
+ * A string-keyed map compacts its key arena once the bytes belonging
+ * to removed keys exceed both the bytes of the live keys and this
+ * value, so that small maps don't compact over and over.
+ */
+#define ARENA_COMPACT_MIN_WASTE (64 * 1024)
+
+/**
+ * Identifies hashmap images written by hz_map_serialize(). Reading the
+ * magic number on a platform with the opposite byte order gives a
+ * different value, so it also catches endianness mismatches.
+ */
+#define IMAGE_MAGIC UINT64_C(0x50414d494b5a4148)
+
+/**
+ * Version of the image format. Bump this whenever the layout changes.
+ */
+#define IMAGE_VERSION 1
+
+/**
+ * Image flag set for string-keyed hashmaps.
+ */
+#define IMAGE_STRING_KEYS 1
+
+/**
+ * Number of 64-bit words in a Bloom filter block. Every key is recorded
+ * in a single block, so a block is one cache line.
+ */
+#define BLOOM_BLOCK_WORDS (HZ_CACHE_LINE_SIZE / 8)
+
+/**
+ * Number of buckets per Bloom filter block. With 512-bit blocks, this
+ * gives the filter 8 bits per bucket, or about 11 to 21 bits per entry
+ * depending on how full the map is. Must be a power of 2.
+ */
+#define BLOOM_BLOCK_BUCKETS 64
+
+/**
+ * Number of bits set in the filter for each key. Each bit is chosen
+ * by 9 bits of the key's hash (3 for the word, 6 for the bit).
+ */
+#define BLOOM_PROBES 4
+
+/**
+ * Removed keys can't be cleared from a Bloom filter, so their bits stay
+ * set until the filter is rebuilt. This happens when the next resize
+ * finishes, or once the number of removals since the filter was built
+ * exceeds this fraction of the bucket count.
+ */
+#define BLOOM_MAX_STALE 0.5
+
+/**
+ * Counts operations towards the map's stats, if the library is compiled
+ * with HZ_MAP_STATS. Lookups count themselves through a const pointer,
+ * which is fine since maps are always allocated by us. Lookups may run
+ * on several threads at once, so the counters are updated atomically;
+ * they don't order any other memory accesses, so relaxed is enough.
+ */
+#if defined(HZ_MAP_STATS)
+#if !defined(__GNUC__)
+#error "HZ_MAP_STATS requires the GCC __atomic builtins"
+#endif
+#define hz_map_count(map, counter, n) \
+    ((void)__atomic_fetch_add(&((hz_map *)(map))->counter, (n), __ATOMIC_RELAXED))
+#else
+#define hz_map_count(map, counter, n) ((void)0)
+#endif
+
+/**
+ * Hints to the processor that the given address will be read soon.
+ * This has no effect on program behavior.
+ */
+#if defined(__GNUC__)
+#define hz_map_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define hz_map_prefetch(addr) ((void)(addr))
+#endif
+
+/**
+ * Entry header. Each entry is allocated as a single block, with the key
+ * stored at key_offset and the value stored at value_offset (both
+ * relative to the start of the entry, and suitably aligned).
+ */
 typedef struct hz_map_entry
 {
     struct hz_map_entry *next;
     size_t hash;
-    void *key;
-    void *value;
 } hz_map_entry;
 
+/**
+ * A fixed-size slice of the bucket array, along with the entries in its
+ * chains. A page may be shared between a map and its snapshots, in which
+ * case neither the page nor its entries may be modified; a map must copy
+ * the page (and its entries) before writing to it. Pages of maps with
+ * fewer than PAGE_BUCKETS buckets are shortened to fit, and the single
+ * page of a flat table holds every bucket.
+ */
+typedef struct hz_map_page
+{
+    size_t refs;
+    size_t slot_count;
+    struct hz_map_tree_node **trees;
+    hz_map_entry *buckets[];
+} hz_map_page;
+
+/**
+ * Node of a bucket tree. Once a bucket's chain reaches TREEIFY_THRESHOLD
+ * entries, it is indexed by an AVL tree ordered by hash and then by the
+ * map's order function, so that lookups in it take O(log n) time even if
+ * every key has the same hash. The chain is kept in the same order as the
+ * tree, so code that only walks chains doesn't need to know about trees.
+ * A page's trees array holds the root for each of its buckets (NULL for
+ * plain chains), and is only allocated once one of them is treeified.
+ */
+typedef struct hz_map_tree_node
+{
+    struct hz_map_tree_node *left;
+    struct hz_map_tree_node *right;
+    hz_map_entry *entry;
+    size_t height;
+} hz_map_tree_node;
+
+/**
+ * A group of CHUNK_PAGES consecutive pages (or fewer, for small maps).
+ * Pages are allocated when they are first written to; a NULL page has
+ * only empty buckets. Like pages, a chunk may be shared.
+ */
+typedef struct hz_map_chunk
+{
+    size_t refs;
+    hz_map_page *pages[];
+} hz_map_chunk;
+
+/**
+ * Bucket array, stored as a two-level directory of pages. As with
+ * pages, chunks are allocated on first write, and a table may be
+ * shared between a map and its snapshots.
+ *
+ * Splitting the buckets into pages costs two extra dependent loads on
+ * every lookup, which is wasted on maps that never share anything. So
+ * until a map is first snapshotted, its tables are flat: all of the
+ * buckets are in one page, and the directory is unused. Flat tables
+ * are never shared; hz_map_snapshot() splits them into pages first.
+ */
+typedef struct hz_map_table
+{
+    size_t refs;
+    hz_map_page *flat;
+    hz_map_chunk *chunks[];
+} hz_map_table;
+
+/**
+ * Entry pool, shared between a map and its snapshots since pages
+ * (and therefore entries) may be freed by any of them.
+ */
+typedef struct hz_map_pool
+{
+    size_t refs;
+    hz_pool *objects;
+} hz_map_pool;
+
+/**
+ * Key stored in the entries of a string-keyed map. The bytes (including
+ * the NUL terminator) live in the map's key arena. Keys passed to the
+ * public functions are converted to this form on the way in, so the
+ * hash and comparator functions of a string-keyed map always receive
+ * one of these, and the length is only computed once per operation.
+ */
+typedef struct
+{
+    const char *data;
+    size_t length;
+} hz_map_string_key;
+
+/**
+ * Block of memory in a key arena. Keys are bump-allocated from the
+ * newest block, and are only freed when the whole arena is.
+ */
+typedef struct hz_map_arena_block
+{
+    struct hz_map_arena_block *next;
+    size_t capacity;
+    size_t used;
+    char data[];
+} hz_map_arena_block;
+
+/**
+ * Owns the key bytes of a string-keyed map. Like the entry pool, the
+ * arena is shared between a map and its snapshots, since their entries
+ * may point into it.
+ */
+typedef struct hz_map_arena
+{
+    size_t refs;
+    hz_map_arena_block *blocks;
+    size_t used;
+} hz_map_arena;
+
+/**
+ * Blocked Bloom filter over the hashes of a map's keys. The filter has a
+ * block per BLOOM_BLOCK_BUCKETS buckets, rounded to a power of 2, and
+ * each key sets BLOOM_PROBES bits in one block, so checking a key reads
+ * a single cache line. Like tables, a filter may be shared between a map
+ * and its snapshots, and is copied by whichever writes to it first.
+ */
+typedef struct hz_map_bloom
+{
+    size_t refs;
+    size_t block_count;
+    uint64_t *blocks;
+    char storage[];
+} hz_map_bloom;
+
+/**
+ * Header of a hashmap image. The image is laid out as
+ * [header][bucket offsets][entries][strings], with each section aligned
+ * to the maximum alignment. Bucket i holds entries [buckets[i],
+ * buckets[i + 1]), so there are bucket_count + 1 offsets. Each entry is
+ * [hash][key][value], padded to entry_size bytes; the hash is the mixed
+ * hash stored in hz_map_entry. For string-keyed maps, the key is a
+ * hz_map_image_string, and the bytes (with NUL terminators) are stored
+ * in the strings section. All offsets are relative to the start of the
+ * image, except for string offsets, which are relative to the start of
+ * the strings section.
+ */
+typedef struct
+{
+    uint64_t magic;
+    uint64_t version;
+    uint64_t word_size;
+    uint64_t flags;
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t seed;
+    uint64_t size;
+    uint64_t bucket_count;
+    uint64_t entry_size;
+    uint64_t key_offset;
+    uint64_t value_offset;
+    uint64_t buckets_offset;
+    uint64_t entries_offset;
+    uint64_t strings_offset;
+    uint64_t total_size;
+} hz_map_image_header;
+
+/**
+ * Key stored in the entries of a string-keyed hashmap image.
+ */
+typedef struct
+{
+    uint64_t offset;
+    uint64_t length;
+} hz_map_image_string;
+
 struct hz_map
 {
     size_t key_size;
     size_t value_size;
+    size_t key_offset;
+    size_t value_offset;
+    size_t entry_size;
     hz_map_hash_func hash_func;
     hz_map_cmp_func cmp_func;
+    hz_map_cmp_func order_func;
+    size_t seed;
+    hz_map_pool *pool;
+    hz_map_arena *arena;
+    size_t key_bytes;
+    bool incremental_resize;
+    bool auto_shrink;
+    bool bloom_filter;
     size_t size;
     size_t bucket_count;
-    hz_map_entry **buckets;
+    hz_map_table *table;
+    size_t old_bucket_count;
+    hz_map_table *old_table;
+    size_t migrate_index;
+    hz_map_bloom *bloom;
+    hz_map_bloom *next_bloom;
+    size_t bloom_removed;
+    bool paged;
+    unsigned int unshare_count;
+    size_t resizes;
+#if defined(HZ_MAP_STATS)
+    size_t gets;
+    size_t puts;
+    size_t removes;
+#endif
     unsigned int mod_count;
 };
 
 struct hz_map_iterator
 {
-    const hz_map *map;
-    size_t bucket_index;
-    hz_map_entry *current_entry;
-    unsigned int mod_count;
+    hz_map_cursor cursor;
+};
+
+struct hz_map_view
+{
+    hz_map_hash_func hash_func;
+    hz_map_cmp_func cmp_func;
+    bool string_keys;
+    size_t value_size;
+    size_t seed;
+    size_t size;
+    size_t bucket_count;
+    size_t entry_size;
+    size_t key_offset;
+    size_t value_offset;
+    const uint64_t *buckets;
+    const char *entries;
+    const char *strings;
+    size_t strings_size;
 };
 
 static void
@@ -58,350 +431,2744 @@ hz_map_touch(hz_map *map)
 static size_t
 hz_map_hash_key(const hz_map *map, const void *key)
 {
-    // Key hash function. If desired, a secondary key hashing round
-    // can be applied here to reduce the risk of collisions.
-    return map->hash_func(key);
+    // User hash functions are often weak (e.g. the identity function
+    // for integers), and we only use the low bits to pick a bucket,
+    // so scramble the hash before using it. Mixing in a per-map seed
+    // also makes it hard to pick keys that collide on purpose.
+    return hz_hash_mix(map->hash_func(key), map->seed);
 }
 
 static size_t
 hz_map_get_bucket_index(size_t hash, size_t bucket_count)
 {
-    // We compute the index as the hash modulo the number of buckets.
-    // If the bucket count is always a power of 2, we can use
-    // hash & (bucket_count - 1) instead which is a bit faster.
-    return hash % bucket_count;
+    // The bucket count is always a power of 2, so we can use a mask
+    // instead of a (much slower) modulo operation.
+    return hash & (bucket_count - 1);
 }
 
-static hz_map_entry *
-hz_map_entry_alloc(const hz_map *map)
+/**
+ * Copies a value. Sets are maps with zero-sized values, which
+ * hz_memcpy() does not allow, so there is nothing to copy for them.
+ */
+static void
+hz_map_copy_value(void *dest, const void *src, size_t value_size)
 {
-    hz_map_entry *entry = hz_malloc(1, sizeof(hz_map_entry));
-    entry->key = hz_malloc(1, map->key_size);
-    entry->value = hz_malloc(1, map->value_size);
-    return entry;
+    if (value_size != 0) {
+        hz_memcpy(dest, src, 1, value_size);
+    }
 }
 
-static bool
-hz_map_entry_matches(
-    const hz_map *map,
-    const hz_map_entry *entry,
-    size_t hash,
-    const void *key)
+static void
+hz_map_init_layout(hz_map *map)
 {
-    // If the hashes don't match, we don't need to compare the keys.
-    if (entry->hash != hash) {
-        return false;
+    // Entries are laid out as [header][key][value], with padding
+    // as required to align the key and value.
+    size_t key_align = hz_align_of(map->key_size);
+    size_t value_align = hz_align_of(map->value_size);
+    map->key_offset = hz_align_up(sizeof(hz_map_entry), key_align);
+    if (map->key_size > SIZE_MAX - map->key_offset) {
+        hz_abort("Entry size is too large");
+    }
+    map->value_offset = hz_align_up(map->key_offset + map->key_size, value_align);
+    if (map->value_size > SIZE_MAX - map->value_offset) {
+        hz_abort("Entry size is too large");
     }
+    map->entry_size = map->value_offset + map->value_size;
+}
 
-    // If the hashes match, we still need to check that the keys are equal.
-    return map->cmp_func(key, entry->key) == 0;
+static void *
+hz_map_entry_key(const hz_map *map, const hz_map_entry *entry)
+{
+    return (char *)entry + map->key_offset;
 }
 
-static hz_map_entry *
-hz_map_find_entry(const hz_map *map, size_t hash, const void *key)
+static void *
+hz_map_entry_value(const hz_map *map, const hz_map_entry *entry)
 {
-    if (map->bucket_count == 0) {
-        return NULL;
-    }
-    size_t index = hz_map_get_bucket_index(hash, map->bucket_count);
-    hz_map_entry *entry = map->buckets[index];
-    while (entry != NULL) {
-        if (hz_map_entry_matches(map, entry, hash, key)) {
-            return entry;
-        }
-        entry = entry->next;
+    return (char *)entry + map->value_offset;
+}
+
+static size_t
+hz_map_string_hash(const void *key)
+{
+    // Consume 8 bytes at a time; the result is scrambled by
+    // hz_hash_mix() afterwards, so this only needs to make sure
+    // that every byte affects the output
+    const hz_map_string_key *str = key;
+    const char *bytes = str->data;
+    size_t remaining = str->length;
+    uint64_t h = str->length;
+    uint64_t word;
+    while (remaining >= sizeof(word)) {
+        memcpy(&word, bytes, sizeof(word));
+        h = (h ^ word) * UINT64_C(0x9e3779b97f4a7c15);
+        h ^= h >> 32;
+        bytes += sizeof(word);
+        remaining -= sizeof(word);
     }
-    return NULL;
+    word = 0;
+    memcpy(&word, bytes, remaining);
+    h = (h ^ word) * UINT64_C(0x9e3779b97f4a7c15);
+    return (size_t)h;
 }
 
-static hz_map_entry *
-hz_map_entry_new(
-    const hz_map *map,
-    size_t hash,
-    const void *key,
-    const void *value)
+static int
+hz_map_string_cmp(const void *a, const void *b)
 {
-    hz_map_entry *entry = hz_map_entry_alloc(map);
-    entry->next = NULL;
-    entry->hash = hash;
-    hz_memcpy(entry->key, key, 1, map->key_size);
-    hz_memcpy(entry->value, value, 1, map->value_size);
-    return entry;
+    // Only touch the key bytes if the lengths match. Hashes have
+    // already been compared by the time we get here.
+    const hz_map_string_key *as = a;
+    const hz_map_string_key *bs = b;
+    if (as->length != bs->length) {
+        return 1;
+    }
+    return memcmp(as->data, bs->data, as->length);
 }
 
-static hz_map_entry *
-hz_map_entry_copy(const hz_map *map, const hz_map_entry *entry)
-{
-    // "Pop" each value from the old list, clone it, and "push"
-    // it at the head of the new list. This has the side effect
-    // of reversing the entry order.
-    hz_map_entry *prev = NULL;
-    while (entry != NULL) {
-        hz_map_entry *curr = hz_map_entry_alloc(map);
-        curr->next = prev;
-        curr->hash = entry->hash;
-        hz_memcpy(curr->key, entry->key, 1, map->key_size);
-        hz_memcpy(curr->value, entry->value, 1, map->value_size);
-        prev = curr;
-        entry = entry->next;
+static int
+hz_map_string_order(const void *a, const void *b)
+{
+    // Any consistent order will do, so order by length first
+    const hz_map_string_key *as = a;
+    const hz_map_string_key *bs = b;
+    if (as->length != bs->length) {
+        return as->length < bs->length ? -1 : 1;
     }
-    return prev;
+    return memcmp(as->data, bs->data, as->length);
 }
 
-static void
-hz_map_entry_free(hz_map_entry *entry)
+/**
+ * Converts a key passed to a public function into the form stored in
+ * entries. For string-keyed maps, this fills in *storage; other keys
+ * are used as-is.
+ */
+static const void *
+hz_map_lookup_key(const hz_map *map, const void *key, hz_map_string_key *storage)
 {
-    hz_free(entry->key);
-    hz_free(entry->value);
-    hz_free(entry);
+    if (map->arena == NULL) {
+        return key;
+    }
+    storage->data = key;
+    storage->length = strlen(key);
+    return storage;
 }
 
-static size_t
-hz_map_next_bucket_count(size_t current_count)
+/**
+ * Same as hz_map_lookup_key(), but for the i-th key in an array of keys
+ * passed to a public function. For string-keyed maps, this is an array
+ * of string pointers.
+ */
+static const void *
+hz_map_lookup_key_at(
+    const hz_map *map,
+    const void *keys,
+    size_t i,
+    hz_map_string_key *storage)
 {
-    if (current_count > (size_t)(SIZE_MAX / SCALING_FACTOR)) {
-        return SIZE_MAX;
-    } else if (current_count == 0) {
-        return INITIAL_CAPACITY;
-    } else {
-        return (size_t)(current_count * SCALING_FACTOR);
+    if (map->arena == NULL) {
+        return (const char *)keys + i * map->key_size;
     }
+    return hz_map_lookup_key(map, ((const char *const *)keys)[i], storage);
 }
 
-static void
-hz_map_resize(hz_map *map)
+static hz_map_arena *
+hz_map_arena_new(void)
 {
-    size_t old_size = map->bucket_count;
+    hz_map_arena *arena = hz_malloc(1, sizeof(hz_map_arena));
+    arena->refs = 1;
+    arena->blocks = NULL;
+    arena->used = 0;
+    return arena;
+}
 
-    // Allocate and initialize new bucket array
-    size_t new_size = hz_map_next_bucket_count(old_size);
-    hz_map_entry **new_buckets = hz_malloc(new_size, sizeof(hz_map_entry *));
-    for (size_t i = 0; i < new_size; ++i) {
-        new_buckets[i] = NULL;
+static void
+hz_map_arena_release(hz_map_arena *arena)
+{
+    if (arena == NULL || --arena->refs > 0) {
+        return;
     }
+    hz_map_arena_block *block = arena->blocks;
+    while (block != NULL) {
+        hz_map_arena_block *next = block->next;
+        hz_free(block);
+        block = next;
+    }
+    hz_free(arena);
+}
 
-    // Move entries to the new array
-    hz_map_entry **old_buckets = map->buckets;
-    for (size_t i = 0; i < old_size; ++i) {
-        hz_map_entry *e = old_buckets[i];
-        while (e != NULL) {
-            size_t dest_index = hz_map_get_bucket_index(e->hash, new_size);
-            hz_map_entry *old_head = new_buckets[dest_index];
-            new_buckets[dest_index] = e;
-            e = e->next;
-            new_buckets[dest_index]->next = old_head;
+/**
+ * Copies a string of the given length (plus a NUL terminator) into
+ * the arena, and returns the copy.
+ */
+static const char *
+hz_map_arena_intern(hz_map_arena *arena, const char *str, size_t length)
+{
+    if (length > SIZE_MAX - sizeof(hz_map_arena_block) - 1) {
+        hz_abort("Key is too large: %zu", length);
+    }
+    size_t size = length + 1;
+    hz_map_arena_block *block = arena->blocks;
+    if (block == NULL || block->capacity - block->used < size) {
+        size_t capacity = ARENA_MIN_BLOCK_SIZE;
+        if (block != NULL) {
+            capacity = hz_min(block->capacity, ARENA_MAX_BLOCK_SIZE / 2) * 2;
         }
+        capacity = hz_max(capacity, size);
+        block = hz_malloc(1, sizeof(hz_map_arena_block) + capacity);
+        block->next = arena->blocks;
+        block->capacity = capacity;
+        block->used = 0;
+        arena->blocks = block;
     }
-    map->bucket_count = new_size;
-    map->buckets = new_buckets;
-
-    // Free old bucket array
-    hz_free(old_buckets);
+    char *copy = &block->data[block->used];
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    block->used += size;
+    arena->used += size;
+    return copy;
 }
 
-static bool
-hz_map_should_resize(const hz_map *map, size_t index)
+/**
+ * Gets the key of an entry in the form that public functions return it,
+ * which for string-keyed maps is the string itself.
+ */
+static const void *
+hz_map_entry_public_key(const hz_map *map, const hz_map_entry *entry)
 {
-    if (map->bucket_count == 0) {
-        // Always need to resize an empty map
-        return true;
-    } else if (map->buckets[index] == NULL) {
-        // If we don't have a collision, don't resize even
-        // if we are over the load factor
-        return false;
-    } else if (map->bucket_count == SIZE_MAX) {
-        // Can't resize a full map (though this case will
-        // probably never be hit since we would reach the
-        // maximum memory far before this)
-        return false;
-    } else {
-        // Otherwise, resize if we are over the load factor
-        return map->size >= (size_t)(map->bucket_count * LOAD_FACTOR);
+    const void *key = hz_map_entry_key(map, entry);
+    if (map->arena != NULL) {
+        return ((const hz_map_string_key *)key)->data;
     }
+    return key;
 }
 
-static void
-hz_map_add_entry(hz_map *map, size_t hash, const void *key, const void *value)
+static hz_map_entry *
+hz_map_entry_alloc(hz_map *map)
 {
-    // First find which bucket this entry belongs to,
-    // since we only resize the map if we've reached the
-    // load factor AND we get a collision.
-    size_t index = 0;
-    if (map->bucket_count != 0) {
-        index = hz_map_get_bucket_index(hash, map->bucket_count);
+    if (map->pool != NULL) {
+        return hz_pool_alloc(map->pool->objects);
+    } else {
+        return hz_malloc(1, map->entry_size);
     }
+}
 
-    // Resize the map if necessary. If a resize is performed,
-    // we need to recalculate the bucket index.
-    if (hz_map_should_resize(map, index)) {
-        hz_map_resize(map);
-        index = hz_map_get_bucket_index(hash, map->bucket_count);
+static bool
+hz_map_entry_matches(
+    const hz_map *map,
+    const hz_map_entry *entry,
+    size_t hash,
+    const void *key)
+{
+    // If the hashes don't match, we don't need to compare the keys.
+    if (entry->hash != hash) {
+        return false;
     }
 
-    // Allocate entry and push it at the head of the bucket
-    hz_map_entry *new_entry = hz_map_entry_new(map, hash, key, value);
-    hz_map_entry *old_head = map->buckets[index];
-    new_entry->next = old_head;
-    map->buckets[index] = new_entry;
-    map->size++;
+    // If the hashes match, we still need to check that the keys are equal.
+    return map->cmp_func(key, hz_map_entry_key(map, entry)) == 0;
 }
 
+static hz_map_entry *
+hz_map_entry_clone(hz_map *map, const hz_map_entry *entry);
+
 static void
-hz_map_free_buckets(hz_map *map)
+hz_map_entry_free(hz_map *map, hz_map_entry *entry);
+
+/**
+ * Compares a key with the key of an entry in a bucket tree, returning
+ * -1, 0, or 1.
+ */
+static int
+hz_map_tree_cmp(const hz_map *map, size_t hash, const void *key, const hz_map_entry *entry)
 {
-    for (size_t i = 0; i < map->bucket_count; ++i) {
-        hz_map_entry *entry = map->buckets[i];
-        while (entry != NULL) {
-            hz_map_entry *next = entry->next;
-            hz_map_entry_free(entry);
-            entry = next;
-        }
+    if (hash != entry->hash) {
+        return hash < entry->hash ? -1 : 1;
     }
-    hz_free(map->buckets);
+    int cmp = map->order_func(key, hz_map_entry_key(map, entry));
+    return (cmp > 0) - (cmp < 0);
 }
 
-hz_map *
-hz_map_new(
-    size_t key_size,
-    size_t value_size,
+static size_t
+hz_map_tree_height(const hz_map_tree_node *node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+static hz_map_tree_node *
+hz_map_tree_update(hz_map_tree_node *node)
+{
+    node->height = hz_max(hz_map_tree_height(node->left), hz_map_tree_height(node->right)) + 1;
+    return node;
+}
+
+static hz_map_tree_node *
+hz_map_tree_rotate_left(hz_map_tree_node *node)
+{
+    hz_map_tree_node *right = node->right;
+    node->right = right->left;
+    right->left = hz_map_tree_update(node);
+    return hz_map_tree_update(right);
+}
+
+static hz_map_tree_node *
+hz_map_tree_rotate_right(hz_map_tree_node *node)
+{
+    hz_map_tree_node *left = node->left;
+    node->left = left->right;
+    left->right = hz_map_tree_update(node);
+    return hz_map_tree_update(left);
+}
+
+/**
+ * Restores the AVL invariant at a node whose subtrees differ in height
+ * by at most 2, and returns the new root of the subtree.
+ */
+static hz_map_tree_node *
+hz_map_tree_balance(hz_map_tree_node *node)
+{
+    size_t left_height = hz_map_tree_height(node->left);
+    size_t right_height = hz_map_tree_height(node->right);
+    if (left_height > right_height + 1) {
+        hz_map_tree_node *left = node->left;
+        if (hz_map_tree_height(left->right) > hz_map_tree_height(left->left)) {
+            node->left = hz_map_tree_rotate_left(left);
+        }
+        return hz_map_tree_rotate_right(node);
+    } else if (right_height > left_height + 1) {
+        hz_map_tree_node *right = node->right;
+        if (hz_map_tree_height(right->left) > hz_map_tree_height(right->right)) {
+            node->right = hz_map_tree_rotate_right(right);
+        }
+        return hz_map_tree_rotate_left(node);
+    }
+    return hz_map_tree_update(node);
+}
+
+/**
+ * Inserts a node for an entry whose key is not in the tree yet, and
+ * returns the new root.
+ */
+static hz_map_tree_node *
+hz_map_tree_insert(const hz_map *map, hz_map_tree_node *node, hz_map_tree_node *new_node)
+{
+    if (node == NULL) {
+        return new_node;
+    }
+    const hz_map_entry *entry = new_node->entry;
+    if (hz_map_tree_cmp(map, entry->hash, hz_map_entry_key(map, entry), node->entry) < 0) {
+        node->left = hz_map_tree_insert(map, node->left, new_node);
+    } else {
+        node->right = hz_map_tree_insert(map, node->right, new_node);
+    }
+    return hz_map_tree_balance(node);
+}
+
+static hz_map_tree_node *
+hz_map_tree_remove_min(hz_map_tree_node *node, hz_map_tree_node **out_min)
+{
+    if (node->left == NULL) {
+        *out_min = node;
+        return node->right;
+    }
+    node->left = hz_map_tree_remove_min(node->left, out_min);
+    return hz_map_tree_balance(node);
+}
+
+/**
+ * Removes the node for a key that is in the tree, and returns the new
+ * root. The removed node is written to out_node.
+ */
+static hz_map_tree_node *
+hz_map_tree_remove(
+    const hz_map *map,
+    hz_map_tree_node *node,
+    size_t hash,
+    const void *key,
+    hz_map_tree_node **out_node)
+{
+    int cmp = hz_map_tree_cmp(map, hash, key, node->entry);
+    if (cmp < 0) {
+        node->left = hz_map_tree_remove(map, node->left, hash, key, out_node);
+    } else if (cmp > 0) {
+        node->right = hz_map_tree_remove(map, node->right, hash, key, out_node);
+    } else {
+        *out_node = node;
+        if (node->left == NULL) {
+            return node->right;
+        } else if (node->right == NULL) {
+            return node->left;
+        }
+
+        // Replace the node with its successor
+        hz_map_tree_node *successor;
+        hz_map_tree_node *right = hz_map_tree_remove_min(node->right, &successor);
+        successor->left = node->left;
+        successor->right = right;
+        node = successor;
+    }
+    return hz_map_tree_balance(node);
+}
+
+static hz_map_entry *
+hz_map_tree_find(const hz_map *map, const hz_map_tree_node *node, size_t hash, const void *key)
+{
+    while (node != NULL) {
+        int cmp = hz_map_tree_cmp(map, hash, key, node->entry);
+        if (cmp == 0) {
+            return node->entry;
+        }
+        node = cmp < 0 ? node->left : node->right;
+    }
+    return NULL;
+}
+
+/**
+ * Gets the entry that comes right before the given key in the tree
+ * (whether or not the key is in it), or NULL if there is none. This is
+ * the entry whose next pointer links to the key's place in the chain.
+ */
+static hz_map_entry *
+hz_map_tree_predecessor(const hz_map *map, const hz_map_tree_node *node, size_t hash, const void *key)
+{
+    hz_map_entry *pred = NULL;
+    while (node != NULL) {
+        if (hz_map_tree_cmp(map, hash, key, node->entry) > 0) {
+            pred = node->entry;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return pred;
+}
+
+static hz_map_tree_node *
+hz_map_tree_node_new(hz_map_entry *entry)
+{
+    hz_map_tree_node *node = hz_malloc(1, sizeof(hz_map_tree_node));
+    node->left = NULL;
+    node->right = NULL;
+    node->entry = entry;
+    node->height = 1;
+    return node;
+}
+
+static void
+hz_map_tree_free(hz_map_tree_node *node)
+{
+    if (node != NULL) {
+        hz_map_tree_free(node->left);
+        hz_map_tree_free(node->right);
+        hz_free(node);
+    }
+}
+
+/**
+ * Relinks the chain of a bucket in tree order, starting at *tail, and
+ * returns the link after the last entry.
+ */
+static hz_map_entry **
+hz_map_tree_link(hz_map_tree_node *node, hz_map_entry **tail)
+{
+    if (node != NULL) {
+        tail = hz_map_tree_link(node->left, tail);
+        *tail = node->entry;
+        tail = hz_map_tree_link(node->right, &node->entry->next);
+    }
+    return tail;
+}
+
+static size_t
+hz_map_page_bucket_count(size_t bucket_count)
+{
+    return hz_min(bucket_count, PAGE_BUCKETS);
+}
+
+static size_t
+hz_map_page_count(size_t bucket_count)
+{
+    return (bucket_count + PAGE_BUCKETS - 1) / PAGE_BUCKETS;
+}
+
+/**
+ * Returns true if the chain starting at the given entry has at least
+ * TREEIFY_THRESHOLD entries, without walking the rest of it.
+ */
+static bool
+hz_map_chain_is_long(const hz_map_entry *entry)
+{
+    size_t length = 0;
+    while (entry != NULL && length < TREEIFY_THRESHOLD) {
+        entry = entry->next;
+        length++;
+    }
+    return length == TREEIFY_THRESHOLD;
+}
+
+/**
+ * Gets the root of the tree for the given bucket of a page, or NULL if
+ * the bucket is a plain chain. Only long chains have trees, so this
+ * doesn't read the page header for short ones.
+ */
+static hz_map_tree_node *
+hz_map_page_tree(const hz_map *map, const hz_map_page *page, size_t slot)
+{
+    if (map->order_func == NULL || !hz_map_chain_is_long(page->buckets[slot])) {
+        return NULL;
+    }
+    return page->trees[slot];
+}
+
+/**
+ * Indexes the chain in the given bucket of a page with a tree. The
+ * chain is relinked in tree order.
+ */
+static void
+hz_map_page_treeify(hz_map *map, hz_map_page *page, size_t slot)
+{
+    if (page->trees == NULL) {
+        page->trees = hz_calloc(page->slot_count, sizeof(hz_map_tree_node *));
+    }
+    hz_map_tree_node *root = NULL;
+    for (hz_map_entry *entry = page->buckets[slot]; entry != NULL; entry = entry->next) {
+        root = hz_map_tree_insert(map, root, hz_map_tree_node_new(entry));
+    }
+    *hz_map_tree_link(root, &page->buckets[slot]) = NULL;
+    page->trees[slot] = root;
+}
+
+/**
+ * Frees the trees of a page, but not the entries they index.
+ */
+static void
+hz_map_page_free_trees(hz_map_page *page)
+{
+    if (page->trees != NULL) {
+        for (size_t i = 0; i < page->slot_count; ++i) {
+            hz_map_tree_free(page->trees[i]);
+        }
+        hz_free(page->trees);
+    }
+}
+
+/**
+ * Adds an entry to the given bucket of a writable page, indexing the
+ * bucket with a tree if its chain has grown long enough.
+ */
+static void
+hz_map_page_push(hz_map *map, hz_map_page *page, size_t slot, hz_map_entry *entry)
+{
+    hz_map_entry **head = &page->buckets[slot];
+    hz_map_tree_node *root = hz_map_page_tree(map, page, slot);
+    if (root != NULL) {
+        const void *key = hz_map_entry_key(map, entry);
+        hz_map_entry *pred = hz_map_tree_predecessor(map, root, entry->hash, key);
+        hz_map_entry **link = pred != NULL ? &pred->next : head;
+        entry->next = *link;
+        *link = entry;
+        page->trees[slot] = hz_map_tree_insert(map, root, hz_map_tree_node_new(entry));
+        return;
+    }
+
+    entry->next = *head;
+    *head = entry;
+    if (map->order_func != NULL && hz_map_chain_is_long(entry)) {
+        hz_map_page_treeify(map, page, slot);
+    }
+}
+
+/**
+ * Unlinks the entry for the given key from the given bucket of a
+ * writable page, and returns it. Returns NULL if the key is not in the
+ * bucket.
+ */
+static hz_map_entry *
+hz_map_page_remove(hz_map *map, hz_map_page *page, size_t slot, size_t hash, const void *key)
+{
+    hz_map_entry **link = &page->buckets[slot];
+    hz_map_tree_node *root = hz_map_page_tree(map, page, slot);
+    if (root == NULL) {
+        while (*link != NULL) {
+            hz_map_entry *entry = *link;
+            if (hz_map_entry_matches(map, entry, hash, key)) {
+                *link = entry->next;
+                return entry;
+            }
+            link = &entry->next;
+        }
+        return NULL;
+    }
+
+    hz_map_entry *entry = hz_map_tree_find(map, root, hash, key);
+    if (entry == NULL) {
+        return NULL;
+    }
+    hz_map_entry *pred = hz_map_tree_predecessor(map, root, hash, key);
+    if (pred != NULL) {
+        link = &pred->next;
+    }
+    *link = entry->next;
+    hz_map_tree_node *node;
+    page->trees[slot] = hz_map_tree_remove(map, root, hash, key, &node);
+    hz_free(node);
+
+    if (!hz_map_chain_is_long(page->buckets[slot])) {
+        hz_map_tree_free(page->trees[slot]);
+        page->trees[slot] = NULL;
+    }
+    return entry;
+}
+
+/**
+ * Unlinks the first entry in the given bucket of a writable page, which
+ * must not be empty, and returns it.
+ */
+static hz_map_entry *
+hz_map_page_pop(hz_map *map, hz_map_page *page, size_t slot)
+{
+    hz_map_entry *entry = page->buckets[slot];
+    if (hz_map_page_tree(map, page, slot) != NULL) {
+        return hz_map_page_remove(map, page, slot, entry->hash, hz_map_entry_key(map, entry));
+    }
+    page->buckets[slot] = entry->next;
+    return entry;
+}
+
+static hz_map_page *
+hz_map_page_new(size_t slot_count)
+{
+    // Like the bucket arrays, this assumes NULL is all-bits-zero
+    hz_map_page *page = hz_calloc(1, sizeof(hz_map_page) + slot_count * sizeof(hz_map_entry *));
+    page->refs = 1;
+    page->slot_count = slot_count;
+    return page;
+}
+
+/**
+ * Copies the chain in the given bucket of one page (which must be
+ * empty) into the given bucket of another, along with its tree. The
+ * chain keeps its order.
+ */
+static void
+hz_map_page_copy_chain(
+    hz_map *map,
+    hz_map_page *dest,
+    size_t dest_slot,
+    const hz_map_page *src,
+    size_t src_slot)
+{
+    hz_map_entry **tail = &dest->buckets[dest_slot];
+    for (const hz_map_entry *entry = src->buckets[src_slot]; entry != NULL; entry = entry->next) {
+        *tail = hz_map_entry_clone(map, entry);
+        tail = &(*tail)->next;
+    }
+    if (hz_map_page_tree(map, src, src_slot) != NULL) {
+        hz_map_page_treeify(map, dest, dest_slot);
+    }
+}
+
+/**
+ * Creates an unshared copy of a page, including all of its entries and
+ * trees. Chains keep their order.
+ */
+static hz_map_page *
+hz_map_page_copy(hz_map *map, const hz_map_page *page)
+{
+    hz_map_page *copy = hz_map_page_new(page->slot_count);
+    for (size_t i = 0; i < page->slot_count; ++i) {
+        hz_map_page_copy_chain(map, copy, i, page, i);
+    }
+    return copy;
+}
+
+/**
+ * Frees every entry in a writable page, leaving its buckets empty.
+ */
+static void
+hz_map_page_empty(hz_map *map, hz_map_page *page)
+{
+    for (size_t i = 0; i < page->slot_count; ++i) {
+        hz_map_entry *entry = page->buckets[i];
+        while (entry != NULL) {
+            hz_map_entry *next = entry->next;
+            hz_map_entry_free(map, entry);
+            entry = next;
+        }
+        page->buckets[i] = NULL;
+    }
+    hz_map_page_free_trees(page);
+    page->trees = NULL;
+}
+
+/**
+ * Drops a reference to a page, freeing it and its entries if this
+ * was the last one.
+ */
+static void
+hz_map_page_release(hz_map *map, hz_map_page *page)
+{
+    if (page == NULL || --page->refs > 0) {
+        return;
+    }
+    hz_map_page_empty(map, page);
+    hz_free(page);
+}
+
+static size_t
+hz_map_chunk_page_count(size_t bucket_count)
+{
+    return hz_min(hz_map_page_count(bucket_count), CHUNK_PAGES);
+}
+
+static size_t
+hz_map_chunk_count(size_t bucket_count)
+{
+    return (bucket_count + CHUNK_BUCKETS - 1) / CHUNK_BUCKETS;
+}
+
+static hz_map_chunk *
+hz_map_chunk_new(size_t bucket_count)
+{
+    size_t page_count = hz_map_chunk_page_count(bucket_count);
+    hz_map_chunk *chunk = hz_calloc(1, sizeof(hz_map_chunk) + page_count * sizeof(hz_map_page *));
+    chunk->refs = 1;
+    return chunk;
+}
+
+/**
+ * Drops a reference to a chunk, releasing its pages if this was the
+ * last one.
+ */
+static void
+hz_map_chunk_release(hz_map *map, hz_map_chunk *chunk, size_t bucket_count)
+{
+    if (chunk == NULL || --chunk->refs > 0) {
+        return;
+    }
+    size_t page_count = hz_map_chunk_page_count(bucket_count);
+    for (size_t i = 0; i < page_count; ++i) {
+        hz_map_page_release(map, chunk->pages[i]);
+    }
+    hz_free(chunk);
+}
+
+/**
+ * Creates an empty table for the given map, which is flat unless the
+ * map has been snapshotted.
+ */
+static hz_map_table *
+hz_map_table_new(const hz_map *map, size_t bucket_count)
+{
+    // Chunks and pages are allocated lazily, so a new paged table is
+    // just a small zeroed directory, even for huge bucket counts
+    size_t chunk_count = hz_map_chunk_count(bucket_count);
+    hz_map_table *table = hz_calloc(1, sizeof(hz_map_table) + chunk_count * sizeof(hz_map_chunk *));
+    table->refs = 1;
+    if (!map->paged) {
+        table->flat = hz_map_page_new(bucket_count);
+    }
+    return table;
+}
+
+/**
+ * Drops a reference to a table, releasing its chunks if this was the
+ * last one.
+ */
+static void
+hz_map_table_release(hz_map *map, hz_map_table *table, size_t bucket_count)
+{
+    if (table == NULL || --table->refs > 0) {
+        return;
+    }
+    hz_map_page_release(map, table->flat);
+    size_t chunk_count = hz_map_chunk_count(bucket_count);
+    for (size_t i = 0; i < chunk_count; ++i) {
+        hz_map_chunk_release(map, table->chunks[i], bucket_count);
+    }
+    hz_free(table);
+}
+
+/**
+ * Gets the page holding the given bucket, or NULL if it hasn't been
+ * allocated, without modifying anything.
+ */
+static hz_map_page *
+hz_map_page_at(const hz_map_table *table, size_t index)
+{
+    if (table->flat != NULL) {
+        return table->flat;
+    }
+    const hz_map_chunk *chunk = table->chunks[index / CHUNK_BUCKETS];
+    if (chunk == NULL) {
+        return NULL;
+    }
+    return chunk->pages[index / PAGE_BUCKETS % CHUNK_PAGES];
+}
+
+/**
+ * Gets the index of the given bucket within its page.
+ */
+static size_t
+hz_map_page_slot(const hz_map_table *table, size_t index)
+{
+    return table->flat != NULL ? index : index % PAGE_BUCKETS;
+}
+
+/**
+ * Gets the first entry in the given bucket, without modifying anything.
+ */
+static hz_map_entry *
+hz_map_bucket_head(const hz_map_table *table, size_t index)
+{
+    const hz_map_page *page = hz_map_page_at(table, index);
+    if (page == NULL) {
+        return NULL;
+    }
+    return page->buckets[hz_map_page_slot(table, index)];
+}
+
+/**
+ * Returns true if the given bucket may be shared with a snapshot.
+ */
+static bool
+hz_map_bucket_shared(const hz_map_table *table, size_t index)
+{
+    if (table->flat != NULL) {
+        return false;
+    }
+    const hz_map_chunk *chunk = table->chunks[index / CHUNK_BUCKETS];
+    const hz_map_page *page = chunk->pages[index / PAGE_BUCKETS % CHUNK_PAGES];
+    return table->refs > 1 || chunk->refs > 1 || page->refs > 1;
+}
+
+/**
+ * Gets the page holding the given bucket so that it can be written
+ * to, first copying the table, chunk, and page if they are shared with
+ * a snapshot, or allocating them if they don't exist. Only the pointers
+ * in a shared table or chunk are copied (adding a reference to each
+ * child), while a shared page is deep-copied.
+ *
+ * This doesn't count as a modification of the map, since the copies
+ * have the same contents; hz_map_get_ref() uses it too. But copying a
+ * page moves its entries, so it bumps unshare_count to let cursors know
+ * to find their place again.
+ */
+static hz_map_page *
+hz_map_page_for_write(
+    hz_map *map,
+    hz_map_table **table_ptr,
+    size_t bucket_count,
+    size_t index)
+{
+    hz_map_table *table = *table_ptr;
+    if (table->flat != NULL) {
+        return table->flat;
+    }
+    if (table->refs > 1) {
+        size_t chunk_count = hz_map_chunk_count(bucket_count);
+        hz_map_table *copy = hz_map_table_new(map, bucket_count);
+        for (size_t i = 0; i < chunk_count; ++i) {
+            copy->chunks[i] = table->chunks[i];
+            if (copy->chunks[i] != NULL) {
+                copy->chunks[i]->refs++;
+            }
+        }
+        table->refs--;
+        table = *table_ptr = copy;
+    }
+
+    hz_map_chunk **chunk_ptr = &table->chunks[index / CHUNK_BUCKETS];
+    if (*chunk_ptr == NULL) {
+        *chunk_ptr = hz_map_chunk_new(bucket_count);
+    } else if ((*chunk_ptr)->refs > 1) {
+        size_t page_count = hz_map_chunk_page_count(bucket_count);
+        hz_map_chunk *copy = hz_map_chunk_new(bucket_count);
+        for (size_t i = 0; i < page_count; ++i) {
+            copy->pages[i] = (*chunk_ptr)->pages[i];
+            if (copy->pages[i] != NULL) {
+                copy->pages[i]->refs++;
+            }
+        }
+        (*chunk_ptr)->refs--;
+        *chunk_ptr = copy;
+    }
+
+    hz_map_page **page_ptr = &(*chunk_ptr)->pages[index / PAGE_BUCKETS % CHUNK_PAGES];
+    if (*page_ptr == NULL) {
+        *page_ptr = hz_map_page_new(hz_map_page_bucket_count(bucket_count));
+    } else if ((*page_ptr)->refs > 1) {
+        hz_map_page *copy = hz_map_page_copy(map, *page_ptr);
+        (*page_ptr)->refs--;
+        *page_ptr = copy;
+        map->unshare_count++;
+    }
+    return *page_ptr;
+}
+
+static hz_map_bloom *
+hz_map_bloom_new(size_t bucket_count)
+{
+    size_t block_count = 1;
+    while (block_count < bucket_count / BLOOM_BLOCK_BUCKETS) {
+        block_count *= 2;
+    }
+
+    // malloc() only guarantees alignment for the fundamental types,
+    // so over-allocate and align the blocks to a cache line ourselves
+    size_t blocks_size = block_count * HZ_CACHE_LINE_SIZE;
+    hz_map_bloom *bloom = hz_malloc(1, sizeof(hz_map_bloom) + blocks_size + HZ_CACHE_LINE_SIZE);
+    uintptr_t base = (uintptr_t)bloom->storage;
+    size_t padding = (HZ_CACHE_LINE_SIZE - base % HZ_CACHE_LINE_SIZE) % HZ_CACHE_LINE_SIZE;
+    bloom->refs = 1;
+    bloom->block_count = block_count;
+    bloom->blocks = (uint64_t *)(void *)(bloom->storage + padding);
+    memset(bloom->blocks, 0, blocks_size);
+    return bloom;
+}
+
+static hz_map_bloom *
+hz_map_bloom_copy(const hz_map_bloom *bloom)
+{
+    if (bloom == NULL) {
+        return NULL;
+    }
+    hz_map_bloom *copy = hz_map_bloom_new(bloom->block_count * BLOOM_BLOCK_BUCKETS);
+    hz_memcpy(copy->blocks, bloom->blocks, bloom->block_count, HZ_CACHE_LINE_SIZE);
+    return copy;
+}
+
+static void
+hz_map_bloom_release(hz_map_bloom *bloom)
+{
+    if (bloom != NULL && --bloom->refs == 0) {
+        hz_free(bloom);
+    }
+}
+
+/**
+ * Gets a writable version of the filter at the given address, copying
+ * it first if it is shared with a snapshot.
+ */
+static hz_map_bloom *
+hz_map_bloom_for_write(hz_map_bloom **bloom_ptr)
+{
+    if ((*bloom_ptr)->refs > 1) {
+        hz_map_bloom *copy = hz_map_bloom_copy(*bloom_ptr);
+        (*bloom_ptr)->refs--;
+        *bloom_ptr = copy;
+    }
+    return *bloom_ptr;
+}
+
+/**
+ * Mixes an entry hash for use by a Bloom filter. The low bits of the
+ * entry hash also select the bucket, so they are mixed with the high
+ * bits to keep the filter's bits independent of the bucket index.
+ */
+static uint64_t
+hz_map_bloom_mix(size_t hash)
+{
+    return hz_fmix64((uint64_t)hash);
+}
+
+/**
+ * Gets the block that records the given mixed hash. The probes use the
+ * low bits of the hash, and the block index uses the high ones.
+ */
+static uint64_t *
+hz_map_bloom_block(const hz_map_bloom *bloom, uint64_t h)
+{
+    size_t index = (size_t)(h >> (BLOOM_PROBES * 9)) & (bloom->block_count - 1);
+    return &bloom->blocks[index * BLOOM_BLOCK_WORDS];
+}
+
+static void
+hz_map_bloom_add(hz_map_bloom *bloom, size_t hash)
+{
+    uint64_t h = hz_map_bloom_mix(hash);
+    uint64_t *block = hz_map_bloom_block(bloom, h);
+    for (int i = 0; i < BLOOM_PROBES; ++i) {
+        unsigned int bits = (unsigned int)(h >> (i * 9));
+        block[(bits >> 6) % BLOOM_BLOCK_WORDS] |= UINT64_C(1) << (bits & 63);
+    }
+}
+
+static bool
+hz_map_bloom_may_contain(const hz_map_bloom *bloom, size_t hash)
+{
+    uint64_t h = hz_map_bloom_mix(hash);
+    const uint64_t *block = hz_map_bloom_block(bloom, h);
+    for (int i = 0; i < BLOOM_PROBES; ++i) {
+        unsigned int bits = (unsigned int)(h >> (i * 9));
+        if ((block[(bits >> 6) % BLOOM_BLOCK_WORDS] & (UINT64_C(1) << (bits & 63))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns false if the key with the given hash is definitely not in
+ * the map. Maps without a Bloom filter always return true.
+ */
+static bool
+hz_map_may_contain(const hz_map *map, size_t hash)
+{
+    return map->bloom == NULL || hz_map_bloom_may_contain(map->bloom, hash);
+}
+
+/**
+ * Records a new entry's hash in the map's Bloom filters. While a
+ * resize is in progress, the filter for the new bucket array has to
+ * see it too, since it replaces the current one once the resize is done.
+ */
+static void
+hz_map_bloom_insert(hz_map *map, size_t hash)
+{
+    if (map->bloom != NULL) {
+        hz_map_bloom_add(hz_map_bloom_for_write(&map->bloom), hash);
+    }
+    if (map->next_bloom != NULL) {
+        hz_map_bloom_add(hz_map_bloom_for_write(&map->next_bloom), hash);
+    }
+}
+
+/**
+ * Finds the entry for the given key in the given bucket of a page, or
+ * returns NULL if the key is not in the bucket.
+ */
+static hz_map_entry *
+hz_map_find_in_page(
+    const hz_map *map,
+    const hz_map_page *page,
+    size_t slot,
+    size_t hash,
+    const void *key)
+{
+    // Search the chain directly until it turns out to be long enough to
+    // have a tree. This way, lookups in short chains never have to read
+    // the page header for the trees array.
+    hz_map_entry *entry = page->buckets[slot];
+    for (size_t i = 0; entry != NULL; ++i) {
+        if (i == TREEIFY_THRESHOLD - 1 && map->order_func != NULL) {
+            return hz_map_tree_find(map, page->trees[slot], hash, key);
+        }
+        if (hz_map_entry_matches(map, entry, hash, key)) {
+            return entry;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+static hz_map_entry *
+hz_map_find_in_bucket(
+    const hz_map *map,
+    const hz_map_table *table,
+    size_t index,
+    size_t hash,
+    const void *key)
+{
+    const hz_map_page *page = hz_map_page_at(table, index);
+    if (page == NULL) {
+        return NULL;
+    }
+    return hz_map_find_in_page(map, page, hz_map_page_slot(table, index), hash, key);
+}
+
+/**
+ * Returns true if the given old bucket index hasn't been migrated
+ * yet, i.e. the bucket may still hold entries.
+ */
+static bool
+hz_map_old_bucket_live(const hz_map *map, size_t old_index)
+{
+    return map->old_table != NULL && old_index >= map->migrate_index;
+}
+
+static hz_map_entry *
+hz_map_find_entry(const hz_map *map, size_t hash, const void *key)
+{
+    if (!hz_map_may_contain(map, hash)) {
+        return NULL;
+    }
+
+    // While a resize is in progress, entries that haven't been
+    // migrated yet are still in the old bucket array
+    if (map->old_table != NULL) {
+        size_t old_index = hz_map_get_bucket_index(hash, map->old_bucket_count);
+        if (hz_map_old_bucket_live(map, old_index)) {
+            hz_map_entry *entry = hz_map_find_in_bucket(map, map->old_table, old_index, hash, key);
+            if (entry != NULL) {
+                return entry;
+            }
+        }
+    }
+
+    if (map->bucket_count == 0) {
+        return NULL;
+    }
+    size_t index = hz_map_get_bucket_index(hash, map->bucket_count);
+    return hz_map_find_in_bucket(map, map->table, index, hash, key);
+}
+
+/**
+ * Finds the entry for the given key in the given bucket, making sure
+ * that it can be written to. Returns NULL if the key is not in the
+ * bucket.
+ */
+static hz_map_entry *
+hz_map_find_in_bucket_for_write(
+    hz_map *map,
+    hz_map_table **table_ptr,
+    size_t bucket_count,
+    size_t index,
+    size_t hash,
+    const void *key)
+{
+    // If the bucket is shared with a snapshot, only copy it if the key
+    // is actually there, so that lookups which miss don't unshare anything
+    hz_map_entry *entry = hz_map_find_in_bucket(map, *table_ptr, index, hash, key);
+    if (entry == NULL || !hz_map_bucket_shared(*table_ptr, index)) {
+        return entry;
+    }
+    hz_map_page *page = hz_map_page_for_write(map, table_ptr, bucket_count, index);
+    return hz_map_find_in_page(map, page, hz_map_page_slot(*table_ptr, index), hash, key);
+}
+
+/**
+ * Finds the entry for the given key, making sure that it can be written
+ * to. Returns NULL if the key is not in the map.
+ */
+static hz_map_entry *
+hz_map_find_entry_for_write(hz_map *map, size_t hash, const void *key)
+{
+    if (!hz_map_may_contain(map, hash)) {
+        return NULL;
+    }
+
+    if (map->old_table != NULL) {
+        size_t old_index = hz_map_get_bucket_index(hash, map->old_bucket_count);
+        if (hz_map_old_bucket_live(map, old_index)) {
+            hz_map_entry *entry = hz_map_find_in_bucket_for_write(
+                map, &map->old_table, map->old_bucket_count, old_index, hash, key);
+            if (entry != NULL) {
+                return entry;
+            }
+        }
+    }
+
+    if (map->bucket_count == 0) {
+        return NULL;
+    }
+    size_t index = hz_map_get_bucket_index(hash, map->bucket_count);
+    return hz_map_find_in_bucket_for_write(map, &map->table, map->bucket_count, index, hash, key);
+}
+
+/**
+ * Unlinks the entry for the given key from the given bucket and returns
+ * it, or returns NULL if the key is not in the bucket.
+ */
+static hz_map_entry *
+hz_map_remove_from_bucket(
+    hz_map *map,
+    hz_map_table **table_ptr,
+    size_t bucket_count,
+    size_t index,
+    size_t hash,
+    const void *key)
+{
+    hz_map_page *page = hz_map_page_at(*table_ptr, index);
+    if (page == NULL) {
+        return NULL;
+    }
+
+    // As above, don't unshare the bucket unless the key is there
+    size_t slot = hz_map_page_slot(*table_ptr, index);
+    if (hz_map_bucket_shared(*table_ptr, index)) {
+        if (hz_map_find_in_page(map, page, slot, hash, key) == NULL) {
+            return NULL;
+        }
+        page = hz_map_page_for_write(map, table_ptr, bucket_count, index);
+    }
+    return hz_map_page_remove(map, page, slot, hash, key);
+}
+
+/**
+ * Unlinks the entry for the given key from the map and returns it, or
+ * returns NULL if the key is not in the map. The entry is not freed.
+ */
+static hz_map_entry *
+hz_map_unlink_entry(hz_map *map, size_t hash, const void *key)
+{
+    if (!hz_map_may_contain(map, hash)) {
+        return NULL;
+    }
+
+    if (map->old_table != NULL) {
+        size_t old_index = hz_map_get_bucket_index(hash, map->old_bucket_count);
+        if (hz_map_old_bucket_live(map, old_index)) {
+            hz_map_entry *entry = hz_map_remove_from_bucket(
+                map, &map->old_table, map->old_bucket_count, old_index, hash, key);
+            if (entry != NULL) {
+                return entry;
+            }
+        }
+    }
+
+    if (map->bucket_count == 0) {
+        return NULL;
+    }
+    size_t index = hz_map_get_bucket_index(hash, map->bucket_count);
+    return hz_map_remove_from_bucket(map, &map->table, map->bucket_count, index, hash, key);
+}
+
+/**
+ * Gets the number of chains that may hold entries. While a resize is
+ * in progress, chains [0, old_bucket_count) are in the old bucket array
+ * and the rest are in the new one; otherwise, chain i is bucket i.
+ */
+static size_t
+hz_map_chain_count(const hz_map *map)
+{
+    return map->old_bucket_count + map->bucket_count;
+}
+
+static hz_map_entry *
+hz_map_chain_at(const hz_map *map, size_t chain_index)
+{
+    if (chain_index < map->old_bucket_count) {
+        return hz_map_bucket_head(map->old_table, chain_index);
+    } else {
+        return hz_map_bucket_head(map->table, chain_index - map->old_bucket_count);
+    }
+}
+
+/**
+ * Gets the entry at the given position in the given chain, which must
+ * have more than pos entries.
+ */
+static hz_map_entry *
+hz_map_chain_entry_at(const hz_map *map, size_t chain_index, size_t pos)
+{
+    hz_map_entry *entry = hz_map_chain_at(map, chain_index);
+    for (size_t i = 0; i < pos; ++i) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+static hz_map_entry *
+hz_map_entry_new(
+    hz_map *map,
+    size_t hash,
+    const void *key,
+    const void *value)
+{
+    hz_map_entry *entry = hz_map_entry_alloc(map);
+    entry->next = NULL;
+    entry->hash = hash;
+    hz_memcpy(hz_map_entry_key(map, entry), key, 1, map->key_size);
+    if (map->arena != NULL) {
+        hz_map_string_key *str = hz_map_entry_key(map, entry);
+        str->data = hz_map_arena_intern(map->arena, str->data, str->length);
+        map->key_bytes += str->length + 1;
+    }
+    if (value != NULL) {
+        hz_map_copy_value(hz_map_entry_value(map, entry), value, map->value_size);
+    } else {
+        memset(hz_map_entry_value(map, entry), 0, map->value_size);
+    }
+    return entry;
+}
+
+static hz_map_entry *
+hz_map_entry_clone(hz_map *map, const hz_map_entry *entry)
+{
+    hz_map_entry *clone = hz_map_entry_alloc(map);
+    clone->next = NULL;
+    clone->hash = entry->hash;
+    hz_memcpy(
+        hz_map_entry_key(map, clone),
+        hz_map_entry_key(map, entry),
+        1,
+        map->entry_size - map->key_offset);
+    return clone;
+}
+
+static void
+hz_map_entry_free(hz_map *map, hz_map_entry *entry)
+{
+    if (map->pool != NULL) {
+        hz_pool_release(map->pool->objects, entry);
+    } else {
+        hz_free(entry);
+    }
+}
+
+static size_t
+hz_map_next_bucket_count(size_t current_count)
+{
+    if (current_count > MAX_BUCKET_COUNT / SCALING_FACTOR) {
+        return MAX_BUCKET_COUNT;
+    } else if (current_count == 0) {
+        return INITIAL_CAPACITY;
+    } else {
+        return (size_t)(current_count * SCALING_FACTOR);
+    }
+}
+
+/**
+ * Moves entries from the old bucket array to the new one, stopping
+ * after max_entries entries have been moved or max_buckets buckets
+ * have been visited. Frees the old bucket array once it is empty.
+ */
+static void
+hz_map_migrate(hz_map *map, size_t max_entries, size_t max_buckets)
+{
+    while (map->migrate_index < map->old_bucket_count && max_buckets > 0) {
+        // Pop entries off the old chain and push them onto the new
+        // one. If we stop partway through the chain, the remaining
+        // entries stay where they are and can still be found
+        // since migrate_index hasn't moved past them. Empty buckets
+        // are skipped without unsharing their page.
+        if (hz_map_bucket_head(map->old_table, map->migrate_index) != NULL) {
+            hz_map_page *old_page = hz_map_page_for_write(
+                map, &map->old_table, map->old_bucket_count, map->migrate_index);
+            size_t old_slot = hz_map_page_slot(map->old_table, map->migrate_index);
+            while (old_page->buckets[old_slot] != NULL) {
+                if (max_entries == 0) {
+                    return;
+                }
+                hz_map_entry *e = hz_map_page_pop(map, old_page, old_slot);
+                size_t dest_index = hz_map_get_bucket_index(e->hash, map->bucket_count);
+                hz_map_page *dest_page = hz_map_page_for_write(
+                    map, &map->table, map->bucket_count, dest_index);
+                hz_map_page_push(map, dest_page, hz_map_page_slot(map->table, dest_index), e);
+                if (map->next_bloom != NULL) {
+                    hz_map_bloom_add(hz_map_bloom_for_write(&map->next_bloom), e->hash);
+                }
+                max_entries--;
+            }
+        }
+        map->migrate_index++;
+        max_buckets--;
+    }
+
+    if (map->migrate_index == map->old_bucket_count) {
+        hz_map_table_release(map, map->old_table, map->old_bucket_count);
+        map->old_bucket_count = 0;
+        map->old_table = NULL;
+        map->migrate_index = 0;
+
+        // Every entry is in the new filter now, and it has none of
+        // the bits left behind by removed entries
+        if (map->next_bloom != NULL) {
+            hz_map_bloom_release(map->bloom);
+            map->bloom = map->next_bloom;
+            map->next_bloom = NULL;
+            map->bloom_removed = 0;
+        }
+    }
+}
+
+static void
+hz_map_finish_migration(hz_map *map)
+{
+    hz_map_migrate(map, SIZE_MAX, SIZE_MAX);
+}
+
+/**
+ * Performs a bounded amount of incremental resize work, if a resize is
+ * in progress. Must be called only from operations that modify the map.
+ */
+static void
+hz_map_migrate_step(hz_map *map)
+{
+    if (map->old_table != NULL) {
+        hz_map_touch(map);
+        hz_map_migrate(map, MIGRATION_ENTRIES, MIGRATION_BUCKETS);
+    }
+}
+
+/**
+ * Gets the smallest bucket count that can hold the given number of
+ * entries without exceeding the load factor.
+ */
+static size_t
+hz_map_bucket_count_for(size_t num_entries)
+{
+    size_t count = INITIAL_CAPACITY;
+    while (count < MAX_BUCKET_COUNT && (size_t)(count * LOAD_FACTOR) <= num_entries) {
+        count *= 2;
+    }
+    return count;
+}
+
+/**
+ * Moves the entries to a new bucket array with the given size. If
+ * incremental is true, only a few entries are moved now and the rest
+ * are moved by subsequent operations.
+ */
+static void
+hz_map_resize_to(hz_map *map, size_t new_size, bool incremental)
+{
+    // We can only have one resize in progress at a time. Insertions and
+    // removals wait for the current one to finish before starting
+    // another, so this only happens for explicit resizes such as
+    // hz_map_reserve(), which may take O(n) time anyway.
+    if (map->old_table != NULL) {
+        hz_map_finish_migration(map);
+    }
+
+    // A new paged table starts out with no pages, which are allocated as
+    // entries are added to them, and a new flat table is zeroed lazily by
+    // the allocator. This keeps the cost of starting a resize low, which
+    // matters when resizing incrementally.
+    hz_map_table *new_table = hz_map_table_new(map, new_size);
+
+    // Entries are added to the new Bloom filter as they are moved, so
+    // it is ready to replace the current one once the move is done.
+    // Until then, the current filter still covers every entry.
+    if (map->bloom_filter) {
+        map->next_bloom = hz_map_bloom_new(new_size);
+    }
+
+    // Make the current array the old one, and move entries over.
+    // If incremental resizing is enabled, we only move a few entries
+    // now and leave the rest to subsequent operations.
+    if (map->bucket_count != 0) {
+        map->old_bucket_count = map->bucket_count;
+        map->old_table = map->table;
+        map->migrate_index = 0;
+    }
+    map->bucket_count = new_size;
+    map->table = new_table;
+    map->resizes++;
+    if (incremental) {
+        hz_map_migrate(map, MIGRATION_ENTRIES, MIGRATION_BUCKETS);
+    } else {
+        hz_map_finish_migration(map);
+    }
+}
+
+static void
+hz_map_resize(hz_map *map)
+{
+    size_t new_size = hz_map_next_bucket_count(map->bucket_count);
+    hz_map_resize_to(map, new_size, map->incremental_resize);
+}
+
+static bool
+hz_map_should_resize(const hz_map *map, size_t index)
+{
+    if (map->bucket_count == 0) {
+        // Always need to resize an empty map
+        return true;
+    } else if (map->old_table != NULL) {
+        // Starting another resize would mean finishing this one all at
+        // once. Go over the load factor instead; every modification
+        // moves more entries, so the current resize finishes soon.
+        return false;
+    } else if (hz_map_bucket_head(map->table, index) == NULL) {
+        // If we don't have a collision, don't resize even
+        // if we are over the load factor
+        return false;
+    } else if (map->bucket_count == MAX_BUCKET_COUNT) {
+        // Can't resize a full map (though this case will
+        // probably never be hit since we would reach the
+        // maximum memory far before this)
+        return false;
+    } else {
+        // Otherwise, resize if we are over the load factor
+        return map->size >= (size_t)(map->bucket_count * LOAD_FACTOR);
+    }
+}
+
+/**
+ * Inserts a new entry for a key that is not already in the map, and
+ * returns it. If value is NULL, the entry's value is zero-filled.
+ */
+static hz_map_entry *
+hz_map_add_entry(hz_map *map, size_t hash, const void *key, const void *value)
+{
+    // First find which bucket this entry belongs to,
+    // since we only resize the map if we've reached the
+    // load factor AND we get a collision.
+    size_t index = 0;
+    if (map->bucket_count != 0) {
+        index = hz_map_get_bucket_index(hash, map->bucket_count);
+    }
+
+    // Resize the map if necessary. If a resize is performed,
+    // we need to recalculate the bucket index.
+    if (hz_map_should_resize(map, index)) {
+        hz_map_resize(map);
+        index = hz_map_get_bucket_index(hash, map->bucket_count);
+    }
+
+    // Allocate entry and add it to the bucket
+    hz_map_page *page = hz_map_page_for_write(map, &map->table, map->bucket_count, index);
+    hz_map_entry *new_entry = hz_map_entry_new(map, hash, key, value);
+    hz_map_page_push(map, page, hz_map_page_slot(map->table, index), new_entry);
+    hz_map_bloom_insert(map, hash);
+    map->size++;
+    return new_entry;
+}
+
+/**
+ * Frees a table, its chunks, and its pages without walking the
+ * chains, for when the entries are freed separately.
+ */
+static void
+hz_map_table_free_pages(hz_map_table *table, size_t bucket_count)
+{
+    if (table == NULL) {
+        return;
+    }
+    if (table->flat != NULL) {
+        hz_map_page_free_trees(table->flat);
+        hz_free(table->flat);
+    }
+    size_t chunk_count = hz_map_chunk_count(bucket_count);
+    size_t page_count = hz_map_chunk_page_count(bucket_count);
+    for (size_t i = 0; i < chunk_count; ++i) {
+        hz_map_chunk *chunk = table->chunks[i];
+        if (chunk != NULL) {
+            for (size_t j = 0; j < page_count; ++j) {
+                if (chunk->pages[j] != NULL) {
+                    hz_map_page_free_trees(chunk->pages[j]);
+                    hz_free(chunk->pages[j]);
+                }
+            }
+            hz_free(chunk);
+        }
+    }
+    hz_free(table);
+}
+
+static void
+hz_map_free_buckets(hz_map *map)
+{
+    hz_map_bloom_release(map->bloom);
+    hz_map_bloom_release(map->next_bloom);
+
+    // If the entries came from a pool that only we use, we can
+    // release all of them at once without walking the chains. No
+    // other map can share our pages, since snapshots share the pool.
+    if (map->pool != NULL && map->pool->refs == 1) {
+        hz_pool_clear(map->pool->objects);
+        hz_map_table_free_pages(map->table, map->bucket_count);
+        hz_map_table_free_pages(map->old_table, map->old_bucket_count);
+        return;
+    }
+
+    hz_map_table_release(map, map->table, map->bucket_count);
+    hz_map_table_release(map, map->old_table, map->old_bucket_count);
+}
+
+static void
+hz_map_reset_buckets(hz_map *map)
+{
+    map->size = 0;
+    map->bucket_count = 0;
+    map->table = NULL;
+    map->old_bucket_count = 0;
+    map->old_table = NULL;
+    map->migrate_index = 0;
+    map->bloom = NULL;
+    map->next_bloom = NULL;
+    map->bloom_removed = 0;
+}
+
+static hz_map_pool *
+hz_map_pool_new(size_t entry_size)
+{
+    hz_map_pool *pool = hz_malloc(1, sizeof(hz_map_pool));
+    pool->refs = 1;
+    pool->objects = hz_pool_new(entry_size);
+    return pool;
+}
+
+static void
+hz_map_pool_release(hz_map_pool *pool)
+{
+    if (pool != NULL && --pool->refs == 0) {
+        hz_pool_free(pool->objects);
+        hz_free(pool);
+    }
+}
+
+static void
+hz_map_reset_stats(hz_map *map)
+{
+    map->resizes = 0;
+#if defined(HZ_MAP_STATS)
+    map->gets = 0;
+    map->puts = 0;
+    map->removes = 0;
+#endif
+}
+
+/**
+ * Creates a new map with the same settings as the given one,
+ * but without any entries or pool.
+ */
+static hz_map *
+hz_map_clone_settings(const hz_map *map)
+{
+    hz_map *new_map = hz_malloc(1, sizeof(hz_map));
+    new_map->key_size = map->key_size;
+    new_map->value_size = map->value_size;
+    new_map->key_offset = map->key_offset;
+    new_map->value_offset = map->value_offset;
+    new_map->entry_size = map->entry_size;
+    new_map->hash_func = map->hash_func;
+    new_map->cmp_func = map->cmp_func;
+    new_map->order_func = map->order_func;
+    new_map->seed = map->seed;
+    new_map->pool = NULL;
+    new_map->arena = NULL;
+    new_map->key_bytes = 0;
+    new_map->incremental_resize = map->incremental_resize;
+    new_map->auto_shrink = map->auto_shrink;
+    new_map->bloom_filter = map->bloom_filter;
+    new_map->paged = false;
+    new_map->unshare_count = 0;
+    hz_map_reset_buckets(new_map);
+    hz_map_reset_stats(new_map);
+    new_map->mod_count = 0;
+    return new_map;
+}
+
+/**
+ * Creates an unshared deep copy of a table for the given map, which
+ * must not have been snapshotted, so the copy is flat.
+ */
+static hz_map_table *
+hz_map_table_copy(hz_map *map, const hz_map_table *table, size_t bucket_count)
+{
+    if (table == NULL) {
+        return NULL;
+    }
+    hz_map_table *copy = hz_map_table_new(map, bucket_count);
+    for (size_t index = 0; index < bucket_count; ++index) {
+        const hz_map_page *page = hz_map_page_at(table, index);
+        if (page != NULL) {
+            hz_map_page_copy_chain(map, copy->flat, index, page, hz_map_page_slot(table, index));
+        }
+    }
+    return copy;
+}
+
+/**
+ * Splits a flat table into pages so that it can be shared. Only the
+ * bucket heads and tree roots are moved; the entries stay where they
+ * are. Pages whose buckets are all empty are left unallocated.
+ */
+static void
+hz_map_table_split(hz_map_table *table, size_t bucket_count)
+{
+    if (table == NULL || table->flat == NULL) {
+        return;
+    }
+    hz_map_page *flat = table->flat;
+    size_t page_buckets = hz_map_page_bucket_count(bucket_count);
+    for (size_t start = 0; start < bucket_count; start += page_buckets) {
+        size_t used = 0;
+        for (size_t i = 0; i < page_buckets; ++i) {
+            used += flat->buckets[start + i] != NULL;
+        }
+        if (used == 0) {
+            continue;
+        }
+        hz_map_chunk **chunk_ptr = &table->chunks[start / CHUNK_BUCKETS];
+        if (*chunk_ptr == NULL) {
+            *chunk_ptr = hz_map_chunk_new(bucket_count);
+        }
+        hz_map_page *page = hz_map_page_new(page_buckets);
+        hz_memcpy(page->buckets, &flat->buckets[start], page_buckets, sizeof(hz_map_entry *));
+        for (size_t i = 0; flat->trees != NULL && i < page_buckets; ++i) {
+            if (flat->trees[start + i] != NULL) {
+                if (page->trees == NULL) {
+                    page->trees = hz_calloc(page_buckets, sizeof(hz_map_tree_node *));
+                }
+                page->trees[i] = flat->trees[start + i];
+            }
+        }
+        (*chunk_ptr)->pages[start / PAGE_BUCKETS % CHUNK_PAGES] = page;
+    }
+    hz_free(flat->trees);
+    hz_free(flat);
+    table->flat = NULL;
+}
+
+/**
+ * Copies the keys of every entry in the table into the map's arena.
+ * The table must not be shared.
+ */
+static void
+hz_map_table_intern_keys(hz_map *map, hz_map_table *table, size_t bucket_count)
+{
+    if (table == NULL) {
+        return;
+    }
+    for (size_t index = 0; index < bucket_count; ++index) {
+        for (hz_map_entry *entry = hz_map_bucket_head(table, index); entry != NULL; entry = entry->next) {
+            hz_map_string_key *str = hz_map_entry_key(map, entry);
+            str->data = hz_map_arena_intern(map->arena, str->data, str->length);
+        }
+    }
+}
+
+/**
+ * Moves the keys of a string-keyed map into a new arena that holds
+ * nothing else, and releases the old one. The map's tables must not
+ * be shared.
+ */
+static void
+hz_map_rebuild_arena(hz_map *map)
+{
+    hz_map_arena *old_arena = map->arena;
+    map->arena = hz_map_arena_new();
+    hz_map_table_intern_keys(map, map->table, map->bucket_count);
+    hz_map_table_intern_keys(map, map->old_table, map->old_bucket_count);
+    hz_map_arena_release(old_arena);
+}
+
+/**
+ * Compacts the key arena if most of it belongs to removed keys. This
+ * is only possible if no snapshot shares the arena, since snapshots
+ * may still be using the removed keys.
+ */
+static void
+hz_map_maybe_compact_arena(hz_map *map)
+{
+    if (map->arena == NULL || map->arena->refs > 1) {
+        return;
+    }
+    size_t waste = map->arena->used - map->key_bytes;
+    if (waste > map->key_bytes && waste > ARENA_COMPACT_MIN_WASTE) {
+        hz_map_rebuild_arena(map);
+    }
+}
+
+void
+hz_map_options_init(hz_map_options *options)
+{
+    hz_check_null(options);
+    options->use_pool = false;
+    options->incremental_resize = false;
+    options->auto_shrink = false;
+    options->bloom_filter = false;
+    options->order_func = NULL;
+    options->seed = 0;
+}
+
+hz_map *
+hz_map_new(
+    size_t key_size,
+    size_t value_size,
     hz_map_hash_func hash_func,
     hz_map_cmp_func cmp_func)
+{
+    return hz_map_new_with_options(key_size, value_size, hash_func, cmp_func, NULL);
+}
+
+hz_map *
+hz_map_new_with_options(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_map_options *options)
 {
     hz_check_null(hash_func);
     hz_check_null(cmp_func);
+    hz_map_options defaults;
+    if (options == NULL) {
+        hz_map_options_init(&defaults);
+        options = &defaults;
+    }
+
     hz_map *map = hz_malloc(1, sizeof(hz_map));
     map->key_size = key_size;
     map->value_size = value_size;
+    hz_map_init_layout(map);
     map->hash_func = hash_func;
     map->cmp_func = cmp_func;
+    map->order_func = options->order_func;
+    map->seed = options->seed;
+    map->pool = NULL;
+    if (options->use_pool) {
+        map->pool = hz_map_pool_new(map->entry_size);
+    }
+    map->arena = NULL;
+    map->key_bytes = 0;
+    map->incremental_resize = options->incremental_resize;
+    map->auto_shrink = options->auto_shrink;
+    map->bloom_filter = options->bloom_filter;
+    map->paged = false;
+    map->unshare_count = 0;
+    hz_map_reset_buckets(map);
+    hz_map_reset_stats(map);
+    map->mod_count = 0;
+    return map;
+}
+
+hz_map *
+hz_map_new_string(size_t value_size, const hz_map_options *options)
+{
+    hz_map *map = hz_map_new_with_options(
+        sizeof(hz_map_string_key),
+        value_size,
+        hz_map_string_hash,
+        hz_map_string_cmp,
+        options);
+    map->order_func = hz_map_string_order;
+    map->arena = hz_map_arena_new();
+    return map;
+}
+
+hz_map *
+hz_map_new_with_capacity(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    size_t capacity)
+{
+    hz_map *map = hz_map_new(key_size, value_size, hash_func, cmp_func);
+    hz_map_reserve(map, capacity);
+    return map;
+}
+
+hz_map *
+hz_map_copy(const hz_map *map)
+{
+    hz_check_null(map);
+    hz_map *new_map = hz_map_clone_settings(map);
+    if (map->pool != NULL) {
+        new_map->pool = hz_map_pool_new(map->entry_size);
+    }
+
+    // Copy page by page, including any resize in progress
+    new_map->size = map->size;
+    new_map->bucket_count = map->bucket_count;
+    new_map->table = hz_map_table_copy(new_map, map->table, map->bucket_count);
+    new_map->old_bucket_count = map->old_bucket_count;
+    new_map->old_table = hz_map_table_copy(new_map, map->old_table, map->old_bucket_count);
+    new_map->migrate_index = map->migrate_index;
+    new_map->bloom = hz_map_bloom_copy(map->bloom);
+    new_map->next_bloom = hz_map_bloom_copy(map->next_bloom);
+    new_map->bloom_removed = map->bloom_removed;
+    new_map->mod_count = map->mod_count;
+
+    // The copied entries still point to keys in the original map's
+    // arena, so give the copy its own
+    if (map->arena != NULL) {
+        new_map->arena = map->arena;
+        new_map->arena->refs++;
+        new_map->key_bytes = map->key_bytes;
+        hz_map_rebuild_arena(new_map);
+    }
+    return new_map;
+}
+
+hz_map *
+hz_map_snapshot(hz_map *map)
+{
+    hz_check_null(map);
+
+    hz_map *new_map = hz_map_clone_settings(map);
+    if (map->pool != NULL) {
+        new_map->pool = map->pool;
+        new_map->pool->refs++;
+    }
+    if (map->arena != NULL) {
+        new_map->arena = map->arena;
+        new_map->arena->refs++;
+        new_map->key_bytes = map->key_bytes;
+    }
+
+    // Share the tables; whichever map writes to them next will copy
+    // the parts it touches. Both maps use paged tables from now on.
+    map->paged = true;
+    new_map->paged = true;
+    hz_map_table_split(map->table, map->bucket_count);
+    hz_map_table_split(map->old_table, map->old_bucket_count);
+    new_map->size = map->size;
+    new_map->bucket_count = map->bucket_count;
+    new_map->table = map->table;
+    if (new_map->table != NULL) {
+        new_map->table->refs++;
+    }
+    new_map->old_bucket_count = map->old_bucket_count;
+    new_map->old_table = map->old_table;
+    if (new_map->old_table != NULL) {
+        new_map->old_table->refs++;
+    }
+    new_map->migrate_index = map->migrate_index;
+    new_map->bloom = map->bloom;
+    if (new_map->bloom != NULL) {
+        new_map->bloom->refs++;
+    }
+    new_map->next_bloom = map->next_bloom;
+    if (new_map->next_bloom != NULL) {
+        new_map->next_bloom->refs++;
+    }
+    new_map->bloom_removed = map->bloom_removed;
+    return new_map;
+}
+
+void
+hz_map_free(hz_map *map)
+{
+    if (map != NULL) {
+        hz_map_free_buckets(map);
+        hz_map_pool_release(map->pool);
+        hz_map_arena_release(map->arena);
+        hz_free(map);
+    }
+}
+
+size_t
+hz_map_size(const hz_map *map)
+{
+    hz_check_null(map);
+    return map->size;
+}
+
+size_t
+hz_map_key_size(const hz_map *map)
+{
+    hz_check_null(map);
+    return map->key_size;
+}
+
+size_t
+hz_map_value_size(const hz_map *map)
+{
+    hz_check_null(map);
+    return map->value_size;
+}
+
+bool
+hz_map_is_string(const hz_map *map)
+{
+    hz_check_null(map);
+    return map->arena != NULL;
+}
+
+void
+hz_map_reserve(hz_map *map, size_t capacity)
+{
+    hz_check_null(map);
+    if (capacity == 0) {
+        return;
+    }
+
+    // Since the caller asked for it, the resize always happens up
+    // front, even if incremental resizing is enabled
+    size_t new_size = hz_map_bucket_count_for(capacity);
+    if (new_size > map->bucket_count) {
+        hz_map_touch(map);
+        hz_map_resize_to(map, new_size, false);
+    }
+}
+
+void
+hz_map_trim(hz_map *map)
+{
+    hz_check_null(map);
+    hz_map_touch(map);
+    if (map->size == 0) {
+        hz_map_free_buckets(map);
+        hz_map_reset_buckets(map);
+    } else {
+        size_t new_size = hz_map_bucket_count_for(map->size);
+        if (new_size < map->bucket_count) {
+            hz_map_resize_to(map, new_size, false);
+        } else {
+            hz_map_finish_migration(map);
+        }
+    }
+
+    // Snapshots may still use the keys of removed entries, so the arena
+    // can only be compacted if we're its only user
+    if (map->arena != NULL && map->arena->refs == 1 && map->arena->used > map->key_bytes) {
+        hz_map_rebuild_arena(map);
+    }
+}
+
+/**
+ * Frees every entry in a table, but keeps its directory and pages
+ * allocated. Parts of the table that are shared with a snapshot are
+ * released instead.
+ */
+static void
+hz_map_table_empty(hz_map *map, hz_map_table **table_ptr, size_t bucket_count)
+{
+    if ((*table_ptr)->refs > 1) {
+        hz_map_table_release(map, *table_ptr, bucket_count);
+        *table_ptr = hz_map_table_new(map, bucket_count);
+        return;
+    }
+    if ((*table_ptr)->flat != NULL) {
+        hz_map_page_empty(map, (*table_ptr)->flat);
+        return;
+    }
+    size_t chunk_count = hz_map_chunk_count(bucket_count);
+    size_t page_count = hz_map_chunk_page_count(bucket_count);
+    for (size_t i = 0; i < chunk_count; ++i) {
+        hz_map_chunk **chunk_ptr = &(*table_ptr)->chunks[i];
+        if (*chunk_ptr != NULL && (*chunk_ptr)->refs > 1) {
+            hz_map_chunk_release(map, *chunk_ptr, bucket_count);
+            *chunk_ptr = NULL;
+        }
+        for (size_t j = 0; *chunk_ptr != NULL && j < page_count; ++j) {
+            hz_map_page **page_ptr = &(*chunk_ptr)->pages[j];
+            if (*page_ptr != NULL && (*page_ptr)->refs > 1) {
+                hz_map_page_release(map, *page_ptr);
+                *page_ptr = NULL;
+            }
+            if (*page_ptr != NULL) {
+                hz_map_page_empty(map, *page_ptr);
+            }
+        }
+    }
+}
+
+void
+hz_map_clear_keep_capacity(hz_map *map)
+{
+    hz_check_null(map);
+    if (map->bucket_count == 0) {
+        return;
+    }
+    hz_map_touch(map);
+
+    hz_map_table_release(map, map->old_table, map->old_bucket_count);
+    map->old_bucket_count = 0;
+    map->old_table = NULL;
+    map->migrate_index = 0;
+
+    // Entries go back to the pool (if any) one by one, so the next batch
+    // of insertions can reuse them, and the pages stay allocated
+    hz_map_table_empty(map, &map->table, map->bucket_count);
     map->size = 0;
-    map->bucket_count = 0;
-    map->buckets = NULL;
-    map->mod_count = 0;
-    return map;
+
+    hz_map_bloom_release(map->bloom);
+    hz_map_bloom_release(map->next_bloom);
+    map->bloom = NULL;
+    map->next_bloom = NULL;
+    map->bloom_removed = 0;
+    if (map->bloom_filter) {
+        map->bloom = hz_map_bloom_new(map->bucket_count);
+    }
+    if (map->arena != NULL) {
+        hz_map_arena_release(map->arena);
+        map->arena = hz_map_arena_new();
+        map->key_bytes = 0;
+    }
 }
 
-hz_map *
-hz_map_copy(const hz_map *map)
+void
+hz_map_clear(hz_map *map)
 {
     hz_check_null(map);
-    hz_map *new_map = hz_malloc(1, sizeof(hz_map));
-    new_map->key_size = map->key_size;
-    new_map->value_size = map->value_size;
-    new_map->hash_func = map->hash_func;
-    new_map->cmp_func = map->cmp_func;
-    new_map->size = map->size;
-    new_map->bucket_count = map->bucket_count;
-    new_map->buckets = hz_malloc(map->bucket_count, sizeof(hz_map_entry *));
-    for (size_t i = 0; i < map->bucket_count; ++i) {
-        new_map->buckets[i] = hz_map_entry_copy(map, map->buckets[i]);
+    hz_map_touch(map);
+    hz_map_free_buckets(map);
+    hz_map_reset_buckets(map);
+    if (map->arena != NULL) {
+        hz_map_arena_release(map->arena);
+        map->arena = hz_map_arena_new();
+        map->key_bytes = 0;
     }
-    new_map->mod_count = map->mod_count;
-    return new_map;
+}
+
+static size_t
+hz_map_page_memory_usage(const hz_map_page *page)
+{
+    if (page == NULL) {
+        return 0;
+    }
+    size_t usage = sizeof(hz_map_page) + page->slot_count * sizeof(hz_map_entry *);
+    if (page->trees != NULL) {
+        usage += page->slot_count * sizeof(hz_map_tree_node *);
+    }
+    return usage;
+}
+
+/**
+ * Adds the directory, pages, chain lengths, and trees of a table to the
+ * stats, counting only the chains at or after start_index.
+ */
+static void
+hz_map_table_stats(
+    const hz_map *map,
+    const hz_map_table *table,
+    size_t bucket_count,
+    size_t start_index,
+    hz_map_stats *stats)
+{
+    if (table == NULL) {
+        return;
+    }
+    size_t chunk_count = hz_map_chunk_count(bucket_count);
+    size_t page_count = hz_map_chunk_page_count(bucket_count);
+    stats->memory_usage += sizeof(hz_map_table) + chunk_count * sizeof(hz_map_chunk *);
+    stats->memory_usage += hz_map_page_memory_usage(table->flat);
+    for (size_t i = 0; i < chunk_count; ++i) {
+        const hz_map_chunk *chunk = table->chunks[i];
+        if (chunk == NULL) {
+            continue;
+        }
+        stats->memory_usage += sizeof(hz_map_chunk) + page_count * sizeof(hz_map_page *);
+        for (size_t j = 0; j < page_count; ++j) {
+            stats->memory_usage += hz_map_page_memory_usage(chunk->pages[j]);
+        }
+    }
+
+    for (size_t index = start_index; index < bucket_count; ++index) {
+        size_t length = 0;
+        for (hz_map_entry *e = hz_map_bucket_head(table, index); e != NULL; e = e->next) {
+            length++;
+        }
+        stats->chain_lengths[hz_min(length, HZ_MAP_CHAIN_HISTOGRAM_SIZE - 1)]++;
+        stats->max_chain_length = hz_max(stats->max_chain_length, length);
+        if (map->order_func != NULL && length >= TREEIFY_THRESHOLD) {
+            stats->tree_buckets++;
+            stats->memory_usage += length * sizeof(hz_map_tree_node);
+        }
+    }
+}
+
+static size_t
+hz_map_bloom_memory_usage(const hz_map_bloom *bloom)
+{
+    if (bloom == NULL) {
+        return 0;
+    }
+    return sizeof(hz_map_bloom) + bloom->block_count * HZ_CACHE_LINE_SIZE + HZ_CACHE_LINE_SIZE;
 }
 
 void
-hz_map_free(hz_map *map)
+hz_map_get_stats(const hz_map *map, hz_map_stats *out_stats)
+{
+    hz_check_null(map);
+    hz_check_null(out_stats);
+    hz_map_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.size = map->size;
+    stats.bucket_count = map->bucket_count;
+    if (map->bucket_count != 0) {
+        stats.load_factor = (double)map->size / (double)map->bucket_count;
+    }
+    stats.resizes = map->resizes;
+#if defined(HZ_MAP_STATS)
+    stats.gets = __atomic_load_n(&map->gets, __ATOMIC_RELAXED);
+    stats.puts = __atomic_load_n(&map->puts, __ATOMIC_RELAXED);
+    stats.removes = __atomic_load_n(&map->removes, __ATOMIC_RELAXED);
+#endif
+
+    // Only the old buckets that haven't been migrated can hold entries,
+    // but the whole old table is still allocated
+    hz_map_table_stats(map, map->table, map->bucket_count, 0, &stats);
+    hz_map_table_stats(map, map->old_table, map->old_bucket_count, map->migrate_index, &stats);
+
+    stats.memory_usage += sizeof(hz_map) + map->size * map->entry_size;
+    if (map->pool != NULL) {
+        stats.memory_usage += sizeof(hz_map_pool);
+    }
+    if (map->arena != NULL) {
+        stats.memory_usage += sizeof(hz_map_arena);
+        for (const hz_map_arena_block *block = map->arena->blocks; block != NULL; block = block->next) {
+            stats.memory_usage += sizeof(hz_map_arena_block) + block->capacity;
+        }
+    }
+    stats.memory_usage += hz_map_bloom_memory_usage(map->bloom);
+    stats.memory_usage += hz_map_bloom_memory_usage(map->next_bloom);
+    *out_stats = stats;
+}
+
+/**
+ * Looks up the entry with the given hash and (internal form of the) key.
+ * Shared by hz_map_get() and hz_map_get_hashed().
+ */
+static bool
+hz_map_get_key(const hz_map *map, size_t hash, const void *key, void *out_value)
+{
+    hz_map_entry *entry = hz_map_find_entry(map, hash, key);
+    if (entry != NULL) {
+        if (out_value != NULL) {
+            hz_map_copy_value(out_value, hz_map_entry_value(map, entry), map->value_size);
+        }
+        return true;
+    } else {
+        return false;
+    }
+}
+
+bool
+hz_map_get(const hz_map *map, const void *key, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_map_count(map, gets, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    return hz_map_get_key(map, hz_map_hash_key(map, key), key, out_value);
+}
+
+size_t
+hz_map_hash(const hz_map *map, const void *key)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    return hz_map_hash_key(map, key);
+}
+
+bool
+hz_map_get_hashed(const hz_map *map, size_t hash, const void *key, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_map_count(map, gets, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    return hz_map_get_key(map, hash, key, out_value);
+}
+
+size_t
+hz_map_get_many(
+    const hz_map *map,
+    const void *keys,
+    size_t n,
+    void *out_values,
+    bool *out_found)
+{
+    hz_check_null(map);
+    if (n != 0) {
+        hz_check_null(keys);
+    }
+    hz_map_count(map, gets, n);
+
+    char *value_bytes = out_values;
+    hz_map_string_key strs[GET_BATCH_SIZE];
+    const void *batch_keys[GET_BATCH_SIZE];
+    size_t hashes[GET_BATCH_SIZE];
+    hz_map_page *const *pages[GET_BATCH_SIZE];
+    hz_map_entry *const *heads[GET_BATCH_SIZE];
+    size_t found = 0;
+    for (size_t start = 0; start < n; start += GET_BATCH_SIZE) {
+        size_t count = hz_min(n - start, GET_BATCH_SIZE);
+
+        // First pass: hash every key and prefetch its page pointer
+        // (unless the table is flat, and there is only one page). The
+        // top-level directory is small and almost always cached, so we
+        // don't bother prefetching it. During a resize we only prefetch
+        // the new bucket, which is where most keys will be by the time
+        // we get here.
+        const hz_map_table *table = map->table;
+        for (size_t i = 0; i < count; ++i) {
+            batch_keys[i] = hz_map_lookup_key_at(map, keys, start + i, &strs[i]);
+            hashes[i] = hz_map_hash_key(map, batch_keys[i]);
+            pages[i] = NULL;
+            if (map->bucket_count != 0 && hz_map_may_contain(map, hashes[i])) {
+                size_t index = hz_map_get_bucket_index(hashes[i], map->bucket_count);
+                if (table->flat != NULL) {
+                    pages[i] = &table->flat;
+                } else if (table->chunks[index / CHUNK_BUCKETS] != NULL) {
+                    pages[i] = &table->chunks[index / CHUNK_BUCKETS]->pages[index / PAGE_BUCKETS % CHUNK_PAGES];
+                    hz_map_prefetch(pages[i]);
+                }
+            }
+        }
+
+        // Second pass: prefetch each bucket
+        for (size_t i = 0; i < count; ++i) {
+            heads[i] = NULL;
+            if (pages[i] != NULL && *pages[i] != NULL) {
+                size_t index = hz_map_get_bucket_index(hashes[i], map->bucket_count);
+                heads[i] = &(*pages[i])->buckets[hz_map_page_slot(table, index)];
+                hz_map_prefetch(heads[i]);
+            }
+        }
+
+        // Third pass: prefetch the first entry in each bucket,
+        // which is usually the one we're looking for
+        for (size_t i = 0; i < count; ++i) {
+            if (heads[i] != NULL && *heads[i] != NULL) {
+                hz_map_prefetch(*heads[i]);
+                hz_map_prefetch(hz_map_entry_key(map, *heads[i]));
+            }
+        }
+
+        // Fourth pass: resolve each key, hopefully without stalling
+        for (size_t i = 0; i < count; ++i) {
+            hz_map_entry *entry = hz_map_find_entry(map, hashes[i], batch_keys[i]);
+            if (entry != NULL) {
+                if (value_bytes != NULL) {
+                    void *out_value = &value_bytes[(start + i) * map->value_size];
+                    hz_map_copy_value(out_value, hz_map_entry_value(map, entry), map->value_size);
+                }
+                found++;
+            }
+            if (out_found != NULL) {
+                out_found[start + i] = (entry != NULL);
+            }
+        }
+    }
+    return found;
+}
+
+/**
+ * Inserts or replaces the entry with the given hash and (internal form
+ * of the) key. Shared by hz_map_put() and hz_map_put_hashed().
+ */
+static bool
+hz_map_put_key(hz_map *map, size_t hash, const void *key, const void *value, void *out_value)
+{
+    hz_map_touch(map);
+    hz_map_migrate_step(map);
+    hz_map_entry *entry = hz_map_find_entry_for_write(map, hash, key);
+    if (entry != NULL) {
+        // If we already had a matching entry for the given key,
+        // just replace the entry's value
+        if (out_value != NULL) {
+            hz_map_copy_value(out_value, hz_map_entry_value(map, entry), map->value_size);
+        }
+        hz_map_copy_value(hz_map_entry_value(map, entry), value, map->value_size);
+        return true;
+    } else {
+        // No matching entry for the given key, insert a new one
+        hz_map_add_entry(map, hash, key, value);
+        return false;
+    }
+}
+
+bool
+hz_map_put(hz_map *map, const void *key, const void *value, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_check_null(value);
+    hz_map_count(map, puts, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    return hz_map_put_key(map, hz_map_hash_key(map, key), key, value, out_value);
+}
+
+bool
+hz_map_put_hashed(hz_map *map, size_t hash, const void *key, const void *value, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_check_null(value);
+    hz_map_count(map, puts, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    return hz_map_put_key(map, hash, key, value, out_value);
+}
+
+void *
+hz_map_get_ref(hz_map *map, const void *key)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_map_count(map, gets, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+
+    // If the entry is shared with a snapshot, this gives us our own
+    // copy of it to return, so writes through the reference don't show
+    // up in the snapshot. That isn't a modification, so it doesn't
+    // invalidate cursors.
+    size_t hash = hz_map_hash_key(map, key);
+    hz_map_entry *entry = hz_map_find_entry_for_write(map, hash, key);
+    if (entry != NULL) {
+        return hz_map_entry_value(map, entry);
+    } else {
+        return NULL;
+    }
+}
+
+const void *
+hz_map_find(const hz_map *map, const void *key)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_map_count(map, gets, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    hz_map_entry *entry = hz_map_find_entry(map, hz_map_hash_key(map, key), key);
+    if (entry != NULL) {
+        return hz_map_entry_value(map, entry);
+    } else {
+        return NULL;
+    }
+}
+
+/**
+ * Finds or inserts the entry with the given hash and (internal form of
+ * the) key. Shared by hz_map_emplace() and hz_map_emplace_hashed().
+ */
+static void *
+hz_map_emplace_key(hz_map *map, size_t hash, const void *key, bool *out_inserted)
+{
+    hz_map_touch(map);
+    hz_map_migrate_step(map);
+    hz_map_entry *entry = hz_map_find_entry_for_write(map, hash, key);
+    bool inserted = (entry == NULL);
+    if (inserted) {
+        entry = hz_map_add_entry(map, hash, key, NULL);
+    }
+    if (out_inserted != NULL) {
+        *out_inserted = inserted;
+    }
+    return hz_map_entry_value(map, entry);
+}
+
+void *
+hz_map_emplace(hz_map *map, const void *key, bool *out_inserted)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_map_count(map, puts, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    return hz_map_emplace_key(map, hz_map_hash_key(map, key), key, out_inserted);
+}
+
+void *
+hz_map_emplace_hashed(hz_map *map, size_t hash, const void *key, bool *out_inserted)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_map_count(map, puts, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    return hz_map_emplace_key(map, hash, key, out_inserted);
+}
+
+size_t
+hz_map_put_many(hz_map *map, const void *keys, const void *values, size_t n)
+{
+    hz_check_null(map);
+    if (n == 0) {
+        return 0;
+    }
+    hz_check_null(keys);
+    hz_check_null(values);
+    hz_map_count(map, puts, n);
+
+    // Size the map for the worst case (no duplicate keys) once, so
+    // that none of the insertions below trigger a resize
+    if (n > SIZE_MAX - map->size) {
+        hz_abort("Too many entries: %zu + %zu", map->size, n);
+    }
+    hz_map_reserve(map, map->size + n);
+    hz_map_touch(map);
+
+    const char *value_bytes = values;
+    size_t inserted = 0;
+    for (size_t i = 0; i < n; ++i) {
+        hz_map_string_key str;
+        const void *key = hz_map_lookup_key_at(map, keys, i, &str);
+        const void *value = &value_bytes[i * map->value_size];
+        size_t hash = hz_map_hash_key(map, key);
+        hz_map_entry *entry = hz_map_find_entry_for_write(map, hash, key);
+        if (entry != NULL) {
+            hz_map_copy_value(hz_map_entry_value(map, entry), value, map->value_size);
+        } else {
+            hz_map_add_entry(map, hash, key, value);
+            inserted++;
+        }
+    }
+    return inserted;
+}
+
+/**
+ * Checks that src can be merged into dst, aborting if not.
+ */
+static void
+hz_map_check_merge(const hz_map *dst, const hz_map *src)
+{
+    hz_check_null(src);
+    if (dst == src) {
+        hz_abort("Cannot merge a map into itself");
+    }
+    if (dst->key_size != src->key_size || (dst->arena == NULL) != (src->arena == NULL)) {
+        hz_abort("Maps have different key types");
+    }
+    if (dst->value_size != src->value_size) {
+        hz_abort("Maps have different value types");
+    }
+}
+
+static bool
+hz_map_same_hash(const hz_map *a, const hz_map *b)
+{
+    return a->hash_func == b->hash_func && a->seed == b->seed;
+}
+
+static size_t
+hz_map_shard_of_hash(size_t hash, size_t shard_count)
+{
+    return hz_hash_mix(hash, SHARD_SEED) % shard_count;
+}
+
+/**
+ * Merges one entry of src into dst. The caller must have already
+ * reserved space in dst. Returns true if the key was not already in dst.
+ */
+static bool
+hz_map_merge_entry(
+    hz_map *dst,
+    const hz_map *src,
+    const hz_map_entry *entry,
+    bool same_hash,
+    hz_map_combine_func combine_func,
+    void *ctx)
+{
+    hz_map_count(dst, puts, 1);
+    const void *key = hz_map_entry_key(src, entry);
+    const void *value = hz_map_entry_value(src, entry);
+    size_t hash = same_hash ? entry->hash : hz_map_hash_key(dst, key);
+    hz_map_entry *dst_entry = hz_map_find_entry_for_write(dst, hash, key);
+    if (dst_entry == NULL) {
+        hz_map_add_entry(dst, hash, key, value);
+        return true;
+    }
+    if (combine_func != NULL) {
+        combine_func(
+            hz_map_entry_public_key(dst, dst_entry),
+            hz_map_entry_value(dst, dst_entry),
+            value,
+            ctx);
+    } else {
+        hz_map_copy_value(hz_map_entry_value(dst, dst_entry), value, dst->value_size);
+    }
+    return false;
+}
+
+size_t
+hz_map_merge(hz_map *dst, const hz_map *src, hz_map_combine_func combine_func, void *ctx)
+{
+    hz_check_null(dst);
+    hz_map_check_merge(dst, src);
+    if (src->size == 0) {
+        return 0;
+    }
+
+    // The result holds at least as many keys as the larger map, and no
+    // more than both combined. Reserving the sum would double the size
+    // of maps that mostly share their keys, so only reserve the lower
+    // bound, and let inserts grow the map past it as usual.
+    hz_map_reserve(dst, hz_max(dst->size, src->size));
+    hz_map_touch(dst);
+
+    bool same_hash = hz_map_same_hash(dst, src);
+    size_t inserted = 0;
+    size_t chain_count = hz_map_chain_count(src);
+    for (size_t i = 0; i < chain_count; ++i) {
+        for (hz_map_entry *entry = hz_map_chain_at(src, i); entry != NULL; entry = entry->next) {
+            inserted += hz_map_merge_entry(dst, src, entry, same_hash, combine_func, ctx);
+        }
+    }
+    return inserted;
+}
+
+size_t
+hz_map_shard_of(const hz_map *map, const void *key, size_t shard_count)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    if (shard_count == 0) {
+        hz_abort("Shard count must be positive");
+    }
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    return hz_map_shard_of_hash(hz_map_hash_key(map, key), shard_count);
+}
+
+size_t
+hz_map_merge_shard(
+    hz_map *dst,
+    const hz_map *const *srcs,
+    size_t src_count,
+    size_t shard,
+    size_t shard_count,
+    hz_map_combine_func combine_func,
+    void *ctx)
+{
+    hz_check_null(dst);
+    if (src_count == 0) {
+        return 0;
+    }
+    hz_check_null(srcs);
+    if (shard >= shard_count) {
+        hz_abort("Shard index %zu out of range [0, %zu)", shard, shard_count);
+    }
+    size_t largest = 0;
+    for (size_t i = 0; i < src_count; ++i) {
+        hz_map_check_merge(dst, srcs[i]);
+        if (!hz_map_same_hash(srcs[i], srcs[0])) {
+            hz_abort("Maps have different hash functions or seeds");
+        }
+        largest = hz_max(largest, srcs[i]->size);
+    }
+
+    // Each shard gets about 1 / shard_count of the keys. As in
+    // hz_map_merge(), only reserve room for the keys of the largest map.
+    // The sources' hashes pick the shard, so entries outside of this
+    // shard are skipped without touching their keys.
+    hz_map_reserve(dst, hz_max(dst->size, largest / shard_count));
+    hz_map_touch(dst);
+    size_t inserted = 0;
+    for (size_t i = 0; i < src_count; ++i) {
+        const hz_map *src = srcs[i];
+        bool same_hash = hz_map_same_hash(dst, src);
+        size_t chain_count = hz_map_chain_count(src);
+        for (size_t j = 0; j < chain_count; ++j) {
+            for (hz_map_entry *entry = hz_map_chain_at(src, j); entry != NULL; entry = entry->next) {
+                if (hz_map_shard_of_hash(entry->hash, shard_count) == shard) {
+                    inserted += hz_map_merge_entry(dst, src, entry, same_hash, combine_func, ctx);
+                }
+            }
+        }
+    }
+    return inserted;
+}
+
+/**
+ * Shrinks the bucket array after a removal if automatic shrinking is
+ * enabled and the map is mostly empty. A resize that is already in
+ * progress has to finish first.
+ */
+static void
+hz_map_maybe_shrink(hz_map *map)
 {
-    if (map != NULL) {
-        hz_map_free_buckets(map);
-        hz_free(map);
+    if (!map->auto_shrink || map->old_table != NULL || map->bucket_count <= INITIAL_CAPACITY) {
+        return;
+    }
+    if (map->size < (size_t)(map->bucket_count * SHRINK_LOAD_FACTOR)) {
+        hz_map_resize_to(map, hz_map_bucket_count_for(map->size), map->incremental_resize);
     }
 }
 
-size_t
-hz_map_size(const hz_map *map)
+/**
+ * Counts a removal against the map's Bloom filter, and rebuilds the
+ * filter from the remaining entries if too many of its bits belong to
+ * removed ones. Rebuilding visits every bucket, but happens at most once
+ * per bucket_count * BLOOM_MAX_STALE removals, so it is O(1) amortized.
+ * During a resize, the filter is rebuilt by the resize instead.
+ */
+static void
+hz_map_maybe_rebuild_bloom(hz_map *map)
 {
-    hz_check_null(map);
-    return map->size;
+    if (map->bloom == NULL || map->next_bloom != NULL) {
+        return;
+    }
+    map->bloom_removed++;
+    if (map->bloom_removed <= (size_t)(map->bucket_count * BLOOM_MAX_STALE)) {
+        return;
+    }
+    hz_map_bloom *bloom = hz_map_bloom_new(map->bucket_count);
+    size_t chain_count = hz_map_chain_count(map);
+    for (size_t i = 0; i < chain_count; ++i) {
+        for (hz_map_entry *e = hz_map_chain_at(map, i); e != NULL; e = e->next) {
+            hz_map_bloom_add(bloom, e->hash);
+        }
+    }
+    hz_map_bloom_release(map->bloom);
+    map->bloom = bloom;
+    map->bloom_removed = 0;
 }
 
-void
-hz_map_clear(hz_map *map)
+/**
+ * Removes the entry with the given hash and (internal form of the) key.
+ * Shared by hz_map_remove(), hz_map_remove_hashed(), and
+ * hz_map_remove_ref().
+ */
+static bool
+hz_map_remove_key(hz_map *map, size_t hash, const void *key, void *out_value)
 {
-    hz_check_null(map);
+    hz_map_migrate_step(map);
+    hz_map_entry *curr = hz_map_unlink_entry(map, hash, key);
+    if (curr == NULL) {
+        return false;
+    }
+    if (out_value != NULL) {
+        hz_map_copy_value(out_value, hz_map_entry_value(map, curr), map->value_size);
+    }
+    if (map->arena != NULL) {
+        map->key_bytes -= ((hz_map_string_key *)hz_map_entry_key(map, curr))->length + 1;
+    }
+    hz_map_entry_free(map, curr);
     hz_map_touch(map);
-    hz_map_free_buckets(map);
-    map->size = 0;
-    map->bucket_count = 0;
-    map->buckets = NULL;
+    map->size--;
+    hz_map_maybe_compact_arena(map);
+    hz_map_maybe_shrink(map);
+    hz_map_maybe_rebuild_bloom(map);
+    return true;
 }
 
 bool
-hz_map_get(const hz_map *map, const void *key, void *out_value)
+hz_map_remove(hz_map *map, const void *key, void *out_value)
 {
     hz_check_null(map);
     hz_check_null(key);
+    hz_map_count(map, removes, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
 
-    size_t hash = hz_map_hash_key(map, key);
-    hz_map_entry *entry = hz_map_find_entry(map, hash, key);
-    if (entry != NULL) {
-        if (out_value != NULL) {
-            hz_memcpy(out_value, entry->value, 1, map->value_size);
-        }
-        return true;
-    } else {
+    // No buckets to check, fail fast
+    if (map->size == 0) {
         return false;
     }
+    return hz_map_remove_key(map, hz_map_hash_key(map, key), key, out_value);
 }
 
 bool
-hz_map_put(hz_map *map, const void *key, const void *value, void *out_value)
+hz_map_remove_hashed(hz_map *map, size_t hash, const void *key, void *out_value)
 {
     hz_check_null(map);
     hz_check_null(key);
-    hz_check_null(value);
-
-    hz_map_touch(map);
-    size_t hash = hz_map_hash_key(map, key);
-    hz_map_entry *entry = hz_map_find_entry(map, hash, key);
-    if (entry != NULL) {
-        // If we already had a matching entry for the given key,
-        // just replace the entry's value
-        if (out_value != NULL) {
-            hz_memcpy(out_value, entry->value, 1, map->value_size);
-        }
-        hz_memcpy(entry->value, value, 1, map->value_size);
-        return true;
-    } else {
-        // No matching entry for the given key, insert a new one
-        hz_map_add_entry(map, hash, key, value);
+    hz_map_count(map, removes, 1);
+    hz_map_string_key str;
+    key = hz_map_lookup_key(map, key, &str);
+    if (map->size == 0) {
         return false;
     }
+    return hz_map_remove_key(map, hash, key, out_value);
 }
 
-bool
-hz_map_remove(hz_map *map, const void *key, void *out_value)
+const void *
+hz_map_ref_key(const hz_map *map, const void *value)
 {
     hz_check_null(map);
-    hz_check_null(key);
+    hz_check_null(value);
+    const hz_map_entry *entry = (const void *)((const char *)value - map->value_offset);
+    return hz_map_entry_public_key(map, entry);
+}
 
-    // No buckets to check, fail fast
-    if (map->size == 0) {
-        return false;
-    }
+void
+hz_map_remove_ref(hz_map *map, void *value, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(value);
+    hz_map_count(map, removes, 1);
 
-    // Scan corresponding bucket for the entry
-    size_t hash = hz_map_hash_key(map, key);
-    size_t index = hz_map_get_bucket_index(hash, map->bucket_count);
-    hz_map_entry **entry = &map->buckets[index];
-    while (*entry != NULL) {
-        hz_map_entry *curr = *entry;
-        if (hz_map_entry_matches(map, curr, hash, key)) {
-            if (out_value != NULL) {
-                hz_memcpy(out_value, curr->value, 1, map->value_size);
-            }
-            *entry = curr->next;
-            hz_map_entry_free(curr);
-            hz_map_touch(map);
-            map->size--;
-            return true;
-        }
-        entry = &curr->next;
+    // The entry already knows its hash, so unlike hz_map_remove() this
+    // never calls the hash function
+    hz_map_entry *entry = (void *)((char *)value - map->value_offset);
+    if (!hz_map_remove_key(map, entry->hash, hz_map_entry_key(map, entry), out_value)) {
+        hz_abort("Value does not belong to the map");
     }
-
-    // Didn't find an entry for the given key
-    return false;
 }
 
 bool
@@ -413,7 +3180,7 @@ hz_map_equals(const hz_map *a, const hz_map *b, hz_map_cmp_func cmp_func)
     if (a == NULL || b == NULL) {
         return false;
     }
-    if (a->key_size != b->key_size) {
+    if (a->key_size != b->key_size || (a->arena == NULL) != (b->arena == NULL)) {
         hz_abort("Maps have different key types");
     }
     if (a->value_size != b->value_size) {
@@ -425,22 +3192,25 @@ hz_map_equals(const hz_map *a, const hz_map *b, hz_map_cmp_func cmp_func)
 
     // Since the maps have the same size, they are equal if and only if
     // each key in A also exists in B and maps to the same value.
-    for (size_t i = 0; i < a->bucket_count; ++i) {
-        hz_map_entry *a_entry = a->buckets[i];
+    for (size_t i = 0; i < hz_map_chain_count(a); ++i) {
+        hz_map_entry *a_entry = hz_map_chain_at(a, i);
         while (a_entry != NULL) {
             // Find corresponding entry in B
-            size_t b_hash = hz_map_hash_key(b, a_entry->key);
-            hz_map_entry *b_entry = hz_map_find_entry(b, b_hash, a_entry->key);
+            void *a_key = hz_map_entry_key(a, a_entry);
+            size_t b_hash = hz_map_hash_key(b, a_key);
+            hz_map_entry *b_entry = hz_map_find_entry(b, b_hash, a_key);
             if (b_entry == NULL) {
                 return false;
             }
 
             // If a custom comparator function was provided, use
             // that to determine value equality. Otherwise, use memcmp().
-            void *a_value = a_entry->value;
-            void *b_value = b_entry->value;
+            void *a_value = hz_map_entry_value(a, a_entry);
+            void *b_value = hz_map_entry_value(b, b_entry);
             int cmp;
-            if (cmp_func == NULL) {
+            if (a->value_size == 0) {
+                cmp = 0;
+            } else if (cmp_func == NULL) {
                 cmp = hz_memcmp(a_value, b_value, 1, a->value_size);
             } else {
                 cmp = cmp_func(a_value, b_value);
@@ -460,10 +3230,7 @@ hz_map_iterator_new(const hz_map *map)
 {
     hz_check_null(map);
     hz_map_iterator *it = hz_malloc(1, sizeof(hz_map_iterator));
-    it->map = map;
-    it->mod_count = map->mod_count;
-    it->bucket_index = 0;
-    it->current_entry = NULL;
+    hz_map_cursor_init(&it->cursor, map);
     return it;
 }
 
@@ -478,31 +3245,534 @@ hz_map_iterator_next(hz_map_iterator *it, void *key, void *value)
 {
     hz_check_null(it);
 
+    const void *entry_key;
+    const void *entry_value;
+    if (!hz_map_cursor_next(&it->cursor, &entry_key, &entry_value)) {
+        return false;
+    }
+
+    // Write key and value as necessary
+    const hz_map *map = it->cursor.map;
+    if (key != NULL) {
+        if (map->arena != NULL) {
+            hz_memcpy(key, &entry_key, 1, sizeof(entry_key));
+        } else {
+            hz_memcpy(key, entry_key, 1, map->key_size);
+        }
+    }
+    if (value != NULL) {
+        hz_map_copy_value(value, entry_value, map->value_size);
+    }
+    return true;
+}
+
+void
+hz_map_cursor_init(hz_map_cursor *cursor, const hz_map *map)
+{
+    hz_check_null(cursor);
+    hz_check_null(map);
+    cursor->map = map;
+    cursor->entry = NULL;
+    cursor->chain_index = 0;
+    cursor->chain_end = hz_map_chain_count(map);
+    cursor->chain_pos = 0;
+    cursor->mod_count = map->mod_count;
+    cursor->unshare_count = map->unshare_count;
+}
+
+/**
+ * Gets the first chain of the given partition. Partition i starts at
+ * i * n / count, computed without overflowing: the first n % count
+ * partitions get one extra chain.
+ */
+static size_t
+hz_map_partition_start(const hz_map *map, size_t index, size_t count)
+{
+    size_t n = hz_map_chain_count(map);
+    return n / count * index + hz_min(index, n % count);
+}
+
+void
+hz_map_cursor_init_partition(hz_map_cursor *cursor, const hz_map *map, size_t index, size_t count)
+{
+    hz_check_null(cursor);
+    hz_check_null(map);
+    if (index >= count) {
+        hz_abort("Partition index %zu out of range [0, %zu)", index, count);
+    }
+    cursor->map = map;
+    cursor->entry = NULL;
+    cursor->chain_index = hz_map_partition_start(map, index, count);
+    cursor->chain_end = hz_map_partition_start(map, index + 1, count);
+    cursor->chain_pos = 0;
+    cursor->mod_count = map->mod_count;
+    cursor->unshare_count = map->unshare_count;
+}
+
+bool
+hz_map_cursor_next(hz_map_cursor *cursor, const void **key, const void **value)
+{
+    hz_check_null(cursor);
+
     // Make sure we haven't modified the map between iterations,
     // since the index and entry may no longer be valid
-    if (it->mod_count != it->map->mod_count) {
+    const hz_map *map = cursor->map;
+    if (cursor->mod_count != map->mod_count) {
         hz_abort("Map contents modified during iteration");
     }
 
-    // If we've iterated over everything in the current bucket,
-    // move to the next bucket
-    while (it->current_entry == NULL) {
-        // If no more buckets, we've finished iterating the map
-        if (it->bucket_index == it->map->bucket_count) {
+    // If hz_map_get_ref() copied entries that were shared with a
+    // snapshot, the rest of the current chain may have been replaced by
+    // copies. Chains keep their order when copied, so find our place in
+    // the copy.
+    if (cursor->unshare_count != map->unshare_count) {
+        cursor->unshare_count = map->unshare_count;
+        if (cursor->entry != NULL) {
+            cursor->entry = hz_map_chain_entry_at(map, cursor->chain_index - 1, cursor->chain_pos);
+        }
+    }
+
+    // If we've iterated over everything in the current chain,
+    // move to the next chain
+    while (cursor->entry == NULL) {
+        // If no more chains, we've finished iterating the map
+        if (cursor->chain_index == cursor->chain_end) {
             return false;
         }
-        it->current_entry = it->map->buckets[it->bucket_index++];
+        cursor->entry = hz_map_chain_at(map, cursor->chain_index++);
+        cursor->chain_pos = 0;
     }
 
-    // Write key and value as necessary
     if (key != NULL) {
-        hz_memcpy(key, it->current_entry->key, 1, it->map->key_size);
+        *key = hz_map_entry_public_key(map, cursor->entry);
     }
     if (value != NULL) {
-        hz_memcpy(value, it->current_entry->value, 1, it->map->value_size);
+        *value = hz_map_entry_value(map, cursor->entry);
     }
 
     // Move to the next entry in the current bucket
-    it->current_entry = it->current_entry->next;
+    cursor->entry = cursor->entry->next;
+    cursor->chain_pos++;
+    return true;
+}
+
+/**
+ * Calls visit_func for each element in chains [start, end).
+ */
+static bool
+hz_map_for_each_in_range(
+    const hz_map *map,
+    size_t start,
+    size_t end,
+    hz_map_visit_func visit_func,
+    void *ctx)
+{
+    // Walk the chains directly instead of going through a cursor,
+    // so the loop has less per-element bookkeeping
+    unsigned int mod_count = map->mod_count;
+    unsigned int unshare_count = map->unshare_count;
+    for (size_t i = start; i < end; ++i) {
+        size_t pos = 0;
+        for (hz_map_entry *entry = hz_map_chain_at(map, i); entry != NULL; entry = entry->next) {
+            bool keep_going = visit_func(
+                hz_map_entry_public_key(map, entry),
+                hz_map_entry_value(map, entry),
+                ctx);
+            if (map->mod_count != mod_count) {
+                hz_abort("Map contents modified during iteration");
+            }
+            if (!keep_going) {
+                return false;
+            }
+
+            // Same as in hz_map_cursor_next()
+            if (map->unshare_count != unshare_count) {
+                unshare_count = map->unshare_count;
+                entry = hz_map_chain_entry_at(map, i, pos);
+            }
+            pos++;
+        }
+    }
+    return true;
+}
+
+bool
+hz_map_for_each(const hz_map *map, hz_map_visit_func visit_func, void *ctx)
+{
+    hz_check_null(map);
+    hz_check_null(visit_func);
+    return hz_map_for_each_in_range(map, 0, hz_map_chain_count(map), visit_func, ctx);
+}
+
+bool
+hz_map_for_each_partition(
+    const hz_map *map,
+    size_t index,
+    size_t count,
+    hz_map_visit_func visit_func,
+    void *ctx)
+{
+    hz_check_null(map);
+    hz_check_null(visit_func);
+    if (index >= count) {
+        hz_abort("Partition index %zu out of range [0, %zu)", index, count);
+    }
+    return hz_map_for_each_in_range(
+        map,
+        hz_map_partition_start(map, index, count),
+        hz_map_partition_start(map, index + 1, count),
+        visit_func,
+        ctx);
+}
+
+/**
+ * Computes the layout of the image of the given map. Fills in every
+ * field of the header except the seed, size, and magic fields.
+ */
+static void
+hz_map_image_layout(const hz_map *map, hz_map_image_header *header)
+{
+    // Use about one bucket per entry. Chains are stored contiguously, so
+    // unlike in the map itself, a longer chain is only a few more bytes
+    // to scan, but the offsets cost 8 bytes per bucket.
+    size_t bucket_count = 1;
+    while (bucket_count < map->size) {
+        bucket_count *= 2;
+    }
+    size_t key_size = map->arena != NULL ? sizeof(hz_map_image_string) : map->key_size;
+    size_t key_align = hz_align_of(key_size);
+    size_t value_align = hz_align_of(map->value_size);
+    size_t key_offset = hz_align_up(sizeof(uint64_t), key_align);
+    size_t value_offset = hz_align_up(key_offset + key_size, value_align);
+    size_t entry_align = hz_max(hz_max(key_align, value_align), sizeof(uint64_t));
+    size_t entry_size = hz_align_up(value_offset + map->value_size, entry_align);
+
+    header->version = IMAGE_VERSION;
+    header->word_size = sizeof(size_t);
+    header->flags = map->arena != NULL ? IMAGE_STRING_KEYS : 0;
+    header->key_size = map->arena != NULL ? 0 : map->key_size;
+    header->value_size = map->value_size;
+    header->bucket_count = bucket_count;
+    header->entry_size = entry_size;
+    header->key_offset = key_offset;
+    header->value_offset = value_offset;
+    header->buckets_offset = hz_align_up(sizeof(hz_map_image_header), HZ_MAX_ALIGN);
+    if (bucket_count + 1 > (SIZE_MAX - header->buckets_offset) / sizeof(uint64_t)) {
+        hz_abort("Map is too large to serialize");
+    }
+    header->entries_offset = hz_align_up(
+        header->buckets_offset + (bucket_count + 1) * sizeof(uint64_t), HZ_MAX_ALIGN);
+    if (map->size > (SIZE_MAX - header->entries_offset) / entry_size) {
+        hz_abort("Map is too large to serialize");
+    }
+    header->strings_offset = hz_align_up(
+        header->entries_offset + map->size * entry_size, HZ_MAX_ALIGN);
+    if (map->key_bytes > SIZE_MAX - header->strings_offset) {
+        hz_abort("Map is too large to serialize");
+    }
+    header->total_size = header->strings_offset + map->key_bytes;
+}
+
+size_t
+hz_map_serialized_size(const hz_map *map)
+{
+    hz_check_null(map);
+    hz_map_image_header header;
+    hz_map_image_layout(map, &header);
+    return (size_t)header.total_size;
+}
+
+void
+hz_map_serialize(const hz_map *map, void *buf, size_t buf_size)
+{
+    hz_check_null(map);
+    hz_check_null(buf);
+    hz_map_image_header header;
+    hz_map_image_layout(map, &header);
+    if (buf_size < header.total_size) {
+        hz_abort("Buffer is too small");
+    }
+    if ((uintptr_t)buf % HZ_MAX_ALIGN != 0) {
+        hz_abort("Buffer is not suitably aligned");
+    }
+    header.magic = IMAGE_MAGIC;
+    header.seed = map->seed;
+    header.size = map->size;
+
+    // Zero everything first so that padding bytes are deterministic
+    char *image = buf;
+    memset(image, 0, (size_t)header.total_size);
+    memcpy(image, &header, sizeof(header));
+    uint64_t *buckets = (uint64_t *)(image + header.buckets_offset);
+    char *entries = image + header.entries_offset;
+    char *strings = image + header.strings_offset;
+    size_t bucket_count = (size_t)header.bucket_count;
+
+    // Group the entries by bucket with a counting sort. First count the
+    // entries in each bucket, then turn the counts into start offsets,
+    // then use buckets[i] as the insertion point for bucket i. That
+    // leaves buckets[i] at the end of bucket i, so shift the offsets
+    // over by one at the end.
+    size_t chain_count = hz_map_chain_count(map);
+    for (size_t i = 0; i < chain_count; ++i) {
+        for (hz_map_entry *entry = hz_map_chain_at(map, i); entry != NULL; entry = entry->next) {
+            buckets[hz_map_get_bucket_index(entry->hash, bucket_count)]++;
+        }
+    }
+    uint64_t offset = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        uint64_t count = buckets[i];
+        buckets[i] = offset;
+        offset += count;
+    }
+    size_t string_offset = 0;
+    for (size_t i = 0; i < chain_count; ++i) {
+        for (hz_map_entry *entry = hz_map_chain_at(map, i); entry != NULL; entry = entry->next) {
+            size_t index = hz_map_get_bucket_index(entry->hash, bucket_count);
+            char *dest = entries + (size_t)buckets[index]++ * (size_t)header.entry_size;
+            uint64_t hash = entry->hash;
+            memcpy(dest, &hash, sizeof(hash));
+            if (map->arena != NULL) {
+                const hz_map_string_key *key = hz_map_entry_key(map, entry);
+                hz_map_image_string str = { string_offset, key->length };
+                memcpy(dest + header.key_offset, &str, sizeof(str));
+                memcpy(strings + string_offset, key->data, key->length + 1);
+                string_offset += key->length + 1;
+            } else {
+                memcpy(dest + header.key_offset, hz_map_entry_key(map, entry), map->key_size);
+            }
+            memcpy(dest + header.value_offset, hz_map_entry_value(map, entry), map->value_size);
+        }
+    }
+    memmove(&buckets[1], &buckets[0], bucket_count * sizeof(uint64_t));
+    buckets[0] = 0;
+}
+
+/**
+ * Opens a view of an image, returning NULL if the header is invalid
+ * or doesn't match the expected key and value types.
+ */
+static hz_map_view *
+hz_map_view_open_image(
+    const void *data,
+    size_t size,
+    bool string_keys,
+    size_t key_size,
+    size_t value_size)
+{
+    hz_check_null(data);
+    if ((uintptr_t)data % HZ_MAX_ALIGN != 0) {
+        hz_abort("Image is not suitably aligned");
+    }
+    if (size < sizeof(hz_map_image_header)) {
+        return NULL;
+    }
+
+    // Check that the header belongs to an image from this platform, that
+    // every section fits in the data, and that the hash, key, and value
+    // fit in an entry without overlapping and are suitably aligned
+    const hz_map_image_header *header = data;
+    size_t stored_key_size = string_keys ? sizeof(hz_map_image_string) : key_size;
+    size_t key_align = hz_align_of(stored_key_size);
+    size_t value_align = hz_align_of(value_size);
+    if (header->magic != IMAGE_MAGIC ||
+        header->version != IMAGE_VERSION ||
+        header->word_size != sizeof(size_t) ||
+        header->flags != (string_keys ? IMAGE_STRING_KEYS : 0) ||
+        header->key_size != key_size ||
+        header->value_size != value_size ||
+        header->total_size > size ||
+        header->bucket_count == 0 ||
+        (header->bucket_count & (header->bucket_count - 1)) != 0 ||
+        header->buckets_offset < sizeof(hz_map_image_header) ||
+        header->buckets_offset % sizeof(uint64_t) != 0 ||
+        header->entries_offset < header->buckets_offset ||
+        header->entries_offset % HZ_MAX_ALIGN != 0 ||
+        (header->entries_offset - header->buckets_offset) / sizeof(uint64_t) <= header->bucket_count ||
+        header->strings_offset < header->entries_offset ||
+        header->entry_size == 0 ||
+        (header->strings_offset - header->entries_offset) / header->entry_size < header->size ||
+        header->total_size < header->strings_offset ||
+        header->key_offset < sizeof(uint64_t) ||
+        header->key_offset % key_align != 0 ||
+        header->value_offset < header->key_offset ||
+        header->value_offset - header->key_offset < stored_key_size ||
+        header->value_offset % value_align != 0 ||
+        header->value_offset > header->entry_size ||
+        header->entry_size - header->value_offset < value_size ||
+        header->entry_size % hz_max(key_align, value_align) != 0)
+    {
+        return NULL;
+    }
+
+    const char *image = data;
+    hz_map_view *view = hz_malloc(1, sizeof(hz_map_view));
+    view->hash_func = NULL;
+    view->cmp_func = NULL;
+    view->string_keys = string_keys;
+    view->value_size = value_size;
+    view->seed = (size_t)header->seed;
+    view->size = (size_t)header->size;
+    view->bucket_count = (size_t)header->bucket_count;
+    view->entry_size = (size_t)header->entry_size;
+    view->key_offset = (size_t)header->key_offset;
+    view->value_offset = (size_t)header->value_offset;
+    view->buckets = (const uint64_t *)(image + header->buckets_offset);
+    view->entries = image + header->entries_offset;
+    view->strings = image + header->strings_offset;
+    view->strings_size = (size_t)(header->total_size - header->strings_offset);
+    return view;
+}
+
+hz_map_view *
+hz_map_view_open(
+    const void *data,
+    size_t size,
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func)
+{
+    hz_check_null(hash_func);
+    hz_check_null(cmp_func);
+    hz_map_view *view = hz_map_view_open_image(data, size, false, key_size, value_size);
+    if (view != NULL) {
+        view->hash_func = hash_func;
+        view->cmp_func = cmp_func;
+    }
+    return view;
+}
+
+hz_map_view *
+hz_map_view_open_string(const void *data, size_t size, size_t value_size)
+{
+    return hz_map_view_open_image(data, size, true, 0, value_size);
+}
+
+void
+hz_map_view_free(hz_map_view *view)
+{
+    hz_free(view);
+}
+
+size_t
+hz_map_view_size(const hz_map_view *view)
+{
+    hz_check_null(view);
+    return view->size;
+}
+
+/**
+ * Gets the key of an image entry in the form that public functions
+ * return it.
+ */
+static const void *
+hz_map_view_entry_key(const hz_map_view *view, const char *entry)
+{
+    if (view->string_keys) {
+        hz_map_image_string str;
+        memcpy(&str, entry + view->key_offset, sizeof(str));
+        return view->strings + str.offset;
+    }
+    return entry + view->key_offset;
+}
+
+const void *
+hz_map_view_get_ref(const hz_map_view *view, const void *key)
+{
+    hz_check_null(view);
+    hz_check_null(key);
+    hz_map_string_key str = { NULL, 0 };
+    size_t hash;
+    if (view->string_keys) {
+        str.data = key;
+        str.length = strlen(key);
+        hash = hz_hash_mix(hz_map_string_hash(&str), view->seed);
+    } else {
+        hash = hz_hash_mix(view->hash_func(key), view->seed);
+    }
+
+    // Entries in a bucket are contiguous, so scan them in order
+    size_t index = hz_map_get_bucket_index(hash, view->bucket_count);
+    const char *entry = view->entries + (size_t)view->buckets[index] * view->entry_size;
+    const char *end = view->entries + (size_t)view->buckets[index + 1] * view->entry_size;
+    for (; entry < end; entry += view->entry_size) {
+        uint64_t entry_hash;
+        memcpy(&entry_hash, entry, sizeof(entry_hash));
+        if (entry_hash != hash) {
+            continue;
+        }
+        if (view->string_keys) {
+            hz_map_image_string entry_str;
+            memcpy(&entry_str, entry + view->key_offset, sizeof(entry_str));
+            if (entry_str.length == str.length &&
+                memcmp(view->strings + entry_str.offset, str.data, str.length) == 0)
+            {
+                return entry + view->value_offset;
+            }
+        } else if (view->cmp_func(entry + view->key_offset, key) == 0) {
+            return entry + view->value_offset;
+        }
+    }
+    return NULL;
+}
+
+bool
+hz_map_view_get(const hz_map_view *view, const void *key, void *out_value)
+{
+    const void *value = hz_map_view_get_ref(view, key);
+    if (value == NULL) {
+        return false;
+    }
+    if (out_value != NULL) {
+        hz_map_copy_value(out_value, value, view->value_size);
+    }
+    return true;
+}
+
+bool
+hz_map_view_validate(const hz_map_view *view)
+{
+    hz_check_null(view);
+
+    // Lookups scan entries [buckets[i], buckets[i + 1]), so the offsets
+    // must never decrease or point past the last entry
+    uint64_t prev = 0;
+    for (size_t i = 0; i <= view->bucket_count; ++i) {
+        if (view->buckets[i] < prev || view->buckets[i] > view->size) {
+            return false;
+        }
+        prev = view->buckets[i];
+    }
+
+    // Each string must fit in the strings section, along with the NUL
+    // terminator that lets it be returned as a C string
+    if (view->string_keys) {
+        const char *entry = view->entries;
+        for (size_t i = 0; i < view->size; ++i, entry += view->entry_size) {
+            hz_map_image_string str;
+            memcpy(&str, entry + view->key_offset, sizeof(str));
+            if (str.length >= view->strings_size ||
+                str.offset > view->strings_size - str.length - 1 ||
+                view->strings[str.offset + str.length] != '\0')
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool
+hz_map_view_for_each(const hz_map_view *view, hz_map_visit_func visit_func, void *ctx)
+{
+    hz_check_null(view);
+    hz_check_null(visit_func);
+    const char *entry = view->entries;
+    for (size_t i = 0; i < view->size; ++i, entry += view->entry_size) {
+        if (!visit_func(hz_map_view_entry_key(view, entry), entry + view->value_offset, ctx)) {
+            return false;
+        }
+    }
     return true;
 }
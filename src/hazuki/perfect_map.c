@@ -0,0 +1,419 @@
+#include "hazuki/perfect_map.h"
+#include "hazuki/map.h"
+#include "hazuki/utils.h"
+#include "hazuki/vector.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Average number of keys per bucket. Each bucket costs 4 bytes for its
+ * pilot, so larger buckets use less memory, but take longer to place
+ * since all of a bucket's keys must land in free slots at once.
+ */
+#define BUCKET_KEYS 4
+
+/**
+ * Number of pilots tried per key before giving up on a seed and starting
+ * over with the next one. The last few keys to be placed need about n
+ * tries each, since almost every slot is taken by then, so this has to
+ * scale with n.
+ */
+#define MAX_PILOT_FACTOR 64
+
+/**
+ * Each key is first hashed to a bucket, and each bucket has a pilot
+ * value; the key's slot is a hash of the key's hash and its bucket's
+ * pilot. The builder picks each bucket's pilot so that its keys land in
+ * slots that no other key has taken. Entries are stored as [key][value],
+ * padded to entry_size bytes, in slot order.
+ */
+struct hz_perfect_map
+{
+    size_t key_size;
+    size_t value_size;
+    size_t value_offset;
+    size_t entry_size;
+    hz_map_hash_func hash_func;
+    hz_map_cmp_func cmp_func;
+    uint64_t seed;
+    size_t size;
+    size_t bucket_count;
+    uint32_t *pilots;
+    char *entries;
+};
+
+/**
+ * Maps a 32-bit value to [0, n) without a division.
+ */
+static size_t
+hz_perfect_map_reduce(uint32_t x, size_t n)
+{
+    return (size_t)(((uint64_t)x * n) >> 32);
+}
+
+/**
+ * Mixes a key's hash with the seed. This uses hz_fmix64() rather than
+ * hz_hash_mix() so that the hashes are 64 bits wide even where size_t
+ * is not.
+ */
+static uint64_t
+hz_perfect_map_hash(uint64_t user_hash, uint64_t seed)
+{
+    return hz_fmix64(user_hash ^ (seed * UINT64_C(0x9e3779b97f4a7c15)));
+}
+
+static size_t
+hz_perfect_map_bucket(uint64_t hash, size_t bucket_count)
+{
+    return hz_perfect_map_reduce((uint32_t)hash, bucket_count);
+}
+
+static size_t
+hz_perfect_map_slot(uint64_t hash, uint32_t pilot, size_t size)
+{
+    uint64_t x = hz_fmix64(hash ^ ((pilot + UINT64_C(1)) * UINT64_C(0xbf58476d1ce4e5b9)));
+    return hz_perfect_map_reduce((uint32_t)(x >> 32), size);
+}
+
+static void *
+hz_perfect_map_entry(const hz_perfect_map *map, size_t slot)
+{
+    return map->entries + slot * map->entry_size;
+}
+
+/**
+ * Checks that no two keys in the bucket have the same hash, since no
+ * pilot could ever separate them. Returns false if two distinct keys do,
+ * and aborts if a key appears twice.
+ */
+static bool
+hz_perfect_map_check_bucket(
+    const hz_perfect_map *map,
+    const char *keys,
+    const uint64_t *hashes,
+    const size_t *members,
+    size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t j = i + 1; j < count; ++j) {
+            if (hashes[members[i]] != hashes[members[j]]) {
+                continue;
+            }
+            const void *a = keys + members[i] * map->key_size;
+            const void *b = keys + members[j] * map->key_size;
+            if (map->cmp_func(a, b) == 0) {
+                hz_abort("Duplicate key");
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Tries to find a pilot for every bucket using the map's current seed.
+ * On success, fills in the pilots and writes the slot of each key to
+ * slots, and returns true. Returns false if some bucket could not be
+ * placed, in which case the caller should try again with another seed,
+ * unless out_collision was set to true: that means two distinct keys
+ * have the same hash, which no seed can fix.
+ */
+static bool
+hz_perfect_map_try_build(
+    hz_perfect_map *map,
+    const char *keys,
+    const uint64_t *user_hashes,
+    uint64_t *hashes,
+    size_t *slots,
+    bool *out_collision)
+{
+    size_t n = map->size;
+    size_t bucket_count = map->bucket_count;
+    for (size_t i = 0; i < n; ++i) {
+        hashes[i] = hz_perfect_map_hash(user_hashes[i], map->seed);
+    }
+
+    // Group the keys by bucket with a counting sort: starts[b] is the
+    // index in members of the first key in bucket b
+    size_t *starts = hz_calloc(bucket_count + 1, sizeof(size_t));
+    size_t *members = hz_malloc(n, sizeof(size_t));
+    for (size_t i = 0; i < n; ++i) {
+        starts[hz_perfect_map_bucket(hashes[i], bucket_count) + 1]++;
+    }
+    size_t max_bucket_size = 0;
+    for (size_t b = 0; b < bucket_count; ++b) {
+        max_bucket_size = hz_max(max_bucket_size, starts[b + 1]);
+        starts[b + 1] += starts[b];
+    }
+    size_t *fill = hz_malloc(bucket_count, sizeof(size_t));
+    memcpy(fill, starts, bucket_count * sizeof(size_t));
+    for (size_t i = 0; i < n; ++i) {
+        members[fill[hz_perfect_map_bucket(hashes[i], bucket_count)]++] = i;
+    }
+
+    // Place the largest buckets first, while most slots are still free.
+    // fill is reused to hold the bucket order.
+    size_t *size_starts = hz_calloc(max_bucket_size + 2, sizeof(size_t));
+    for (size_t b = 0; b < bucket_count; ++b) {
+        size_starts[max_bucket_size - (starts[b + 1] - starts[b]) + 1]++;
+    }
+    for (size_t s = 0; s <= max_bucket_size; ++s) {
+        size_starts[s + 1] += size_starts[s];
+    }
+    for (size_t b = 0; b < bucket_count; ++b) {
+        fill[size_starts[max_bucket_size - (starts[b + 1] - starts[b])]++] = b;
+    }
+    hz_free(size_starts);
+
+    bool *taken = hz_calloc(n, sizeof(bool));
+    uint64_t max_pilot = hz_min((uint64_t)hz_max(n, 1024) * MAX_PILOT_FACTOR, UINT32_MAX);
+    bool ok = true;
+    for (size_t i = 0; i < bucket_count && ok; ++i) {
+        size_t b = fill[i];
+        size_t *bucket = &members[starts[b]];
+        size_t count = starts[b + 1] - starts[b];
+        if (count == 0) {
+            map->pilots[b] = 0;
+            continue;
+        }
+        if (!hz_perfect_map_check_bucket(map, keys, hashes, bucket, count)) {
+            *out_collision = true;
+            ok = false;
+            break;
+        }
+
+        // Try pilots until all of the bucket's keys land in free slots,
+        // tentatively taking each slot so that keys within the bucket
+        // don't collide with each other either
+        uint64_t pilot;
+        for (pilot = 0; pilot <= max_pilot; ++pilot) {
+            size_t placed = 0;
+            while (placed < count) {
+                size_t slot = hz_perfect_map_slot(hashes[bucket[placed]], (uint32_t)pilot, n);
+                if (taken[slot]) {
+                    break;
+                }
+                taken[slot] = true;
+                slots[bucket[placed]] = slot;
+                placed++;
+            }
+            if (placed == count) {
+                break;
+            }
+            while (placed > 0) {
+                taken[slots[bucket[--placed]]] = false;
+            }
+        }
+        if (pilot > max_pilot) {
+            ok = false;
+        } else {
+            map->pilots[b] = (uint32_t)pilot;
+        }
+    }
+
+    hz_free(taken);
+    hz_free(fill);
+    hz_free(members);
+    hz_free(starts);
+    return ok;
+}
+
+/**
+ * Builds a perfect map from arrays of n keys and n values. Returns NULL
+ * if two distinct keys have the same hash.
+ */
+static hz_perfect_map *
+hz_perfect_map_build(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const char *keys,
+    const char *values,
+    size_t n)
+{
+    hz_check_null(hash_func);
+    hz_check_null(cmp_func);
+    if (key_size == 0) {
+        hz_abort("Key size must be positive");
+    }
+    if ((uint64_t)n > UINT32_MAX) {
+        hz_abort("Too many keys");
+    }
+
+    // Entries are laid out as [key][value], with padding as required
+    // to align the value and the next entry
+    hz_perfect_map *map = hz_malloc(1, sizeof(hz_perfect_map));
+    size_t key_align = hz_align_of(key_size);
+    size_t value_align = hz_align_of(value_size);
+    map->key_size = key_size;
+    map->value_size = value_size;
+    map->value_offset = hz_align_up(key_size, value_align);
+    if (value_size > SIZE_MAX - map->value_offset) {
+        hz_abort("Entry size is too large");
+    }
+    map->entry_size = hz_align_up(
+        map->value_offset + value_size, hz_max(key_align, value_align));
+    map->hash_func = hash_func;
+    map->cmp_func = cmp_func;
+    map->seed = 0;
+    map->size = n;
+    map->bucket_count = n / BUCKET_KEYS + 1;
+    map->pilots = hz_malloc(map->bucket_count, sizeof(uint32_t));
+    map->entries = hz_malloc(n, map->entry_size);
+
+    uint64_t *user_hashes = hz_malloc(n, sizeof(uint64_t));
+    uint64_t *hashes = hz_malloc(n, sizeof(uint64_t));
+    size_t *slots = hz_malloc(n, sizeof(size_t));
+    for (size_t i = 0; i < n; ++i) {
+        user_hashes[i] = hash_func(keys + i * key_size);
+    }
+    bool collision = false;
+    while (!hz_perfect_map_try_build(map, keys, user_hashes, hashes, slots, &collision)) {
+        if (collision) {
+            hz_free(slots);
+            hz_free(hashes);
+            hz_free(user_hashes);
+            hz_perfect_map_free(map);
+            return NULL;
+        }
+        map->seed++;
+    }
+
+    // Padding is zeroed so that the entries have no uninitialized bytes
+    if (n > 0) {
+        memset(map->entries, 0, n * map->entry_size);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        char *entry = hz_perfect_map_entry(map, slots[i]);
+        memcpy(entry, keys + i * key_size, key_size);
+        memcpy(entry + map->value_offset, values + i * value_size, value_size);
+    }
+    hz_free(slots);
+    hz_free(hashes);
+    hz_free(user_hashes);
+    return map;
+}
+
+hz_perfect_map *
+hz_perfect_map_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_vector *keys,
+    const hz_vector *values)
+{
+    hz_check_null(keys);
+    hz_check_null(values);
+    if (hz_vector_size(keys) != hz_vector_size(values)) {
+        hz_abort("Key and value vectors have different sizes");
+    }
+    return hz_perfect_map_build(
+        key_size,
+        value_size,
+        hash_func,
+        cmp_func,
+        hz_vector_data(keys),
+        hz_vector_data(values),
+        hz_vector_size(keys));
+}
+
+hz_perfect_map *
+hz_perfect_map_new_from_map(
+    const hz_map *map,
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func)
+{
+    hz_check_null(map);
+    if (hz_map_is_string(map)) {
+        hz_abort("String-keyed maps are not supported");
+    }
+    if (hz_map_key_size(map) != key_size || hz_map_value_size(map) != value_size) {
+        hz_abort("Map has different key or value sizes");
+    }
+    if (key_size == 0) {
+        hz_abort("Key size must be positive");
+    }
+
+    // Gather the entries into flat arrays first
+    size_t n = hz_map_size(map);
+    char *keys = hz_malloc(n, key_size);
+    char *values = hz_malloc(n, hz_max(value_size, 1));
+    hz_map_cursor cursor;
+    hz_map_cursor_init(&cursor, map);
+    const void *key;
+    const void *value;
+    for (size_t i = 0; hz_map_cursor_next(&cursor, &key, &value); ++i) {
+        memcpy(keys + i * key_size, key, key_size);
+        memcpy(values + i * value_size, value, value_size);
+    }
+    hz_perfect_map *perfect = hz_perfect_map_build(
+        key_size, value_size, hash_func, cmp_func, keys, values, n);
+    hz_free(values);
+    hz_free(keys);
+    return perfect;
+}
+
+void
+hz_perfect_map_free(hz_perfect_map *map)
+{
+    if (map != NULL) {
+        hz_free(map->entries);
+        hz_free(map->pilots);
+        hz_free(map);
+    }
+}
+
+size_t
+hz_perfect_map_size(const hz_perfect_map *map)
+{
+    hz_check_null(map);
+    return map->size;
+}
+
+size_t
+hz_perfect_map_memory_usage(const hz_perfect_map *map)
+{
+    hz_check_null(map);
+    return sizeof(hz_perfect_map) +
+        map->bucket_count * sizeof(uint32_t) +
+        map->size * map->entry_size;
+}
+
+void *
+hz_perfect_map_get_ref(const hz_perfect_map *map, const void *key)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    if (map->size == 0) {
+        return NULL;
+    }
+
+    // Every key has exactly one possible slot, so a key that isn't in
+    // the map is detected by comparing against whatever key is there
+    uint64_t hash = hz_perfect_map_hash(map->hash_func(key), map->seed);
+    uint32_t pilot = map->pilots[hz_perfect_map_bucket(hash, map->bucket_count)];
+    char *entry = hz_perfect_map_entry(map, hz_perfect_map_slot(hash, pilot, map->size));
+    if (map->cmp_func(entry, key) != 0) {
+        return NULL;
+    }
+    return entry + map->value_offset;
+}
+
+bool
+hz_perfect_map_get(const hz_perfect_map *map, const void *key, void *out_value)
+{
+    void *value = hz_perfect_map_get_ref(map, key);
+    if (value == NULL) {
+        return false;
+    }
+    if (out_value != NULL) {
+        hz_memcpy(out_value, value, 1, map->value_size);
+    }
+    return true;
+}
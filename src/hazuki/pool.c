@@ -0,0 +1,169 @@
+#include "hazuki/pool.h"
+#include "hazuki/utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Number of objects in the first slab allocated by the pool.
+ * Must be an integer > 0.
+ */
+#define INITIAL_SLAB_CAPACITY 16
+
+/**
+ * Factor by which each new slab is larger than the previous one,
+ * until the slab size reaches MAX_SLAB_BYTES. Must be > 1.
+ */
+#define SCALING_FACTOR 2
+
+/**
+ * Slabs stop growing once they reach this many bytes.
+ */
+#define MAX_SLAB_BYTES (1024 * 1024)
+
+/**
+ * Slab header. The objects follow the header in the same allocation.
+ */
+typedef union hz_pool_slab
+{
+    union hz_pool_slab *next;
+    hz_max_align align;
+} hz_pool_slab;
+
+/**
+ * Released objects are threaded through a singly linked list using
+ * the first bytes of the object itself.
+ */
+typedef struct hz_pool_free_object
+{
+    struct hz_pool_free_object *next;
+} hz_pool_free_object;
+
+struct hz_pool
+{
+    size_t object_size;
+    size_t stride;
+    size_t next_slab_capacity;
+    hz_pool_slab *slabs;
+    char *bump;
+    size_t bump_left;
+    hz_pool_free_object *free_list;
+};
+
+static size_t
+hz_pool_stride(size_t object_size)
+{
+    // Every object must be able to hold a free list link,
+    // and must be aligned for any type
+    return hz_align_up(hz_max(object_size, sizeof(hz_pool_free_object)), HZ_MAX_ALIGN);
+}
+
+static void
+hz_pool_add_slab(hz_pool *pool)
+{
+    size_t capacity = pool->next_slab_capacity;
+    hz_pool_slab *slab = hz_malloc(1, sizeof(hz_pool_slab) + capacity * pool->stride);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->bump = (char *)(slab + 1);
+    pool->bump_left = capacity;
+
+    // Grow the next slab, unless we've hit the size limit
+    if (capacity * pool->stride * SCALING_FACTOR <= MAX_SLAB_BYTES) {
+        pool->next_slab_capacity = capacity * SCALING_FACTOR;
+    }
+}
+
+static void
+hz_pool_free_slabs(hz_pool *pool)
+{
+    hz_pool_slab *slab = pool->slabs;
+    while (slab != NULL) {
+        hz_pool_slab *next = slab->next;
+        hz_free(slab);
+        slab = next;
+    }
+}
+
+static void
+hz_pool_reset(hz_pool *pool)
+{
+    pool->next_slab_capacity = INITIAL_SLAB_CAPACITY;
+    pool->slabs = NULL;
+    pool->bump = NULL;
+    pool->bump_left = 0;
+    pool->free_list = NULL;
+}
+
+hz_pool *
+hz_pool_new(size_t object_size)
+{
+    if (object_size == 0) {
+        hz_abort("Object size is zero");
+    }
+    hz_pool *pool = hz_malloc(1, sizeof(hz_pool));
+    pool->object_size = object_size;
+    pool->stride = hz_pool_stride(object_size);
+    if (pool->stride > (SIZE_MAX - sizeof(hz_pool_slab)) / INITIAL_SLAB_CAPACITY) {
+        hz_abort("Object size is too large: %zu", object_size);
+    }
+    hz_pool_reset(pool);
+    return pool;
+}
+
+void
+hz_pool_free(hz_pool *pool)
+{
+    if (pool != NULL) {
+        hz_pool_free_slabs(pool);
+        hz_free(pool);
+    }
+}
+
+size_t
+hz_pool_object_size(const hz_pool *pool)
+{
+    hz_check_null(pool);
+    return pool->object_size;
+}
+
+void *
+hz_pool_alloc(hz_pool *pool)
+{
+    hz_check_null(pool);
+
+    // Prefer recycling released objects, since they are
+    // more likely to still be in the cache
+    if (pool->free_list != NULL) {
+        hz_pool_free_object *object = pool->free_list;
+        pool->free_list = object->next;
+        return object;
+    }
+
+    // Otherwise carve a new object out of the current slab
+    if (pool->bump_left == 0) {
+        hz_pool_add_slab(pool);
+    }
+    void *object = pool->bump;
+    pool->bump += pool->stride;
+    pool->bump_left--;
+    return object;
+}
+
+void
+hz_pool_release(hz_pool *pool, void *ptr)
+{
+    hz_check_null(pool);
+    if (ptr != NULL) {
+        hz_pool_free_object *object = ptr;
+        object->next = pool->free_list;
+        pool->free_list = object;
+    }
+}
+
+void
+hz_pool_clear(hz_pool *pool)
+{
+    hz_check_null(pool);
+    hz_pool_free_slabs(pool);
+    hz_pool_reset(pool);
+}
@@ -0,0 +1,533 @@
+#include "hazuki/rcu_map.h"
+#include "hazuki/map.h"
+#include "hazuki/utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(__GNUC__)
+#error "hz_rcu_map requires the GCC __atomic builtins"
+#endif
+
+/**
+ * Number of buckets in a new or cleared map. Must be a power of 2.
+ */
+#define INITIAL_CAPACITY 8
+
+/**
+ * Factor by which the bucket count grows when the load factor is
+ * exceeded. Must be a power of 2.
+ */
+#define SCALING_FACTOR 2
+
+/**
+ * Maximum average number of entries per bucket before the map grows.
+ */
+#define LOAD_FACTOR 0.75
+
+/**
+ * Reader epoch value meaning that the reader is not currently reading.
+ * The map's epoch starts at 1 and only increases, so no reader can
+ * ever announce this value.
+ */
+#define QUIESCENT_EPOCH 0
+
+/**
+ * A single key-value pair. Everything except next is immutable once
+ * the node is reachable by readers; updating a value replaces the node.
+ */
+typedef struct hz_rcu_node
+{
+    struct hz_rcu_node *next;
+    size_t hash;
+    struct hz_rcu_node *retired_next;
+    size_t retire_epoch;
+    hz_max_align data[];
+} hz_rcu_node;
+
+/**
+ * Bucket array. When the map is resized or cleared, the whole table
+ * (along with the nodes still in its chains) is replaced and retired.
+ */
+typedef struct hz_rcu_table
+{
+    size_t bucket_count;
+    struct hz_rcu_table *retired_next;
+    size_t retire_epoch;
+    hz_rcu_node *buckets[];
+} hz_rcu_table;
+
+struct hz_rcu_reader
+{
+    // Keep the epoch on a cache line of its own, since it is
+    // written by the reader on every lookup
+    char padding_before[HZ_CACHE_LINE_SIZE];
+    size_t epoch;
+    int in_use;
+    hz_rcu_map *map;
+    hz_rcu_reader *next;
+    char padding_after[HZ_CACHE_LINE_SIZE];
+};
+
+struct hz_rcu_map
+{
+    // Fields read by readers. Other than table and epoch,
+    // these never change after the map is created.
+    size_t key_size;
+    size_t value_size;
+    size_t value_offset;
+    size_t node_size;
+    hz_map_hash_func hash_func;
+    hz_map_cmp_func cmp_func;
+    size_t seed;
+    hz_rcu_table *table;
+    size_t epoch;
+    hz_rcu_reader *readers;
+
+    // Fields used only by the writer, kept off the readers' cache lines
+    char padding[HZ_CACHE_LINE_SIZE];
+    size_t size;
+    hz_rcu_node *retired_nodes;
+    hz_rcu_table *retired_tables;
+};
+
+static size_t
+hz_rcu_map_hash_key(const hz_rcu_map *map, const void *key)
+{
+    return hz_hash_mix(map->hash_func(key), map->seed);
+}
+
+static void *
+hz_rcu_node_key(const hz_rcu_node *node)
+{
+    return (char *)node->data;
+}
+
+static void *
+hz_rcu_node_value(const hz_rcu_map *map, const hz_rcu_node *node)
+{
+    return (char *)node->data + map->value_offset;
+}
+
+static hz_rcu_node *
+hz_rcu_node_new(hz_rcu_map *map, size_t hash, const void *key, const void *value)
+{
+    hz_rcu_node *node = hz_malloc(1, map->node_size);
+    node->next = NULL;
+    node->hash = hash;
+    node->retired_next = NULL;
+    node->retire_epoch = 0;
+    hz_memcpy(hz_rcu_node_key(node), key, 1, map->key_size);
+    hz_memcpy(hz_rcu_node_value(map, node), value, 1, map->value_size);
+    return node;
+}
+
+static hz_rcu_table *
+hz_rcu_table_new(size_t bucket_count)
+{
+    // Bucket heads are zeroed with calloc(), which assumes that
+    // NULL is all-bits-zero (as on every platform we care about)
+    if (bucket_count > (SIZE_MAX - sizeof(hz_rcu_table)) / sizeof(hz_rcu_node *)) {
+        hz_abort("Too many buckets: %zu", bucket_count);
+    }
+    hz_rcu_table *table = hz_calloc(1, sizeof(hz_rcu_table) + bucket_count * sizeof(hz_rcu_node *));
+    table->bucket_count = bucket_count;
+    return table;
+}
+
+/**
+ * Frees a table along with all the nodes in its chains.
+ */
+static void
+hz_rcu_table_free(hz_rcu_table *table)
+{
+    for (size_t i = 0; i < table->bucket_count; ++i) {
+        hz_rcu_node *node = table->buckets[i];
+        while (node != NULL) {
+            hz_rcu_node *next = node->next;
+            hz_free(node);
+            node = next;
+        }
+    }
+    hz_free(table);
+}
+
+/**
+ * Finds the link (either a bucket head or the next pointer of the
+ * previous node) that points to the node with the given key, or NULL
+ * if the key is not in the table. Only called by the writer.
+ */
+static hz_rcu_node **
+hz_rcu_map_find_link(const hz_rcu_map *map, hz_rcu_table *table, size_t hash, const void *key)
+{
+    hz_rcu_node **link = &table->buckets[hash & (table->bucket_count - 1)];
+    while (*link != NULL) {
+        hz_rcu_node *node = *link;
+        if (node->hash == hash && map->cmp_func(key, hz_rcu_node_key(node)) == 0) {
+            return link;
+        }
+        link = &node->next;
+    }
+    return NULL;
+}
+
+/**
+ * Makes a node visible to readers. The release ordering ensures that
+ * readers who see the pointer also see the node's contents.
+ */
+static void
+hz_rcu_map_publish_node(hz_rcu_node **link, hz_rcu_node *node)
+{
+    __atomic_store_n(link, node, __ATOMIC_RELEASE);
+}
+
+static void
+hz_rcu_map_publish_table(hz_rcu_map *map, hz_rcu_table *table)
+{
+    __atomic_store_n(&map->table, table, __ATOMIC_RELEASE);
+}
+
+static void
+hz_rcu_map_retire_node(hz_rcu_map *map, hz_rcu_node *node)
+{
+    node->retire_epoch = map->epoch;
+    node->retired_next = map->retired_nodes;
+    map->retired_nodes = node;
+}
+
+static void
+hz_rcu_map_retire_table(hz_rcu_map *map, hz_rcu_table *table)
+{
+    table->retire_epoch = map->epoch;
+    table->retired_next = map->retired_tables;
+    map->retired_tables = table;
+}
+
+static void
+hz_rcu_map_set_size(hz_rcu_map *map, size_t size)
+{
+    __atomic_store_n(&map->size, size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Replaces the table with a new one with the given number of buckets,
+ * holding copies of all the nodes in the current table. The nodes can't
+ * be moved, since readers may be walking the old chains.
+ */
+static void
+hz_rcu_map_resize(hz_rcu_map *map, size_t bucket_count)
+{
+    hz_rcu_table *old_table = map->table;
+    hz_rcu_table *new_table = hz_rcu_table_new(bucket_count);
+    for (size_t i = 0; i < old_table->bucket_count; ++i) {
+        for (hz_rcu_node *node = old_table->buckets[i]; node != NULL; node = node->next) {
+            hz_rcu_node *copy = hz_rcu_node_new(
+                map,
+                node->hash,
+                hz_rcu_node_key(node),
+                hz_rcu_node_value(map, node));
+            hz_rcu_node **head = &new_table->buckets[node->hash & (bucket_count - 1)];
+            copy->next = *head;
+            *head = copy;
+        }
+    }
+    hz_rcu_map_publish_table(map, new_table);
+    hz_rcu_map_retire_table(map, old_table);
+}
+
+void
+hz_rcu_map_collect(hz_rcu_map *map)
+{
+    hz_check_null(map);
+
+    // Nothing retired before this point can be reached by readers
+    // that see the new epoch. The fence pairs with the one in
+    // hz_rcu_map_get(): either the reader sees our unlinks, or we
+    // see the reader's announced epoch.
+    size_t epoch = map->epoch;
+    __atomic_store_n(&map->epoch, epoch + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // Find the oldest epoch that a reader is still reading in
+    size_t min_epoch = SIZE_MAX;
+    hz_rcu_reader *reader = __atomic_load_n(&map->readers, __ATOMIC_ACQUIRE);
+    while (reader != NULL) {
+        size_t reader_epoch = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+        if (reader_epoch != QUIESCENT_EPOCH && reader_epoch < min_epoch) {
+            min_epoch = reader_epoch;
+        }
+        reader = reader->next;
+    }
+
+    // Free everything retired before that epoch
+    hz_rcu_node **node_link = &map->retired_nodes;
+    while (*node_link != NULL) {
+        hz_rcu_node *node = *node_link;
+        if (node->retire_epoch < min_epoch) {
+            *node_link = node->retired_next;
+            hz_free(node);
+        } else {
+            node_link = &node->retired_next;
+        }
+    }
+    hz_rcu_table **table_link = &map->retired_tables;
+    while (*table_link != NULL) {
+        hz_rcu_table *table = *table_link;
+        if (table->retire_epoch < min_epoch) {
+            *table_link = table->retired_next;
+            hz_rcu_table_free(table);
+        } else {
+            table_link = &table->retired_next;
+        }
+    }
+}
+
+void
+hz_rcu_map_options_init(hz_rcu_map_options *options)
+{
+    hz_check_null(options);
+    options->seed = 0;
+}
+
+hz_rcu_map *
+hz_rcu_map_new(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func)
+{
+    return hz_rcu_map_new_with_options(key_size, value_size, hash_func, cmp_func, NULL);
+}
+
+hz_rcu_map *
+hz_rcu_map_new_with_options(
+    size_t key_size,
+    size_t value_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_rcu_map_options *options)
+{
+    hz_check_null(hash_func);
+    hz_check_null(cmp_func);
+    if (key_size == 0) {
+        hz_abort("Key size is zero");
+    }
+    if (value_size == 0) {
+        hz_abort("Value size is zero");
+    }
+
+    hz_rcu_map *map = hz_malloc(1, sizeof(hz_rcu_map));
+    map->key_size = key_size;
+    map->value_size = value_size;
+    size_t align = HZ_MAX_ALIGN;
+    size_t header_size = offsetof(hz_rcu_node, data);
+    if (key_size > SIZE_MAX - header_size - align ||
+        value_size > SIZE_MAX - header_size - align - key_size)
+    {
+        hz_abort("Key and value sizes are too large: %zu + %zu", key_size, value_size);
+    }
+    map->value_offset = hz_align_up(key_size, align);
+    map->node_size = header_size + map->value_offset + value_size;
+    map->hash_func = hash_func;
+    map->cmp_func = cmp_func;
+    map->seed = options != NULL ? options->seed : 0;
+    map->table = hz_rcu_table_new(INITIAL_CAPACITY);
+    map->epoch = QUIESCENT_EPOCH + 1;
+    map->readers = NULL;
+    map->size = 0;
+    map->retired_nodes = NULL;
+    map->retired_tables = NULL;
+    return map;
+}
+
+void
+hz_rcu_map_free(hz_rcu_map *map)
+{
+    if (map != NULL) {
+        hz_rcu_node *node = map->retired_nodes;
+        while (node != NULL) {
+            hz_rcu_node *next = node->retired_next;
+            hz_free(node);
+            node = next;
+        }
+        hz_rcu_table *table = map->retired_tables;
+        while (table != NULL) {
+            hz_rcu_table *next = table->retired_next;
+            hz_rcu_table_free(table);
+            table = next;
+        }
+        hz_rcu_table_free(map->table);
+        hz_rcu_reader *reader = map->readers;
+        while (reader != NULL) {
+            hz_rcu_reader *next = reader->next;
+            hz_free(reader);
+            reader = next;
+        }
+        hz_free(map);
+    }
+}
+
+size_t
+hz_rcu_map_size(const hz_rcu_map *map)
+{
+    hz_check_null(map);
+    return __atomic_load_n(&map->size, __ATOMIC_RELAXED);
+}
+
+hz_rcu_reader *
+hz_rcu_reader_new(hz_rcu_map *map)
+{
+    hz_check_null(map);
+
+    // Try to recycle a released reader first
+    hz_rcu_reader *reader = __atomic_load_n(&map->readers, __ATOMIC_ACQUIRE);
+    while (reader != NULL) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(
+                &reader->in_use, &expected, 1, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            return reader;
+        }
+        reader = reader->next;
+    }
+
+    // Otherwise push a new one. Readers are only unlinked when the
+    // map is freed, so there is no ABA problem here.
+    reader = hz_malloc(1, sizeof(hz_rcu_reader));
+    reader->epoch = QUIESCENT_EPOCH;
+    reader->in_use = 1;
+    reader->map = map;
+    reader->next = __atomic_load_n(&map->readers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(
+               &map->readers, &reader->next, reader, true,
+               __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+        // reader->next was updated with the current head, retry
+    }
+    return reader;
+}
+
+void
+hz_rcu_reader_free(hz_rcu_reader *reader)
+{
+    if (reader != NULL) {
+        __atomic_store_n(&reader->in_use, 0, __ATOMIC_RELEASE);
+    }
+}
+
+bool
+hz_rcu_map_get(hz_rcu_reader *reader, const void *key, void *out_value)
+{
+    hz_check_null(reader);
+    hz_check_null(key);
+
+    const hz_rcu_map *map = reader->map;
+    size_t hash = hz_rcu_map_hash_key(map, key);
+
+    // Announce the epoch we are reading in, so that the writer doesn't
+    // free anything we might see. The fence keeps the loads below from
+    // being reordered before the announcement.
+    size_t epoch = __atomic_load_n(&map->epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&reader->epoch, epoch, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    bool found = false;
+    hz_rcu_table *table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+    size_t index = hash & (table->bucket_count - 1);
+    hz_rcu_node *node = __atomic_load_n(&table->buckets[index], __ATOMIC_ACQUIRE);
+    while (node != NULL) {
+        if (node->hash == hash && map->cmp_func(key, hz_rcu_node_key(node)) == 0) {
+            if (out_value != NULL) {
+                hz_memcpy(out_value, hz_rcu_node_value(map, node), 1, map->value_size);
+            }
+            found = true;
+            break;
+        }
+        node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    }
+
+    // Release ordering makes sure we're done with the nodes
+    // before the writer can observe that we've finished
+    __atomic_store_n(&reader->epoch, QUIESCENT_EPOCH, __ATOMIC_RELEASE);
+    return found;
+}
+
+bool
+hz_rcu_map_put(hz_rcu_map *map, const void *key, const void *value, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+    hz_check_null(value);
+
+    size_t hash = hz_rcu_map_hash_key(map, key);
+    hz_rcu_node **link = hz_rcu_map_find_link(map, map->table, hash, key);
+    if (link != NULL) {
+        // Readers may be copying the old value right now, so swap
+        // in a new node instead of overwriting it
+        hz_rcu_node *old_node = *link;
+        hz_rcu_node *new_node = hz_rcu_node_new(map, hash, key, value);
+        new_node->next = old_node->next;
+        if (out_value != NULL) {
+            hz_memcpy(out_value, hz_rcu_node_value(map, old_node), 1, map->value_size);
+        }
+        hz_rcu_map_publish_node(link, new_node);
+        hz_rcu_map_retire_node(map, old_node);
+        hz_rcu_map_collect(map);
+        return true;
+    }
+
+    // Grow before inserting, so the new node only goes into one table
+    hz_rcu_table *table = map->table;
+    if (map->size >= (size_t)(table->bucket_count * LOAD_FACTOR)) {
+        if (table->bucket_count > SIZE_MAX / SCALING_FACTOR) {
+            hz_abort("Map is too large");
+        }
+        hz_rcu_map_resize(map, table->bucket_count * SCALING_FACTOR);
+        table = map->table;
+    }
+
+    hz_rcu_node **head = &table->buckets[hash & (table->bucket_count - 1)];
+    hz_rcu_node *node = hz_rcu_node_new(map, hash, key, value);
+    node->next = *head;
+    hz_rcu_map_publish_node(head, node);
+    hz_rcu_map_set_size(map, map->size + 1);
+    hz_rcu_map_collect(map);
+    return false;
+}
+
+bool
+hz_rcu_map_remove(hz_rcu_map *map, const void *key, void *out_value)
+{
+    hz_check_null(map);
+    hz_check_null(key);
+
+    size_t hash = hz_rcu_map_hash_key(map, key);
+    hz_rcu_node **link = hz_rcu_map_find_link(map, map->table, hash, key);
+    if (link == NULL) {
+        return false;
+    }
+
+    // Readers currently on the node can still follow its next
+    // pointer, since it isn't freed until they are done
+    hz_rcu_node *node = *link;
+    if (out_value != NULL) {
+        hz_memcpy(out_value, hz_rcu_node_value(map, node), 1, map->value_size);
+    }
+    hz_rcu_map_publish_node(link, node->next);
+    hz_rcu_map_retire_node(map, node);
+    hz_rcu_map_set_size(map, map->size - 1);
+    hz_rcu_map_collect(map);
+    return true;
+}
+
+void
+hz_rcu_map_clear(hz_rcu_map *map)
+{
+    hz_check_null(map);
+    hz_rcu_table *old_table = map->table;
+    hz_rcu_map_publish_table(map, hz_rcu_table_new(INITIAL_CAPACITY));
+    hz_rcu_map_retire_table(map, old_table);
+    hz_rcu_map_set_size(map, 0);
+    hz_rcu_map_collect(map);
+}
@@ -0,0 +1,237 @@
+#include "hazuki/set.h"
+#include "hazuki/map.h"
+#include "hazuki/utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+struct hz_set
+{
+    hz_map *map;
+    size_t key_size;
+    hz_map_hash_func hash_func;
+    hz_map_cmp_func cmp_func;
+    hz_map_options options;
+};
+
+/**
+ * Wraps a map in a set with the same settings as the given set.
+ */
+static hz_set *
+hz_set_wrap(const hz_set *settings, hz_map *map)
+{
+    hz_set *set = hz_malloc(1, sizeof(hz_set));
+    set->map = map;
+    set->key_size = settings->key_size;
+    set->hash_func = settings->hash_func;
+    set->cmp_func = settings->cmp_func;
+    set->options = settings->options;
+    return set;
+}
+
+/**
+ * Creates an empty set with the same settings as the given set.
+ */
+static hz_set *
+hz_set_new_like(const hz_set *settings)
+{
+    return hz_set_new_with_options(
+        settings->key_size, settings->hash_func, settings->cmp_func, &settings->options);
+}
+
+static void
+hz_set_check_compatible(const hz_set *a, const hz_set *b)
+{
+    hz_check_null(a);
+    hz_check_null(b);
+    if (a->key_size != b->key_size) {
+        hz_abort("Sets have different key types");
+    }
+    if (a->hash_func != b->hash_func || a->cmp_func != b->cmp_func) {
+        hz_abort("Sets have different hash or comparator functions");
+    }
+}
+
+hz_set *
+hz_set_new(size_t key_size, hz_map_hash_func hash_func, hz_map_cmp_func cmp_func)
+{
+    return hz_set_new_with_options(key_size, hash_func, cmp_func, NULL);
+}
+
+hz_set *
+hz_set_new_with_options(
+    size_t key_size,
+    hz_map_hash_func hash_func,
+    hz_map_cmp_func cmp_func,
+    const hz_map_options *options)
+{
+    hz_check_null(hash_func);
+    hz_check_null(cmp_func);
+    hz_set *set = hz_malloc(1, sizeof(hz_set));
+    set->key_size = key_size;
+    set->hash_func = hash_func;
+    set->cmp_func = cmp_func;
+    if (options != NULL) {
+        set->options = *options;
+    } else {
+        hz_map_options_init(&set->options);
+    }
+    set->map = hz_map_new_with_options(key_size, 0, hash_func, cmp_func, &set->options);
+    return set;
+}
+
+void
+hz_set_free(hz_set *set)
+{
+    if (set != NULL) {
+        hz_map_free(set->map);
+        hz_free(set);
+    }
+}
+
+hz_set *
+hz_set_copy(const hz_set *set)
+{
+    hz_check_null(set);
+    return hz_set_wrap(set, hz_map_copy(set->map));
+}
+
+size_t
+hz_set_size(const hz_set *set)
+{
+    hz_check_null(set);
+    return hz_map_size(set->map);
+}
+
+void
+hz_set_reserve(hz_set *set, size_t capacity)
+{
+    hz_check_null(set);
+    hz_map_reserve(set->map, capacity);
+}
+
+void
+hz_set_clear(hz_set *set)
+{
+    hz_check_null(set);
+    hz_map_clear(set->map);
+}
+
+bool
+hz_set_contains(const hz_set *set, const void *key)
+{
+    hz_check_null(set);
+    return hz_map_get(set->map, key, NULL);
+}
+
+bool
+hz_set_add(hz_set *set, const void *key)
+{
+    hz_check_null(set);
+    bool inserted;
+    hz_map_emplace(set->map, key, &inserted);
+    return inserted;
+}
+
+bool
+hz_set_remove(hz_set *set, const void *key)
+{
+    hz_check_null(set);
+    return hz_map_remove(set->map, key, NULL);
+}
+
+bool
+hz_set_equals(const hz_set *a, const hz_set *b)
+{
+    if (a == b) {
+        return true;
+    }
+    if (a == NULL || b == NULL) {
+        return false;
+    }
+    hz_set_check_compatible(a, b);
+    return hz_map_equals(a->map, b->map, NULL);
+}
+
+void
+hz_set_cursor_init(hz_set_cursor *cursor, const hz_set *set)
+{
+    hz_check_null(cursor);
+    hz_check_null(set);
+    hz_map_cursor_init(&cursor->map_cursor, set->map);
+}
+
+bool
+hz_set_cursor_next(hz_set_cursor *cursor, const void **key)
+{
+    hz_check_null(cursor);
+    return hz_map_cursor_next(&cursor->map_cursor, key, NULL);
+}
+
+hz_set *
+hz_set_union(const hz_set *a, const hz_set *b)
+{
+    hz_set_check_compatible(a, b);
+
+    const hz_set *larger = a;
+    const hz_set *smaller = b;
+    if (hz_set_size(b) > hz_set_size(a)) {
+        larger = b;
+        smaller = a;
+    }
+
+    // Copying a map doesn't hash or compare any keys, so copy the larger
+    // set and only add the keys of the smaller one. Merging reuses the
+    // smaller set's hashes if the sets also have the same seed.
+    hz_set *result = hz_set_copy(larger);
+    hz_map_merge(result->map, smaller->map, NULL, NULL);
+    return result;
+}
+
+hz_set *
+hz_set_intersection(const hz_set *a, const hz_set *b)
+{
+    hz_set_check_compatible(a, b);
+    const hz_set *larger = a;
+    const hz_set *smaller = b;
+    if (hz_set_size(b) > hz_set_size(a)) {
+        larger = b;
+        smaller = a;
+    }
+
+    hz_set *result = hz_set_new_like(a);
+    hz_set_reserve(result, hz_set_size(smaller));
+    hz_map_cursor cursor;
+    hz_map_cursor_init(&cursor, smaller->map);
+    const void *key;
+    while (hz_map_cursor_next(&cursor, &key, NULL)) {
+        if (hz_map_get(larger->map, key, NULL)) {
+            hz_set_add(result, key);
+        }
+    }
+    return result;
+}
+
+hz_set *
+hz_set_difference(const hz_set *a, const hz_set *b)
+{
+    hz_set_check_compatible(a, b);
+    hz_map_cursor cursor;
+    const void *key;
+    if (hz_set_size(a) <= hz_set_size(b)) {
+        hz_set *result = hz_set_new_like(a);
+        hz_map_cursor_init(&cursor, a->map);
+        while (hz_map_cursor_next(&cursor, &key, NULL)) {
+            if (!hz_map_get(b->map, key, NULL)) {
+                hz_set_add(result, key);
+            }
+        }
+        return result;
+    } else {
+        hz_set *result = hz_set_copy(a);
+        hz_map_cursor_init(&cursor, b->map);
+        while (hz_map_cursor_next(&cursor, &key, NULL)) {
+            hz_set_remove(result, key);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,260 @@
+#include "hazuki/btree.h"
+#include "hazuki/utils.h"
+#include "hazuki/vector.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Key type that is large enough that each node only holds a few keys,
+ * so that small trees are already several levels deep.
+ */
+typedef struct
+{
+    int id;
+    char padding[60];
+} big_key;
+
+static int
+int_cmp(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static big_key
+big_key_make(int id)
+{
+    big_key key;
+    memset(&key, 0, sizeof(key));
+    key.id = id;
+    return key;
+}
+
+static void
+hz_btree_assert_get(const hz_btree *tree, int key, int expected)
+{
+    big_key k = big_key_make(key);
+    int value;
+    if (!hz_btree_get(tree, &k, &value)) {
+        hz_abort("Expected key %d to exist", key);
+    }
+    if (value != expected) {
+        hz_abort("Expected %d => %d, got %d", key, expected, value);
+    }
+}
+
+/**
+ * Checks that iterating the tree yields exactly the keys marked as
+ * present, in increasing order, each mapped to its negation.
+ */
+static void
+hz_btree_assert_contents(const hz_btree *tree, const bool *present, int max_key)
+{
+    hz_btree_cursor cursor;
+    hz_btree_cursor_init(&cursor, tree);
+    const void *key_ptr;
+    const void *value_ptr;
+    size_t count = 0;
+    int expected = 0;
+    while (hz_btree_cursor_next(&cursor, &key_ptr, &value_ptr)) {
+        const big_key *key = key_ptr;
+        const int *value = value_ptr;
+        while (expected < max_key && !present[expected]) {
+            expected++;
+        }
+        if (key->id != expected || *value != -expected) {
+            hz_abort("Expected %d => %d, got %d => %d", expected, -expected, key->id, *value);
+        }
+        expected++;
+        count++;
+    }
+    if (count != hz_btree_size(tree)) {
+        hz_abort("Expected %zu entries, visited %zu", hz_btree_size(tree), count);
+    }
+}
+
+static void
+test_btree_basic(void)
+{
+    hz_btree *tree = hz_btree_new(sizeof(int), sizeof(int), int_cmp);
+    int key = 1;
+    int value = 10;
+    int old_value;
+    if (hz_btree_get(tree, &key, NULL) || hz_btree_remove(tree, &key, NULL)) {
+        hz_abort("Expected empty tree");
+    }
+    if (hz_btree_put(tree, &key, &value, NULL)) {
+        hz_abort("Expected key to be new");
+    }
+    value = 11;
+    if (!hz_btree_put(tree, &key, &value, &old_value) || old_value != 10) {
+        hz_abort("Expected put to replace value");
+    }
+    if (!hz_btree_get(tree, &key, &value) || value != 11) {
+        hz_abort("Expected updated value");
+    }
+    if (!hz_btree_remove(tree, &key, &old_value) || old_value != 11) {
+        hz_abort("Expected remove to return value");
+    }
+    if (hz_btree_size(tree) != 0 || hz_btree_get(tree, &key, NULL)) {
+        hz_abort("Expected tree to be empty");
+    }
+
+    for (int i = 0; i < 1000; ++i) {
+        key = i * 2;
+        hz_btree_put(tree, &key, &i, NULL);
+    }
+    hz_btree_clear(tree);
+    if (hz_btree_size(tree) != 0) {
+        hz_abort("Expected tree to be empty");
+    }
+    hz_btree_free(tree);
+}
+
+static void
+test_btree_random(void)
+{
+    // Apply random puts and removes, checking the full contents of the
+    // tree every so often, with enough entries to exercise every split,
+    // borrow, and merge path
+    enum { MAX_KEY = 2000 };
+    bool present[MAX_KEY] = {false};
+    size_t size = 0;
+    hz_btree *tree = hz_btree_new(sizeof(big_key), sizeof(int), int_cmp);
+    unsigned int state = 1;
+    for (int i = 0; i < 50000; ++i) {
+        state = state * 1103515245 + 12345;
+        int id = (int)((state >> 8) % MAX_KEY);
+        big_key key = big_key_make(id);
+        int value = -id;
+
+        // Mostly insert in the first half and mostly remove in the
+        // second, so the tree both grows and shrinks a lot
+        bool insert = ((state >> 4) % 4 != 0) == (i < 25000);
+        if (insert) {
+            if (hz_btree_put(tree, &key, &value, NULL) != present[id]) {
+                hz_abort("Unexpected put result for key %d", id);
+            }
+            size += !present[id];
+            present[id] = true;
+        } else {
+            int old_value;
+            if (hz_btree_remove(tree, &key, &old_value) != present[id]) {
+                hz_abort("Unexpected remove result for key %d", id);
+            }
+            if (present[id] && old_value != -id) {
+                hz_abort("Unexpected removed value for key %d", id);
+            }
+            size -= present[id];
+            present[id] = false;
+        }
+        if (hz_btree_size(tree) != size) {
+            hz_abort("Expected size %zu, got %zu", size, hz_btree_size(tree));
+        }
+        if (i % 1000 == 0) {
+            hz_btree_assert_contents(tree, present, MAX_KEY);
+        }
+    }
+    hz_btree_assert_contents(tree, present, MAX_KEY);
+    hz_btree_free(tree);
+}
+
+static void
+test_btree_lower_bound(void)
+{
+    hz_btree *tree = hz_btree_new(sizeof(big_key), sizeof(int), int_cmp);
+    for (int i = 0; i < 500; ++i) {
+        big_key key = big_key_make(i * 10);
+        hz_btree_put(tree, &key, &i, NULL);
+    }
+
+    // Every possible starting point, including ones before the first
+    // key, between keys, on a key, and after the last key
+    for (int start = -5; start <= 5000; start += 3) {
+        big_key key = big_key_make(start);
+        hz_btree_cursor cursor;
+        hz_btree_lower_bound(tree, &key, &cursor);
+        const void *found;
+        int expected = start <= 0 ? 0 : (start + 9) / 10 * 10;
+        if (expected >= 5000) {
+            if (hz_btree_cursor_next(&cursor, NULL, NULL)) {
+                hz_abort("Expected no key >= %d", start);
+            }
+            continue;
+        }
+        if (!hz_btree_cursor_next(&cursor, &found, NULL) || ((const big_key *)found)->id != expected) {
+            hz_abort("Expected lower bound of %d to be %d", start, expected);
+        }
+    }
+
+    // Range scan of [1000, 2000)
+    big_key lo = big_key_make(1000);
+    big_key hi = big_key_make(2000);
+    hz_btree_cursor cursor;
+    hz_btree_lower_bound(tree, &lo, &cursor);
+    const void *key;
+    int count = 0;
+    while (hz_btree_cursor_next(&cursor, &key, NULL) && int_cmp(key, &hi) < 0) {
+        count++;
+    }
+    if (count != 100) {
+        hz_abort("Expected 100 keys in range, got %d", count);
+    }
+    hz_btree_free(tree);
+}
+
+static void
+test_btree_load_sorted(void)
+{
+    // Sizes around the node capacity, where the bottom-up build has to
+    // spread entries between nodes
+    int sizes[] = { 0, 1, 3, 4, 5, 9, 10, 25, 1000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        int n = sizes[s];
+        hz_vector *keys = hz_vector_new(sizeof(big_key));
+        hz_vector *values = hz_vector_new(sizeof(int));
+        bool *present = calloc((size_t)n + 1, sizeof(bool));
+        for (int i = 0; i < n; ++i) {
+            big_key key = big_key_make(i);
+            int value = -i;
+            hz_vector_append(keys, &key);
+            hz_vector_append(values, &value);
+            present[i] = true;
+        }
+        hz_btree *tree = hz_btree_new(sizeof(big_key), sizeof(int), int_cmp);
+        hz_btree_load_sorted(tree, keys, values);
+        if (hz_btree_size(tree) != (size_t)n) {
+            hz_abort("Expected %d entries after load", n);
+        }
+        hz_btree_assert_contents(tree, present, n);
+
+        // The loaded tree must support modifications as usual
+        for (int i = 0; i < n; i += 2) {
+            big_key key = big_key_make(i);
+            hz_btree_remove(tree, &key, NULL);
+            present[i] = false;
+        }
+        for (int i = 1; i < n; i += 4) {
+            hz_btree_assert_get(tree, i, -i);
+        }
+        hz_btree_assert_contents(tree, present, n);
+
+        free(present);
+        hz_btree_free(tree);
+        hz_vector_free(keys);
+        hz_vector_free(values);
+    }
+}
+
+void
+test_btree(void)
+{
+    test_btree_basic();
+    test_btree_random();
+    test_btree_lower_bound();
+    test_btree_load_sorted();
+    printf("All B-tree tests passed!\n");
+}
@@ -0,0 +1,279 @@
+#include "hazuki/cache.h"
+#include "hazuki/utils.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t
+int_hash(const void *key)
+{
+    return (size_t)*(const int *)key;
+}
+
+static int
+int_cmp(const void *a, const void *b)
+{
+    return *(const int *)a != *(const int *)b;
+}
+
+static hz_cache *
+hz_cache_new_int(size_t max_entries, size_t max_bytes)
+{
+    hz_cache_options options;
+    hz_cache_options_init(&options);
+    options.max_entries = max_entries;
+    options.max_bytes = max_bytes;
+    return hz_cache_new(sizeof(int), sizeof(int), int_hash, int_cmp, &options);
+}
+
+static void
+hz_cache_put_int(hz_cache *cache, int key, int value)
+{
+    hz_cache_put(cache, &key, &value, NULL);
+}
+
+static bool
+hz_cache_contains(const hz_cache *cache, int key)
+{
+    return hz_cache_peek(cache, &key, NULL);
+}
+
+static void
+test_cache_basic(void)
+{
+    hz_cache *cache = hz_cache_new_int(10, 0);
+    int key = 1;
+    int value = 10;
+    int old_value;
+    if (hz_cache_get(cache, &key, NULL) || hz_cache_remove(cache, &key, NULL)) {
+        hz_abort("Expected empty cache");
+    }
+    if (hz_cache_put(cache, &key, &value, NULL)) {
+        hz_abort("Expected key to be new");
+    }
+    value = 11;
+    if (!hz_cache_put(cache, &key, &value, &old_value) || old_value != 10) {
+        hz_abort("Expected put to replace value");
+    }
+    int *ref = hz_cache_get_ref(cache, &key);
+    if (ref == NULL || *ref != 11) {
+        hz_abort("Expected reference to updated value");
+    }
+    *ref = 12;
+    if (!hz_cache_get(cache, &key, &value) || value != 12) {
+        hz_abort("Expected value to be updated in place");
+    }
+    if (!hz_cache_remove(cache, &key, &old_value) || old_value != 12) {
+        hz_abort("Expected remove to return value");
+    }
+    if (hz_cache_size(cache) != 0 || hz_cache_bytes(cache) != 0) {
+        hz_abort("Expected cache to be empty");
+    }
+
+    hz_cache_put_int(cache, 1, 1);
+    hz_cache_put_int(cache, 2, 2);
+    hz_cache_clear(cache);
+    if (hz_cache_size(cache) != 0 || hz_cache_contains(cache, 1)) {
+        hz_abort("Expected cache to be empty after clear");
+    }
+    hz_cache_put_int(cache, 3, 3);
+    if (!hz_cache_contains(cache, 3)) {
+        hz_abort("Expected cache to be usable after clear");
+    }
+    hz_cache_free(cache);
+}
+
+static void
+test_cache_lru(void)
+{
+    hz_cache *cache = hz_cache_new_int(3, 0);
+    hz_cache_put_int(cache, 1, 1);
+    hz_cache_put_int(cache, 2, 2);
+    hz_cache_put_int(cache, 3, 3);
+
+    // Using 1 makes 2 the least recently used, but peeking doesn't count
+    int key = 1;
+    hz_cache_get(cache, &key, NULL);
+    key = 2;
+    hz_cache_peek(cache, &key, NULL);
+    hz_cache_put_int(cache, 4, 4);
+    if (hz_cache_contains(cache, 2) || !hz_cache_contains(cache, 1)) {
+        hz_abort("Expected 2 to be evicted");
+    }
+
+    // Replacing a value also counts as a use
+    hz_cache_put_int(cache, 3, 30);
+    hz_cache_put_int(cache, 5, 5);
+    if (hz_cache_contains(cache, 1) || !hz_cache_contains(cache, 3)) {
+        hz_abort("Expected 1 to be evicted");
+    }
+    if (hz_cache_size(cache) != 3) {
+        hz_abort("Expected cache to be full");
+    }
+
+    hz_cache_stats stats;
+    hz_cache_get_stats(cache, &stats);
+    if (stats.hits != 1 || stats.misses != 0 || stats.evictions != 2) {
+        hz_abort("Unexpected stats %zu/%zu/%zu", stats.hits, stats.misses, stats.evictions);
+    }
+    key = 1;
+    hz_cache_get(cache, &key, NULL);
+    hz_cache_get_stats(cache, &stats);
+    if (stats.misses != 1) {
+        hz_abort("Expected a miss");
+    }
+    hz_cache_free(cache);
+}
+
+typedef struct
+{
+    size_t evicted_count;
+    int evicted_sum;
+} evict_state;
+
+static size_t
+value_size_func(const void *key, const void *value, void *ctx)
+{
+    (void)key;
+    (void)ctx;
+    return (size_t)*(const int *)value;
+}
+
+static void
+record_evict_func(const void *key, void *value, void *ctx)
+{
+    evict_state *state = ctx;
+    if (*(const int *)key != *(const int *)value) {
+        hz_abort("Expected evicted key to match its value");
+    }
+    state->evicted_count++;
+    state->evicted_sum += *(const int *)value;
+}
+
+static void
+test_cache_bytes(void)
+{
+    evict_state state = { 0, 0 };
+    hz_cache_options options;
+    hz_cache_options_init(&options);
+    options.max_bytes = 100;
+    options.size_func = value_size_func;
+    options.evict_func = record_evict_func;
+    options.ctx = &state;
+    hz_cache *cache = hz_cache_new(sizeof(int), sizeof(int), int_hash, int_cmp, &options);
+
+    // Each entry weighs as much as its value
+    hz_cache_put_int(cache, 40, 40);
+    hz_cache_put_int(cache, 30, 30);
+    hz_cache_put_int(cache, 20, 20);
+    if (hz_cache_bytes(cache) != 90 || state.evicted_count != 0) {
+        hz_abort("Expected everything to fit");
+    }
+    hz_cache_put_int(cache, 50, 50);
+    if (hz_cache_bytes(cache) != 100 || state.evicted_count != 1 || state.evicted_sum != 40) {
+        hz_abort("Expected only 40 to be evicted, got %zu bytes", hz_cache_bytes(cache));
+    }
+
+    // An entry that is too large on its own evicts everything else, but
+    // is kept itself
+    hz_cache_put_int(cache, 150, 150);
+    if (hz_cache_size(cache) != 1 || !hz_cache_contains(cache, 150)) {
+        hz_abort("Expected only the large entry to remain");
+    }
+    if (state.evicted_count != 4) {
+        hz_abort("Expected 4 evictions, got %zu", state.evicted_count);
+    }
+
+    // Explicit removal isn't an eviction
+    int key = 150;
+    hz_cache_remove(cache, &key, NULL);
+    if (state.evicted_count != 4 || hz_cache_bytes(cache) != 0) {
+        hz_abort("Expected removal not to count as eviction");
+    }
+    hz_cache_free(cache);
+}
+
+static void
+test_cache_random(void)
+{
+    // Compare against a naive LRU list, kept in order from most to least
+    // recently used
+    enum { CAPACITY = 50, MAX_KEY = 200 };
+    int order[CAPACITY + 1];
+    size_t count = 0;
+    size_t evictions = 0;
+    hz_cache_options options;
+    hz_cache_options_init(&options);
+    options.max_entries = CAPACITY;
+    options.map_options.use_pool = true;
+    options.map_options.incremental_resize = true;
+    hz_cache *cache = hz_cache_new(sizeof(int), sizeof(int), int_hash, int_cmp, &options);
+    unsigned int seed = 1;
+    for (int i = 0; i < 20000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        int key = (int)((seed >> 8) % MAX_KEY);
+        size_t index = 0;
+        while (index < count && order[index] != key) {
+            index++;
+        }
+        bool present = index < count;
+        int op = (int)((seed >> 4) % 4);
+        if (op == 0 && present) {
+            hz_cache_remove(cache, &key, NULL);
+            memmove(&order[index], &order[index + 1], (count - index - 1) * sizeof(int));
+            count--;
+            continue;
+        }
+        if (op == 1) {
+            int value;
+            if (hz_cache_get(cache, &key, &value) != present || (present && value != key)) {
+                hz_abort("Unexpected get result for key %d", key);
+            }
+            if (!present) {
+                continue;
+            }
+        } else {
+            hz_cache_put_int(cache, key, key);
+            if (!present) {
+                index = count++;
+            }
+        }
+
+        // Move the key to the front of the list, dropping the last key
+        // if it's too long
+        memmove(&order[1], &order[0], index * sizeof(int));
+        order[0] = key;
+        if (count > CAPACITY) {
+            count--;
+            evictions++;
+        }
+        if (hz_cache_size(cache) != count) {
+            hz_abort("Expected size %zu, got %zu", count, hz_cache_size(cache));
+        }
+        if (count == CAPACITY && !hz_cache_contains(cache, order[count - 1])) {
+            hz_abort("Expected least recently used key to be present");
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (!hz_cache_contains(cache, order[i])) {
+            hz_abort("Expected key %d to be present", order[i]);
+        }
+    }
+    hz_cache_stats stats;
+    hz_cache_get_stats(cache, &stats);
+    if (stats.evictions != evictions) {
+        hz_abort("Expected %zu evictions, got %zu", evictions, stats.evictions);
+    }
+    hz_cache_free(cache);
+}
+
+void
+test_cache(void)
+{
+    test_cache_basic();
+    test_cache_lru();
+    test_cache_bytes();
+    test_cache_random();
+    printf("All cache tests passed!\n");
+}
@@ -0,0 +1,393 @@
+#define _POSIX_C_SOURCE 200112L
+#include "hazuki/concurrent_map.h"
+#include "hazuki/utils.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Single-threaded lock that checks it is used correctly. state is
+ * -1 while held exclusively, and the number of readers otherwise.
+ */
+typedef struct
+{
+    int magic;
+    int state;
+} test_lock;
+
+#define TEST_LOCK_MAGIC 0x10c4
+
+static size_t test_lock_live;
+static size_t test_lock_acquired;
+
+static void
+test_lock_init(void *lock)
+{
+    test_lock *l = lock;
+    l->magic = TEST_LOCK_MAGIC;
+    l->state = 0;
+    test_lock_live++;
+}
+
+static void
+test_lock_destroy(void *lock)
+{
+    test_lock *l = lock;
+    if (l->magic != TEST_LOCK_MAGIC || l->state != 0) {
+        hz_abort("Destroying invalid or held lock");
+    }
+    l->magic = 0;
+    test_lock_live--;
+}
+
+static void
+test_lock_lock(void *lock)
+{
+    test_lock *l = lock;
+    if (l->magic != TEST_LOCK_MAGIC || l->state != 0) {
+        hz_abort("Lock is invalid or already held");
+    }
+    l->state = -1;
+    test_lock_acquired++;
+}
+
+static void
+test_lock_unlock(void *lock)
+{
+    test_lock *l = lock;
+    if (l->state != -1) {
+        hz_abort("Unlocking lock that is not held exclusively");
+    }
+    l->state = 0;
+}
+
+static void
+test_lock_lock_shared(void *lock)
+{
+    test_lock *l = lock;
+    if (l->magic != TEST_LOCK_MAGIC || l->state < 0) {
+        hz_abort("Lock is invalid or held exclusively");
+    }
+    l->state++;
+    test_lock_acquired++;
+}
+
+static void
+test_lock_unlock_shared(void *lock)
+{
+    test_lock *l = lock;
+    if (l->state <= 0) {
+        hz_abort("Unlocking lock that is not held for reading");
+    }
+    l->state--;
+}
+
+static const hz_lock_ops test_rwlock_ops = {
+    sizeof(test_lock),
+    test_lock_init,
+    test_lock_destroy,
+    test_lock_lock,
+    test_lock_unlock,
+    test_lock_lock_shared,
+    test_lock_unlock_shared,
+};
+
+static const hz_lock_ops test_mutex_ops = {
+    sizeof(test_lock),
+    test_lock_init,
+    test_lock_destroy,
+    test_lock_lock,
+    test_lock_unlock,
+    NULL,
+    NULL,
+};
+
+static void
+pthread_rwlock_init_op(void *lock)
+{
+    if (pthread_rwlock_init(lock, NULL) != 0) {
+        hz_abort("Failed to initialize rwlock");
+    }
+}
+
+static void
+pthread_rwlock_destroy_op(void *lock)
+{
+    pthread_rwlock_destroy(lock);
+}
+
+static void
+pthread_rwlock_lock_op(void *lock)
+{
+    pthread_rwlock_wrlock(lock);
+}
+
+static void
+pthread_rwlock_unlock_op(void *lock)
+{
+    pthread_rwlock_unlock(lock);
+}
+
+static void
+pthread_rwlock_lock_shared_op(void *lock)
+{
+    pthread_rwlock_rdlock(lock);
+}
+
+static const hz_lock_ops pthread_rwlock_ops = {
+    sizeof(pthread_rwlock_t),
+    pthread_rwlock_init_op,
+    pthread_rwlock_destroy_op,
+    pthread_rwlock_lock_op,
+    pthread_rwlock_unlock_op,
+    pthread_rwlock_lock_shared_op,
+    pthread_rwlock_unlock_op,
+};
+
+static size_t
+int_hash(const void *key)
+{
+    return (size_t)*(const int *)key;
+}
+
+static int
+int_cmp(const void *a, const void *b)
+{
+    return *(const int *)a != *(const int *)b;
+}
+
+static void
+increment(void *value, bool inserted, void *ctx)
+{
+    int *count = value;
+    if (inserted && *count != 0) {
+        hz_abort("Expected inserted value to be zeroed");
+    }
+    *count += *(const int *)ctx;
+}
+
+static hz_concurrent_map *
+hz_concurrent_map_new_int(const hz_lock_ops *lock_ops, size_t shard_count)
+{
+    hz_concurrent_map_options options;
+    hz_concurrent_map_options_init(&options);
+    options.lock_ops = lock_ops;
+    options.shard_count = shard_count;
+    return hz_concurrent_map_new(sizeof(int), sizeof(int), int_hash, int_cmp, &options);
+}
+
+static void
+hz_concurrent_map_assert_get(hz_concurrent_map *map, int key, int expected)
+{
+    int value;
+    if (!hz_concurrent_map_get(map, &key, &value)) {
+        hz_abort("Expected key %d to exist", key);
+    }
+    if (value != expected) {
+        hz_abort("Expected %d => %d, got %d", key, expected, value);
+    }
+}
+
+static void
+test_concurrent_map_basic(const hz_lock_ops *lock_ops)
+{
+    hz_concurrent_map *map = hz_concurrent_map_new_int(lock_ops, 8);
+    if (test_lock_live != 8) {
+        hz_abort("Expected 8 locks, got %zu", test_lock_live);
+    }
+
+    for (int i = 0; i < 1000; ++i) {
+        int value = i * 2;
+        if (hz_concurrent_map_put(map, &i, &value, NULL)) {
+            hz_abort("Expected key %d to be new", i);
+        }
+    }
+    if (hz_concurrent_map_size(map) != 1000) {
+        hz_abort("Expected 1000 entries");
+    }
+    for (int i = 0; i < 1000; ++i) {
+        hz_concurrent_map_assert_get(map, i, i * 2);
+    }
+
+    int key = 5;
+    int value = -1;
+    int old_value;
+    if (!hz_concurrent_map_put(map, &key, &value, &old_value) || old_value != 10) {
+        hz_abort("Expected put to replace value");
+    }
+    if (!hz_concurrent_map_remove(map, &key, &old_value) || old_value != -1) {
+        hz_abort("Expected remove to return value");
+    }
+    if (hz_concurrent_map_get(map, &key, NULL)) {
+        hz_abort("Expected key to be removed");
+    }
+
+    hz_concurrent_map_clear(map);
+    if (hz_concurrent_map_size(map) != 0) {
+        hz_abort("Expected map to be empty");
+    }
+
+    hz_concurrent_map_free(map);
+    if (test_lock_live != 0) {
+        hz_abort("Expected all locks to be destroyed");
+    }
+}
+
+static void
+test_concurrent_map_emplace(void)
+{
+    hz_concurrent_map *map = hz_concurrent_map_new_int(&test_rwlock_ops, 4);
+    int one = 1;
+    int ten = 10;
+    for (int i = 0; i < 100; ++i) {
+        int key = i % 10;
+        bool inserted = hz_concurrent_map_emplace(map, &key, increment, &one);
+        if (inserted != (i < 10)) {
+            hz_abort("Unexpected inserted flag for key %d", key);
+        }
+    }
+    int key = 3;
+    hz_concurrent_map_emplace(map, &key, increment, &ten);
+    hz_concurrent_map_assert_get(map, 3, 20);
+    hz_concurrent_map_assert_get(map, 4, 10);
+    hz_concurrent_map_free(map);
+}
+
+static void
+test_concurrent_map_shard_count(void)
+{
+    size_t acquired = test_lock_acquired;
+    hz_concurrent_map *map = hz_concurrent_map_new_int(&test_rwlock_ops, 5);
+    if (hz_concurrent_map_shard_count(map) != 8) {
+        hz_abort("Expected shard count to round up to 8");
+    }
+    int key = 1;
+    hz_concurrent_map_get(map, &key, NULL);
+    if (test_lock_acquired != acquired + 1) {
+        hz_abort("Expected get to take exactly one lock");
+    }
+    hz_concurrent_map_free(map);
+
+    map = hz_concurrent_map_new_int(&test_rwlock_ops, 0);
+    if (hz_concurrent_map_shard_count(map) != 1) {
+        hz_abort("Expected at least one shard");
+    }
+    hz_concurrent_map_free(map);
+}
+
+/**
+ * Parameters of the threaded stress test. Each writer owns the keys in
+ * [0, STRESS_KEYS) that are equal to its index mod STRESS_WRITERS, and
+ * in round r writes key + r * STRESS_KEYS to each of them (removing
+ * every third key first, so readers also race with removals). All
+ * writers also increment a shared counter key with emplace.
+ */
+#define STRESS_KEYS 1024
+#define STRESS_WRITERS 4
+#define STRESS_READERS 4
+#define STRESS_ROUNDS 100
+#define STRESS_COUNTER_KEY -1
+
+typedef struct
+{
+    hz_concurrent_map *map;
+    int index;
+    int done;
+} test_stress_ctx;
+
+static void *
+test_stress_writer(void *arg)
+{
+    test_stress_ctx *ctx = arg;
+    int one = 1;
+    int counter_key = STRESS_COUNTER_KEY;
+    for (int r = 0; r < STRESS_ROUNDS; ++r) {
+        for (int k = ctx->index; k < STRESS_KEYS; k += STRESS_WRITERS) {
+            if (k % 3 == 0) {
+                hz_concurrent_map_remove(ctx->map, &k, NULL);
+            }
+            int value = k + r * STRESS_KEYS;
+            hz_concurrent_map_put(ctx->map, &k, &value, NULL);
+        }
+        hz_concurrent_map_emplace(ctx->map, &counter_key, increment, &one);
+    }
+    return NULL;
+}
+
+static void *
+test_stress_reader(void *arg)
+{
+    test_stress_ctx *ctx = arg;
+    unsigned int k = (unsigned int)ctx->index;
+    do {
+        for (int i = 0; i < STRESS_KEYS; ++i) {
+            // Step through the keys in a different order in each reader
+            k = (k * 1103515245u + 12345u) % STRESS_KEYS;
+            int key = (int)k;
+            int value;
+            if (hz_concurrent_map_get(ctx->map, &key, &value)) {
+                if (value < 0 || value % STRESS_KEYS != key) {
+                    hz_abort("Read torn value %d for key %d", value, key);
+                }
+            }
+        }
+        if (hz_concurrent_map_size(ctx->map) > STRESS_KEYS + 1) {
+            hz_abort("Map has too many entries");
+        }
+    } while (!__atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE));
+    return NULL;
+}
+
+static void
+test_concurrent_map_threads(void)
+{
+    hz_concurrent_map *map = hz_concurrent_map_new_int(&pthread_rwlock_ops, 8);
+    test_stress_ctx writers[STRESS_WRITERS];
+    test_stress_ctx readers[STRESS_READERS];
+    pthread_t writer_threads[STRESS_WRITERS];
+    pthread_t reader_threads[STRESS_READERS];
+    for (int i = 0; i < STRESS_READERS; ++i) {
+        readers[i].map = map;
+        readers[i].index = i;
+        readers[i].done = 0;
+        if (pthread_create(&reader_threads[i], NULL, test_stress_reader, &readers[i]) != 0) {
+            hz_abort("Failed to create reader thread");
+        }
+    }
+    for (int i = 0; i < STRESS_WRITERS; ++i) {
+        writers[i].map = map;
+        writers[i].index = i;
+        writers[i].done = 0;
+        if (pthread_create(&writer_threads[i], NULL, test_stress_writer, &writers[i]) != 0) {
+            hz_abort("Failed to create writer thread");
+        }
+    }
+    for (int i = 0; i < STRESS_WRITERS; ++i) {
+        pthread_join(writer_threads[i], NULL);
+    }
+    for (int i = 0; i < STRESS_READERS; ++i) {
+        __atomic_store_n(&readers[i].done, 1, __ATOMIC_RELEASE);
+        pthread_join(reader_threads[i], NULL);
+    }
+
+    if (hz_concurrent_map_size(map) != STRESS_KEYS + 1) {
+        hz_abort("Expected %d entries", STRESS_KEYS + 1);
+    }
+    for (int k = 0; k < STRESS_KEYS; ++k) {
+        hz_concurrent_map_assert_get(map, k, k + (STRESS_ROUNDS - 1) * STRESS_KEYS);
+    }
+    hz_concurrent_map_assert_get(map, STRESS_COUNTER_KEY, STRESS_WRITERS * STRESS_ROUNDS);
+    hz_concurrent_map_free(map);
+}
+
+void
+test_concurrent_map(void)
+{
+    test_concurrent_map_basic(&test_rwlock_ops);
+    test_concurrent_map_basic(&test_mutex_ops);
+    test_concurrent_map_emplace();
+    test_concurrent_map_shard_count();
+    test_concurrent_map_threads();
+    printf("All concurrent map tests passed!\n");
+}
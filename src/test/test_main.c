@@ -3,14 +3,32 @@
 
 extern void test_utils(void);
 extern void test_vector(void);
+extern void test_pool(void);
 extern void test_map(void);
+extern void test_flat_map(void);
+extern void test_concurrent_map(void);
+extern void test_rcu_map(void);
+extern void test_typed_map(void);
+extern void test_btree(void);
+extern void test_cache(void);
+extern void test_perfect_map(void);
+extern void test_set(void);
 
 int
 main(void)
 {
     test_utils();
     test_vector();
+    test_pool();
     test_map();
+    test_flat_map();
+    test_concurrent_map();
+    test_rcu_map();
+    test_typed_map();
+    test_btree();
+    test_cache();
+    test_perfect_map();
+    test_set();
     printf("All tests passed!\n");
     return 0;
 }
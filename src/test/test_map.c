@@ -1,6 +1,9 @@
+#define _POSIX_C_SOURCE 200112L
 #include "hazuki/map.h"
 #include "hazuki/utils.h"
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +35,20 @@ key_cmp_T(const void *a, const void *b)
     return *(TKey *)a != *(TKey *)b;
 }
 
+static size_t
+key_hash_few_T(const void *key)
+{
+    return (size_t)(*(TKey *)key % 3);
+}
+
+static int
+key_order_T(const void *a, const void *b)
+{
+    TKey ak = *(TKey *)a;
+    TKey bk = *(TKey *)b;
+    return (ak > bk) - (ak < bk);
+}
+
 static int
 value_cmp_T(const void *a, const void *b)
 {
@@ -374,6 +391,1615 @@ test_map_equals(void)
     hz_map_free(map2);
 }
 
+static void
+test_map_pool(void)
+{
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.use_pool = true;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    for (TKey i = 0; i < 1000; ++i) {
+        hz_map_assert_put_new(map, i, "value");
+    }
+    for (TKey i = 0; i < 1000; i += 2) {
+        hz_map_assert_remove(map, i, "value");
+    }
+    for (TKey i = 0; i < 1000; i += 2) {
+        hz_map_assert_put_new(map, i, "new value");
+    }
+    hz_map *copy = hz_map_copy(map);
+    hz_map_clear(map);
+    hz_map_assert_size(map, 0);
+    hz_map_assert_put_new(map, 0, "zero");
+    hz_map_assert_get(map, 0, "zero");
+    hz_map_free(map);
+    for (TKey i = 0; i < 1000; ++i) {
+        hz_map_assert_get(copy, i, (i % 2 == 0) ? "new value" : "value");
+    }
+    hz_map_free(copy);
+}
+
+static size_t
+hz_map_count_it(const hz_map *map)
+{
+    hz_map_iterator *it = hz_map_iterator_new(map);
+    size_t n = 0;
+    while (hz_map_iterator_next(it, NULL, NULL)) {
+        n++;
+    }
+    hz_map_iterator_free(it);
+    return n;
+}
+
+static void
+test_map_incremental(void)
+{
+    TValue values[] = {
+        "zero",
+        "one",
+        "two",
+    };
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.incremental_resize = true;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    hz_map *expected = hz_map_new_T(key_hash_T);
+    for (TKey i = 0; i < 5000; ++i) {
+        hz_map_assert_put_new(map, i, values[i % 3]);
+        hz_map_put_T(expected, i, values[i % 3], NULL);
+        if (i % 7 == 0) {
+            hz_map_assert_remove(map, i / 2, values[(i / 2) % 3]);
+            hz_map_remove_T(expected, i / 2, NULL);
+        }
+        if (i % 97 == 0) {
+            hz_map_assert_equals_true(map, expected, NULL);
+            hz_map_assert_equals_true(expected, map, NULL);
+            if (hz_map_count_it(map) != hz_map_size(map)) {
+                hz_abort("Iterator count mismatch");
+            }
+            hz_map *copy = hz_map_copy(map);
+            hz_map_assert_equals_true(copy, expected, NULL);
+            hz_map_free(copy);
+        }
+    }
+    hz_map_assert_equals_true(map, expected, NULL);
+    hz_map_clear(map);
+    hz_map_assert_size(map, 0);
+    hz_map_free(map);
+    hz_map_free(expected);
+}
+
+/**
+ * A test that creates its maps with the given options.
+ */
+typedef void (*test_map_options_func)(const hz_map_options *options);
+
+/**
+ * Runs the test with each combination of the options that change how
+ * entries are allocated and moved: with and without an entry pool, and
+ * with and without incremental resizing.
+ */
+static void
+test_map_option_matrix(test_map_options_func test_func)
+{
+    for (int i = 0; i < 4; ++i) {
+        hz_map_options options;
+        hz_map_options_init(&options);
+        options.use_pool = (i & 1) != 0;
+        options.incremental_resize = (i & 2) != 0;
+        test_func(&options);
+    }
+}
+
+static void
+test_map_snapshot_options(const hz_map_options *options)
+{
+    TValue values[] = {
+        "zero",
+        "one",
+        "two",
+    };
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, options);
+
+    // Take snapshots along the way (some in the middle of a resize),
+    // along with deep copies to compare them against later
+    hz_map *snapshots[6];
+    hz_map *expected[6];
+    size_t count = 0;
+    for (TKey i = 0; i < 3000; ++i) {
+        hz_map_put_T(map, i, values[i % 3], NULL);
+        if (i % 5 == 0) {
+            hz_map_put_T(map, i / 2, values[(i + 1) % 3], NULL);
+        }
+        if (i % 7 == 0) {
+            hz_map_remove_T(map, i / 3, NULL);
+        }
+        if (i % 500 == 250) {
+            snapshots[count] = hz_map_snapshot(map);
+            expected[count] = hz_map_copy(map);
+            hz_map_assert_equals_true(snapshots[count], map, NULL);
+            count++;
+        }
+    }
+
+    // Modifying a snapshot must not affect the original or other snapshots
+    hz_map *final = hz_map_copy(map);
+    hz_map_put_T(snapshots[1], 10000, "snapshot", NULL);
+    hz_map_put_T(expected[1], 10000, "snapshot", NULL);
+    hz_map_remove_T(snapshots[1], 1, NULL);
+    hz_map_remove_T(expected[1], 1, NULL);
+    TValue *ref = hz_map_get_ref(snapshots[2], &(TKey){1000});
+    *ref = "written";
+    hz_map_put_T(expected[2], 1000, "written", NULL);
+
+    // Snapshots of snapshots work too
+    hz_map *nested = hz_map_snapshot(snapshots[3]);
+    hz_map_clear(snapshots[3]);
+    hz_map_assert_size(snapshots[3], 0);
+    hz_map_assert_equals_true(nested, expected[3], NULL);
+    hz_map_free(nested);
+
+    hz_map_assert_equals_true(map, final, NULL);
+    for (size_t i = 0; i < count; ++i) {
+        if (i != 3) {
+            hz_map_assert_equals_true(snapshots[i], expected[i], NULL);
+            hz_map_assert_equals_true(expected[i], snapshots[i], NULL);
+            if (hz_map_count_it(snapshots[i]) != hz_map_size(snapshots[i])) {
+                hz_abort("Iterator count mismatch");
+            }
+        }
+    }
+
+    // A reference fetched after a snapshot only points into the
+    // original map
+    hz_map *after = hz_map_snapshot(map);
+    TValue *after_ref = hz_map_get_ref(map, &(TKey){2000});
+    *after_ref = "written";
+    hz_map_assert_get(map, 2000, "written");
+    hz_map_assert_get(after, 2000, values[2000 % 3]);
+    hz_map_free(after);
+
+    // Writing through references unshares entries mid-iteration without
+    // invalidating the cursor, and the snapshot doesn't see the writes
+    hz_map *shared = hz_map_copy(final);
+    hz_map *snapshot = hz_map_snapshot(shared);
+    hz_map_cursor cursor;
+    hz_map_cursor_init(&cursor, shared);
+    const void *key;
+    size_t visited = 0;
+    while (hz_map_cursor_next(&cursor, &key, NULL)) {
+        TValue *ref = hz_map_get_ref(shared, key);
+        *ref = "cursor";
+        visited++;
+    }
+    if (visited != hz_map_size(shared)) {
+        hz_abort("Cursor visited %zu of %zu entries", visited, hz_map_size(shared));
+    }
+    hz_map_assert_equals_true(snapshot, final, NULL);
+    hz_map_assert_get(shared, 1000, "cursor");
+    hz_map_assert_get(shared, 2999, "cursor");
+    hz_map_free(snapshot);
+    hz_map_free(shared);
+
+    // Free the original first, so the snapshots have to clean up
+    // the memory they shared with it
+    hz_map_free(map);
+    for (size_t i = 0; i < count; ++i) {
+        hz_map_free(snapshots[i]);
+        hz_map_free(expected[i]);
+    }
+    hz_map_free(final);
+}
+
+static void
+test_map_snapshot(void)
+{
+    test_map_option_matrix(test_map_snapshot_options);
+}
+
+static void
+test_map_seed(void)
+{
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.seed = 12345;
+    hz_map *map1 = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    hz_map *map2 = hz_map_new_T(key_hash_T);
+    for (TKey i = 0; i < 1000; ++i) {
+        hz_map_assert_put_new(map1, (TKey)(i * 32), "value");
+        hz_map_assert_put_new(map2, (TKey)(i * 32), "value");
+    }
+    hz_map_assert_equals_true(map1, map2, NULL);
+    hz_map *copy = hz_map_copy(map1);
+    hz_map_assert_equals_true(copy, map2, NULL);
+    hz_map_assert_remove(copy, 32, "value");
+    hz_map_assert_not_get(copy, 32);
+    hz_map_assert_get(copy, 64, "value");
+    hz_map_free(copy);
+    hz_map_free(map1);
+    hz_map_free(map2);
+}
+
+static void
+test_map_hashed(void)
+{
+    // A map with the same hash function and seed agrees on the hash
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.seed = 12345;
+    options.incremental_resize = true;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    hz_map *other = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    for (TKey i = 0; i < 1000; ++i) {
+        size_t hash = hz_map_hash(other, &i);
+        TValue value = "value";
+        if (hz_map_put_hashed(map, hash, &i, &value, NULL)) {
+            hz_abort("Expected key %d to be new", i);
+        }
+    }
+    for (TKey i = 0; i < 1000; ++i) {
+        hz_map_assert_get(map, i, "value");
+        TValue value = NULL;
+        if (!hz_map_get_hashed(map, hz_map_hash(map, &i), &i, &value) || strcmp(value, "value") != 0) {
+            hz_abort("Expected hashed get to find key %d", i);
+        }
+    }
+
+    TKey key = 1000;
+    bool inserted;
+    TValue *value = hz_map_emplace_hashed(map, hz_map_hash(map, &key), &key, &inserted);
+    if (!inserted) {
+        hz_abort("Expected key to be inserted");
+    }
+    *value = "emplaced";
+    hz_map_assert_get(map, 1000, "emplaced");
+    TValue old_value = NULL;
+    if (!hz_map_remove_hashed(map, hz_map_hash(map, &key), &key, &old_value) || strcmp(old_value, "emplaced") != 0) {
+        hz_abort("Expected hashed remove to return the value");
+    }
+    hz_map_assert_not_get(map, 1000);
+    hz_map_free(other);
+    hz_map_free(map);
+}
+
+static void
+test_map_get_many(void)
+{
+    TValue values[] = {
+        "zero",
+        "one",
+        "two",
+    };
+    hz_map *map = hz_map_new_T(key_hash_T);
+    for (TKey i = 0; i < 1000; i += 2) {
+        hz_map_assert_put_new(map, i, values[i % 3]);
+    }
+
+    TKey keys[1000];
+    TValue out_values[1000];
+    bool out_found[1000];
+    for (TKey i = 0; i < 1000; ++i) {
+        keys[i] = (TKey)(999 - i);
+        out_values[i] = NULL;
+    }
+    size_t found = hz_map_get_many(map, keys, 1000, out_values, out_found);
+    if (found != 500) {
+        hz_abort("Expected 500 keys found, got %zu", found);
+    }
+    for (size_t i = 0; i < 1000; ++i) {
+        bool expected = keys[i] % 2 == 0;
+        if (out_found[i] != expected) {
+            hz_abort("Found mismatch for key %d", keys[i]);
+        }
+        TValue expected_value = expected ? values[keys[i] % 3] : NULL;
+        if (value_cmp_T(&out_values[i], &expected_value) != 0) {
+            hz_abort("Value mismatch for key %d", keys[i]);
+        }
+    }
+    if (hz_map_get_many(map, keys, 7, NULL, NULL) != 3) {
+        hz_abort("Expected 3 keys found");
+    }
+    if (hz_map_get_many(map, NULL, 0, NULL, NULL) != 0) {
+        hz_abort("Expected no keys found");
+    }
+    hz_map_free(map);
+}
+
+static void
+test_map_reserve(void)
+{
+    hz_map *map = hz_map_new_with_capacity(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, 1000);
+    hz_map_assert_size(map, 0);
+    hz_map_assert_not_get(map, 0);
+    for (TKey i = 0; i < 2000; ++i) {
+        hz_map_assert_put_new(map, i, "value");
+    }
+    hz_map_reserve(map, 10);
+    hz_map_reserve(map, 5000);
+    for (TKey i = 0; i < 2000; ++i) {
+        hz_map_assert_get(map, i, "value");
+    }
+    hz_map_assert_size(map, 2000);
+    hz_map_free(map);
+}
+
+static void
+test_map_put_many(void)
+{
+    hz_map *map = hz_map_new_T(key_hash_T);
+    hz_map_assert_put_new(map, 1, "old one");
+    TKey keys[] = { 0, 1, 2, 3, 0 };
+    TValue values[] = { "zero", "one", "two", "three", "new zero" };
+    size_t inserted = hz_map_put_many(map, keys, values, 5);
+    if (inserted != 3) {
+        hz_abort("Expected 3 new keys, got %zu", inserted);
+    }
+    TEntry entries[] = {
+        { 0, "new zero" },
+        { 1, "one" },
+        { 2, "two" },
+        { 3, "three" }
+    };
+    hz_map_assert_eq(map, entries, 4);
+    if (hz_map_put_many(map, NULL, NULL, 0) != 0) {
+        hz_abort("Expected no new keys");
+    }
+    hz_map_free(map);
+}
+
+static void
+test_map_emplace(void)
+{
+    hz_map *map = hz_map_new_T(key_hash_T);
+    hz_map_assert_put_new(map, 1, "one");
+    if (hz_map_get_ref(map, &(TKey){0}) != NULL) {
+        hz_abort("Expected no reference for missing key");
+    }
+    TValue *ref = hz_map_get_ref(map, &(TKey){1});
+    if (ref == NULL || strcmp(*ref, "one") != 0) {
+        hz_abort("Expected reference to existing value");
+    }
+    *ref = "uno";
+    hz_map_assert_get(map, 1, "uno");
+    const TValue *found = hz_map_find(map, &(TKey){1});
+    if (found != ref || hz_map_find(map, &(TKey){0}) != NULL) {
+        hz_abort("Expected read-only reference to the same value");
+    }
+
+    bool inserted;
+    ref = hz_map_emplace(map, &(TKey){1}, &inserted);
+    if (inserted || strcmp(*ref, "uno") != 0) {
+        hz_abort("Expected emplace to find existing value");
+    }
+    ref = hz_map_emplace(map, &(TKey){2}, &inserted);
+    if (!inserted || *ref != NULL) {
+        hz_abort("Expected emplace to insert zeroed value");
+    }
+    *ref = "two";
+    hz_map_assert_get(map, 2, "two");
+    hz_map_assert_size(map, 2);
+
+    // References must survive the map being resized
+    for (TKey i = 3; i < 1000; ++i) {
+        hz_map_emplace(map, &i, NULL);
+    }
+    if (strcmp(*ref, "two") != 0 || hz_map_get_ref(map, &(TKey){2}) != ref) {
+        hz_abort("Expected reference to be stable across resizes");
+    }
+    hz_map_assert_size(map, 999);
+    hz_map_free(map);
+}
+
+static void
+test_map_remove_ref(void)
+{
+    hz_map *map = hz_map_new_T(key_hash_T);
+    for (TKey i = 0; i < 100; ++i) {
+        hz_map_put_T(map, i, "value", NULL);
+    }
+    TValue *ref = hz_map_get_ref(map, &(TKey){42});
+    if (*(const TKey *)hz_map_ref_key(map, ref) != 42) {
+        hz_abort("Expected reference to know its key");
+    }
+    TValue old_value;
+    hz_map_remove_ref(map, ref, &old_value);
+    if (strcmp(old_value, "value") != 0 || hz_map_get(map, &(TKey){42}, NULL)) {
+        hz_abort("Expected entry to be removed");
+    }
+    hz_map_assert_size(map, 99);
+
+    // String keys are returned as the string itself
+    hz_map *strings = hz_map_new_string(sizeof(int), NULL);
+    int *count = hz_map_emplace(strings, "hello", NULL);
+    if (strcmp(hz_map_ref_key(strings, count), "hello") != 0) {
+        hz_abort("Expected reference to know its string key");
+    }
+    hz_map_remove_ref(strings, count, NULL);
+    if (hz_map_size(strings) != 0) {
+        hz_abort("Expected string entry to be removed");
+    }
+    hz_map_free(strings);
+    hz_map_free(map);
+}
+
+static bool
+sum_keys_visit(const void *key, const void *value, void *ctx)
+{
+    (void)value;
+    size_t *sum = ctx;
+    *sum += *(const TKey *)key;
+    return *(const TKey *)key != 50;
+}
+
+static void
+test_map_cursor(void)
+{
+    hz_map *map = hz_map_new_T(key_hash_T);
+    hz_map_cursor cursor;
+    hz_map_cursor_init(&cursor, map);
+    if (hz_map_cursor_next(&cursor, NULL, NULL)) {
+        hz_abort("Expected empty cursor");
+    }
+
+    for (TKey i = 0; i < 100; ++i) {
+        hz_map_assert_put_new(map, i, "value");
+    }
+
+    // The cursor yields pointers into the map itself
+    size_t key_sum = 0;
+    size_t n = 0;
+    const void *key;
+    const void *value;
+    hz_map_cursor_init(&cursor, map);
+    while (hz_map_cursor_next(&cursor, &key, &value)) {
+        if (hz_map_get_ref(map, key) != value) {
+            hz_abort("Cursor value does not point into map");
+        }
+        key_sum += *(const TKey *)key;
+        n++;
+    }
+    if (n != 100 || key_sum != 99 * 100 / 2) {
+        hz_abort("Cursor visited %zu keys (sum %zu)", n, key_sum);
+    }
+
+    // Visit everything, then stop early at key 50
+    key_sum = 0;
+    hz_map_remove(map, &(TKey){50}, NULL);
+    if (!hz_map_for_each(map, sum_keys_visit, &key_sum) || key_sum != 99 * 100 / 2 - 50) {
+        hz_abort("Expected for_each to visit all keys");
+    }
+    hz_map_put(map, &(TKey){50}, &(TValue){"value"}, NULL);
+    if (hz_map_for_each(map, sum_keys_visit, &key_sum)) {
+        hz_abort("Expected for_each to stop early");
+    }
+    hz_map_free(map);
+}
+
+static bool
+mark_key_visit(const void *key, const void *value, void *ctx)
+{
+    (void)value;
+    int *seen = ctx;
+    seen[*(const TKey *)key]++;
+    return true;
+}
+
+static void
+hz_map_assert_partitions(const hz_map *map, size_t count, size_t key_count)
+{
+    int *seen = hz_calloc(key_count, sizeof(int));
+    int *seen_for_each = hz_calloc(key_count, sizeof(int));
+    for (size_t i = 0; i < count; ++i) {
+        hz_map_cursor cursor;
+        hz_map_cursor_init_partition(&cursor, map, i, count);
+        const void *key;
+        while (hz_map_cursor_next(&cursor, &key, NULL)) {
+            seen[*(const TKey *)key]++;
+        }
+        if (!hz_map_for_each_partition(map, i, count, mark_key_visit, seen_for_each)) {
+            hz_abort("Expected for_each_partition to visit all keys");
+        }
+    }
+    for (size_t i = 0; i < key_count; ++i) {
+        int expected = hz_map_get_T(map, (TKey)i, NULL) ? 1 : 0;
+        if (seen[i] != expected || seen_for_each[i] != expected) {
+            hz_abort("Key %zu visited %d times across %zu partitions", i, seen[i], count);
+        }
+    }
+    hz_free(seen);
+    hz_free(seen_for_each);
+}
+
+static void
+test_map_partition(void)
+{
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.incremental_resize = true;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    hz_map_assert_partitions(map, 1, 1);
+    hz_map_assert_partitions(map, 4, 1);
+
+    // Check after every insertion for a while, so that some of the
+    // checks happen in the middle of a resize
+    for (TKey i = 0; i < 3000; ++i) {
+        hz_map_assert_put_new(map, i, "value");
+        if (i < 200 || i % 97 == 0) {
+            hz_map_assert_partitions(map, 1, 3000);
+            hz_map_assert_partitions(map, 3, 3000);
+            hz_map_assert_partitions(map, 64, 3000);
+        }
+    }
+
+    // More partitions than buckets leaves some of them empty
+    hz_map_assert_partitions(map, 100000, 3000);
+    hz_map_free(map);
+}
+
+/**
+ * Number of threads scanning partitions at once in the threaded
+ * partition test. Each thread scans PARTITION_THREAD_SHARE partitions.
+ */
+#define PARTITION_THREADS 4
+#define PARTITION_THREAD_SHARE 4
+
+typedef struct
+{
+    const hz_map *map;
+    int *seen;
+    size_t index;
+} test_partition_ctx;
+
+static bool
+mark_key_visit_atomic(const void *key, const void *value, void *ctx)
+{
+    (void)value;
+    int *seen = ctx;
+    __atomic_fetch_add(&seen[*(const TKey *)key], 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void *
+test_partition_scan(void *arg)
+{
+    // Alternate between cursors and for_each, so both are checked
+    test_partition_ctx *ctx = arg;
+    size_t count = PARTITION_THREADS * PARTITION_THREAD_SHARE;
+    for (size_t i = ctx->index; i < count; i += PARTITION_THREADS) {
+        if (i % 2 == 0) {
+            hz_map_cursor cursor;
+            hz_map_cursor_init_partition(&cursor, ctx->map, i, count);
+            const void *key;
+            while (hz_map_cursor_next(&cursor, &key, NULL)) {
+                mark_key_visit_atomic(key, NULL, ctx->seen);
+            }
+        } else {
+            hz_map_for_each_partition(ctx->map, i, count, mark_key_visit_atomic, ctx->seen);
+        }
+    }
+    return NULL;
+}
+
+static void
+test_map_partition_threads(void)
+{
+    // Use incremental resizing, so that partitions may have to span
+    // both tables
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.incremental_resize = true;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    TKey key_count = 3000;
+    for (TKey i = 0; i < key_count; ++i) {
+        hz_map_put_T(map, i, "value", NULL);
+    }
+    for (TKey i = 0; i < key_count; i += 3) {
+        hz_map_remove_T(map, i, NULL);
+    }
+
+    int *seen = hz_calloc((size_t)key_count, sizeof(int));
+    test_partition_ctx ctxs[PARTITION_THREADS];
+    pthread_t threads[PARTITION_THREADS];
+    for (size_t i = 0; i < PARTITION_THREADS; ++i) {
+        ctxs[i].map = map;
+        ctxs[i].seen = seen;
+        ctxs[i].index = i;
+        if (pthread_create(&threads[i], NULL, test_partition_scan, &ctxs[i]) != 0) {
+            hz_abort("Failed to create scan thread");
+        }
+    }
+    for (size_t i = 0; i < PARTITION_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // The partitions are disjoint and cover the whole map
+    for (TKey i = 0; i < key_count; ++i) {
+        int expected = i % 3 == 0 ? 0 : 1;
+        if (seen[i] != expected) {
+            hz_abort("Key %d visited %d times", i, seen[i]);
+        }
+    }
+    hz_free(seen);
+    hz_map_free(map);
+}
+
+static void
+add_int_combine(const void *key, void *dst_value, const void *src_value, void *ctx)
+{
+    (void)key;
+    *(int *)dst_value += *(const int *)src_value;
+    (*(size_t *)ctx)++;
+}
+
+static hz_map *
+hz_map_new_counts(size_t seed)
+{
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.seed = seed;
+    return hz_map_new_with_options(sizeof(TKey), sizeof(int), key_hash_T, key_cmp_T, &options);
+}
+
+static int
+hz_map_get_count(const hz_map *map, TKey key)
+{
+    int value = 0;
+    hz_map_get(map, &key, &value);
+    return value;
+}
+
+static void
+test_map_merge(void)
+{
+    // Keys [0, 2000) in a, [1000, 3000) in b
+    hz_map *a = hz_map_new_counts(0);
+    hz_map *b = hz_map_new_counts(0);
+    for (TKey i = 0; i < 2000; ++i) {
+        hz_map_put(a, &i, &(int){1}, NULL);
+        hz_map_put(b, &(TKey){(TKey)(i + 1000)}, &(int){10}, NULL);
+    }
+
+    // Same seed, so the hashes are reused, and then a different seed,
+    // so they are not
+    for (size_t seed = 0; seed <= 1; ++seed) {
+        hz_map *merged = hz_map_new_counts(seed);
+        size_t combined = 0;
+        if (hz_map_merge(merged, a, add_int_combine, &combined) != 2000 ||
+            hz_map_merge(merged, b, add_int_combine, &combined) != 1000 ||
+            combined != 1000)
+        {
+            hz_abort("Merge inserted or combined the wrong number of keys");
+        }
+        hz_map_assert_size(merged, 3000);
+        if (hz_map_get_count(merged, 0) != 1 ||
+            hz_map_get_count(merged, 1500) != 11 ||
+            hz_map_get_count(merged, 2999) != 10)
+        {
+            hz_abort("Merged value mismatch");
+        }
+
+        // Without a combiner, source values win
+        hz_map_merge(merged, a, NULL, NULL);
+        if (hz_map_get_count(merged, 1500) != 1 || hz_map_get_count(merged, 2999) != 10) {
+            hz_abort("Merge without combiner should replace values");
+        }
+        hz_map_free(merged);
+    }
+
+    // Merge three sources shard by shard, and check that the shards are
+    // disjoint and add up to a regular merge
+    hz_map *c = hz_map_new_counts(0);
+    for (TKey i = 0; i < 500; ++i) {
+        hz_map_put(c, &(TKey){(TKey)(i * 7)}, &(int){100}, NULL);
+    }
+    const hz_map *srcs[] = { a, b, c };
+    hz_map *expected = hz_map_new_counts(0);
+    size_t combined = 0;
+    for (size_t i = 0; i < 3; ++i) {
+        hz_map_merge(expected, srcs[i], add_int_combine, &combined);
+    }
+    for (size_t shard_count = 1; shard_count <= 5; shard_count += 2) {
+        hz_map *shards[5];
+        size_t total = 0;
+        size_t shard_combined = 0;
+        for (size_t i = 0; i < shard_count; ++i) {
+            shards[i] = hz_map_new_counts(i);
+            total += hz_map_merge_shard(shards[i], srcs, 3, i, shard_count, add_int_combine, &shard_combined);
+            if (shard_count > 1 && hz_map_size(shards[i]) == 0) {
+                hz_abort("Shard %zu of %zu is empty", i, shard_count);
+            }
+        }
+        if (total != hz_map_size(expected) || shard_combined != combined) {
+            hz_abort("Sharded merge size mismatch");
+        }
+        for (TKey i = 0; i < 3500; ++i) {
+            size_t shard = hz_map_shard_of(a, &i, shard_count);
+            if (hz_map_get_count(shards[shard], i) != hz_map_get_count(expected, i)) {
+                hz_abort("Sharded merge value mismatch for key %d", (int)i);
+            }
+        }
+        for (size_t i = 0; i < shard_count; ++i) {
+            hz_map_free(shards[i]);
+        }
+    }
+    hz_map_free(a);
+    hz_map_free(b);
+    hz_map_free(c);
+    hz_map_free(expected);
+
+    // String keys are copied into the destination's arena
+    hz_map *s1 = hz_map_new_string(sizeof(int), NULL);
+    hz_map *s2 = hz_map_new_string(sizeof(int), NULL);
+    hz_map_put(s1, "apple", &(int){1}, NULL);
+    hz_map_put(s2, "apple", &(int){2}, NULL);
+    hz_map_put(s2, "banana", &(int){3}, NULL);
+    combined = 0;
+    if (hz_map_merge(s1, s2, add_int_combine, &combined) != 1 || combined != 1) {
+        hz_abort("String merge mismatch");
+    }
+    hz_map_free(s2);
+    int value;
+    if (!hz_map_get(s1, "apple", &value) || value != 3 ||
+        !hz_map_get(s1, "banana", &value) || value != 3)
+    {
+        hz_abort("String merge value mismatch");
+    }
+    hz_map_free(s1);
+}
+
+/**
+ * Number of source maps and threads in the threaded merge test. Each
+ * thread merges one shard of every source.
+ */
+#define MERGE_SOURCES 4
+#define MERGE_THREADS 4
+
+typedef struct
+{
+    hz_map *dst;
+    const hz_map *const *srcs;
+    size_t shard;
+    size_t inserted;
+    size_t combined;
+} test_merge_ctx;
+
+static void *
+test_merge_shard_run(void *arg)
+{
+    test_merge_ctx *ctx = arg;
+    ctx->inserted = hz_map_merge_shard(
+        ctx->dst, ctx->srcs, MERGE_SOURCES, ctx->shard, MERGE_THREADS, add_int_combine, &ctx->combined);
+    return NULL;
+}
+
+static void
+test_map_merge_threads(void)
+{
+    // Source i holds keys [i * 1000, i * 1000 + 2000), each with value
+    // i + 1, so neighboring sources share half of their keys
+    hz_map *srcs[MERGE_SOURCES];
+    for (size_t i = 0; i < MERGE_SOURCES; ++i) {
+        srcs[i] = hz_map_new_counts(0);
+        for (TKey k = 0; k < 2000; ++k) {
+            hz_map_put(srcs[i], &(TKey){(TKey)(i * 1000 + k)}, &(int){(int)i + 1}, NULL);
+        }
+    }
+
+    // Each thread gets its own destination, and reads the shared sources
+    test_merge_ctx ctxs[MERGE_THREADS];
+    pthread_t threads[MERGE_THREADS];
+    for (size_t i = 0; i < MERGE_THREADS; ++i) {
+        ctxs[i].dst = hz_map_new_counts(i);
+        ctxs[i].srcs = (const hz_map *const *)srcs;
+        ctxs[i].shard = i;
+        ctxs[i].inserted = 0;
+        ctxs[i].combined = 0;
+        if (pthread_create(&threads[i], NULL, test_merge_shard_run, &ctxs[i]) != 0) {
+            hz_abort("Failed to create merge thread");
+        }
+    }
+    for (size_t i = 0; i < MERGE_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Keys [1000, 4000) are in two sources, and the rest in one
+    size_t key_count = (MERGE_SOURCES + 1) * 1000;
+    size_t inserted = 0;
+    size_t combined = 0;
+    for (size_t i = 0; i < MERGE_THREADS; ++i) {
+        inserted += ctxs[i].inserted;
+        combined += ctxs[i].combined;
+        if (hz_map_size(ctxs[i].dst) != ctxs[i].inserted) {
+            hz_abort("Shard %zu size mismatch", i);
+        }
+    }
+    if (inserted != key_count || combined != (MERGE_SOURCES - 1) * 1000) {
+        hz_abort("Threaded merge inserted %zu and combined %zu keys", inserted, combined);
+    }
+    for (TKey k = 0; k < (TKey)key_count; ++k) {
+        int expected = 0;
+        for (size_t i = 0; i < MERGE_SOURCES; ++i) {
+            if (k >= (TKey)(i * 1000) && k < (TKey)(i * 1000 + 2000)) {
+                expected += (int)i + 1;
+            }
+        }
+        size_t shard = hz_map_shard_of(srcs[0], &k, MERGE_THREADS);
+        if (hz_map_get_count(ctxs[shard].dst, k) != expected) {
+            hz_abort("Threaded merge value mismatch for key %d", (int)k);
+        }
+    }
+    for (size_t i = 0; i < MERGE_THREADS; ++i) {
+        hz_map_free(ctxs[i].dst);
+    }
+    for (size_t i = 0; i < MERGE_SOURCES; ++i) {
+        hz_map_free(srcs[i]);
+    }
+}
+
+static size_t
+char_hash(const void *key)
+{
+    return (size_t)*(const char *)key;
+}
+
+static int
+char_cmp(const void *a, const void *b)
+{
+    return *(const char *)a != *(const char *)b;
+}
+
+static void
+hz_map_assert_get_string(const hz_map *map, const char *key, int expected)
+{
+    int value;
+    if (!hz_map_get(map, key, &value)) {
+        hz_abort("Expected key %s to exist", key);
+    }
+    if (value != expected) {
+        hz_abort("Expected %s => %d, got %d", key, expected, value);
+    }
+}
+
+static void
+test_map_string_options(const hz_map_options *options)
+{
+    hz_map *map = hz_map_new_string(sizeof(int), options);
+
+    // Keys are copied, so the buffer can be reused. Keys of the same
+    // length, keys that are prefixes of each other, and the empty
+    // string must all be distinct.
+    const char *keys[] = { "", "a", "b", "ab", "abc", "abcdefghijklmnop", "abcdefghijklmnoq" };
+    size_t key_count = sizeof(keys) / sizeof(keys[0]);
+    char buf[32];
+    for (size_t i = 0; i < key_count; ++i) {
+        strcpy(buf, keys[i]);
+        int value = (int)i;
+        if (hz_map_put(map, buf, &value, NULL)) {
+            hz_abort("Expected key %s to be new", keys[i]);
+        }
+    }
+    memset(buf, 'x', sizeof(buf) - 1);
+    for (size_t i = 0; i < key_count; ++i) {
+        hz_map_assert_get_string(map, keys[i], (int)i);
+    }
+    if (hz_map_get(map, "abcd", NULL) || hz_map_get(map, "c", NULL)) {
+        hz_abort("Expected missing keys to not exist");
+    }
+    int *count = hz_map_emplace(map, "ab", NULL);
+    *count += 10;
+    hz_map_assert_get_string(map, "ab", 13);
+
+    // Iterators write out pointers to the stored keys
+    hz_map_iterator *it = hz_map_iterator_new(map);
+    const char *key;
+    int value;
+    size_t seen = 0;
+    while (hz_map_iterator_next(it, &key, &value)) {
+        if (strcmp(key, keys[value % 10]) != 0) {
+            hz_abort("Unexpected key %s => %d", key, value);
+        }
+        seen++;
+    }
+    hz_map_iterator_free(it);
+    if (seen != key_count) {
+        hz_abort("Expected to visit each key once");
+    }
+
+    const char *many_keys[] = { "abc", "nope", "" };
+    int many_values[3] = { -1, -1, -1 };
+    bool found[3];
+    if (hz_map_get_many(map, many_keys, 3, many_values, found) != 2 ||
+        !found[0] || found[1] || !found[2] || many_values[0] != 4 || many_values[2] != 0)
+    {
+        hz_abort("Unexpected get_many result");
+    }
+    int put_values[3] = { 10, 11, 12 };
+    if (hz_map_put_many(map, many_keys, put_values, 3) != 1) {
+        hz_abort("Expected put_many to insert one key");
+    }
+    hz_map_assert_get_string(map, "nope", 11);
+
+    // Snapshots and copies keep working after the original changes
+    // or goes away, and removing most of the keys compacts the arena
+    hz_map *snapshot = hz_map_snapshot(map);
+    hz_map *copy = hz_map_copy(map);
+    for (int i = 0; i < 10000; ++i) {
+        sprintf(buf, "key %d", i);
+        hz_map_put(map, buf, &i, NULL);
+    }
+    for (int i = 0; i < 10000; ++i) {
+        if (i % 100 != 0) {
+            sprintf(buf, "key %d", i);
+            if (!hz_map_remove(map, buf, NULL)) {
+                hz_abort("Expected key %s to exist", buf);
+            }
+        }
+    }
+    hz_map_free(snapshot);
+    for (int i = 0; i < 10000; ++i) {
+        if (i % 100 != 0) {
+            sprintf(buf, "key %d", i);
+            hz_map_put(map, buf, &i, NULL);
+            hz_map_remove(map, buf, NULL);
+        }
+    }
+    for (int i = 0; i < 10000; i += 100) {
+        sprintf(buf, "key %d", i);
+        hz_map_assert_get_string(map, buf, i);
+    }
+    hz_map_assert_get_string(map, "abcdefghijklmnop", 5);
+    hz_map_free(map);
+    hz_map_assert_get_string(copy, "abcdefghijklmnoq", 6);
+    hz_map_assert_size(copy, key_count + 1);
+
+    hz_map_clear(copy);
+    hz_map_assert_size(copy, 0);
+    hz_map_put(copy, "again", &value, NULL);
+    hz_map_assert_get_string(copy, "again", value);
+    hz_map_free(copy);
+}
+
+static void
+test_map_string(void)
+{
+    test_map_option_matrix(test_map_string_options);
+}
+
+static size_t
+int_hash(const void *key)
+{
+    return (size_t)*(const int *)key;
+}
+
+static int
+int_cmp(const void *a, const void *b)
+{
+    return *(const int *)a != *(const int *)b;
+}
+
+static bool
+sum_view_visit(const void *key, const void *value, void *ctx)
+{
+    if (*(const double *)value != *(const int *)key * 0.5) {
+        hz_abort("Unexpected value for key %d", *(const int *)key);
+    }
+    *(long *)ctx += *(const int *)key;
+    return true;
+}
+
+static hz_map_view *
+hz_map_serialize_and_open(const hz_map *map, void **out_buf, size_t *out_size)
+{
+    size_t size = hz_map_serialized_size(map);
+    void *buf = malloc(size);
+    hz_map_serialize(map, buf, size);
+    *out_buf = buf;
+    *out_size = size;
+    return hz_map_view_open(buf, size, sizeof(int), sizeof(double), int_hash, int_cmp);
+}
+
+static void
+test_map_serialize_options(const hz_map_options *matrix_options)
+{
+    hz_map_options options = *matrix_options;
+    options.seed = 12345;
+    hz_map *map = hz_map_new_with_options(sizeof(int), sizeof(double), int_hash, int_cmp, &options);
+
+    // An empty map has an image too
+    void *buf;
+    size_t size;
+    hz_map_view *view = hz_map_serialize_and_open(map, &buf, &size);
+    if (view == NULL || hz_map_view_size(view) != 0 || hz_map_view_get(view, &(int){0}, NULL)) {
+        hz_abort("Expected empty view");
+    }
+    hz_map_view_free(view);
+    free(buf);
+
+    // Odd keys only, stopping partway through an incremental resize
+    long expected_sum = 0;
+    for (int i = 1; i < 5000; i += 2) {
+        double value = i * 0.5;
+        hz_map_put(map, &i, &value, NULL);
+        expected_sum += i;
+    }
+    view = hz_map_serialize_and_open(map, &buf, &size);
+    if (view == NULL || hz_map_view_size(view) != hz_map_size(map)) {
+        hz_abort("Expected view of every entry");
+    }
+    for (int i = 0; i < 5000; ++i) {
+        double value = 0;
+        bool found = hz_map_view_get(view, &i, &value);
+        if (found != (i % 2 == 1) || (found && value != i * 0.5)) {
+            hz_abort("Unexpected view lookup result for key %d", i);
+        }
+    }
+    const double *ref = hz_map_view_get_ref(view, &(int){7});
+    if (ref == NULL || (uintptr_t)ref % sizeof(double) != 0 || *ref != 3.5) {
+        hz_abort("Expected aligned reference into image");
+    }
+    long sum = 0;
+    hz_map_view_for_each(view, sum_view_visit, &sum);
+    if (sum != expected_sum) {
+        hz_abort("Expected for_each to visit every entry");
+    }
+
+    // The image doesn't depend on where it lives in memory, and
+    // serializing twice gives the same bytes
+    void *moved = malloc(size);
+    hz_map_serialize(map, moved, size);
+    if (memcmp(buf, moved, size) != 0) {
+        hz_abort("Expected identical images");
+    }
+    hz_map_view_free(view);
+    free(buf);
+    view = hz_map_view_open(moved, size, sizeof(int), sizeof(double), int_hash, int_cmp);
+    if (!hz_map_view_get(view, &(int){4999}, NULL)) {
+        hz_abort("Expected moved image to work");
+    }
+    hz_map_view_free(view);
+
+    // Truncated images, mismatched types, and bad headers are rejected
+    if (hz_map_view_open(moved, size - 1, sizeof(int), sizeof(double), int_hash, int_cmp) != NULL ||
+        hz_map_view_open(moved, size, sizeof(int), sizeof(float), int_hash, int_cmp) != NULL ||
+        hz_map_view_open_string(moved, size, sizeof(double)) != NULL ||
+        hz_map_view_open(moved, 16, sizeof(int), sizeof(double), int_hash, int_cmp) != NULL)
+    {
+        hz_abort("Expected invalid image to be rejected");
+    }
+    ((char *)moved)[0] ^= 1;
+    if (hz_map_view_open(moved, size, sizeof(int), sizeof(double), int_hash, int_cmp) != NULL) {
+        hz_abort("Expected bad magic number to be rejected");
+    }
+    ((char *)moved)[0] ^= 1;
+
+    // A key offset that overlaps the hash is rejected when opening, and a
+    // bucket offset past the last entry is caught by validation
+    uint64_t *header = moved;
+    header[10] = 0;
+    if (hz_map_view_open(moved, size, sizeof(int), sizeof(double), int_hash, int_cmp) != NULL) {
+        hz_abort("Expected bad key offset to be rejected");
+    }
+    header[10] = sizeof(uint64_t);
+    view = hz_map_view_open(moved, size, sizeof(int), sizeof(double), int_hash, int_cmp);
+    if (view == NULL || !hz_map_view_validate(view)) {
+        hz_abort("Expected valid image to pass validation");
+    }
+    hz_map_view_free(view);
+    uint64_t *buckets = (uint64_t *)((char *)moved + header[12]);
+    buckets[0] = header[7] + 1;
+    view = hz_map_view_open(moved, size, sizeof(int), sizeof(double), int_hash, int_cmp);
+    if (view == NULL || hz_map_view_validate(view)) {
+        hz_abort("Expected bad bucket offset to fail validation");
+    }
+    hz_map_view_free(view);
+    free(moved);
+    hz_map_free(map);
+}
+
+static void
+test_map_serialize_string(void)
+{
+    hz_map *map = hz_map_new_string(sizeof(int), NULL);
+    const char *keys[] = { "", "a", "ab", "abcdefghijklmnop", "abcdefghijklmnoq" };
+    size_t key_count = sizeof(keys) / sizeof(keys[0]);
+    for (size_t i = 0; i < key_count; ++i) {
+        hz_map_put(map, keys[i], &(int){(int)i}, NULL);
+    }
+    size_t size = hz_map_serialized_size(map);
+    void *buf = malloc(size);
+    hz_map_serialize(map, buf, size);
+    hz_map_free(map);
+
+    hz_map_view *view = hz_map_view_open_string(buf, size, sizeof(int));
+    if (view == NULL || hz_map_view_size(view) != key_count) {
+        hz_abort("Expected string view of every entry");
+    }
+    for (size_t i = 0; i < key_count; ++i) {
+        int value;
+        if (!hz_map_view_get(view, keys[i], &value) || value != (int)i) {
+            hz_abort("Expected key %s in view", keys[i]);
+        }
+    }
+    if (hz_map_view_get(view, "abc", NULL) || hz_map_view_get(view, "b", NULL)) {
+        hz_abort("Expected missing keys to not exist");
+    }
+    if (!hz_map_view_validate(view)) {
+        hz_abort("Expected valid string image to pass validation");
+    }
+    hz_map_view_free(view);
+
+    // A string running past the end of the image fails validation
+    const uint64_t *header = buf;
+    uint64_t *str = (uint64_t *)((char *)buf + header[13] + header[10]);
+    str[0] = header[15] - header[14];
+    view = hz_map_view_open_string(buf, size, sizeof(int));
+    if (view == NULL || hz_map_view_validate(view)) {
+        hz_abort("Expected bad string offset to fail validation");
+    }
+    hz_map_view_free(view);
+    free(buf);
+}
+
+static void
+test_map_serialize(void)
+{
+    test_map_option_matrix(test_map_serialize_options);
+    test_map_serialize_string();
+}
+
+static void
+test_map_alignment(void)
+{
+    // Entries store keys and values inline, so check that an
+    // odd-sized key doesn't misalign a strictly aligned value.
+    hz_map *map = hz_map_new(sizeof(char), sizeof(long double), char_hash, char_cmp);
+    for (char c = 'a'; c <= 'z'; ++c) {
+        long double value = c * 0.5L;
+        hz_map_put(map, &c, &value, NULL);
+    }
+    for (char c = 'a'; c <= 'z'; ++c) {
+        long double value;
+        if (!hz_map_get(map, &c, &value) || value != c * 0.5L) {
+            hz_abort("Map value mismatch");
+        }
+    }
+    hz_map_free(map);
+
+    // References must be aligned for any type of the value's size,
+    // whether entries come from malloc() or from the pool
+    size_t value_sizes[] = { 1, 2, 3, 4, 6, 8, 12, 16, sizeof(long double), 24, 40 };
+    size_t size_count = sizeof(value_sizes) / sizeof(value_sizes[0]);
+    unsigned char value[64] = { 0 };
+    for (int use_pool = 0; use_pool <= 1; ++use_pool) {
+        hz_map_options options;
+        hz_map_options_init(&options);
+        options.use_pool = use_pool != 0;
+        for (size_t i = 0; i < size_count; ++i) {
+            size_t required_alignment = hz_align_of(value_sizes[i]);
+            map = hz_map_new_with_options(sizeof(char), value_sizes[i], char_hash, char_cmp, &options);
+            for (char c = 'a'; c <= 'z'; ++c) {
+                hz_map_put(map, &c, value, NULL);
+            }
+            for (char c = 'a'; c <= 'z'; ++c) {
+                if ((uintptr_t)hz_map_get_ref(map, &c) % required_alignment != 0) {
+                    hz_abort("Value of size %zu is not aligned to %zu", value_sizes[i], required_alignment);
+                }
+            }
+            hz_map_free(map);
+        }
+    }
+}
+
+static void
+test_map_tree_hash(const hz_map_options *matrix_options, hz_map_hash_func hash_func)
+{
+    TValue values[] = {
+        "zero",
+        "one",
+        "two",
+    };
+    hz_map_options options = *matrix_options;
+    options.order_func = key_order_T;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), hash_func, key_cmp_T, &options);
+    hz_map *expected = hz_map_new_T(key_hash_T);
+
+    // Insert keys out of order and remove some of them as we go, so the
+    // trees have to rebalance in both directions
+    hz_map *snapshot = NULL;
+    hz_map *snapshot_expected = NULL;
+    for (int i = 0; i < 3000; ++i) {
+        TKey key = (TKey)(i * 7 % 3001);
+        hz_map_assert_put_new(map, key, values[i % 3]);
+        hz_map_put_T(expected, key, values[i % 3], NULL);
+        if (i % 5 == 0) {
+            hz_map_assert_put_replace(map, key, "replaced", values[i % 3]);
+            hz_map_put_T(expected, key, "replaced", NULL);
+        }
+        if (i % 4 == 0) {
+            TKey old_key = (TKey)(i / 4 * 7 % 3001);
+            hz_map_remove_T(map, old_key, NULL);
+            hz_map_remove_T(expected, old_key, NULL);
+        }
+        if (i == 1500) {
+            snapshot = hz_map_snapshot(map);
+            snapshot_expected = hz_map_copy(map);
+        }
+    }
+    hz_map_assert_equals_true(map, expected, NULL);
+    hz_map_assert_equals_true(expected, map, NULL);
+    if (hz_map_count_it(map) != hz_map_size(map)) {
+        hz_abort("Iterator count mismatch");
+    }
+    hz_map_assert_not_get(map, -1);
+    hz_map_assert_not_remove(map, -1);
+
+    // Writes to the snapshot copy its trees rather than sharing them
+    hz_map_assert_equals_true(snapshot, snapshot_expected, NULL);
+    hz_map_assert_put_new(snapshot, -1, "snapshot");
+    hz_map_assert_not_get(map, -1);
+    hz_map *copy = hz_map_copy(map);
+    hz_map_assert_equals_true(copy, expected, NULL);
+
+    // Removing by reference unlinks the entry from its tree
+    TValue *ref = hz_map_get_ref(copy, &(TKey){2987});
+    hz_map_remove_ref(copy, ref, NULL);
+    hz_map_assert_not_get(copy, 2987);
+    hz_map_assert_get(map, 2987, "two");
+
+    // Empty the map, so every tree shrinks back down to nothing
+    for (TKey key = 0; key < 3001; ++key) {
+        bool removed = hz_map_remove_T(map, key, NULL);
+        if (removed != hz_map_remove_T(expected, key, NULL)) {
+            hz_abort("Removal result mismatch");
+        }
+    }
+    hz_map_assert_size(map, 0);
+    hz_map_assert_put_new(map, 1, "one");
+    hz_map_assert_get(map, 1, "one");
+
+    hz_map_free(map);
+    hz_map_free(expected);
+    hz_map_free(copy);
+    hz_map_free(snapshot);
+    hz_map_free(snapshot_expected);
+}
+
+static void
+test_map_tree_options(const hz_map_options *matrix_options)
+{
+    // Every key in a single tree, and keys split across three trees
+    test_map_tree_hash(matrix_options, key_hash_bad_T);
+    test_map_tree_hash(matrix_options, key_hash_few_T);
+}
+
+static void
+test_map_tree(void)
+{
+    test_map_option_matrix(test_map_tree_options);
+}
+
+static void
+test_map_stats(void)
+{
+    hz_map_stats stats;
+    hz_map *map = hz_map_new_T(key_hash_T);
+    hz_map_get_stats(map, &stats);
+    if (stats.size != 0 || stats.bucket_count != 0 || stats.load_factor != 0 ||
+        stats.max_chain_length != 0 || stats.resizes != 0 || stats.memory_usage == 0)
+    {
+        hz_abort("Empty map stats mismatch");
+    }
+
+    for (TKey i = 0; i < 1000; ++i) {
+        hz_map_put_T(map, i, "value", NULL);
+        hz_map_get_T(map, i, NULL);
+    }
+    hz_map_remove_T(map, 0, NULL);
+    hz_map_get_stats(map, &stats);
+    size_t buckets = 0;
+    size_t entries = 0;
+    for (size_t i = 0; i < HZ_MAP_CHAIN_HISTOGRAM_SIZE; ++i) {
+        buckets += stats.chain_lengths[i];
+        entries += i * stats.chain_lengths[i];
+    }
+    if (stats.size != 999 || buckets != stats.bucket_count || entries != 999) {
+        hz_abort("Chain length histogram mismatch");
+    }
+    if (stats.load_factor != 999.0 / (double)stats.bucket_count || stats.load_factor > 0.75) {
+        hz_abort("Load factor mismatch");
+    }
+    if (stats.resizes < 2 || stats.tree_buckets != 0 ||
+        stats.memory_usage < stats.bucket_count * sizeof(void *) + 999 * (sizeof(TKey) + sizeof(TValue)))
+    {
+        hz_abort("Map stats mismatch");
+    }
+#if defined(HZ_MAP_STATS)
+    if (stats.gets != 1000 || stats.puts != 1000 || stats.removes != 1) {
+        hz_abort("Operation counter mismatch");
+    }
+#else
+    if (stats.gets != 0 || stats.puts != 0 || stats.removes != 0) {
+        hz_abort("Operation counters should be disabled");
+    }
+#endif
+    hz_map_free(map);
+
+    // A bad hash function shows up as one long chain
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.order_func = key_order_T;
+    map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_bad_T, key_cmp_T, &options);
+    for (TKey i = 0; i < 100; ++i) {
+        hz_map_put_T(map, i, "value", NULL);
+    }
+    hz_map_get_stats(map, &stats);
+    if (stats.max_chain_length != 100 || stats.tree_buckets != 1 ||
+        stats.chain_lengths[HZ_MAP_CHAIN_HISTOGRAM_SIZE - 1] != 1 ||
+        stats.chain_lengths[0] != stats.bucket_count - 1)
+    {
+        hz_abort("Bad hash stats mismatch");
+    }
+    hz_map_free(map);
+}
+
+static void
+test_map_bloom_options(const hz_map_options *matrix_options)
+{
+    hz_map_options options = *matrix_options;
+    options.bloom_filter = true;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    hz_map *expected = hz_map_new_T(key_hash_T);
+    hz_map_assert_not_get(map, 1);
+
+    // Grow the map and churn it with removals, so that the filter is
+    // rebuilt both by resizes and by stale bits, and check keys that
+    // were never added along the way
+    hz_map *snapshot = NULL;
+    hz_map *snapshot_expected = NULL;
+    for (TKey i = 0; i < 8000; ++i) {
+        hz_map_assert_put_new(map, i, "value");
+        hz_map_put_T(expected, i, "value", NULL);
+        if (i % 3 == 0) {
+            hz_map_assert_remove(map, i / 3, "value");
+            hz_map_remove_T(expected, i / 3, NULL);
+        }
+        hz_map_assert_not_get(map, (TKey)(-1 - i));
+        if (i == 3000) {
+            snapshot = hz_map_snapshot(map);
+            snapshot_expected = hz_map_copy(map);
+        }
+    }
+    hz_map_assert_equals_true(map, expected, NULL);
+    hz_map_assert_equals_true(expected, map, NULL);
+
+    // Removed keys must not be found, whether or not their bits are
+    // still set, and must be found again once they are re-added
+    for (TKey i = 0; i < 2000; ++i) {
+        hz_map_assert_not_get(map, i);
+        hz_map_assert_not_remove(map, i);
+    }
+    for (TKey i = 0; i < 2000; i += 2) {
+        hz_map_assert_put_new(map, i, "again");
+        hz_map_put_T(expected, i, "again", NULL);
+    }
+    hz_map_assert_get(map, 1000, "again");
+    hz_map_assert_not_get(map, 1001);
+
+    TKey keys[] = { 0, 1, 4000, -5 };
+    bool found[4];
+    if (hz_map_get_many(map, keys, 4, NULL, found) != 2 ||
+        !found[0] || found[1] || !found[2] || found[3])
+    {
+        hz_abort("get_many result mismatch");
+    }
+
+    // The snapshot shares the filter, and must not see later writes
+    hz_map_assert_equals_true(snapshot, snapshot_expected, NULL);
+    hz_map_assert_put_new(snapshot, -1, "snapshot");
+    hz_map_assert_not_get(map, -1);
+    hz_map_assert_get(snapshot, -1, "snapshot");
+
+    hz_map *copy = hz_map_copy(map);
+    hz_map_assert_equals_true(copy, expected, NULL);
+    hz_map_free(copy);
+    hz_map_clear(map);
+    hz_map_assert_not_get(map, 4000);
+    hz_map_assert_put_new(map, 4000, "value");
+    hz_map_assert_get(map, 4000, "value");
+    hz_map_free(map);
+    hz_map_free(expected);
+    hz_map_free(snapshot);
+    hz_map_free(snapshot_expected);
+}
+
+static void
+test_map_bloom(void)
+{
+    test_map_option_matrix(test_map_bloom_options);
+}
+
+static size_t
+hz_map_bucket_count_T(const hz_map *map)
+{
+    hz_map_stats stats;
+    hz_map_get_stats(map, &stats);
+    return stats.bucket_count;
+}
+
+static void
+test_map_trim_options(const hz_map_options *matrix_options)
+{
+    hz_map_options options = *matrix_options;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    for (TKey i = 0; i < 10000; ++i) {
+        hz_map_put_T(map, i, "value", NULL);
+    }
+    hz_map *snapshot = hz_map_snapshot(map);
+    size_t full_buckets = hz_map_bucket_count_T(map);
+    for (TKey i = 100; i < 10000; ++i) {
+        hz_map_assert_remove(map, i, "value");
+    }
+    if (hz_map_bucket_count_T(map) != full_buckets) {
+        hz_abort("Map shrank without auto_shrink");
+    }
+
+    // Trimming must not disturb the snapshot sharing the old buckets
+    hz_map_trim(map);
+    if (hz_map_bucket_count_T(map) >= full_buckets / 16) {
+        hz_abort("Map did not shrink after trim");
+    }
+    hz_map_assert_size(map, 100);
+    for (TKey i = 0; i < 100; ++i) {
+        hz_map_assert_get(map, i, "value");
+    }
+    hz_map_assert_not_get(map, 100);
+    hz_map_assert_size(snapshot, 10000);
+    hz_map_assert_get(snapshot, 9999, "value");
+
+    // Trimming an empty map frees the buckets, and the map still works
+    hz_map_clear_keep_capacity(map);
+    hz_map_trim(map);
+    if (hz_map_bucket_count_T(map) != 0) {
+        hz_abort("Empty map should have no buckets after trim");
+    }
+    hz_map_assert_put_new(map, 1, "again");
+    hz_map_assert_get(map, 1, "again");
+    hz_map_free(map);
+    hz_map_free(snapshot);
+
+    // With auto_shrink, the map shrinks while entries are removed, but
+    // not as soon as it drops below the growth threshold
+    options.auto_shrink = true;
+    map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    hz_map *expected = hz_map_new_T(key_hash_T);
+    for (TKey i = 0; i < 10000; ++i) {
+        hz_map_put_T(map, i, "value", NULL);
+        hz_map_put_T(expected, i, "value", NULL);
+    }
+    full_buckets = hz_map_bucket_count_T(map);
+    for (TKey i = 0; i < 5000; ++i) {
+        hz_map_assert_remove(map, i, "value");
+        hz_map_remove_T(expected, i, NULL);
+    }
+    if (hz_map_bucket_count_T(map) != full_buckets) {
+        hz_abort("Map shrank too eagerly");
+    }
+    for (TKey i = 5000; i < 9990; ++i) {
+        hz_map_assert_remove(map, i, "value");
+        hz_map_remove_T(expected, i, NULL);
+        if (i % 100 == 0) {
+            hz_map_assert_equals_true(map, expected, NULL);
+        }
+    }
+    hz_map_trim(map);
+    hz_map_assert_equals_true(map, expected, NULL);
+    hz_map_assert_equals_true(expected, map, NULL);
+    if (hz_map_bucket_count_T(map) >= full_buckets / 64) {
+        hz_abort("Map did not shrink automatically");
+    }
+    hz_map_free(map);
+    hz_map_free(expected);
+
+    // Trimming a string map also frees the keys of removed entries
+    options.auto_shrink = false;
+    hz_map *strings = hz_map_new_string(sizeof(int), &options);
+    char buf[32];
+    for (int i = 0; i < 1000; ++i) {
+        sprintf(buf, "key%d", i);
+        hz_map_put(strings, buf, &i, NULL);
+    }
+    for (int i = 10; i < 1000; ++i) {
+        sprintf(buf, "key%d", i);
+        hz_map_remove(strings, buf, NULL);
+    }
+    hz_map_stats before;
+    hz_map_stats after;
+    hz_map_get_stats(strings, &before);
+    hz_map_trim(strings);
+    hz_map_get_stats(strings, &after);
+    if (after.memory_usage >= before.memory_usage) {
+        hz_abort("String map did not shrink after trim");
+    }
+    for (int i = 0; i < 10; ++i) {
+        sprintf(buf, "key%d", i);
+        int value;
+        if (!hz_map_get(strings, buf, &value) || value != i) {
+            hz_abort("String map lost key %s after trim", buf);
+        }
+    }
+    hz_map_free(strings);
+}
+
+static void
+test_map_trim(void)
+{
+    test_map_option_matrix(test_map_trim_options);
+}
+
+static void
+test_map_clear_keep_capacity_options(const hz_map_options *matrix_options)
+{
+    hz_map_options options = *matrix_options;
+    options.bloom_filter = true;
+    hz_map *map = hz_map_new_with_options(sizeof(TKey), sizeof(TValue), key_hash_T, key_cmp_T, &options);
+    hz_map_clear_keep_capacity(map);
+    hz_map_assert_size(map, 0);
+
+    // Clear in the middle of a resize, with a snapshot holding on to
+    // part of the buckets, and refill with different keys
+    hz_map *snapshot = NULL;
+    for (int round = 0; round < 3; ++round) {
+        TKey base = (TKey)(round * 10000);
+        for (TKey i = 0; i < 5000; ++i) {
+            hz_map_assert_put_new(map, base + i, "value");
+        }
+        if (round == 1) {
+            snapshot = hz_map_snapshot(map);
+        }
+        size_t buckets = hz_map_bucket_count_T(map);
+        hz_map_clear_keep_capacity(map);
+        hz_map_assert_size(map, 0);
+        if (hz_map_bucket_count_T(map) != buckets) {
+            hz_abort("Clear did not keep the bucket array");
+        }
+        if (hz_map_count_it(map) != 0) {
+            hz_abort("Cleared map should not have any entries");
+        }
+        for (TKey i = 0; i < 5000; i += 7) {
+            hz_map_assert_not_get(map, base + i);
+        }
+    }
+    hz_map_assert_size(snapshot, 5000);
+    hz_map_assert_get(snapshot, 10000, "value");
+    hz_map_assert_get(snapshot, 14999, "value");
+
+    for (TKey i = 0; i < 100; ++i) {
+        hz_map_assert_put_new(map, i, "again");
+    }
+    hz_map_assert_get(map, 50, "again");
+    hz_map_assert_not_get(map, 100);
+    hz_map_free(map);
+    hz_map_free(snapshot);
+
+    hz_map *strings = hz_map_new_string(sizeof(int), &options);
+    hz_map_put(strings, "hello", &(int){1}, NULL);
+    hz_map_clear_keep_capacity(strings);
+    if (hz_map_get(strings, "hello", NULL)) {
+        hz_abort("Cleared string map should not contain key");
+    }
+    hz_map_put(strings, "world", &(int){2}, NULL);
+    if (hz_map_size(strings) != 1 || !hz_map_get(strings, "world", NULL)) {
+        hz_abort("String map lost key after clear");
+    }
+    hz_map_free(strings);
+}
+
+static void
+test_map_clear_keep_capacity(void)
+{
+    test_map_option_matrix(test_map_clear_keep_capacity_options);
+}
+
 void
 test_map(void)
 {
@@ -385,5 +2011,28 @@ test_map(void)
     test_map_iterator();
     test_map_copy();
     test_map_equals();
+    test_map_alignment();
+    test_map_pool();
+    test_map_incremental();
+    test_map_seed();
+    test_map_hashed();
+    test_map_get_many();
+    test_map_reserve();
+    test_map_put_many();
+    test_map_emplace();
+    test_map_remove_ref();
+    test_map_cursor();
+    test_map_partition();
+    test_map_partition_threads();
+    test_map_merge();
+    test_map_merge_threads();
+    test_map_snapshot();
+    test_map_string();
+    test_map_serialize();
+    test_map_bloom();
+    test_map_tree();
+    test_map_stats();
+    test_map_trim();
+    test_map_clear_keep_capacity();
     printf("All map tests passed!\n");
 }
@@ -0,0 +1,170 @@
+#include "hazuki/map.h"
+#include "hazuki/perfect_map.h"
+#include "hazuki/utils.h"
+#include "hazuki/vector.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static size_t
+u64_hash(const void *key)
+{
+    return (size_t)*(const uint64_t *)key;
+}
+
+static int
+u64_cmp(const void *a, const void *b)
+{
+    return *(const uint64_t *)a != *(const uint64_t *)b;
+}
+
+static size_t
+u64_hash_half(const void *key)
+{
+    return (size_t)(*(const uint64_t *)key / 2);
+}
+
+/**
+ * Gets the i-th key of the test key set. Keys are spread out, so that
+ * most integers are not keys.
+ */
+static uint64_t
+test_key(size_t i)
+{
+    return (uint64_t)i * 2654435761u + 17;
+}
+
+static void
+hz_perfect_map_assert_contents(const hz_perfect_map *map, size_t n)
+{
+    if (hz_perfect_map_size(map) != n) {
+        hz_abort("Expected %zu entries, got %zu", n, hz_perfect_map_size(map));
+    }
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = test_key(i);
+        double value;
+        if (!hz_perfect_map_get(map, &key, &value) || value != (double)i) {
+            hz_abort("Expected key %zu to map to %zu", i, i);
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = test_key(i) + 1;
+        if (hz_perfect_map_get(map, &key, NULL)) {
+            hz_abort("Expected missing key to not exist");
+        }
+    }
+}
+
+static hz_perfect_map *
+hz_perfect_map_new_test(size_t n)
+{
+    hz_vector *keys = hz_vector_new(sizeof(uint64_t));
+    hz_vector *values = hz_vector_new(sizeof(double));
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = test_key(i);
+        double value = (double)i;
+        hz_vector_append(keys, &key);
+        hz_vector_append(values, &value);
+    }
+    hz_perfect_map *map = hz_perfect_map_new(
+        sizeof(uint64_t), sizeof(double), u64_hash, u64_cmp, keys, values);
+    hz_vector_free(keys);
+    hz_vector_free(values);
+    return map;
+}
+
+static void
+test_perfect_map_sizes(void)
+{
+    // Sizes around the bucket size, and a few large ones
+    size_t sizes[] = { 0, 1, 2, 3, 4, 5, 7, 8, 100, 1000, 100000 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        hz_perfect_map *map = hz_perfect_map_new_test(sizes[s]);
+        hz_perfect_map_assert_contents(map, sizes[s]);
+        hz_perfect_map_free(map);
+    }
+}
+
+static void
+test_perfect_map_get_ref(void)
+{
+    hz_perfect_map *map = hz_perfect_map_new_test(100);
+    uint64_t key = test_key(42);
+    double *ref = hz_perfect_map_get_ref(map, &key);
+    if (ref == NULL || (uintptr_t)ref % sizeof(double) != 0 || *ref != 42.0) {
+        hz_abort("Expected aligned reference to value");
+    }
+    *ref = -1.0;
+    double value;
+    if (!hz_perfect_map_get(map, &key, &value) || value != -1.0) {
+        hz_abort("Expected value to be updated in place");
+    }
+    key = 0;
+    if (hz_perfect_map_get_ref(map, &key) != NULL) {
+        hz_abort("Expected no reference for missing key");
+    }
+    if (hz_perfect_map_memory_usage(map) < 100 * (sizeof(uint64_t) + sizeof(double))) {
+        hz_abort("Expected memory usage to include the entries");
+    }
+    hz_perfect_map_free(map);
+}
+
+static void
+test_perfect_map_from_map(void)
+{
+    hz_map *source = hz_map_new(sizeof(uint64_t), sizeof(double), u64_hash, u64_cmp);
+    for (size_t i = 0; i < 5000; ++i) {
+        uint64_t key = test_key(i);
+        double value = (double)i;
+        hz_map_put(source, &key, &value, NULL);
+    }
+    hz_perfect_map *map = hz_perfect_map_new_from_map(
+        source, sizeof(uint64_t), sizeof(double), u64_hash, u64_cmp);
+    hz_map_free(source);
+    hz_perfect_map_assert_contents(map, 5000);
+    hz_perfect_map_free(map);
+
+    // Maps without values work too
+    hz_map *keys = hz_map_new(sizeof(uint64_t), 0, u64_hash, u64_cmp);
+    for (size_t i = 0; i < 100; ++i) {
+        hz_map_emplace(keys, &(uint64_t){test_key(i)}, NULL);
+    }
+    map = hz_perfect_map_new_from_map(keys, sizeof(uint64_t), 0, u64_hash, u64_cmp);
+    hz_map_free(keys);
+    for (size_t i = 0; i < 100; ++i) {
+        if (!hz_perfect_map_get(map, &(uint64_t){test_key(i)}, NULL)) {
+            hz_abort("Expected key %zu to exist", i);
+        }
+    }
+    hz_perfect_map_free(map);
+}
+
+static void
+test_perfect_map_hash_collision(void)
+{
+    // 2 and 3 have the same hash, so no perfect hash can separate them
+    hz_vector *keys = hz_vector_new(sizeof(uint64_t));
+    hz_vector *values = hz_vector_new(sizeof(double));
+    uint64_t key_data[] = { 0, 2, 3 };
+    for (size_t i = 0; i < 3; ++i) {
+        hz_vector_append(keys, &key_data[i]);
+        hz_vector_append(values, &(double){0});
+    }
+    hz_perfect_map *map = hz_perfect_map_new(
+        sizeof(uint64_t), sizeof(double), u64_hash_half, u64_cmp, keys, values);
+    if (map != NULL) {
+        hz_abort("Expected colliding keys to fail the build");
+    }
+    hz_vector_free(keys);
+    hz_vector_free(values);
+}
+
+void
+test_perfect_map(void)
+{
+    test_perfect_map_sizes();
+    test_perfect_map_get_ref();
+    test_perfect_map_from_map();
+    test_perfect_map_hash_collision();
+    printf("All perfect map tests passed!\n");
+}
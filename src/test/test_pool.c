@@ -0,0 +1,97 @@
+#include "hazuki/pool.h"
+#include "hazuki/utils.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+    long double a;
+    char b[3];
+} T;
+
+static T *
+hz_pool_alloc_T(hz_pool *pool, int seed)
+{
+    T *t = hz_pool_alloc(pool);
+    t->a = seed;
+    t->b[0] = (char)seed;
+    t->b[1] = (char)(seed + 1);
+    t->b[2] = (char)(seed + 2);
+    return t;
+}
+
+static void
+hz_pool_assert_T(const T *t, int seed)
+{
+    if (t->a != seed || t->b[0] != (char)seed || t->b[2] != (char)(seed + 2)) {
+        hz_abort("Pool object %d was overwritten", seed);
+    }
+}
+
+static void
+hz_pool_assert_aligned(const void *ptr)
+{
+    if ((uintptr_t)ptr % sizeof(long double) != 0) {
+        hz_abort("Pool object %p is misaligned", ptr);
+    }
+}
+
+static void
+test_pool_alloc(void)
+{
+    hz_pool *pool = hz_pool_new(sizeof(T));
+    T *objects[1000];
+    for (int i = 0; i < 1000; ++i) {
+        objects[i] = hz_pool_alloc_T(pool, i);
+        hz_pool_assert_aligned(objects[i]);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        hz_pool_assert_T(objects[i], i);
+    }
+    hz_pool_free(pool);
+}
+
+static void
+test_pool_release(void)
+{
+    hz_pool *pool = hz_pool_new(sizeof(T));
+    T *a = hz_pool_alloc_T(pool, 1);
+    T *b = hz_pool_alloc_T(pool, 2);
+    hz_pool_release(pool, a);
+    hz_pool_release(pool, NULL);
+    T *c = hz_pool_alloc_T(pool, 3);
+    if (c != a) {
+        hz_abort("Pool did not reuse released object");
+    }
+    hz_pool_assert_T(b, 2);
+    hz_pool_assert_T(c, 3);
+    hz_pool_free(pool);
+}
+
+static void
+test_pool_clear(void)
+{
+    hz_pool *pool = hz_pool_new(1);
+    for (int i = 0; i < 100000; ++i) {
+        char *c = hz_pool_alloc(pool);
+        *c = (char)i;
+    }
+    hz_pool_clear(pool);
+    char *c = hz_pool_alloc(pool);
+    *c = 'x';
+    hz_pool_release(pool, c);
+    if (hz_pool_object_size(pool) != 1) {
+        hz_abort("Pool object size changed");
+    }
+    hz_pool_free(pool);
+}
+
+void
+test_pool(void)
+{
+    test_pool_alloc();
+    test_pool_release();
+    test_pool_clear();
+    printf("All pool tests passed!\n");
+}
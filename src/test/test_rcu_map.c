@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200112L
+#include "hazuki/rcu_map.h"
+#include "hazuki/utils.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t
+int_hash(const void *key)
+{
+    return (size_t)*(const int *)key;
+}
+
+static int
+int_cmp(const void *a, const void *b)
+{
+    return *(const int *)a != *(const int *)b;
+}
+
+static void
+hz_rcu_map_assert_get(hz_rcu_reader *reader, int key, int expected)
+{
+    int value;
+    if (!hz_rcu_map_get(reader, &key, &value)) {
+        hz_abort("Expected key %d to exist", key);
+    }
+    if (value != expected) {
+        hz_abort("Expected %d => %d, got %d", key, expected, value);
+    }
+}
+
+static void
+hz_rcu_map_assert_not_get(hz_rcu_reader *reader, int key)
+{
+    if (hz_rcu_map_get(reader, &key, NULL)) {
+        hz_abort("Expected key %d to not exist", key);
+    }
+}
+
+static void
+test_rcu_map_basic(void)
+{
+    hz_rcu_map *map = hz_rcu_map_new(sizeof(int), sizeof(int), int_hash, int_cmp);
+    hz_rcu_reader *reader = hz_rcu_reader_new(map);
+    hz_rcu_map_assert_not_get(reader, 0);
+
+    // Enough entries to go through several resizes
+    for (int i = 0; i < 1000; ++i) {
+        int value = i * 2;
+        if (hz_rcu_map_put(map, &i, &value, NULL)) {
+            hz_abort("Expected key %d to be new", i);
+        }
+    }
+    if (hz_rcu_map_size(map) != 1000) {
+        hz_abort("Expected 1000 entries");
+    }
+    for (int i = 0; i < 1000; ++i) {
+        hz_rcu_map_assert_get(reader, i, i * 2);
+    }
+    hz_rcu_map_assert_not_get(reader, 1000);
+
+    int key = 7;
+    int value = -7;
+    int old_value;
+    if (!hz_rcu_map_put(map, &key, &value, &old_value) || old_value != 14) {
+        hz_abort("Expected put to replace value");
+    }
+    hz_rcu_map_assert_get(reader, 7, -7);
+    if (!hz_rcu_map_remove(map, &key, &old_value) || old_value != -7) {
+        hz_abort("Expected remove to return value");
+    }
+    if (hz_rcu_map_remove(map, &key, NULL)) {
+        hz_abort("Expected key to be removed already");
+    }
+    hz_rcu_map_assert_not_get(reader, 7);
+    hz_rcu_map_assert_get(reader, 8, 16);
+    if (hz_rcu_map_size(map) != 999) {
+        hz_abort("Expected 999 entries");
+    }
+
+    hz_rcu_map_clear(map);
+    if (hz_rcu_map_size(map) != 0) {
+        hz_abort("Expected map to be empty");
+    }
+    hz_rcu_map_assert_not_get(reader, 8);
+    hz_rcu_map_collect(map);
+
+    hz_rcu_reader_free(reader);
+    hz_rcu_map_free(map);
+}
+
+static void
+test_rcu_map_readers(void)
+{
+    hz_rcu_map *map = hz_rcu_map_new(sizeof(int), sizeof(int), int_hash, int_cmp);
+    hz_rcu_reader *a = hz_rcu_reader_new(map);
+    hz_rcu_reader *b = hz_rcu_reader_new(map);
+    if (a == b) {
+        hz_abort("Expected live readers to be distinct");
+    }
+
+    // Released readers are recycled
+    hz_rcu_reader_free(a);
+    hz_rcu_reader *c = hz_rcu_reader_new(map);
+    if (c != a) {
+        hz_abort("Expected released reader to be recycled");
+    }
+
+    int key = 1;
+    hz_rcu_map_put(map, &key, &key, NULL);
+    hz_rcu_map_assert_get(b, 1, 1);
+    hz_rcu_map_assert_get(c, 1, 1);
+
+    // Unreleased readers are freed along with the map
+    hz_rcu_map_free(map);
+}
+
+static void
+test_rcu_map_seed(void)
+{
+    hz_rcu_map_options options;
+    hz_rcu_map_options_init(&options);
+    options.seed = 12345;
+    hz_rcu_map *map = hz_rcu_map_new_with_options(sizeof(int), sizeof(int), int_hash, int_cmp, &options);
+    hz_rcu_reader *reader = hz_rcu_reader_new(map);
+    for (int i = 0; i < 1000; ++i) {
+        int value = -i;
+        hz_rcu_map_put(map, &i, &value, NULL);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        hz_rcu_map_assert_get(reader, i, -i);
+    }
+    hz_rcu_map_assert_not_get(reader, 1000);
+    hz_rcu_reader_free(reader);
+    hz_rcu_map_free(map);
+}
+
+/**
+ * Parameters of the threaded reclamation test. The writer repeatedly
+ * replaces, removes, and re-inserts every key (growing the table from
+ * scratch after each clear), so each write retires nodes or tables
+ * that the readers may be walking. The value of a key is always equal
+ * to the key mod THREAD_KEYS, so a reader that sees freed or reused
+ * memory reads the wrong value (or trips the address sanitizer).
+ */
+#define THREAD_KEYS 512
+#define THREAD_READERS 4
+#define THREAD_ROUNDS 20
+
+typedef struct
+{
+    hz_rcu_map *map;
+    int index;
+    int done;
+} test_thread_ctx;
+
+static void *
+test_rcu_map_reader_thread(void *arg)
+{
+    test_thread_ctx *ctx = arg;
+    hz_rcu_reader *reader = hz_rcu_reader_new(ctx->map);
+    unsigned int k = (unsigned int)ctx->index;
+    do {
+        for (int i = 0; i < THREAD_KEYS; ++i) {
+            k = (k * 1103515245u + 12345u) % THREAD_KEYS;
+            int key = (int)k;
+            int value;
+            if (hz_rcu_map_get(reader, &key, &value) && value % THREAD_KEYS != key) {
+                hz_abort("Read value %d for key %d", value, key);
+            }
+        }
+    } while (!__atomic_load_n(&ctx->done, __ATOMIC_ACQUIRE));
+    hz_rcu_reader_free(reader);
+    return NULL;
+}
+
+static void
+test_rcu_map_threads(void)
+{
+    hz_rcu_map *map = hz_rcu_map_new(sizeof(int), sizeof(int), int_hash, int_cmp);
+    test_thread_ctx readers[THREAD_READERS];
+    pthread_t threads[THREAD_READERS];
+    for (int i = 0; i < THREAD_READERS; ++i) {
+        readers[i].map = map;
+        readers[i].index = i;
+        readers[i].done = 0;
+        if (pthread_create(&threads[i], NULL, test_rcu_map_reader_thread, &readers[i]) != 0) {
+            hz_abort("Failed to create reader thread");
+        }
+    }
+
+    for (int r = 0; r < THREAD_ROUNDS; ++r) {
+        for (int k = 0; k < THREAD_KEYS; ++k) {
+            int value = k + r * THREAD_KEYS;
+            hz_rcu_map_put(map, &k, &value, NULL);
+        }
+        for (int k = 0; k < THREAD_KEYS; ++k) {
+            int value = k + (r + 1) * THREAD_KEYS;
+            hz_rcu_map_put(map, &k, &value, NULL);
+            if (k % 2 == 0) {
+                hz_rcu_map_remove(map, &k, NULL);
+            }
+        }
+        if (r % 4 == 3) {
+            hz_rcu_map_clear(map);
+        }
+    }
+    for (int i = 0; i < THREAD_READERS; ++i) {
+        __atomic_store_n(&readers[i].done, 1, __ATOMIC_RELEASE);
+        pthread_join(threads[i], NULL);
+    }
+
+    // With no readers left, this frees everything that was retired
+    hz_rcu_map_collect(map);
+    hz_rcu_map_free(map);
+}
+
+void
+test_rcu_map(void)
+{
+    test_rcu_map_basic();
+    test_rcu_map_readers();
+    test_rcu_map_seed();
+    test_rcu_map_threads();
+    printf("All RCU map tests passed!\n");
+}
@@ -0,0 +1,221 @@
+#include "hazuki/set.h"
+#include "hazuki/utils.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static size_t
+int_hash(const void *key)
+{
+    return (size_t)*(const int *)key;
+}
+
+static int
+int_cmp(const void *a, const void *b)
+{
+    return *(const int *)a != *(const int *)b;
+}
+
+static hz_set *
+hz_set_new_int(void)
+{
+    return hz_set_new(sizeof(int), int_hash, int_cmp);
+}
+
+/**
+ * Creates a set of the integers in [start, end) that are multiples
+ * of step.
+ */
+static hz_set *
+hz_set_new_range(int start, int end, int step)
+{
+    hz_set *set = hz_set_new_int();
+    for (int i = start; i < end; ++i) {
+        if (i % step == 0) {
+            hz_set_add(set, &i);
+        }
+    }
+    return set;
+}
+
+static bool
+hz_set_contains_int(const hz_set *set, int key)
+{
+    return hz_set_contains(set, &key);
+}
+
+static void
+hz_set_assert_equals(const hz_set *a, const hz_set *b)
+{
+    if (!hz_set_equals(a, b) || !hz_set_equals(b, a)) {
+        hz_abort("Sets should be equal");
+    }
+}
+
+static void
+test_set_basic(void)
+{
+    hz_set *set = hz_set_new_int();
+    int key = 1;
+    if (hz_set_contains(set, &key) || hz_set_remove(set, &key)) {
+        hz_abort("Expected empty set");
+    }
+    if (!hz_set_add(set, &key) || hz_set_add(set, &key)) {
+        hz_abort("Expected only the first add to insert");
+    }
+    if (!hz_set_contains(set, &key) || hz_set_size(set) != 1) {
+        hz_abort("Expected set to contain key");
+    }
+    if (!hz_set_remove(set, &key) || hz_set_contains(set, &key) || hz_set_size(set) != 0) {
+        hz_abort("Expected key to be removed");
+    }
+
+    for (int i = 0; i < 10000; ++i) {
+        hz_set_add(set, &i);
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        hz_set_remove(set, &i);
+    }
+    if (hz_set_size(set) != 5000 || hz_set_contains_int(set, 100) || !hz_set_contains_int(set, 101)) {
+        hz_abort("Set contents mismatch");
+    }
+
+    // The cursor visits each key once
+    hz_set_cursor cursor;
+    hz_set_cursor_init(&cursor, set);
+    const void *k;
+    size_t n = 0;
+    long long sum = 0;
+    while (hz_set_cursor_next(&cursor, &k)) {
+        sum += *(const int *)k;
+        n++;
+    }
+    if (n != 5000 || sum != 5000LL * 5000) {
+        hz_abort("Cursor visited %zu keys (sum %lld)", n, sum);
+    }
+
+    hz_set *copy = hz_set_copy(set);
+    hz_set_assert_equals(set, copy);
+    hz_set_remove(copy, &(int){101});
+    if (hz_set_equals(set, copy)) {
+        hz_abort("Sets should not be equal");
+    }
+    hz_set_clear(set);
+    if (hz_set_size(set) != 0 || hz_set_contains_int(set, 101)) {
+        hz_abort("Expected set to be cleared");
+    }
+    hz_set_free(set);
+    hz_set_free(copy);
+}
+
+static void
+test_set_options(void)
+{
+    hz_map_options options;
+    hz_map_options_init(&options);
+    options.use_pool = true;
+    options.incremental_resize = true;
+    options.bloom_filter = true;
+    hz_set *set = hz_set_new_with_options(sizeof(int), int_hash, int_cmp, &options);
+    for (int i = 0; i < 5000; ++i) {
+        hz_set_add(set, &i);
+    }
+    for (int i = 0; i < 10000; ++i) {
+        if (hz_set_contains_int(set, i) != (i < 5000)) {
+            hz_abort("Set contents mismatch for %d", i);
+        }
+    }
+
+    // Results of set operations keep the options
+    hz_set *other = hz_set_new_range(0, 100, 1);
+    hz_set *result = hz_set_intersection(set, other);
+    hz_set_assert_equals(result, other);
+    hz_set_free(result);
+    hz_set_free(other);
+    hz_set_free(set);
+}
+
+static void
+test_set_operations(void)
+{
+    // Try both orders, so that both a and b get to be the smaller set
+    hz_set *evens = hz_set_new_range(0, 2000, 2);
+    hz_set *threes = hz_set_new_range(0, 600, 3);
+    hz_set *sixes = hz_set_new_range(0, 600, 6);
+    hz_set *evens_or_threes = hz_set_new_int();
+    hz_set *evens_not_threes = hz_set_new_int();
+    hz_set *threes_not_evens = hz_set_new_int();
+    for (int i = 0; i < 2000; ++i) {
+        bool even = i % 2 == 0;
+        bool three = i < 600 && i % 3 == 0;
+        if (even || three) {
+            hz_set_add(evens_or_threes, &i);
+        }
+        if (even && !three) {
+            hz_set_add(evens_not_threes, &i);
+        }
+        if (three && !even) {
+            hz_set_add(threes_not_evens, &i);
+        }
+    }
+
+    hz_set *result = hz_set_union(evens, threes);
+    hz_set_assert_equals(result, evens_or_threes);
+    hz_set_free(result);
+    result = hz_set_union(threes, evens);
+    hz_set_assert_equals(result, evens_or_threes);
+    hz_set_free(result);
+
+    result = hz_set_intersection(evens, threes);
+    hz_set_assert_equals(result, sixes);
+    hz_set_free(result);
+    result = hz_set_intersection(threes, evens);
+    hz_set_assert_equals(result, sixes);
+    hz_set_free(result);
+
+    result = hz_set_difference(evens, threes);
+    hz_set_assert_equals(result, evens_not_threes);
+    hz_set_free(result);
+    result = hz_set_difference(threes, evens);
+    hz_set_assert_equals(result, threes_not_evens);
+    hz_set_free(result);
+
+    // Operations with an empty set and with the set itself
+    hz_set *empty = hz_set_new_int();
+    result = hz_set_union(evens, empty);
+    hz_set_assert_equals(result, evens);
+    hz_set_free(result);
+    result = hz_set_union(empty, evens);
+    hz_set_assert_equals(result, evens);
+    hz_set_free(result);
+    result = hz_set_intersection(empty, evens);
+    hz_set_assert_equals(result, empty);
+    hz_set_free(result);
+    result = hz_set_difference(evens, evens);
+    hz_set_assert_equals(result, empty);
+    hz_set_free(result);
+    result = hz_set_union(evens, evens);
+    hz_set_assert_equals(result, evens);
+    hz_set_free(result);
+
+    // The inputs are unchanged
+    if (hz_set_size(evens) != 1000 || hz_set_size(threes) != 200) {
+        hz_abort("Set operation modified its inputs");
+    }
+    hz_set_free(empty);
+    hz_set_free(evens);
+    hz_set_free(threes);
+    hz_set_free(sixes);
+    hz_set_free(evens_or_threes);
+    hz_set_free(evens_not_threes);
+    hz_set_free(threes_not_evens);
+}
+
+void
+test_set(void)
+{
+    test_set_basic();
+    test_set_options();
+    test_set_operations();
+    printf("All set tests passed!\n");
+}
@@ -0,0 +1,200 @@
+#include "hazuki/map.h"
+#include "hazuki/typed_map.h"
+#include "hazuki/utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+    int x;
+    int y;
+} point;
+
+static inline size_t
+u64_hash(const uint64_t *key)
+{
+    return (size_t)*key;
+}
+
+static inline size_t
+u64_hash_bad(const uint64_t *key)
+{
+    (void)key;
+    return 0;
+}
+
+static inline bool
+u64_eq(const uint64_t *a, const uint64_t *b)
+{
+    return *a == *b;
+}
+
+HZ_MAP_DEFINE(point_map, uint64_t, point, u64_hash, u64_eq)
+HZ_MAP_DEFINE(bad_point_map, uint64_t, point, u64_hash_bad, u64_eq)
+
+static size_t
+u64_hash_generic(const void *key)
+{
+    return (size_t)*(const uint64_t *)key;
+}
+
+static int
+u64_cmp_generic(const void *a, const void *b)
+{
+    return *(const uint64_t *)a != *(const uint64_t *)b;
+}
+
+static void
+point_map_assert_get(const point_map *map, uint64_t key, int x, int y)
+{
+    point value = { 0, 0 };
+    if (!point_map_get(map, &key, &value)) {
+        hz_abort("Expected key %d to exist", (int)key);
+    }
+    if (value.x != x || value.y != y) {
+        hz_abort("Expected %d => (%d, %d), got (%d, %d)", (int)key, x, y, value.x, value.y);
+    }
+}
+
+static void
+test_typed_map_basic(void)
+{
+    point_map *map = point_map_new();
+    uint64_t key = 1;
+    point value = { 1, 2 };
+    point old_value;
+    if (point_map_get(map, &key, NULL) || point_map_remove(map, &key, NULL)) {
+        hz_abort("Expected empty map");
+    }
+    if (point_map_put(map, &key, &value, NULL)) {
+        hz_abort("Expected key to be new");
+    }
+    point_map_assert_get(map, 1, 1, 2);
+
+    value.x = 3;
+    if (!point_map_put(map, &key, &value, &old_value) || old_value.x != 1) {
+        hz_abort("Expected put to replace value");
+    }
+    point_map_assert_get(map, 1, 3, 2);
+    if (!point_map_remove(map, &key, &old_value) || old_value.x != 3) {
+        hz_abort("Expected remove to return value");
+    }
+    if (point_map_size(map) != 0) {
+        hz_abort("Expected map to be empty");
+    }
+
+    // Enough entries to go through several resizes
+    for (uint64_t i = 0; i < 1000; ++i) {
+        point p = { (int)i, -(int)i };
+        point_map_put(map, &i, &p, NULL);
+    }
+    for (uint64_t i = 0; i < 1000; ++i) {
+        point_map_assert_get(map, i, (int)i, -(int)i);
+    }
+    point_map_clear(map);
+    if (point_map_size(map) != 0 || point_map_get(map, &key, NULL)) {
+        hz_abort("Expected map to be empty");
+    }
+    point_map_free(map);
+}
+
+static void
+test_typed_map_emplace(void)
+{
+    point_map *map = point_map_new_with_capacity(100);
+    uint64_t key = 5;
+    if (point_map_get_ref(map, &key) != NULL) {
+        hz_abort("Expected no value for missing key");
+    }
+
+    bool inserted;
+    point *value = point_map_emplace(map, &key, &inserted);
+    if (!inserted || value->x != 0 || value->y != 0) {
+        hz_abort("Expected new zero-filled value");
+    }
+    value->x = 7;
+    if (point_map_emplace(map, &key, &inserted) != value || inserted) {
+        hz_abort("Expected existing value");
+    }
+    point *ref = point_map_get_ref(map, &key);
+    if (ref != value || ref->x != 7) {
+        hz_abort("Expected get_ref to return the same value");
+    }
+    point_map_free(map);
+}
+
+static void
+test_typed_map_cursor(void)
+{
+    bad_point_map *map = bad_point_map_new();
+    uint64_t expected = 0;
+    for (uint64_t i = 0; i < 100; ++i) {
+        point p = { (int)i, 0 };
+        bad_point_map_put(map, &i, &p, NULL);
+        expected += i;
+    }
+
+    bad_point_map_cursor cursor;
+    bad_point_map_cursor_init(&cursor, map);
+    const uint64_t *key;
+    const point *value;
+    uint64_t sum = 0;
+    size_t count = 0;
+    while (bad_point_map_cursor_next(&cursor, &key, &value)) {
+        if ((int)*key != value->x) {
+            hz_abort("Expected key %d to have value %d", (int)*key, value->x);
+        }
+        sum += *key;
+        count++;
+    }
+    if (count != 100 || sum != expected) {
+        hz_abort("Expected to visit each entry once");
+    }
+    bad_point_map_free(map);
+}
+
+static void
+test_typed_map_matches_generic(void)
+{
+    // Apply the same random operations to both maps, with a small key
+    // space so that there are plenty of replacements and removals
+    point_map *typed = point_map_new();
+    hz_map *generic = hz_map_new(sizeof(uint64_t), sizeof(point), u64_hash_generic, u64_cmp_generic);
+    unsigned int state = 1;
+    for (int i = 0; i < 10000; ++i) {
+        state = state * 1103515245 + 12345;
+        uint64_t key = (state >> 16) % 500;
+        point value = { i, (int)key };
+        point a;
+        point b;
+        bool typed_found;
+        bool generic_found;
+        if (state % 3 == 0) {
+            typed_found = point_map_remove(typed, &key, &a);
+            generic_found = hz_map_remove(generic, &key, &b);
+        } else {
+            typed_found = point_map_put(typed, &key, &value, &a);
+            generic_found = hz_map_put(generic, &key, &value, &b);
+        }
+        if (typed_found != generic_found || (typed_found && a.x != b.x)) {
+            hz_abort("Typed and generic maps disagree on key %d", (int)key);
+        }
+    }
+    if (point_map_size(typed) != hz_map_size(generic)) {
+        hz_abort("Typed and generic maps have different sizes");
+    }
+    point_map_free(typed);
+    hz_map_free(generic);
+}
+
+void
+test_typed_map(void)
+{
+    test_typed_map_basic();
+    test_typed_map_emplace();
+    test_typed_map_cursor();
+    test_typed_map_matches_generic();
+    printf("All typed map tests passed!\n");
+}
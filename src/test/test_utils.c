@@ -92,6 +92,37 @@ test_utils_strncpy_concat_loop(void)
     hz_assert_str_eq(buf, "AlphaBetaCharlieDelta");
 }
 
+static void
+test_utils_fmix64(void)
+{
+    // Known outputs of the MurmurHash3 finalizer
+    if (hz_fmix64(0) != 0 || hz_fmix64(1) != UINT64_C(0xb456bcfc34c2cb2c)) {
+        hz_abort("hz_fmix64 output mismatch");
+    }
+}
+
+static void
+test_utils_hash_mix(void)
+{
+    if (hz_hash_mix(42, 0) != hz_hash_mix(42, 0)) {
+        hz_abort("hz_hash_mix is not deterministic");
+    }
+    if (hz_hash_mix(42, 0) == hz_hash_mix(42, 1)) {
+        hz_abort("hz_hash_mix ignores the seed");
+    }
+
+    // Sequential inputs should spread over the low bits
+    int buckets[16] = { 0 };
+    for (size_t i = 0; i < 1600; ++i) {
+        buckets[hz_hash_mix(i * 1024, 0) & 15]++;
+    }
+    for (int i = 0; i < 16; ++i) {
+        if (buckets[i] < 50 || buckets[i] > 150) {
+            hz_abort("hz_hash_mix bucket %d has %d entries", i, buckets[i]);
+        }
+    }
+}
+
 void
 test_utils(void)
 {
@@ -101,5 +132,7 @@ test_utils(void)
     test_utils_strncpy_0();
     test_utils_strncpy_concat();
     test_utils_strncpy_concat_loop();
+    test_utils_fmix64();
+    test_utils_hash_mix();
     printf("All utils tests passed!\n");
 }